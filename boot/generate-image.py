@@ -11,11 +11,16 @@ def sh(command):
     assert system(command) == 0
 
 sector_size = 512
-n_sectors = 256 * 1024
+# 2GiB image (QEMU requires a power of two). The file is sparse, so the swap
+# area costs no disk space until it is used.
+n_sectors = 4 * 1024 * 1024
 boot_offset = 2048
 n_boot_sectors = 128 * 1024
 filesystem_offset = boot_offset + n_boot_sectors
-n_filesystem_sectors = n_sectors - filesystem_offset
+n_filesystem_sectors = 256 * 1024 - filesystem_offset
+# the third partition is the swap area (see src/kernel/swap.h)
+swap_offset = filesystem_offset + n_filesystem_sectors
+n_swap_sectors = n_sectors - swap_offset
 
 def generate_boot_image(target, files):
     sh(f'dd if=/dev/zero of={target} seek={n_boot_sectors - 1} bs={sector_size} count=1')
@@ -28,8 +33,8 @@ def generate_boot_image(target, files):
     for file in files:
         sh(f'mcopy -i {target} {file} ::{Path(file).name};')
 
-def generate_fs_image(target, files):
-	sh(f'cc ../src/user/mkfs/main.c -o ../build/mkfs -I../src/')
+def generate_fs_image(target, files, block_size):
+	sh(f'cc -DBLOCK_SIZE={block_size} ../src/user/mkfs/main.c -o ../build/mkfs -I../src/')
 	file_list=""
 	for file in files:
 		file_list = file_list + "../build/src/user/" + str(file) + ' '
@@ -41,13 +46,15 @@ def generate_sd_image(target, boot_image, fs_image):
 
     boot_line = f'{boot_offset}, {n_boot_sectors * sector_size // 1024}K, c,'
     filesystem_line = f'{filesystem_offset}, {n_filesystem_sectors * sector_size // 1024}K, L,'
-    sh(f'printf "{boot_line}\\n{filesystem_line}\\n" | sfdisk {target}')
+    swap_line = f'{swap_offset}, {n_swap_sectors * sector_size // 1024}K, S,'
+    sh(f'printf "{boot_line}\\n{filesystem_line}\\n{swap_line}\\n" | sfdisk {target}')
 
     sh(f'dd if={boot_image} of={target} seek={boot_offset} conv=notrunc')
     sh(f'dd if={fs_image} of={target} seek={filesystem_offset} conv=notrunc')
 
 if __name__ == '__main__':
     parser = ArgumentParser()
+    parser.add_argument('--block-size', type=int, default=512)
     parser.add_argument('root')
     parser.add_argument('files', nargs=14)
     parser.add_argument('user_files', nargs='*')
@@ -59,5 +66,5 @@ if __name__ == '__main__':
     fs_image = f'{args.root}/fs.img'
 
     generate_boot_image(boot_image, args.files)
-    generate_fs_image(fs_image, args.user_files)
+    generate_fs_image(fs_image, args.user_files, args.block_size)
     generate_sd_image(sd_image, boot_image, fs_image)
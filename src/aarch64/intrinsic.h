@@ -104,6 +104,14 @@ static ALWAYS_INLINE void arch_tlbi_vmalle1is() {
     arch_fence();
 }
 
+// flush TLB entries of the pages in [begin, end), in all ASIDs.
+static ALWAYS_INLINE void arch_tlbi_range(u64 begin, u64 end) {
+    arch_fence();
+    for (u64 va = begin & ~0xfffull; va < end; va += 0x1000)
+        asm volatile("tlbi vaae1is, %[x]" : : [x] "r"(va >> 12));
+    arch_fence();
+}
+
 // set Translation Table Base Register 0 (EL1).
 static ALWAYS_INLINE void arch_set_ttbr0(u64 addr) {
     arch_fence();
@@ -38,6 +38,7 @@
 #define PTE_KERNEL_DATA (PTE_KERNEL | PTE_NORMAL | PTE_BLOCK)
 #define PTE_KERNEL_DEVICE (PTE_KERNEL | PTE_DEVICE | PTE_BLOCK)
 #define PTE_USER_DATA (PTE_USER | PTE_NORMAL | PTE_PAGE)
+#define PTE_USER_BLOCK (PTE_USER | PTE_NORMAL | PTE_BLOCK)
 
 #define N_PTE_PER_TABLE 512
 
@@ -67,6 +68,11 @@ typedef PTEntry *PTEntriesPtr;
 #define P2N(addr) ((addr) >> 12)
 #define PAGE_BASE(addr) ((u64)(addr) & ~(PAGE_SIZE - 1))
 
+// 2MiB block mapped by a level-2 descriptor
+#define HUGE_PAGE_SIZE (1 << 21)
+#define HUGE_PAGE_PAGES (HUGE_PAGE_SIZE / PAGE_SIZE)
+#define HUGE_BASE(addr) ((u64)(addr) & ~(u64)(HUGE_PAGE_SIZE - 1))
+
 #define VA_PART0(va) (((u64)(va) & 0xFF8000000000) >> 39)
 #define VA_PART1(va) (((u64)(va) & 0x7FC0000000) >> 30)
 #define VA_PART2(va) (((u64)(va) & 0x3FE00000) >> 21)
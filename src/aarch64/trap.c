@@ -1,15 +1,33 @@
 #include <aarch64/intrinsic.h>
 #include <aarch64/trap.h>
 #include <driver/interrupt.h>
+#include <kernel/oom.h>
 #include <kernel/paging.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
 #include <kernel/sched.h>
+#include <kernel/swap.h>
 #include <kernel/syscall.h>
 
+extern struct exception_table_entry __start_ex_table[], __stop_ex_table[];
+
+u64 search_exception_table(u64 pc) {
+    for (struct exception_table_entry *e = __start_ex_table;
+         e < __stop_ex_table; e++) {
+        if (e->insn == pc) {
+            return e->fixup;
+        }
+    }
+    return 0;
+}
+
 void trap_global_handler(UserContext *context) {
     // static int syscall_count = 0;
-    thisproc()->ucontext = context;
+    // 内核态的嵌套异常（如 copy_from_user 缺页）不能覆盖用户态的 trap frame
+    bool from_user = (context->spsr & 0xf) == 0;
+    if (from_user) {
+        thisproc()->ucontext = context;
+    }
     u64 esr = arch_get_esr();
     u64 ec = esr >> ESR_EC_SHIFT;
     u64 iss = esr & ESR_ISS_MASK;
@@ -46,12 +64,23 @@ void trap_global_handler(UserContext *context) {
         // printk("id = %lld\n", context->x[8]);
         // syscall_count++;
         // // ASSERT(syscall_count != 2);
+        // 内存快耗尽时被选中的进程不再执行系统调用，直接在下面退出
+        if (oom_check()) {
+            break;
+        }
         syscall_entry(context);
     } break;
     case ESR_EC_IABORT_EL0:
     case ESR_EC_IABORT_EL1:
     case ESR_EC_DABORT_EL0:
     case ESR_EC_DABORT_EL1: {
+        // 用户态缺页时没有持有任何锁，在这里回收内存
+        if (from_user) {
+            swap_balance();
+            if (oom_check()) {
+                break;
+            }
+        }
         // unsigned long long int elr_el1_value, far_el1_value, lr;
         // asm volatile("mrs %0, elr_el1" : "=r"(elr_el1_value));
         // asm volatile("mrs %0, far_el1" : "=r"(far_el1_value));
@@ -61,7 +90,22 @@ void trap_global_handler(UserContext *context) {
         // if (elr_el1_value == 0) {
         //     PANIC();
         // }
-        pgfault_handler(iss);
+        if (pgfault_handler(iss) == 0) {
+            break;
+        }
+        if (from_user) {
+            if (kill(thisproc()->pid)) {
+            }
+            break;
+        }
+        // 内核访问用户地址失败：跳到异常表中的修复代码
+        u64 fixup = search_exception_table(context->elr);
+        if (fixup == 0) {
+            printk("kernel page fault: elr = %llx, far = %llx\n", context->elr,
+                   arch_get_far());
+            PANIC();
+        }
+        context->elr = fixup;
     } break;
     default: {
         printk("Unknwon exception %llu\n", ec);
@@ -12,3 +12,24 @@
 #define ESR_EC_IABORT_EL1  0x21
 #define ESR_EC_DABORT_EL0  0x24
 #define ESR_EC_DABORT_EL1  0x25
+
+// ISS of instruction/data aborts
+#define ISS_FSC_MASK 0x3F
+#define ISS_WNR      (1 << 6)
+
+#define FSC_TYPE_MASK   0x3C
+#define FSC_TRANSLATION 0x04
+#define FSC_ACCESS_FLAG 0x08
+#define FSC_PERMISSION  0x0C
+
+/**
+    @brief an entry of the exception table (section `__ex_table`).
+    A fault at `insn` in kernel mode resumes at `fixup`.
+ */
+struct exception_table_entry {
+    u64 insn;
+    u64 fixup;
+};
+
+// return the fixup address for a faulting kernel pc, or 0 if there is none
+u64 search_exception_table(u64 pc);
@@ -9,12 +9,16 @@
 
 #define B_VALID 0x2 /* Buffer has been read from disk. */
 #define B_DIRTY 0x4 /* Buffer needs to be written to disk. */
+#define B_MULTI 0x8 /* Transfer `count` sectors at `addr` instead of `data`. */
 
 typedef struct buf
 {
     int flags;
     u32 blockno;
     u8 data[BSIZE]; // 1B*512
+    // 只在 B_MULTI 时使用：连续 count 个扇区，addr 按字对齐
+    u32 count;
+    u8 *addr;
 
     /*
      * Add other necessary elements. It depends on you.
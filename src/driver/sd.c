@@ -39,6 +39,8 @@ ALWAYS_INLINE u32 get_and_clear_EMMC_INTERRUPT() {
  */
 static SpinLock sdLock;
 static Queue sdQueue;
+// MBR 分区表：每个分区的起始扇区和扇区数
+static u32 partition_lba[4], partition_sectors[4];
 static SpinLock intrLock;
 Semaphore sdSem;
 
@@ -77,6 +79,11 @@ u32 sd_init() {
     lba = (int *)(b.data + 0x1CE + 8);
     sector_count = (int *)(b.data + 0x1CE + 12);
 
+    for (int i = 0; i < 4; i++) {
+        partition_lba[i] = *(u32 *)(b.data + 0x1BE + 16 * i + 8);
+        partition_sectors[i] = *(u32 *)(b.data + 0x1BE + 16 * i + 12);
+    }
+
     printk("lba:%d,sec:%d\n", *lba, *sector_count);
     return (usize)(*lba);
     // if (sdWaitForInterrupt(INT_DATA_DONE))
@@ -86,6 +93,14 @@ u32 sd_init() {
     // }
 }
 
+bool sd_get_partition(int i, u32 *lba, u32 *sectors) {
+    if (i < 0 || i >= 4 || partition_sectors[i] == 0)
+        return false;
+    *lba = partition_lba[i];
+    *sectors = partition_sectors[i];
+    return true;
+}
+
 /* Start the request for b. Caller must hold sdlock. */
 static void sd_start(struct buf *b) {
     // Address is different depending on the card type.
@@ -105,11 +120,20 @@ static void sd_start(struct buf *b) {
         PANIC();
     }
 
+    // B_MULTI 的请求一次传输连续的 count 个扇区，由控制器自动发 CMD12 结束
+    u32 count = b->flags & B_MULTI ? b->count : 1;
+    u8 *data = b->flags & B_MULTI ? b->addr : b->data;
+
     // Work out the status, interrupt and command values for the transfer.
-    int cmd = write ? IX_WRITE_SINGLE : IX_READ_SINGLE;
+    int cmd;
+    if (count > 1) {
+        cmd = write ? IX_WRITE_MULTI : IX_READ_MULTI;
+    } else {
+        cmd = write ? IX_WRITE_SINGLE : IX_READ_SINGLE;
+    }
 
     int resp;
-    *EMMC_BLKSIZECNT = 512;
+    *EMMC_BLKSIZECNT = (count << 16) | 512;
 
     if ((resp = sdSendCommandA(cmd, bno))) {
         printk("* EMMC send command error.\n");
@@ -117,25 +141,27 @@ static void sd_start(struct buf *b) {
     }
 
     int done = 0;
-    u32 *intbuf = (u32 *)b->data;
-    if (!(((i64)b->data) & 0x03) == 0) {
+    u32 *intbuf = (u32 *)data;
+    if (!(((i64)data) & 0x03) == 0) {
         printk("Only support word-aligned buffers. \n");
         PANIC();
     }
 
     if (write) {
-        // Wait for ready interrupt for the next block.
-        if ((resp = sdWaitForInterrupt(INT_WRITE_RDY))) {
-            printk("* EMMC ERROR: Timeout waiting for ready to write\n");
-            PANIC();
-            // return sdDebugResponse(resp);
-        }
-        if (*EMMC_INTERRUPT) {
-            printk("%d\n", *EMMC_INTERRUPT);
-            PANIC();
+        for (u32 i = 0; i < count; i++) {
+            // Wait for ready interrupt for the next block.
+            if ((resp = sdWaitForInterrupt(INT_WRITE_RDY))) {
+                printk("* EMMC ERROR: Timeout waiting for ready to write\n");
+                PANIC();
+                // return sdDebugResponse(resp);
+            }
+            if (*EMMC_INTERRUPT) {
+                printk("%d\n", *EMMC_INTERRUPT);
+                PANIC();
+            }
+            for (int end = done + 128; done < end;)
+                *EMMC_DATA = intbuf[done++];
         }
-        while (done < 128)
-            *EMMC_DATA = intbuf[done++];
     }
 }
 
@@ -184,14 +210,16 @@ void sd_intr() {
 
         // printk("End Dirty\n");
     } else if (!(b->flags & B_VALID)) {
-        if (sdWaitForInterrupt(INT_READ_RDY)) {
-            printk("sd read_RDY error\n");
-            PANIC();
+        u32 count = b->flags & B_MULTI ? b->count : 1;
+        u32 *p = (u32 *)(b->flags & B_MULTI ? b->addr : b->data);
+        for (u32 j = 0; j < count; j++, p += 128) {
+            if (sdWaitForInterrupt(INT_READ_RDY)) {
+                printk("sd read_RDY error\n");
+                PANIC();
+            }
+            for (int i = 0; i < 128; i++)
+                p[i] = *EMMC_DATA;
         }
-        u32 *p = (u32 *)b->data;
-
-        for (int i = 0; i < 128; i++)
-            p[i] = *EMMC_DATA;
         if (sdWaitForInterrupt(INT_DATA_DONE)) {
             printk("sd data_DONE error\n");
             PANIC();
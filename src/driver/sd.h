@@ -22,3 +22,9 @@ u32 sd_init();
 void sd_intr();
 void sd_test();
 void sdrw(buf *);
+/**
+    @brief get the start sector and size of MBR partition `i` (0-3).
+    @return false if the partition does not exist.
+    @note only valid after `sd_init`.
+ */
+bool sd_get_partition(int i, u32 *lba, u32 *sectors);
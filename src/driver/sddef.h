@@ -268,14 +268,16 @@ static EMMCCommand sdCommandTable[] = {
     {"SET_BLOCKLEN", 0x10000000 | CMD_RSPNS_48, RESP_R1, RCA_NO, 0},
     {"READ_SINGLE", 0x11000000 | CMD_RSPNS_48 | CMD_IS_DATA | TM_DAT_DIR_CH,
      RESP_R1, RCA_NO, 0},
-    {"READ_MULTI", 0x12000000 | CMD_RSPNS_48 | TM_MULTI_DATA | TM_DAT_DIR_CH,
+    {"READ_MULTI",
+     0x12000000 | CMD_RSPNS_48 | TM_MULTI_DATA | TM_AUTO_CMD12 | TM_DAT_DIR_CH,
      RESP_R1, RCA_NO, 0},
     {"SEND_TUNING", 0x13000000 | CMD_RSPNS_48, RESP_R1, RCA_NO, 0},
     {"SPEED_CLASS", 0x14000000 | CMD_RSPNS_48B, RESP_R1b, RCA_NO, 0},
     {"SET_BLOCKCNT", 0x17000000 | CMD_RSPNS_48, RESP_R1, RCA_NO, 0},
     {"WRITE_SINGLE", 0x18000000 | CMD_RSPNS_48 | CMD_IS_DATA | TM_DAT_DIR_HC,
      RESP_R1, RCA_NO, 0},
-    {"WRITE_MULTI", 0x19000000 | CMD_RSPNS_48 | TM_MULTI_DATA | TM_DAT_DIR_HC,
+    {"WRITE_MULTI",
+     0x19000000 | CMD_RSPNS_48 | TM_MULTI_DATA | TM_AUTO_CMD12 | TM_DAT_DIR_HC,
      RESP_R1, RCA_NO, 0},
     {"PROGRAM_CSD", 0x1B000000 | CMD_RSPNS_48, RESP_R1, RCA_NO, 0},
     {"SET_WRITE_PR", 0x1C000000 | CMD_RSPNS_48B, RESP_R1b, RCA_NO, 0},
@@ -11,11 +11,13 @@ static int lba;
     @param[out] buffer the buffer to store the data
  */
 static void sd_read(usize block_no, u8 *buffer) {
+    // 一个块是连续的 SECTORS_PER_BLOCK 个扇区，直接读进 buffer
     struct buf b;
-    b.blockno = (u32)block_no + lba;
-    b.flags = 0;
+    b.blockno = (u32)(block_no * SECTORS_PER_BLOCK) + lba;
+    b.flags = B_MULTI;
+    b.count = SECTORS_PER_BLOCK;
+    b.addr = buffer;
     sdrw(&b);
-    memcpy(buffer, b.data, BLOCK_SIZE);
 }
 
 /**
@@ -26,9 +28,10 @@ static void sd_read(usize block_no, u8 *buffer) {
  */
 static void sd_write(usize block_no, u8 *buffer) {
     struct buf b;
-    b.blockno = (u32)block_no + lba;
-    b.flags = B_DIRTY | B_VALID;
-    memcpy(b.data, buffer, BLOCK_SIZE);
+    b.blockno = (u32)(block_no * SECTORS_PER_BLOCK) + lba;
+    b.flags = B_MULTI | B_DIRTY | B_VALID;
+    b.count = SECTORS_PER_BLOCK;
+    b.addr = buffer;
     sdrw(&b);
 }
 
@@ -38,10 +41,12 @@ static void sd_write(usize block_no, u8 *buffer) {
     We may need to read the super block multiple times, so keep a copy of it in
     memory.
 
-    @note the super block, in our lab, is always read-only, so we don't need to
-    write it back.
+    @note the kernel updates only the free inode counts of the super block,
+    through the block cache, so this copy keeps the counts of boot time and
+    nothing reads them from here. The layout fields never change. The super
+    block fits in the first sector of block 0.
  */
-static u8 sblock_data[BLOCK_SIZE];
+static u8 sblock_data[BSIZE];
 
 BlockDevice block_device;
 
@@ -55,7 +60,18 @@ void init_block_device() {
     lba = b.blockno;
     b.flags = 0;
     sdrw(&b);
-    memcpy(sblock_data, b.data, BLOCK_SIZE);
+    memcpy(sblock_data, b.data, BSIZE);
+
+    // 块大小在编译时确定，必须和 mkfs 写进 super block 的一致。旧的镜像记 0
+    u32 block_size = get_super_block()->block_size;
+    if (block_size == 0) {
+        block_size = 512;
+    }
+    if (block_size != BLOCK_SIZE) {
+        printk("block size of the filesystem is %u, but the kernel uses %d\n",
+               block_size, BLOCK_SIZE);
+        PANIC();
+    }
     block_device.read = sd_read;
     block_device.write = sd_write;
 }
@@ -4,6 +4,10 @@
 #include <kernel/mem.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
+#include <kernel/sched.h>
+
+// log writer 等待更多操作加入同一个事务时最多让出 CPU 的次数
+#define LOG_GROUP_YIELDS 16
 
 /**
     @brief the private reference to the super block.
@@ -32,40 +36,147 @@ static const BlockDevice *device;
 static SpinLock cache_lock;
 
 /**
-    @brief the list of all allocated in-memory block.
+    @brief queues of the 2Q replacement policy.
 
-    We use a linked list to manage all allocated cached blocks.
+    A block read from disk enters `a1in`, a FIFO holding about a quarter of
+    the cache. When it is evicted from `a1in`, its number is remembered in the
+    ghost queue `a1out`. A miss on a remembered block means the block is
+    reused, so it enters `am`, an LRU list holding the rest of the cache.
 
-    You can implement your own data structure if you like better performance.
+    A one-time sequential scan only cycles through `a1in` and does not flush
+    hot metadata blocks out of `am`.
 
     @see Block
  */
-static ListNode head;
+static ListNode a1in, am;
+// 运行中的事务修改过的块，受 cache_lock 保护
+static ListNode dirty;
+static usize num_a1in;
 static usize num_cached_blocks;
+// 不再被使用的块超过该数量时开始淘汰
+static usize capacity;
+static usize evictions;
+
+// a1out 中只记录块号
+typedef struct {
+    usize block_no;
+    ListNode node;  // a1out FIFO
+    ListNode hnode; // ghost_buckets
+} Ghost;
+
+static ListNode a1out;
+static usize num_a1out;
+static ListNode ghost_buckets[BCACHE_NR_BUCKETS];
+
+/**
+    @brief hash buckets indexing cached blocks by block number.
+
+    Lock order: bucket lock first, then `cache_lock`.
+ */
+static struct {
+    SpinLock lock;
+    ListNode head;
+    usize hits;
+    usize misses;
+} buckets[BCACHE_NR_BUCKETS];
 static LogHeader header; // in-memory copy of log header block.
+// 日志头所在块的缓冲。块可能比 LogHeader 大，读写整块要经过它
+static u8 *header_data;
 /**
     @brief a struct to maintain other logging states.
 
-    You may wonder where we store some states, e.g.
-
-    * how many atomic operations are running?
-    * are we checkpointing?
-    * how to notify `end_op` that a checkpoint is done?
-
-    Put them here!
+    Operations join the running transaction. The log writer (or, without a
+    log writer thread, the last operation to finish) closes the transaction,
+    waits for its operations to end and takes a snapshot of its dirty blocks.
+    A new transaction is opened right after the snapshot, so operations can
+    run while the snapshot is being written.
 
-    @see cache_begin_op, cache_end_op, cache_sync
+    @see cache_begin_op, cache_end_op, cache_sync, log_writer
  */
 struct {
-    /* your fields here */
     SpinLock lock;           // 当操作日志时，需要加锁
-    Semaphore sem;           // 保证进行checkpoint时不开启事务
-    int operation_count;     // 当前checkpoint正在执行的FS操作数量
-    bool is_committing;      // 是否正在commit
-    int started_event_count; // 当前checkpoint事务的数量
-    Semaphore end_op_sem;    // 用于通知end_op，checkpoint已经开始
+    Semaphore sem;           // begin_op 等待事务关闭结束或日志空间
+    Semaphore drain_sem;     // 关闭事务时等待其中的操作结束
+    Semaphore commit_sem;    // end_op 等待自己所在的事务提交
+    Semaphore writer_sem;    // 唤醒 log writer
+    SleepLock commit_lock;   // 同一时间只有一个事务在写日志
+    int operation_count;     // 运行中的事务预留和已经用掉的日志块数
+    int started_event_count; // 运行中的事务里还没结束的操作数
+    int ended_event_count;   // 运行中的事务里已经结束的操作数
+    bool closing;            // 运行中的事务正在关闭，新操作需要等待
+    bool has_writer;         // log writer 线程是否在运行
+    usize running_seq;       // 运行中的事务的序号
+    usize committed_seq;     // 最后一个已提交事务的序号
+    usize commits;           // 写入日志的事务数
+    usize checkpoints;       // 把日志写回原位置的次数
+    bool tick;               // 定时器唤醒了 log writer
+    usize tick_seq;          // 上一次定时器唤醒时的 committed_seq
 } log;
 
+// 正在提交的事务的快照，受 log.commit_lock 保护
+static Block *commit_blocks[LOG_MAX_SIZE];
+static u8 *commit_data[LOG_MAX_SIZE];
+static usize commit_count;
+
+// 已经提交、还没有写回原位置的块，每个块只保留最新提交的内容。
+// 受 log.commit_lock 保护
+static struct {
+    Block *block;
+    u8 *data;
+} logged_blocks[LOG_MAX_SIZE];
+static usize num_logged;
+// 日志区已经用掉的块数
+static usize log_used;
+
+/**
+    @brief the queue of the block reader thread.
+
+    @see cache_readahead, block_reader
+ */
+static struct {
+    SpinLock lock;
+    Semaphore sem;    // 唤醒 block reader
+    ListNode queue;   // 等待读入的 ReadRequest
+    bool running;     // block reader 线程是否在运行
+    usize readaheads; // block reader 从磁盘读入的块数
+} reader;
+
+/**
+    @brief the state of the block allocator.
+
+    Blocks whose bits share a bitmap block form a group. The free count of
+    each group lets `alloc_range` skip full groups without reading their
+    bitmap block. The counts are built from the bitmap on the first
+    allocation.
+
+    A block freed by a transaction is cleared in the bitmap right away, but
+    it is not handed out again until that transaction commits. Otherwise
+    another file could get it in the same transaction and its data would be
+    written home before the commit, while a crash would still leave the
+    block with the old file.
+
+    @see cache_alloc_range, cache_free
+ */
+static struct {
+    SleepLock lock;   // 同一时间只有一个线程修改 bitmap
+    usize num_groups; // bitmap 的块数
+    u32 *free;        // 每个组里空闲的块数，NULL 表示还没有统计
+    usize cursor;     // 没有 goal 时从这里开始找，即上次分配的末尾
+    usize total_free; // 所有组的空闲块数，不算还没提交的释放
+    usize reserved;   // reserve 预留、还没有分配的块数
+    // 运行中和正在提交的两个事务释放的块，按 seq % 2 区分。
+    // 每组一个位图，NULL 表示这个组没有
+    BitmapCell **freed[2];
+    usize num_freed[2];
+} allocator;
+
+// 一次预读请求
+typedef struct {
+    ListNode node;
+    usize n;
+    usize block_nos[];
+} ReadRequest;
+
 // read the content from disk.
 static INLINE void device_read(Block *block) {
     device->read(block->block_no, block->data);
@@ -78,12 +189,14 @@ static INLINE void device_write(Block *block) {
 
 // read log header from disk.
 static INLINE void read_header() {
-    device->read(sblock->log_start, (u8 *)&header);
+    device->read(sblock->log_start, header_data);
+    memcpy(&header, header_data, MIN(sizeof(header), (usize)BLOCK_SIZE));
 }
 
 // write log header back to disk.
 static INLINE void write_header() {
-    device->write(sblock->log_start, (u8 *)&header);
+    memcpy(header_data, &header, MIN(sizeof(header), (usize)BLOCK_SIZE));
+    device->write(sblock->log_start, header_data);
 }
 
 // initialize a block struct.
@@ -93,125 +206,238 @@ static void init_block(Block *block) {
     //--------------------------------------------
     block->block_no = 0;
     init_list_node(&block->node);
+    block->frequent = false;
+    init_list_node(&block->hnode);
     block->acquired = false;
     block->pinned = false;
+    block->ordered = false;
+    init_list_node(&block->dnode);
+    block->logged = false;
 
     init_sleeplock(&block->lock);
     block->valid = false;
-    memset(block->data, 0, sizeof(block->data));
+    memset(block->data, 0, BLOCK_SIZE);
+}
+
+// allocate a block struct together with its data buffer.
+static Block *alloc_block() {
+    Block *block = kalloc(sizeof(Block));
+    block->data = kalloc_block();
+    init_block(block);
+    return block;
+}
+
+static void free_block(Block *block) {
+    kfree_block(block->data);
+    kfree(block);
 }
 // see `cache.h`.
 static usize get_num_cached_blocks() {
     // TODO
     return num_cached_blocks;
 }
-//  see `cache.h`.
-static Block *cache_acquire(usize block_no) {
-    // TODO
-    _acquire_spinlock(&cache_lock);
+static INLINE usize bucket_of(usize block_no) {
+    return block_no & (BCACHE_NR_BUCKETS - 1);
+}
 
-    ListNode *b = head.next;
-    // 第一步，遍历cache列表，如果有，则直接返回
-    for (; b != &head; b = b->next) {
-        Block *block = container_of(b, Block, node);
+// caller must hold the lock of bucket `b`
+static Block *find_block(usize b, usize block_no) {
+    ListNode *h = &buckets[b].head;
+    _for_in_list(node, h) {
+        if (node == h) {
+            continue;
+        }
+        Block *block = container_of(node, Block, hnode);
         if (block->block_no == block_no) {
-            block->refcnt++;
-            _release_spinlock(&cache_lock);
-            unalertable_acquire_sleeplock(&block->lock);
-            block->acquired = true;
             return block;
         }
     }
-    // 第二步，没有找到，如果cache的数量小于软限制，那么会分配一个新的block，并且插入到链表头
-    if (num_cached_blocks < EVICTION_THRESHOLD) {
-        Block *block = kalloc(sizeof(Block));
-        init_block(block);
-        block->block_no = block_no;
-        block->refcnt = 1;
-        _insert_into_list(&head, &block->node);
-        num_cached_blocks++;
-        _release_spinlock(&cache_lock);
-        device_read(block);
-        block->valid = 1;
-        unalertable_acquire_sleeplock(&block->lock);
-        block->acquired = 1;
-        return block;
+    return NULL;
+}
+
+static INLINE usize a1in_limit() { return MAX(capacity / 4, (usize)1); }
+
+static INLINE usize a1out_limit() { return MAX(capacity / 2, (usize)1); }
+
+// caller must hold cache_lock
+static void remember(usize block_no) {
+    Ghost *ghost = NULL;
+    while (num_a1out >= a1out_limit()) {
+        ghost = container_of(a1out.prev, Ghost, node);
+        _detach_from_list(&ghost->node);
+        _detach_from_list(&ghost->hnode);
+        num_a1out--;
+        if (num_a1out >= a1out_limit()) {
+            kfree(ghost);
+            ghost = NULL;
+        }
+    }
+    if (ghost == NULL) {
+        ghost = kalloc(sizeof(Ghost));
     }
-    // 没有找到，并且数量大于等于软限制，那么会遍历整个链表，找到一个空闲的block，
+    ghost->block_no = block_no;
+    _insert_into_list(&a1out, &ghost->node);
+    _insert_into_list(&ghost_buckets[bucket_of(block_no)], &ghost->hnode);
+    num_a1out++;
+}
+
+// 如果 block_no 在 a1out 中，把它删掉并返回 true。caller must hold cache_lock
+static bool forget(usize block_no) {
+    ListNode *h = &ghost_buckets[bucket_of(block_no)];
+    _for_in_list(node, h) {
+        if (node == h) {
+            continue;
+        }
+        Ghost *ghost = container_of(node, Ghost, hnode);
+        if (ghost->block_no == block_no) {
+            _detach_from_list(&ghost->node);
+            _detach_from_list(&ghost->hnode);
+            num_a1out--;
+            kfree(ghost);
+            return true;
+        }
+    }
+    return false;
+}
 
-    for (b = head.prev; b != &head; b = b->prev) {
-        Block *block = container_of(b, Block, node);
-        if (block->refcnt == 0 && block->pinned == false) {
+// 从 queue 的表尾淘汰一个没有被引用、也不是脏块的 block。caller must hold
+// cache_lock
+static bool evict_from(ListNode *queue) {
+    for (ListNode *node = queue->prev; node != queue; node = node->prev) {
+        Block *block = container_of(node, Block, node);
+        // 锁顺序是先 bucket 后 cache_lock，这里只能尝试加锁
+        SpinLock *lock = &buckets[bucket_of(block->block_no)].lock;
+        if (!_try_acquire_spinlock(lock)) {
+            continue;
+        }
+        if (block->refcnt == 0 && !block->pinned && !block->ordered &&
+            !block->logged) {
             if (block->acquired) {
-                // 错误检查
                 PANIC();
             }
-            block->block_no = block_no;
-            block->valid = 0;
-            block->refcnt = 1;
-            init_sleeplock(&block->lock);
-            _release_spinlock(&cache_lock);
-            device_read(block);
-            block->valid = 1;
-            unalertable_acquire_sleeplock(&block->lock);
-            block->acquired = 1;
-            return block;
+            _detach_from_list(&block->hnode);
+            _detach_from_list(&block->node);
+            _release_spinlock(lock);
+            num_cached_blocks--;
+            if (!block->frequent) {
+                num_a1in--;
+                remember(block->block_no);
+            }
+            evictions++;
+            free_block(block);
+            return true;
         }
+        _release_spinlock(lock);
+    }
+    return false;
+}
+
+// a1in 超过限额时先淘汰 a1in，否则淘汰 am，直到数量不超过 capacity
+static void evict() {
+    _acquire_spinlock(&cache_lock);
+    while (num_cached_blocks > capacity) {
+        ListNode *first = num_a1in > a1in_limit() ? &a1in : &am;
+        ListNode *second = first == &a1in ? &am : &a1in;
+        if (!evict_from(first) && !evict_from(second)) {
+            break;
+        }
+    }
+    _release_spinlock(&cache_lock);
+}
+
+//  see `cache.h`.
+static Block *cache_acquire(usize block_no) {
+    usize b = bucket_of(block_no);
+    // 第一步，在哈希桶中查找，如果有，则直接返回
+    _acquire_spinlock(&buckets[b].lock);
+    Block *block = find_block(b, block_no);
+    if (block != NULL) {
+        block->refcnt++;
+        buckets[b].hits++;
+        _release_spinlock(&buckets[b].lock);
+        unalertable_acquire_sleeplock(&block->lock);
+        block->acquired = true;
+        return block;
+    }
+    _release_spinlock(&buckets[b].lock);
+
+    // 第二步，没有找到，分配一个新的block。kalloc 可能睡眠，不能持有自旋锁
+    Block *new_block = alloc_block();
+    new_block->block_no = block_no;
+    new_block->refcnt = 1;
+    unalertable_acquire_sleeplock(&new_block->lock);
+
+    // 其他线程可能已经插入了同一个块
+    _acquire_spinlock(&buckets[b].lock);
+    block = find_block(b, block_no);
+    if (block != NULL) {
+        block->refcnt++;
+        buckets[b].hits++;
+        _release_spinlock(&buckets[b].lock);
+        free_block(new_block);
+        unalertable_acquire_sleeplock(&block->lock);
+        block->acquired = true;
+        return block;
+    }
+    _insert_into_list(&buckets[b].head, &new_block->hnode);
+    buckets[b].misses++;
+    _acquire_spinlock(&cache_lock);
+    if (forget(block_no)) {
+        new_block->frequent = true;
+        _insert_into_list(&am, &new_block->node);
+    } else {
+        _insert_into_list(&a1in, &new_block->node);
+        num_a1in++;
     }
-    // 如果找不到，那么会新建一个block，插入到链表头
-    Block *block = kalloc(sizeof(Block));
-    init_block(block);
-    block->block_no = block_no;
-    block->refcnt = 1;
-    _insert_into_list(&head, &block->node);
     num_cached_blocks++;
     _release_spinlock(&cache_lock);
-    device_read(block);
-    // arch_with_trap { device_read(block); }
+    _release_spinlock(&buckets[b].lock);
 
-    block->valid = 1;
-    unalertable_acquire_sleeplock(&block->lock);
-    block->acquired = 1;
-    return block;
+    // 第三步，超出容量时淘汰最久未使用的块，然后读盘
+    evict();
+    device_read(new_block);
+    new_block->valid = true;
+    new_block->acquired = true;
+    return new_block;
 }
 
 // see `cache.h`.
 static void cache_release(Block *block) {
-    // TODO
     // 第一步，释放睡眠锁
     block->acquired = false;
     release_sleeplock(&block->lock);
-    // 第二步，如果refcnt为0，并且不是脏快，并且cache_block的数量大于软限制，那么释放该block
-    _acquire_spinlock(&cache_lock);
+    // 第二步，如果refcnt为0，并且不是脏快，那么将am中的block移到表头。
+    // a1in 是 FIFO，不调整位置
+    usize b = bucket_of(block->block_no);
+    _acquire_spinlock(&buckets[b].lock);
     block->refcnt--;
-    if (block->refcnt == 0 && block->pinned == false &&
-        num_cached_blocks > EVICTION_THRESHOLD) {
-        _detach_from_list(&block->node);
-        num_cached_blocks--;
-        kfree(block);
-        _release_spinlock(&cache_lock);
-        return;
-    }
-    // 如果refcnt为0，并且不是脏快，并且cache_block的数量小于软限制，那么将该block插入到链表头
-    if (block->refcnt == 0 && block->pinned == false &&
-        num_cached_blocks <= EVICTION_THRESHOLD) {
-        _detach_from_list(&block->node);
-        _insert_into_list(&head, &block->node);
+    if (block->refcnt == 0 && block->pinned == false) {
+        _acquire_spinlock(&cache_lock);
+        if (block->frequent) {
+            _detach_from_list(&block->node);
+            _insert_into_list(&am, &block->node);
+        }
+        bool over = num_cached_blocks > capacity;
         _release_spinlock(&cache_lock);
+        _release_spinlock(&buckets[b].lock);
+        if (over) {
+            evict();
+        }
         return;
     }
-    _release_spinlock(&cache_lock);
+    _release_spinlock(&buckets[b].lock);
 }
 
 void restore_log() {
     read_header();
     if (header.valid == true || header.num_blocks != 0) {
         for (usize i = 0; i < header.num_blocks; i++) {
-            Block *block = kalloc(sizeof(Block));
+            Block *block = alloc_block();
             block->block_no = sblock->log_start + 1 + i;
             device_read(block);
             block->block_no = header.block_no[i];
             device_write(block);
+            free_block(block);
         }
         header.num_blocks = 0;
         header.valid = false;
@@ -221,15 +447,66 @@ void restore_log() {
 void init_log() {
     init_spinlock(&log.lock);
     init_sem(&log.sem, 0);
-    init_sem(&log.end_op_sem, 0);
+    init_sem(&log.drain_sem, 0);
+    init_sem(&log.commit_sem, 0);
+    init_sem(&log.writer_sem, 0);
+    init_sleeplock(&log.commit_lock);
     log.operation_count = 0;
-    log.is_committing = false;
     log.started_event_count = 0;
+    log.ended_event_count = 0;
+    log.closing = false;
+    log.has_writer = false;
+    log.running_seq = 1;
+    log.committed_seq = 0;
+    log.commits = 0;
+    log.checkpoints = 0;
+    log.tick = false;
+    log.tick_seq = 0;
+    num_logged = 0;
+    log_used = 0;
+    // 提交快照按块大小分配，只分配日志能放下的数量。重复初始化时复用
+    usize n = MIN((usize)sblock->num_log_blocks - 1, (usize)LOG_MAX_SIZE);
+    for (usize i = 0; i < n; i++) {
+        if (commit_data[i] == NULL) {
+            commit_data[i] = kalloc_block();
+            logged_blocks[i].data = kalloc_block();
+        }
+    }
 }
 void init_log_header() {
     header.num_blocks = 0;
     header.valid = false;
 }
+void init_allocator() {
+    init_sleeplock(&allocator.lock);
+    allocator.num_groups = (sblock->num_blocks + BIT_PER_BLOCK - 1) / BIT_PER_BLOCK;
+    if (allocator.free != NULL) {
+        kfree(allocator.free);
+    }
+    allocator.free = NULL;
+    allocator.cursor = 0;
+    allocator.total_free = 0;
+    allocator.reserved = 0;
+    for (int k = 0; k < 2; k++) {
+        if (allocator.freed[k] != NULL) {
+            for (usize g = 0; g < allocator.num_groups; g++) {
+                if (allocator.freed[k][g] != NULL) {
+                    kfree(allocator.freed[k][g]);
+                }
+            }
+            kfree(allocator.freed[k]);
+        }
+        allocator.freed[k] = NULL;
+        allocator.num_freed[k] = 0;
+    }
+}
+void init_reader() {
+    init_spinlock(&reader.lock);
+    init_sem(&reader.sem, 0);
+    init_list_node(&reader.queue);
+    reader.running = false;
+    reader.readaheads = 0;
+}
 // see `cache.h`.
 void init_bcache(const SuperBlock *_sblock, const BlockDevice *_device) {
     sblock = _sblock;
@@ -238,35 +515,88 @@ void init_bcache(const SuperBlock *_sblock, const BlockDevice *_device) {
     // TODO
     // 初始化锁
     init_spinlock(&cache_lock);
-    init_list_node(&head);
+    init_list_node(&a1in);
+    init_list_node(&am);
+    init_list_node(&dirty);
+    init_list_node(&a1out);
+    num_a1in = 0;
+    num_a1out = 0;
     num_cached_blocks = 0;
+    capacity = EVICTION_THRESHOLD;
+    evictions = 0;
+    for (int i = 0; i < BCACHE_NR_BUCKETS; i++) {
+        init_spinlock(&buckets[i].lock);
+        init_list_node(&buckets[i].head);
+        init_list_node(&ghost_buckets[i]);
+        buckets[i].hits = 0;
+        buckets[i].misses = 0;
+    }
     // init_memory_bitmap();
+    if (header_data == NULL) {
+        header_data = kalloc_block();
+        memset(header_data, 0, BLOCK_SIZE);
+    }
     restore_log();
     init_log();
     init_log_header();
+    init_allocator();
+    init_reader();
 }
 // see `cache.h`.
+void set_bcache_capacity(usize _capacity) {
+    _acquire_spinlock(&cache_lock);
+    capacity = _capacity;
+    _release_spinlock(&cache_lock);
+    evict();
+}
 
-void init_ctx(OpContext *ctx) {
+// see `cache.h`.
+void get_bcache_stat(BCacheStat *stat) {
+    stat->hits = 0;
+    stat->misses = 0;
+    for (int i = 0; i < BCACHE_NR_BUCKETS; i++) {
+        _acquire_spinlock(&buckets[i].lock);
+        stat->hits += buckets[i].hits;
+        stat->misses += buckets[i].misses;
+        _release_spinlock(&buckets[i].lock);
+    }
+    _acquire_spinlock(&cache_lock);
+    stat->evictions = evictions;
+    _release_spinlock(&cache_lock);
+    _acquire_spinlock(&log.lock);
+    stat->commits = log.commits;
+    stat->checkpoints = log.checkpoints;
+    _release_spinlock(&log.lock);
+    _acquire_spinlock(&reader.lock);
+    stat->readaheads = reader.readaheads;
+    _release_spinlock(&reader.lock);
+}
+
+// 一个事务最多能用的日志块数
+static INLINE int log_limit() {
+    return (int)MIN((usize)sblock->num_log_blocks - 1, (usize)LOG_MAX_SIZE);
+}
+
+void init_ctx(OpContext *ctx, usize num_blocks) {
     init_spinlock(&ctx->lock);
-    ctx->rm = OP_MAX_NUM_BLOCKS;
+    ctx->rm = num_blocks;
     ctx->done = 0;
+    ctx->reserved = 0;
 }
 
-static void cache_begin_op(OpContext *ctx) {
-    // TODO
+// see `cache.h`.
+static void cache_begin_op_reserve(OpContext *ctx, usize num_blocks) {
     // 第一步，获取日志锁
-    // 第二步，如果正在committing，那么就陷入睡眠
-    //      如果加上本次操作的事务数量，outstanding的数量超过阈值，那么同样陷入睡眠
-    // 如果上述情况不出现，那么就把本次操作的事务数量加上
-    // 第三步，释放锁
-    // 第四步，将中断关闭，防止中途陷入时钟中断
-    // _acquire_spinlock(&ctx->lock);
-    init_ctx(ctx);
+    // 第二步，如果事务正在关闭，那么就陷入睡眠
+    //      如果加上本次操作预留的块数，日志空间不够，那么同样陷入睡眠
+    // 如果上述情况不出现，那么就加入运行中的事务
+    if (num_blocks > (usize)log_limit()) {
+        printk("begin_op: cannot reserve %lld log blocks\n", num_blocks);
+        PANIC();
+    }
+    init_ctx(ctx, num_blocks);
     _acquire_spinlock(&log.lock);
-    while (log.is_committing == true ||
-           (log.operation_count + ctx->rm > (sblock->num_log_blocks - 1)) ||
-           (log.operation_count + ctx->rm > LOG_MAX_SIZE)) {
+    while (log.closing || log.operation_count + (int)ctx->rm > log_limit()) {
         _lock_sem(&log.sem);
         _release_spinlock(&log.lock);
         if (_wait_sem(&log.sem, false)) {
@@ -279,9 +609,47 @@ static void cache_begin_op(OpContext *ctx) {
     _release_spinlock(&log.lock);
 }
 
+// see `cache.h`.
+static void cache_begin_op(OpContext *ctx) {
+    cache_begin_op_reserve(ctx, OP_MAX_NUM_BLOCKS);
+}
+
+// see `cache.h`.
+static bool cache_extend_op(OpContext *ctx, usize num_blocks) {
+    _acquire_spinlock(&ctx->lock);
+    usize rm = ctx->rm;
+    _release_spinlock(&ctx->lock);
+    if (rm >= num_blocks) {
+        return true;
+    }
+    // 不能睡眠：事务关闭时要等本操作结束
+    usize more = num_blocks - rm;
+    _acquire_spinlock(&log.lock);
+    bool ok = !log.closing &&
+              log.operation_count + (int)more <= log_limit();
+    if (ok) {
+        log.operation_count += more;
+    }
+    _release_spinlock(&log.lock);
+    if (ok) {
+        _acquire_spinlock(&ctx->lock);
+        ctx->rm += more;
+        _release_spinlock(&ctx->lock);
+    }
+    return ok;
+}
+
+// 第一次修改时加入 dirty 链表。caller must hold the lock of the bucket
+static void mark_dirty(Block *block) {
+    if (!block->pinned && !block->ordered) {
+        _acquire_spinlock(&cache_lock);
+        _insert_into_list(&dirty, &block->dnode);
+        _release_spinlock(&cache_lock);
+    }
+}
+
 // see `cache.h`.
 static void cache_sync(OpContext *ctx, Block *block) {
-    // TODO
     if (ctx == NULL) {
         // 如果ctx为空，那么直接写入磁盘
         printk("sync null\n");
@@ -289,223 +657,708 @@ static void cache_sync(OpContext *ctx, Block *block) {
         block->pinned = false;
         return;
     }
-    if (block->pinned == true) {
+    // 如果不为空，那么会将block标记为dirty，不能被替换
+    usize b = bucket_of(block->block_no);
+    _acquire_spinlock(&buckets[b].lock);
+    bool pinned = block->pinned;
+    mark_dirty(block);
+    block->pinned = true;
+    _release_spinlock(&buckets[b].lock);
+    if (pinned) {
         return;
     }
-    block->pinned = true;
     _acquire_spinlock(&ctx->lock);
-    ctx->rm--;
-    ctx->done++;
-    if (ctx->rm + ctx->done != OP_MAX_NUM_BLOCKS) {
+    if (ctx->rm == 0) {
         _release_spinlock(&ctx->lock);
-        printk("ctx->rm = %lld,ctx->done = %lld\n", ctx->rm, ctx->done);
+        printk("ctx->done = %lld, no log block reserved\n", ctx->done);
         PANIC();
     }
+    ctx->rm--;
+    ctx->done++;
     _release_spinlock(&ctx->lock);
+}
 
-    if (ctx->rm == (usize)-1) {
-        printk("ctx->rm = %lld, ctx->done = %lld\n", ctx->rm, ctx->done);
-        PANIC();
-    }
-    if (ctx->done > OP_MAX_NUM_BLOCKS) {
-        PANIC();
+// see `cache.h`.
+static void cache_sync_data(OpContext *ctx, Block *block) {
+    if (ctx == NULL) {
+        cache_sync(ctx, block);
+        return;
     }
-
-    // 如果不为空，那么会将block标记为dirty，不能被替换
+    // 不写日志，也不占用预留的日志空间，提交前写回原位置
+    usize b = bucket_of(block->block_no);
+    _acquire_spinlock(&buckets[b].lock);
+    mark_dirty(block);
+    block->ordered = true;
+    _release_spinlock(&buckets[b].lock);
 }
-static int write_log_count;
-static int write_data_count;
-void write_log() {
-    // 第一步，找到所有的脏快
-    Block *save[sblock->num_log_blocks - 1];
-    int count = 0;
-    _acquire_spinlock(&cache_lock);
-    ListNode *b = head.next;
-    // printk("head.addr = %p,head.next.addr = %p\n", &head, head.next);
 
-    while (b != &head) {
+static void checkpoint();
+static void cache_unreserve(usize num_blocks);
+static void release_freed(usize seq);
 
-        Block *block = container_of(b, Block, node);
-        if (block->pinned == true) {
-            // printk("log Once\n");
-            save[count] = block;
-            count++;
-        }
-        b = b->next;
-    }
-    write_log_count = count;
+// 事务关闭后调用：先把数据块写回原位置，再复制要写日志的脏块。
+// 写日志期间新的事务可以继续修改这些块
+static void snapshot() {
+    ListNode list;
+    init_list_node(&list);
+    _acquire_spinlock(&cache_lock);
+    _merge_list(&list, &dirty);
+    _detach_from_list(&dirty);
     _release_spinlock(&cache_lock);
-    if ((u32)count > (sblock->inode_start - sblock->log_start) - 1) {
-        // 错误检查
-        PANIC();
+
+    // 数据块如果还在日志里（以前当过元数据），写回或重放日志时会覆盖新的
+    // 数据，所以先做一次 checkpoint
+    _for_in_list(node, &list) {
+        if (node == &list) {
+            continue;
+        }
+        Block *block = container_of(node, Block, dnode);
+        if (block->ordered && !block->pinned && block->logged) {
+            checkpoint();
+            break;
+        }
     }
 
-    // 第二步，将脏块写入日志
-    for (int i = 0; i < count; i++) {
-        Block temp;
-        init_block(&temp);
-        temp.block_no = sblock->log_start + 1 + i;
-        for (int j = 0; j < BLOCK_SIZE; j++) {
-            temp.data[j] = save[i]->data[j];
+    commit_count = 0;
+    while (!_empty_list(&list)) {
+        Block *block = container_of(list.next, Block, dnode);
+        _detach_from_list(&block->dnode);
+        usize b = bucket_of(block->block_no);
+        if (block->pinned) {
+            if (commit_count == (usize)log_limit()) {
+                // 错误检查
+                PANIC();
+            }
+            commit_blocks[commit_count] = block;
+            _acquire_spinlock(&buckets[b].lock);
+            memcpy(commit_data[commit_count], block->data, BLOCK_SIZE);
+            block->pinned = false;
+            block->ordered = false;
+            block->logged = true;
+            _release_spinlock(&buckets[b].lock);
+            commit_count++;
+        } else {
+            device_write(block);
+            _acquire_spinlock(&buckets[b].lock);
+            block->ordered = false;
+            _release_spinlock(&buckets[b].lock);
         }
-        device_write(&temp);
+    }
+}
+
+// 把快照追加到日志区已有的事务之后
+void write_log() {
+    for (usize i = 0; i < commit_count; i++) {
+        device->write(sblock->log_start + 1 + log_used + i, commit_data[i]);
     }
     header.valid = true;
-    header.num_blocks = count;
-    // printk("count = %d\n", count);
-    for (int i = 0; i < count; i++) {
-        // printk("block_no = %d\n", save[i]->block_no);
-        header.block_no[i] = save[i]->block_no;
+    header.num_blocks = log_used + commit_count;
+    for (usize i = 0; i < commit_count; i++) {
+        header.block_no[log_used + i] = commit_blocks[i]->block_no;
     }
 }
 
 void write_log_header() { write_header(); }
-void write_data() {
-    Block *save[sblock->num_log_blocks - 1];
-    int count = 0;
-    _acquire_spinlock(&cache_lock);
-    ListNode *b = head.next;
-    while (b != &head) {
-        Block *block = container_of(b, Block, node);
 
-        if (block->pinned == true) {
-            save[count] = block;
-            count++;
+// 记下提交后的内容。同一个块被多个事务修改时只写回一次
+static void absorb() {
+    for (usize i = 0; i < commit_count; i++) {
+        usize j = 0;
+        while (j < num_logged && logged_blocks[j].block != commit_blocks[i]) {
+            j++;
         }
-        b = b->next;
-    }
-    write_data_count = count;
-    if (write_data_count != write_log_count) {
-        printk("write_data_count = %d,write_log_count = %d", write_data_count,
-               write_log_count);
-        PANIC();
-    }
-    _release_spinlock(&cache_lock);
-    // if (count > (sblock->inode_start - sblock->log_start) - 1) {
-    //     // 错误检查
-    //     PANIC();
-    // }
-    for (int i = 0; i < count; i++) {
-        device_write(save[i]);
+        if (j == num_logged) {
+            logged_blocks[j].block = commit_blocks[i];
+            num_logged++;
+        }
+        memcpy(logged_blocks[j].data, commit_data[i], BLOCK_SIZE);
     }
-    _acquire_spinlock(&cache_lock);
-    for (int i = 0; i < count; i++) {
-        save[i]->pinned = false;
+    log_used += commit_count;
+}
+
+void write_data() {
+    for (usize i = 0; i < num_logged; i++) {
+        device->write(logged_blocks[i].block->block_no, logged_blocks[i].data);
     }
-    _release_spinlock(&cache_lock);
 }
 void erase_log_header() {
     init_log_header();
     write_header();
 }
-static void commit() {
-    // 第一步，将所有的脏块写入日志
-    write_log();
-    // 第二步，设置日志头，最后设置valid位
-    write_log_header();
-    // 第三步，将日志内容写入磁盘,之后将所有的脏块标记为非脏块
+
+// 将日志中的块写回原位置，然后清空日志。caller must hold log.commit_lock
+static void checkpoint() {
+    if (log_used == 0) {
+        return;
+    }
     write_data();
-    // 第四步，消除日志头，即把valid位设为false
     erase_log_header();
+    // 写回之后块才可以被淘汰
+    for (usize i = 0; i < num_logged; i++) {
+        Block *block = logged_blocks[i].block;
+        usize b = bucket_of(block->block_no);
+        _acquire_spinlock(&buckets[b].lock);
+        block->logged = false;
+        _release_spinlock(&buckets[b].lock);
+    }
+    num_logged = 0;
+    log_used = 0;
+    _acquire_spinlock(&log.lock);
+    log.checkpoints++;
+    _release_spinlock(&log.lock);
+}
+
+// 提交运行中的事务。caller must hold log.commit_lock
+static void commit() {
+    // 第一步，关闭事务，等待其中的操作结束
+    _acquire_spinlock(&log.lock);
+    log.closing = true;
+    while (log.started_event_count > 0) {
+        _lock_sem(&log.drain_sem);
+        _release_spinlock(&log.lock);
+        if (_wait_sem(&log.drain_sem, false)) {
+        }
+        _acquire_spinlock(&log.lock);
+    }
+    usize seq = log.running_seq;
+    // 脏块数不会超过预留的块数
+    bool full = log_used + log.operation_count > (usize)log_limit();
+    _release_spinlock(&log.lock);
+
+    // 第二步，日志空间不够时先把已提交的事务写回原位置
+    if (full) {
+        checkpoint();
+    }
+
+    // 第三步，复制脏块，然后马上开启新的事务
+    snapshot();
+    _acquire_spinlock(&log.lock);
+    log.closing = false;
+    log.running_seq++;
+    log.ended_event_count = 0;
+    log.operation_count = 0;
+    post_all_sem(&log.sem);
+    _release_spinlock(&log.lock);
+
+    if (commit_count > 0) {
+        // 第四步，将快照追加到日志，写日志头之后事务就提交了
+        write_log();
+        write_log_header();
+        absorb();
+    }
+    // 提交之后，这个事务释放的块才可以再分配
+    release_freed(seq);
+
+    _acquire_spinlock(&log.lock);
+    log.committed_seq = seq;
+    log.commits++;
+    bool has_writer = log.has_writer;
+    post_all_sem(&log.commit_sem);
+    _release_spinlock(&log.lock);
+
+    // 没有 log writer 时没有人在空闲时写回，提交后马上写回
+    if (!has_writer) {
+        checkpoint();
+    }
 }
 
 // see `cache.h`.
 static void cache_end_op(OpContext *ctx) {
-    // TODO
-    // 第一步，获取日志锁
-    // 第二步,错误控制，如果正在committing，那么PANIC
-    // 如果outstanding的数量为0，那么就可以进行commit
-    // 第三步，进行commit，之后获得日志锁，叫commiting位设为0，释放日志锁，并唤醒所有进入深睡眠的进程。
-    // printk("end_op\n");
-    bool can_commit = false;
-    _acquire_spinlock(&log.lock);
-    if (log.is_committing == true) {
-        PANIC();
+    // claim 认领了但没有用到的预留还给别人
+    if (ctx->reserved > 0) {
+        cache_unreserve(ctx->reserved);
+        ctx->reserved = 0;
     }
+    // 第一步，退出运行中的事务，归还没有用到的日志空间
+    _acquire_spinlock(&log.lock);
+    usize seq = log.running_seq;
     log.started_event_count--;
+    log.ended_event_count++;
     log.operation_count -= ctx->rm;
-    if (log.started_event_count == 0) {
-        can_commit = true;
-        log.is_committing = true;
+    bool last = log.started_event_count == 0;
+    if (last && log.closing) {
+        post_all_sem(&log.drain_sem);
+    }
+    post_all_sem(&log.sem);
+    bool has_writer = log.has_writer;
+    _release_spinlock(&log.lock);
+
+    // 第二步，交给 log writer 提交；没有 log writer 时由最后结束的操作提交
+    if (has_writer) {
+        post_sem(&log.writer_sem);
+    } else if (last) {
+        unalertable_acquire_sleeplock(&log.commit_lock);
+        _acquire_spinlock(&log.lock);
+        bool committed = log.committed_seq >= seq;
         _release_spinlock(&log.lock);
-    } else {
-        post_all_sem(&log.sem);
-        _lock_sem(&log.end_op_sem);
+        if (!committed) {
+            commit();
+        }
+        release_sleeplock(&log.commit_lock);
+    }
+
+    // 第三步，等待自己所在的事务提交
+    _acquire_spinlock(&log.lock);
+    while (log.committed_seq < seq) {
+        _lock_sem(&log.commit_sem);
         _release_spinlock(&log.lock);
-        if (_wait_sem(&log.end_op_sem, false)) {
+        if (_wait_sem(&log.commit_sem, false)) {
         }
+        _acquire_spinlock(&log.lock);
     }
-    if (can_commit) {
-        commit();
+    _release_spinlock(&log.lock);
+}
+
+// see `cache.h`.
+NO_RETURN void log_writer(u64 arg) {
+    (void)arg;
+    _acquire_spinlock(&log.lock);
+    log.has_writer = true;
+    _release_spinlock(&log.lock);
+    while (1) {
+        _lock_sem(&log.writer_sem);
+        if (!_wait_sem(&log.writer_sem, false)) {
+            continue;
+        }
+        // 一次处理所有的唤醒
+        get_all_sem(&log.writer_sem);
         _acquire_spinlock(&log.lock);
-        log.is_committing = false;
-        log.operation_count = 0;
-        post_all_sem(&log.sem);
-        post_all_sem(&log.end_op_sem);
+        // 运行中的事务里有已经结束的操作在等待提交
+        bool has_ops = log.ended_event_count > 0;
+        // 两次定时器唤醒之间没有提交，说明文件系统空闲
+        bool idle = log.tick && !has_ops && log.started_event_count == 0 &&
+                    log.tick_seq == log.committed_seq;
+        if (log.tick) {
+            log.tick_seq = log.committed_seq;
+        }
+        log.tick = false;
         _release_spinlock(&log.lock);
+
+        if (!has_ops) {
+            if (idle) {
+                unalertable_acquire_sleeplock(&log.commit_lock);
+                checkpoint();
+                release_sleeplock(&log.commit_lock);
+            }
+            continue;
+        }
+        // 给并发的操作一点时间加入同一个事务，事务空闲或日志快满时马上提交
+        for (int i = 0; i < LOG_GROUP_YIELDS; i++) {
+            _acquire_spinlock(&log.lock);
+            bool ready = log.started_event_count == 0 ||
+                         log.operation_count + OP_MAX_NUM_BLOCKS > log_limit();
+            _release_spinlock(&log.lock);
+            if (ready) {
+                break;
+            }
+            yield();
+        }
+        unalertable_acquire_sleeplock(&log.commit_lock);
+        commit();
+        release_sleeplock(&log.commit_lock);
     }
 }
 
 // see `cache.h`.
-static usize cache_alloc(OpContext *ctx) {
-    // TODO
-    // 第一步，遍历bitmap，找到没有被使用的block
-    int actual_bitmap_block_num = sblock->num_blocks / (BLOCK_SIZE * 8) + 1;
-    int allocated_block_no = -1;
-    bool found = false;
-    for (int i = 0; i < actual_bitmap_block_num; i++) {
-        if (found == true) {
-            break;
+void log_writer_tick() {
+    _acquire_spinlock(&log.lock);
+    log.tick = true;
+    _release_spinlock(&log.lock);
+    post_sem(&log.writer_sem);
+}
+
+static bool is_cached(usize block_no) {
+    usize b = bucket_of(block_no);
+    _acquire_spinlock(&buckets[b].lock);
+    bool cached = find_block(b, block_no) != NULL;
+    _release_spinlock(&buckets[b].lock);
+    return cached;
+}
+
+// see `cache.h`.
+static void cache_readahead(const usize *block_nos, usize n) {
+    _acquire_spinlock(&reader.lock);
+    bool running = reader.running;
+    _release_spinlock(&reader.lock);
+    if (!running || n == 0) {
+        return;
+    }
+    // 已经在缓存里的块不用再读
+    ReadRequest *req = kalloc(sizeof(ReadRequest) + n * sizeof(usize));
+    req->n = 0;
+    for (usize i = 0; i < n; i++) {
+        if (!is_cached(block_nos[i])) {
+            req->block_nos[req->n++] = block_nos[i];
         }
-        int end = BLOCK_SIZE * 8;
-        if (i == actual_bitmap_block_num - 1) {
-            end = sblock->num_blocks % (BLOCK_SIZE * 8);
+    }
+    if (req->n == 0) {
+        kfree(req);
+        return;
+    }
+    _acquire_spinlock(&reader.lock);
+    _insert_into_list(reader.queue.prev, &req->node);
+    _release_spinlock(&reader.lock);
+    post_sem(&reader.sem);
+}
+
+// see `cache.h`.
+NO_RETURN void block_reader(u64 arg) {
+    (void)arg;
+    _acquire_spinlock(&reader.lock);
+    reader.running = true;
+    _release_spinlock(&reader.lock);
+    while (1) {
+        _lock_sem(&reader.sem);
+        if (!_wait_sem(&reader.sem, false)) {
+            continue;
         }
-        Block *block = cache_acquire(sblock->bitmap_start + i);
+        _acquire_spinlock(&reader.lock);
+        ListNode *node = reader.queue.next;
+        _detach_from_list(node);
+        _release_spinlock(&reader.lock);
+        ReadRequest *req = container_of(node, ReadRequest, node);
 
-        for (int index = 0; index < end; index++) {
-            BitmapCell *bitmap = (BitmapCell *)&block->data[0];
-            if (bitmap_get(bitmap, index) == false) {
-                bitmap_set((BitmapCell *)block->data, index);
-                cache_sync(ctx, block);
-                allocated_block_no = i * (BLOCK_SIZE * 8) + index;
-                found = true;
-                break;
+        // 读者追上来时 acquire 会等在块的睡眠锁上，不会重复读盘
+        usize count = 0;
+        for (usize i = 0; i < req->n; i++) {
+            if (is_cached(req->block_nos[i])) {
+                continue;
+            }
+            cache_release(cache_acquire(req->block_nos[i]));
+            count++;
+        }
+        kfree(req);
+        _acquire_spinlock(&reader.lock);
+        reader.readaheads += count;
+        _release_spinlock(&reader.lock);
+    }
+}
+
+// 组 g 里的块数
+static INLINE usize group_size(usize g) {
+    return MIN((usize)BIT_PER_BLOCK, sblock->num_blocks - g * BIT_PER_BLOCK);
+}
+
+// 第一次分配时读出每个 bitmap 块，统计各组的空闲块数
+static void count_free_blocks() {
+    allocator.free = kalloc(allocator.num_groups * sizeof(u32));
+    for (usize g = 0; g < allocator.num_groups; g++) {
+        Block *block = cache_acquire(sblock->bitmap_start + g);
+        BitmapCell *bitmap = (BitmapCell *)block->data;
+        u32 count = 0;
+        for (usize i = 0; i < group_size(g); i++) {
+            if (!bitmap_get(bitmap, i)) {
+                count++;
             }
         }
         cache_release(block);
+        allocator.free[g] = count;
+        allocator.total_free += count;
     }
-    if (found == false)
-        PANIC();
+}
 
-    // 第二步，将对应的block清空
-    Block *block = cache_acquire(allocated_block_no);
-    memset(block->data, 0, BLOCK_SIZE);
+// 组 g 的第 i 块能否分配：bitmap 中空闲，并且不是还没提交的事务释放的
+static bool is_free(usize g, BitmapCell *bitmap, usize i) {
+    if (bitmap_get(bitmap, i)) {
+        return false;
+    }
+    for (int k = 0; k < 2; k++) {
+        if (allocator.num_freed[k] > 0 && allocator.freed[k][g] != NULL &&
+            bitmap_get(allocator.freed[k][g], i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 从 i 开始连续空闲的位数，最多数到 max
+static usize free_run_length(usize g, BitmapCell *bitmap, usize i, usize end,
+                             usize max) {
+    usize n = 0;
+    while (i + n < end && n < max && is_free(g, bitmap, i + n)) {
+        n++;
+    }
+    return n;
+}
+
+// 在 [from, end) 中找第一段至少 n 个空闲位，找不到时返回 end
+static usize find_free_run(usize g, BitmapCell *bitmap, usize from, usize end,
+                           usize n) {
+    usize i = from;
+    while (i < end) {
+        // 整个 cell 都被占用时一次跳过
+        if (i % BITMAP_BITS_PER_CELL == 0 &&
+            bitmap[i / BITMAP_BITS_PER_CELL] == ~(BitmapCell)0) {
+            i += BITMAP_BITS_PER_CELL;
+            continue;
+        }
+        usize len = free_run_length(g, bitmap, i, end, n);
+        if (len == n) {
+            return i;
+        }
+        i += len + 1;
+    }
+    return end;
+}
+
+// 在 bitmap 中标记组 g 里从 i 开始的 len 个块，caller must hold the block
+static void mark_run(OpContext *ctx, Block *block, usize g, usize i,
+                     usize len) {
+    for (usize j = i; j < i + len; j++) {
+        bitmap_set((BitmapCell *)block->data, j);
+    }
     cache_sync(ctx, block);
+    allocator.free[g] -= len;
+    allocator.total_free -= len;
+}
+
+/*
+ * Allocate the free run beginning at block `goal`, at most `n` blocks.
+ * Return the length of the run, or 0 if `goal` is not free.
+ */
+static usize alloc_at(OpContext *ctx, usize goal, usize n) {
+    usize g = goal / BIT_PER_BLOCK;
+    usize i = goal % BIT_PER_BLOCK;
+    if (allocator.free[g] == 0) {
+        return 0;
+    }
+    Block *block = cache_acquire(sblock->bitmap_start + g);
+    usize len =
+        free_run_length(g, (BitmapCell *)block->data, i, group_size(g), n);
+    if (len > 0) {
+        mark_run(ctx, block, g, i, len);
+    }
     cache_release(block);
-    return allocated_block_no;
+    return len;
+}
+
+/*
+ * Search group `g` from `from` for `n` free blocks, or any free block if
+ * `any` is true. On success, allocate them and return true.
+ */
+static bool alloc_in_group(OpContext *ctx, usize g, usize from, usize n,
+                           bool any, usize *start, usize *len) {
+    if (allocator.free[g] == 0 || (!any && allocator.free[g] < n)) {
+        return false;
+    }
+    Block *block = cache_acquire(sblock->bitmap_start + g);
+    BitmapCell *bitmap = (BitmapCell *)block->data;
+    usize end = group_size(g);
+    usize i = find_free_run(g, bitmap, from, end, any ? 1 : n);
+    if (i < end) {
+        *len = free_run_length(g, bitmap, i, end, n);
+        *start = g * BIT_PER_BLOCK + i;
+        mark_run(ctx, block, g, i, *len);
+    }
+    cache_release(block);
+    return i < end;
+}
+
+// 找一段空闲块并在 bitmap 中标记。一段不跨过 bitmap 块，所以只写一个 bitmap 块
+static usize alloc_run(OpContext *ctx, usize n, usize goal, usize *len) {
+    ASSERT(n > 0);
+    unalertable_acquire_sleeplock(&allocator.lock);
+    if (allocator.free == NULL) {
+        count_free_blocks();
+    }
+    // 别人预留的块不能用，ctx 认领的预留可以用
+    usize own = ctx != NULL ? MIN(ctx->reserved, allocator.reserved) : 0;
+    usize avail = allocator.total_free - (allocator.reserved - own);
+    if (avail == 0) {
+        release_sleeplock(&allocator.lock);
+        PANIC();
+    }
+    n = MIN(n, avail);
+    if (goal == 0 || goal >= sblock->num_blocks) {
+        goal = allocator.cursor;
+    }
+    usize g0 = goal / BIT_PER_BLOCK;
+    usize start = goal;
+    // 第一步，goal 空闲时直接从 goal 开始，文件可以接着上一个 extent
+    *len = alloc_at(ctx, goal, n);
+    bool found = *len > 0;
+    // 第二步，从 goal 往后找一段 n 个空闲块，满的组直接跳过；
+    // 第三步，退而求其次，找任意的空闲块
+    for (int any = 0; !found && any < 2; any++) {
+        for (usize k = 0; !found && k <= allocator.num_groups; k++) {
+            usize g = (g0 + k) % allocator.num_groups;
+            usize from = k == 0 ? goal % BIT_PER_BLOCK : 0;
+            found = alloc_in_group(ctx, g, from, n, any, &start, len);
+        }
+    }
+    if (!found) {
+        release_sleeplock(&allocator.lock);
+        PANIC();
+    }
+    allocator.cursor = (start + *len) % sblock->num_blocks;
+    own = MIN(own, *len);
+    allocator.reserved -= own;
+    if (ctx != NULL) {
+        ctx->reserved -= own;
+    }
+    release_sleeplock(&allocator.lock);
+    return start;
+}
+
+// 把新分配的块清零。data 为 true 时按数据块处理，不写日志
+static void zero_blocks(OpContext *ctx, usize start, usize len, bool data) {
+    for (usize i = start; i < start + len; i++) {
+        Block *block = cache_acquire(i);
+        memset(block->data, 0, BLOCK_SIZE);
+        if (data) {
+            cache_sync_data(ctx, block);
+        } else {
+            cache_sync(ctx, block);
+        }
+        cache_release(block);
+    }
+}
+
+// see `cache.h`.
+static usize cache_alloc(OpContext *ctx) {
+    usize len;
+    usize block_no = alloc_run(ctx, 1, 0, &len);
+    zero_blocks(ctx, block_no, 1, false);
+    return block_no;
+}
+
+// see `cache.h`.
+static usize cache_alloc_data(OpContext *ctx) {
+    usize len;
+    usize block_no = alloc_run(ctx, 1, 0, &len);
+    zero_blocks(ctx, block_no, 1, true);
+    return block_no;
+}
+
+// see `cache.h`.
+static usize cache_alloc_range(OpContext *ctx, usize n, usize goal,
+                               usize *len) {
+    usize start = alloc_run(ctx, n, goal, len);
+    zero_blocks(ctx, start, *len, true);
+    return start;
+}
+
+// see `cache.h`.
+static bool cache_reserve(usize num_blocks) {
+    unalertable_acquire_sleeplock(&allocator.lock);
+    if (allocator.free == NULL) {
+        count_free_blocks();
+    }
+    bool ok = allocator.total_free >= allocator.reserved + num_blocks;
+    if (ok) {
+        allocator.reserved += num_blocks;
+    }
+    release_sleeplock(&allocator.lock);
+    return ok;
+}
+
+// see `cache.h`.
+static void cache_unreserve(usize num_blocks) {
+    unalertable_acquire_sleeplock(&allocator.lock);
+    ASSERT(allocator.reserved >= num_blocks);
+    allocator.reserved -= num_blocks;
+    release_sleeplock(&allocator.lock);
+}
+
+// see `cache.h`.
+static void cache_claim(OpContext *ctx, usize num_blocks) {
+    ctx->reserved += num_blocks;
+}
+
+// 记下运行中的事务释放的块，提交前不再分配。caller must hold allocator.lock
+static void hold_freed(usize g, usize index) {
+    _acquire_spinlock(&log.lock);
+    usize k = log.running_seq % 2;
+    _release_spinlock(&log.lock);
+    if (allocator.freed[k] == NULL) {
+        allocator.freed[k] = kalloc(allocator.num_groups * sizeof(BitmapCell *));
+        memset(allocator.freed[k], 0,
+               allocator.num_groups * sizeof(BitmapCell *));
+    }
+    if (allocator.freed[k][g] == NULL) {
+        allocator.freed[k][g] = kalloc(BLOCK_SIZE);
+        memset(allocator.freed[k][g], 0, BLOCK_SIZE);
+    }
+    bitmap_set(allocator.freed[k][g], index);
+    allocator.num_freed[k]++;
+}
+
+// 事务 seq 提交了，把它释放的块还给分配器。caller must hold log.commit_lock
+static void release_freed(usize seq) {
+    usize k = seq % 2;
+    unalertable_acquire_sleeplock(&allocator.lock);
+    for (usize g = 0; allocator.num_freed[k] > 0 && g < allocator.num_groups;
+         g++) {
+        BitmapCell *bits = allocator.freed[k][g];
+        if (bits == NULL) {
+            continue;
+        }
+        for (usize c = 0; c < BLOCK_SIZE / sizeof(BitmapCell); c++) {
+            if (bits[c] == 0) {
+                continue;
+            }
+            for (usize i = c * BITMAP_BITS_PER_CELL;
+                 i < (c + 1) * BITMAP_BITS_PER_CELL; i++) {
+                if (bitmap_get(bits, i)) {
+                    allocator.free[g]++;
+                    allocator.total_free++;
+                    allocator.num_freed[k]--;
+                }
+            }
+            bits[c] = 0;
+        }
+    }
+    ASSERT(allocator.num_freed[k] == 0);
+    release_sleeplock(&allocator.lock);
 }
 
 // see `cache.h`.
 static void cache_free(OpContext *ctx, usize block_no) {
-    // TODO
+    if (block_no >= sblock->num_blocks) {
+        return;
+    }
+    unalertable_acquire_sleeplock(&allocator.lock);
+    // 先统计空闲块，否则之后统计时会把还没提交的释放也算进去
+    if (allocator.free == NULL) {
+        count_free_blocks();
+    }
     // 第一步，找到对应bitmap的所在块
-    int bitmap_block_no = sblock->bitmap_start + block_no / (BLOCK_SIZE * 8);
-    int index = block_no % (BLOCK_SIZE * 8);
+    usize g = block_no / BIT_PER_BLOCK;
+    usize index = block_no % BIT_PER_BLOCK;
     // 第二步，将该位置0
-    Block *block = cache_acquire(bitmap_block_no);
-    bitmap_clear((BitmapCell *)block->data, index);
-    cache_sync(ctx, block);
+    Block *block = cache_acquire(sblock->bitmap_start + g);
+    BitmapCell *bitmap = (BitmapCell *)block->data;
+    if (bitmap_get(bitmap, index)) {
+        bitmap_clear(bitmap, index);
+        cache_sync(ctx, block);
+        // 直接写盘的释放马上生效，事务里的释放等事务提交
+        if (ctx == NULL) {
+            allocator.free[g]++;
+            allocator.total_free++;
+        } else {
+            hold_freed(g, index);
+        }
+    }
     cache_release(block);
+    release_sleeplock(&allocator.lock);
 }
 
 BlockCache bcache = {
     .get_num_cached_blocks = get_num_cached_blocks,
     .acquire = cache_acquire,
     .release = cache_release,
+    .readahead = cache_readahead,
     .begin_op = cache_begin_op,
+    .begin_op_reserve = cache_begin_op_reserve,
+    .extend_op = cache_extend_op,
     .sync = cache_sync,
+    .sync_data = cache_sync_data,
     .end_op = cache_end_op,
     .alloc = cache_alloc,
+    .alloc_data = cache_alloc_data,
+    .alloc_range = cache_alloc_range,
+    .reserve = cache_reserve,
+    .unreserve = cache_unreserve,
+    .claim = cache_claim,
     .free = cache_free,
 };
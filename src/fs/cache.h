@@ -3,6 +3,7 @@
 #include <common/sem.h>
 #include <fs/block_device.h>
 #include <fs/defines.h>
+#include <kernel/mem.h>
 
 /**
     @brief maximum number of distinct blocks that one atomic operation can hold.
@@ -17,6 +18,59 @@
  */
 #define EVICTION_THRESHOLD 20
 
+/**
+    @brief the number of hash buckets indexing cached blocks by block number.
+    Must be a power of 2.
+ */
+#define BCACHE_NR_BUCKETS 1024
+
+/**
+    @brief the number of blocks the kernel keeps in the block cache.
+
+    `init_bcache` starts with EVICTION_THRESHOLD blocks, the kernel raises it
+    with `set_bcache_capacity`.
+ */
+#define BCACHE_KERNEL_CAPACITY 4096
+
+/**
+    @brief allocate a buffer of `BLOCK_SIZE` bytes.
+
+    `kalloc` only serves objects smaller than a page, so a 4 KiB block takes
+    a whole page from `kalloc_page`.
+
+    @see kfree_block
+ */
+static INLINE WARN_RESULT void *kalloc_block() {
+#if BLOCK_SIZE < PAGE_SIZE
+    return kalloc(BLOCK_SIZE);
+#else
+    return kalloc_page();
+#endif
+}
+
+// free a buffer from `kalloc_block`.
+static INLINE void kfree_block(void *p) {
+#if BLOCK_SIZE < PAGE_SIZE
+    kfree(p);
+#else
+    kfree_page(p);
+#endif
+}
+
+/**
+    @brief statistics of the block cache.
+
+    @see get_bcache_stat
+ */
+typedef struct {
+    usize hits;        // acquire found the block in the cache
+    usize misses;      // acquire read the block from disk
+    usize evictions;   // blocks dropped to keep the cache within its capacity
+    usize commits;     // transactions written to the log
+    usize checkpoints; // times the log was written back to home locations
+    usize readaheads;  // blocks read from disk by the block reader
+} BCacheStat;
+
 /**
     @brief a block in block cache.
 
@@ -33,17 +87,32 @@ typedef struct {
     usize block_no;
 
     /**
-        @brief list this block into a linked list.
+        @brief list this block into the `a1in` or `am` queue.
 
         @note should be protected by the global lock of the block cache.
      */
     ListNode node;
 
     /**
-        @brief is the block already acquired by some thread or process?
+        @brief is the block in the `am` queue, i.e. has it been reused after
+        leaving `a1in`?
 
         @note should be protected by the global lock of the block cache.
      */
+    bool frequent;
+
+    /**
+        @brief list this block into its hash bucket.
+
+        @note should be protected by the lock of the bucket.
+     */
+    ListNode hnode;
+
+    /**
+        @brief is the block already acquired by some thread or process?
+
+        @note should be protected by the lock of the bucket.
+     */
     bool acquired;
 
     /**
@@ -53,10 +122,38 @@ typedef struct {
 
         e.g. it is dirty.
 
-        @note should be protected by the global lock of the block cache.
+        @note should be protected by the lock of the bucket.
      */
     bool pinned;
 
+    /**
+        @brief is the block file data that must be written to its home
+        location before the running transaction commits?
+
+        @note should be protected by the lock of the bucket.
+
+        @see sync_data
+     */
+    bool ordered;
+
+    /**
+        @brief list this block into the dirty list of the running transaction
+        if it is pinned or ordered.
+
+        @note should be protected by the global lock of the block cache.
+     */
+    ListNode dnode;
+
+    /**
+        @brief does the log hold committed changes of the block that are not
+        written to its home location yet?
+
+        The block must stay in the cache until it is checkpointed.
+
+        @note should be protected by the lock of the bucket.
+     */
+    bool logged;
+
     /**
         @brief the sleep lock protecting `valid` and `data`.
      */
@@ -76,9 +173,10 @@ typedef struct {
      */
     bool valid;
     /**
-        @brief the real in-memory content of the block on disk.
+        @brief the real in-memory content of the block on disk,
+        `BLOCK_SIZE` bytes from `kalloc_block`.
      */
-    u8 data[BLOCK_SIZE];
+    u8 *data;
     int refcnt;
 } Block;
 
@@ -94,6 +192,8 @@ typedef struct {
         @brief how many operation remains in this atomic operation?
 
         If `rm` is 0, any **new** `sync` will panic.
+
+        @see begin_op_reserve, extend_op
      */
     usize rm;
     /**
@@ -110,6 +210,14 @@ typedef struct {
 
     SpinLock lock;
 
+    /**
+        @brief how many blocks reserved by `reserve` the allocations of this
+        operation may still use.
+
+        @see claim
+     */
+    usize reserved;
+
 } OpContext;
 
 /**
@@ -176,6 +284,18 @@ typedef struct {
      */
     void (*release)(Block *block);
 
+    /**
+        @brief read the blocks in `block_nos` into the cache in the background.
+
+        It only queues the blocks for the block reader thread and returns at
+        once. A later `acquire` of a block being read waits for the read.
+
+        @note it is a hint: it does nothing if the block reader is not running.
+
+        @see block_reader
+     */
+    void (*readahead)(const usize *block_nos, usize n);
+
     // # NOTES FOR ATOMIC OPERATIONS
     //
     // atomic operation has three states:
@@ -202,6 +322,28 @@ typedef struct {
      */
     void (*begin_op)(OpContext *ctx);
 
+    /**
+        @brief like `begin_op`, but reserve `num_blocks` log blocks instead of
+        `OP_MAX_NUM_BLOCKS`.
+
+        Admission only counts the blocks running operations may still use and
+        the blocks ended operations actually modified.
+
+        @throw panic if `num_blocks` is larger than the log.
+     */
+    void (*begin_op_reserve)(OpContext *ctx, usize num_blocks);
+
+    /**
+        @brief make sure the running operation `ctx` can still `sync` at least
+        `num_blocks` new blocks, reserving more log blocks if needed.
+
+        It never sleeps, since the transaction may be waiting for `ctx` to end.
+
+        @return false if the log has no room now. The caller should `end_op`
+        and continue in a new operation.
+     */
+    bool (*extend_op)(OpContext *ctx, usize num_blocks);
+
     /**
         @brief synchronize the content of `block` to disk.
 
@@ -215,14 +357,27 @@ typedef struct {
         @note the caller must hold the lock of `block`.
 
         @throw panic if the number of blocks associated with `ctx` is larger
-                than `OP_MAX_NUM_BLOCKS` after `sync`
+                than its reservation after `sync`
      */
     void (*sync)(OpContext *ctx, Block *block);
 
+    /**
+        @brief like `sync`, but for file data (ordered journaling).
+
+        The block is not copied into the log and does not use the log space
+        reserved by `ctx`. It is written to its home location before the
+        transaction of `ctx` commits, so committed metadata never points to
+        unwritten data.
+
+        @note the caller must hold the lock of `block`.
+     */
+    void (*sync_data)(OpContext *ctx, Block *block);
+
     /**
         @brief end the atomic operation managed by `ctx`.
 
-        It sleeps until all associated blocks are written to disk.
+        It sleeps until all associated blocks are committed to the log. Their
+        home locations are written later by a checkpoint.
 
         @param ctx the atomic operation context to be ended.
 
@@ -258,11 +413,73 @@ typedef struct {
      */
     usize (*alloc)(OpContext *ctx);
 
+    /**
+        @brief like `alloc`, but the block is zeroed with `sync_data`.
+
+        Use it for blocks holding file data.
+     */
+    usize (*alloc_data)(OpContext *ctx);
+
+    /**
+        @brief allocate a run of at most `n` contiguous zero-initialized
+        blocks for file data, preferably beginning at `goal`.
+
+        It takes the free blocks at `goal` if `goal` is free. Otherwise it
+        searches from `goal` for `n` free blocks, skipping groups without
+        enough free blocks, and at last takes the first free blocks found.
+
+        A group is the blocks whose bits share a bitmap block. A run never
+        crosses groups, so it writes only one bitmap block.
+
+        @param goal the preferred block, e.g. the block after the last block
+        of a file. 0 means no preference.
+        @param[out] len the number of allocated blocks, in [1, n].
+
+        @return the first allocated block. Blocks are zeroed like
+        `alloc_data`.
+
+        @throw panic if there is no free block on disk.
+     */
+    usize (*alloc_range)(OpContext *ctx, usize n, usize goal, usize *len);
+
+    /**
+        @brief reserve `num_blocks` free blocks for data that gets its blocks
+        later, e.g. delayed allocation.
+
+        @return false, reserving nothing, if fewer than `num_blocks` unreserved
+        free blocks remain.
+
+        @note `alloc` and `alloc_range` only take free blocks that are not
+        reserved, unless the operation claimed a reservation with `claim`.
+
+        @see unreserve
+     */
+    bool (*reserve)(usize num_blocks);
+
+    /**
+        @brief give back `num_blocks` blocks reserved by `reserve`, e.g. after
+        they have been allocated or the data has been dropped.
+     */
+    void (*unreserve)(usize num_blocks);
+
+    /**
+        @brief let the allocations of `ctx` use `num_blocks` blocks reserved
+        by `reserve`, e.g. to flush delayed allocation.
+
+        Every block `ctx` allocates then uses up one block of the
+        reservation. `end_op` gives back the rest like `unreserve`.
+     */
+    void (*claim)(OpContext *ctx, usize num_blocks);
+
     /**
         @brief free the block at `block_no` in bitmap.
 
         It will NOT panic if `block_no` is already free or invalid.
 
+        The block is not allocated again before the transaction of `ctx`
+        commits, so its new owner cannot overwrite it while a crash would
+        still give it back to the old one.
+
         @param ctx since this function may write on-disk bitmap, it must be
                    associated with an atomic operation.
                    The caller must ensure that `ctx` is **running**.
@@ -292,4 +509,52 @@ extern BlockCache bcache;
 
     @note You may want to put it into `*_init` method groups.
  */
-void init_bcache(const SuperBlock *sblock, const BlockDevice *device);
\ No newline at end of file
+void init_bcache(const SuperBlock *sblock, const BlockDevice *device);
+
+/**
+    @brief set the number of unused blocks the block cache may keep.
+
+    Blocks that are acquired or pinned are never evicted, so the cache can
+    temporarily grow beyond `capacity`.
+ */
+void set_bcache_capacity(usize capacity);
+
+/**
+    @brief copy the statistics of the block cache into `stat`.
+ */
+void get_bcache_stat(BCacheStat *stat);
+
+/**
+    @brief the body of the log writer thread.
+
+    Once it runs, `end_op` no longer commits by itself: the log writer collects
+    the operations that end around the same time and writes them to the log in
+    one group commit.
+
+    Committed blocks are written to their home locations lazily, when the log
+    runs out of space or when the file system is idle between two calls of
+    `log_writer_tick`. Without a log writer, each commit is checkpointed at
+    once.
+ */
+NO_RETURN void log_writer(u64 arg);
+
+/**
+    @brief the interval of `log_writer_tick` in the kernel.
+ */
+#define LOG_CHECKPOINT_IDLE_MS 1000
+
+/**
+    @brief wake up the log writer to checkpoint if nothing was committed since
+    the last tick.
+
+    @note it is called from a timer interrupt.
+ */
+void log_writer_tick();
+
+/**
+    @brief the body of the block reader thread.
+
+    It reads the blocks queued by `readahead` from disk, so that a sequential
+    reader finds them in the cache.
+ */
+NO_RETURN void block_reader(u64 arg);
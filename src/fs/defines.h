@@ -6,16 +6,43 @@
  * this file contains on-disk representations of primitives in our filesystem.
  */
 
+// the size of a block of the filesystem, a multiple of the sector size from
+// 512 to 4096. it is chosen at build time (e.g. `-DBLOCK_SIZE=4096`) and
+// recorded in the super block.
+#ifndef BLOCK_SIZE
 #define BLOCK_SIZE 512
+#endif
+#if BLOCK_SIZE < 512 || BLOCK_SIZE > 4096 || (BLOCK_SIZE & (BLOCK_SIZE - 1))
+#error "BLOCK_SIZE must be a power of two from 512 to 4096"
+#endif
 
-// maximum number of distinct block numbers can be recorded in the log header.
-#define LOG_MAX_SIZE ((BLOCK_SIZE - sizeof(usize)) / sizeof(usize))
+// the size of a sector of the SD card.
+#define SECTOR_SIZE 512
+#define SECTORS_PER_BLOCK (BLOCK_SIZE / SECTOR_SIZE)
 
-#define INODE_NUM_DIRECT 12
-#define INODE_NUM_INDIRECT (BLOCK_SIZE / sizeof(u32))
+// maximum number of distinct block numbers can be recorded in the log header.
+// the header is sized to one sector, so larger blocks do not grow the log.
+#define LOG_MAX_SIZE ((SECTOR_SIZE - sizeof(usize)) / sizeof(usize))
+
+// number of extent tree entries stored in the inode itself.
+#define INODE_NUM_EXTENTS 4
+// number of entries in a block of the extent tree.
+#define EXTENT_PER_BLOCK \
+    ((BLOCK_SIZE - sizeof(ExtentHeader)) / sizeof(Extent))
+// the extent tree never grows deeper than this.
+#define EXTENT_MAX_DEPTH 3
+// `extent_header.depth` of an inode whose data is stored inline in
+// `extents` instead of in blocks. its `num_entries` is 0.
+#define EXTENT_DEPTH_INLINE 0xffff
+// files and directories up to this size are stored inline.
+#define INODE_INLINE_BYTES (sizeof(Extent) * INODE_NUM_EXTENTS)
 #define INODE_PER_BLOCK (BLOCK_SIZE / sizeof(InodeEntry))
-#define INODE_MAX_BLOCKS (INODE_NUM_DIRECT + INODE_NUM_INDIRECT)
-#define INODE_MAX_BYTES (INODE_MAX_BLOCKS * BLOCK_SIZE)
+// the inode allocator works on groups of inodes, 8 blocks of the inode area.
+#define INODE_GROUP_SIZE (INODE_PER_BLOCK * 8)
+// the super block records the free inodes of at most this many groups.
+#define SUPER_MAX_INODE_GROUPS 128
+// `num_bytes` is a u32.
+#define INODE_MAX_BYTES ((usize)0xffffffff)
 
 // the maximum length of file names, including trailing '\0'.
 #define FILE_NAME_MAX_LENGTH 14
@@ -32,9 +59,12 @@ typedef u16 InodeType;
 
 #define BIT_PER_BLOCK (BLOCK_SIZE * 8)
 
+// the super block is the first block of the filesystem.
+#define SUPER_BLOCK_NO 0
+
 // disk layout:
-// [ MBR block | super block | log blocks | inode blocks | bitmap blocks | data
-// blocks ]
+// [ super block | unused | log blocks | inode blocks | inode bitmap blocks |
+// bitmap blocks | data blocks ]
 //
 // `mkfs` generates the super block and builds an initial filesystem. The
 // super block describes the disk layout.
@@ -46,8 +76,34 @@ typedef struct {
     u32 log_start;      // the first block of logging area.
     u32 inode_start;    // the first block of inode area.
     u32 bitmap_start;   // the first block of bitmap area.
+    u32 inode_bitmap_start; // the first block of inode bitmap area.
+    u32 block_size;         // BLOCK_SIZE. 0 in older images, meaning 512.
+    // number of inode groups counted in `free_inodes`. 0 in older images or
+    // if there are more than SUPER_MAX_INODE_GROUPS groups.
+    u32 num_inode_groups;
+    // free inodes of each group, updated with the inode bitmap.
+    u16 free_inodes[SUPER_MAX_INODE_GROUPS];
 } SuperBlock;
 
+// a run of `len` blocks of the file beginning at block `file_block` of the
+// file, stored in blocks [start, start + len) on disk.
+//
+// in an index node of the extent tree, `start` is the child node holding the
+// entries from `file_block` on, and `len` is unused.
+typedef struct {
+    u32 file_block;
+    u32 start;
+    u32 len;
+} Extent;
+
+// a node of the extent tree: the root in the inode or a tree block.
+// entries are sorted by `file_block`. `depth == 0` means that the entries
+// are extents of the file, otherwise they point to nodes of `depth - 1`.
+typedef struct {
+    u16 depth;
+    u16 num_entries;
+} ExtentHeader;
+
 // `type == INODE_INVALID` implies this inode is free.
 typedef struct dinode {
     InodeType type;
@@ -55,14 +111,15 @@ typedef struct dinode {
     u16 minor;     // minor device id, for INODE_DEVICE only.
     u16 num_links; // number of hard links to this inode in the filesystem.
     u32 num_bytes; // number of bytes in the file, i.e. the size of file.
-    u32 addrs[INODE_NUM_DIRECT]; // direct addresses/block numbers.
-    u32 indirect;                // the indirect address block.
+    ExtentHeader extent_header;        // root of the extent tree.
+    Extent extents[INODE_NUM_EXTENTS]; // entries of the root, or inline data.
 } InodeEntry;
 
-// the block pointed by `InodeEntry.indirect`.
+// a block of the extent tree.
 typedef struct {
-    u32 addrs[INODE_NUM_INDIRECT];
-} IndirectBlock;
+    ExtentHeader header;
+    Extent entries[EXTENT_PER_BLOCK];
+} ExtentBlock;
 
 // directory entry. `inode_no == 0` implies this entry is free.
 typedef struct dirent {
@@ -70,6 +127,51 @@ typedef struct dirent {
     char name[FILE_NAME_MAX_LENGTH];
 } DirEntry;
 
+// hashed directory index. when a directory outgrows its first block, that
+// block becomes the root of an index mapping the hash of a name to the leaf
+// block holding its entry. leaves are blocks of plain `DirEntry`s. every slot
+// of an index block begins with a zero `inode_no`, so code that scans the
+// directory linearly sees index blocks as free entries.
+#define DX_MAGIC 0x5e1dc0de
+// the root of the index is never deeper than this.
+#define DX_MAX_DEPTH 2
+// number of entries in a node of the index.
+#define DX_PER_BLOCK (BLOCK_SIZE / sizeof(DxEntry) - 1)
+
+typedef struct {
+    u16 zero; // overlaps `DirEntry::inode_no`.
+    u16 depth;
+    u32 magic;
+    u32 num_entries;
+    u32 unused;
+} DxHeader;
+
+// entry `i` of a node covers the hashes in [hash, the hash of entry `i + 1`).
+typedef struct {
+    u16 zero; // overlaps `DirEntry::inode_no`.
+    u16 unused;
+    u32 hash;
+    u32 block; // file block of the child.
+    u32 unused2;
+} DxEntry;
+
+// a node of the index: the root in the first block of the directory or an
+// index block. entries are sorted by `hash`. `depth == 0` means that the
+// entries point to leaves, otherwise they point to nodes of `depth - 1`.
+typedef struct {
+    DxHeader header;
+    DxEntry entries[DX_PER_BLOCK];
+} DxBlock;
+
+// the hash of a name in the index (FNV-1a).
+static INLINE u32 dx_hash(const char *name) {
+    u32 h = 2166136261u;
+    for (usize i = 0; i < FILE_NAME_MAX_LENGTH && name[i]; i++) {
+        h = (h ^ (u8)name[i]) * 16777619u;
+    }
+    return h;
+}
+
 typedef struct {
     usize num_blocks;
     usize block_no[LOG_MAX_SIZE];
@@ -79,4 +181,4 @@ typedef struct {
 } LogHeader;
 
 // mkfs only
-#define FSSIZE 1000 // Size of file system in blocks
\ No newline at end of file
+#define FSSIZE (16 * 1024 * 1024 / BLOCK_SIZE) // Size of file system in blocks (16 MiB)
\ No newline at end of file
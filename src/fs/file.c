@@ -3,8 +3,10 @@
 #include <common/list.h>
 #include <common/sem.h>
 #include <common/spinlock.h>
+#include <errno.h>
 #include <fs/inode.h>
 #include <kernel/mem.h>
+#include <kernel/pagecache.h>
 
 // My code
 #include <fs/pipe.h>
@@ -24,6 +26,9 @@ void init_ftable() {
 void init_file(File *f) {
     f->ip = NULL;
     f->off = 0;
+    f->ra_prev = (usize)-1;
+    f->ra_next = 0;
+    f->ra_size = 0;
     f->pipe = NULL;
     f->readable = false;
     f->writable = false;
@@ -77,6 +82,15 @@ struct file *file_dup(struct file *f) {
     return f;
 }
 
+// see `file.h`.
+usize file_kernel_bytes(struct file *f) {
+    usize n = sizeof(struct file);
+    if (f->type == FD_PIPE) {
+        n += sizeof(Pipe);
+    }
+    return n;
+}
+
 /* Close file f. (Decrement ref count, close when reaches 0.) */
 void file_close(struct file *f) { /* TODO: LabFinal */
     _acquire_spinlock(&ftable.lock);
@@ -84,9 +98,15 @@ void file_close(struct file *f) { /* TODO: LabFinal */
     if (f->ref == 0) {
         _release_spinlock(&ftable.lock); // begin_op may sleep
         ASSERT(f->ref == 0);
+        if (f->type == FD_INODE) {
+            file_sync(f);
+        }
         OpContext cpx;
         bcache.begin_op(&cpx);
         if (f->type == FD_INODE) {
+            // 已删除的文件：丢掉缓存页，防止 inode 号复用后读到旧内容
+            if (f->ip->entry.num_links == 0)
+                pagecache_invalidate(f->ip->inode_no, 0, (usize)-1);
             inodes.put(&cpx, f->ip);
         } else if (f->type == FD_PIPE) {
             pipeClose(f->pipe, f->writable);
@@ -116,6 +136,43 @@ int file_stat(struct file *f, struct stat *st) {
     return 0;
 }
 
+// 顺序预读：从上一次读到的块（或下一块）接着读视为顺序访问。
+// 已经预读的块剩下不到半个窗口时再预读一个窗口，窗口逐次翻倍。
+// caller must hold the lock of f->ip
+static void file_readahead(File *f, usize n) {
+    Inode *ip = f->ip;
+    usize size = ip->entry.num_bytes;
+    if (ip->entry.type != INODE_REGULAR || n == 0 || f->off >= size) {
+        return;
+    }
+    usize first = f->off / BLOCK_SIZE;
+    usize last = (MIN(f->off + n, size) - 1) / BLOCK_SIZE;
+    bool sequential = first == f->ra_prev || first == f->ra_prev + 1;
+    f->ra_prev = last;
+    if (!sequential) {
+        f->ra_size = 0;
+        f->ra_next = last + 1;
+        return;
+    }
+    if (f->ra_size == 0) {
+        f->ra_size = FILE_READAHEAD_MIN_BLOCKS;
+    }
+    if (f->ra_next <= last) {
+        f->ra_next = last + 1;
+    }
+    if (f->ra_next - (last + 1) > f->ra_size / 2) {
+        return;
+    }
+    usize end = (size - 1) / BLOCK_SIZE + 1;
+    usize target = MIN(last + 1 + f->ra_size, end);
+    if (f->ra_next < target) {
+        inodes.readahead(ip, f->ra_next * BLOCK_SIZE,
+                         (target - f->ra_next) * BLOCK_SIZE);
+        f->ra_next = target;
+        f->ra_size = MIN(f->ra_size * 2, (usize)FILE_READAHEAD_MAX_BLOCKS);
+    }
+}
+
 /* Read from file f. */
 isize file_read(struct file *f, char *addr, isize n) {
     /* TODO: LabFinal */
@@ -129,6 +186,7 @@ isize file_read(struct file *f, char *addr, isize n) {
         result = pipeRead(f->pipe, (u64)addr, n);
     } else {
         inodes.lock(f->ip);
+        file_readahead(f, n);
         result = inodes.read(f->ip, (u8 *)addr, f->off, n);
         inodes.unlock(f->ip);
         f->off += result;
@@ -145,17 +203,129 @@ isize file_write(struct file *f, char *addr, isize n) {
         return -1;
     }
     _release_spinlock(&ftable.lock);
-    bcache.begin_op(&ctx);
-    isize result = 0;
     if (f->type == FD_PIPE) {
-        result = pipeWrite(f->pipe, (u64)addr, n);
-    } else {
-        inodes.lock(f->ip);
-        result = inodes.write(&ctx, f->ip, (u8 *)addr, f->off, n);
-        inodes.sync(&ctx, f->ip, true);
-        inodes.unlock(f->ip);
-        f->off += result;
+        return pipeWrite(f->pipe, (u64)addr, n);
+    }
+    // 按页写入。文件末尾的新块先延迟分配，不用开始原子操作；
+    // 其余的在原子操作里写，预留不够时追加，日志满了才开始新的操作
+    isize result = 0;
+    bool in_op = false;
+    inodes.lock(f->ip);
+    while (result < n) {
+        usize n1 = MIN((usize)(n - result), (usize)PAGE_SIZE);
+        usize r = inodes.write_delayed(f->ip, (u8 *)addr + result, f->off, n1);
+        if (r == 0) {
+            usize blocks = inode_write_blocks(f->ip, n1);
+            if (!in_op || !bcache.extend_op(&ctx, blocks)) {
+                // begin_op 可能要等别的操作结束，不能拿着 inode 锁等
+                inodes.unlock(f->ip);
+                if (in_op) {
+                    bcache.end_op(&ctx);
+                }
+                bcache.begin_op_reserve(&ctx, blocks);
+                in_op = true;
+                inodes.lock(f->ip);
+                continue;
+            }
+            r = inodes.write(&ctx, f->ip, (u8 *)addr + result, f->off, n1);
+        }
+        // 缓存页已过期，下次缺页重新读
+        pagecache_invalidate(f->ip->inode_no, f->off, r);
+        f->off += r;
+        result += r;
+    }
+    inodes.unlock(f->ip);
+    if (in_op) {
+        bcache.end_op(&ctx);
     }
-    bcache.end_op(&ctx);
     return result;
+}
+
+/* Write the delayed blocks of file f to disk. */
+int file_sync(struct file *f) {
+    if (f->type != FD_INODE) {
+        return -1;
+    }
+    Inode *ip = f->ip;
+    OpContext ctx;
+    inodes.lock(ip);
+    while (ip->num_delayed > 0 && ip->entry.num_links > 0) {
+        usize blocks = inode_write_blocks(ip, 0);
+        // begin_op 可能睡眠，不能拿着 inode 锁等
+        inodes.unlock(ip);
+        bcache.begin_op_reserve(&ctx, blocks);
+        inodes.lock(ip);
+        if (bcache.extend_op(&ctx, inode_write_blocks(ip, 0))) {
+            inodes.flush(&ctx, ip);
+        }
+        inodes.unlock(ip);
+        bcache.end_op(&ctx);
+        inodes.lock(ip);
+    }
+    inodes.unlock(ip);
+    return 0;
+}
+
+// fallocate 每个原子操作预分配的字节数
+#define FILE_ALLOCATE_CHUNK (64 * BLOCK_SIZE)
+
+// 能预分配或打洞的文件：可写的普通文件
+static bool file_can_allocate(struct file *f, usize offset, usize len) {
+    return f->type == FD_INODE && f->writable &&
+           f->ip->entry.type == INODE_REGULAR && offset + len >= offset &&
+           offset + len <= INODE_MAX_BYTES;
+}
+
+/* Allocate the blocks of file f in [offset, offset + len). */
+int file_allocate(struct file *f, usize offset, usize len, bool keep_size) {
+    if (!file_can_allocate(f, offset, len)) {
+        return -1;
+    }
+    Inode *ip = f->ip;
+    OpContext ctx;
+    usize done = 0;
+    while (done < len) {
+        usize n = MIN(len - done, (usize)FILE_ALLOCATE_CHUNK);
+        inodes.lock(ip);
+        usize blocks = inode_write_blocks(ip, n);
+        // begin_op 可能睡眠，不能拿着 inode 锁等
+        inodes.unlock(ip);
+        bcache.begin_op_reserve(&ctx, blocks);
+        inodes.lock(ip);
+        if (bcache.extend_op(&ctx, inode_write_blocks(ip, n))) {
+            // 先预留空洞要用的块，磁盘满了就返回错误，不在分配中途 PANIC
+            usize need = inode_allocate_blocks(ip, offset + done, n);
+            if (!bcache.reserve(need)) {
+                inodes.unlock(ip);
+                bcache.end_op(&ctx);
+                return -ENOSPC;
+            }
+            bcache.claim(&ctx, need);
+            inodes.allocate(&ctx, ip, offset + done, n, keep_size);
+            done += n;
+        }
+        inodes.unlock(ip);
+        bcache.end_op(&ctx);
+    }
+    return 0;
+}
+
+/* Punch a hole in file f in [offset, offset + len). */
+int file_punch(struct file *f, usize offset, usize len) {
+    if (!file_can_allocate(f, offset, len)) {
+        return -1;
+    }
+    Inode *ip = f->ip;
+    OpContext ctx;
+    bool done = false;
+    while (!done) {
+        bcache.begin_op_reserve(&ctx, INODE_PUNCH_BLOCKS);
+        inodes.lock(ip);
+        done = inodes.punch(&ctx, ip, offset, len);
+        inodes.unlock(ip);
+        bcache.end_op(&ctx);
+    }
+    // 缓存页里还是旧的内容
+    pagecache_invalidate(ip->inode_no, offset, len);
+    return 0;
 }
\ No newline at end of file
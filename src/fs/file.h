@@ -12,6 +12,10 @@
 #define NFILE 65536
 #define NOFILE 64
 
+// 顺序读文件时预读窗口的初始和最大块数
+#define FILE_READAHEAD_MIN_BLOCKS 8
+#define FILE_READAHEAD_MAX_BLOCKS 128
+
 typedef struct file {
     // type of the file.
     // Note that a device file will be FD_INODE too.
@@ -28,6 +32,10 @@ typedef struct file {
     // offset of the file in bytes.
     // For a pipe, it is the number of bytes that have been written/read.
     usize off;
+    // 顺序预读状态（文件块号）：上次读到的块、下一个未预读的块、当前窗口大小
+    usize ra_prev;
+    usize ra_next;
+    usize ra_size;
 } File;
 
 struct ftable {
@@ -81,6 +89,13 @@ struct file *file_dup(struct file *f);
  */
 void file_close(struct file *f);
 
+/**
+    @brief the kernel memory a file descriptor referring to `f` adds to the
+    `kernel_bytes` of its process: the file object, and the pipe if `f` is a
+    pipe end. Objects shared by several descriptors are counted for each.
+ */
+usize file_kernel_bytes(struct file *f);
+
 /**
     @brief read the metadata of a file.
 
@@ -112,4 +127,41 @@ isize file_read(struct file *f, char *addr, isize n);
     @return isize the number of bytes actually written. -1 on error.
 */
 isize file_write(struct file *f, char *addr, isize n);
+
+/**
+    @brief write the blocks of `f` buffered by delayed allocation to disk,
+    and wait until they are committed.
+
+    It does nothing for a file without links: its blocks are dropped when the
+    inode is freed.
+
+    @return int 0 on success, or -1 if `f` is not an inode.
+
+    @see `InodeTree::flush`
+ */
+int file_sync(struct file *f);
+
+/**
+    @brief allocate the blocks of `f` in range [offset, offset + len), in as
+    many atomic operations as needed.
+
+    @param keep_size if false, the file grows to cover the range.
+
+    @return int 0 on success, -1 if `f` is not a writable regular file, or
+    -ENOSPC if the disk is short of free blocks. The chunks allocated before
+    stay allocated.
+
+    @see `InodeTree::allocate`
+ */
+int file_allocate(struct file *f, usize offset, usize len, bool keep_size);
+
+/**
+    @brief free the blocks of `f` in range [offset, offset + len) and zero the
+    rest of the range. The size of `f` does not change.
+
+    @return int 0 on success, or -1 if `f` is not a writable regular file.
+
+    @see `InodeTree::punch`
+ */
+int file_punch(struct file *f, usize offset, usize len);
 void free_oftable(struct oftable *oftable);
\ No newline at end of file
@@ -5,14 +5,30 @@
 #include <fs/file.h>
 #include <fs/fs.h>
 #include <fs/inode.h>
+#include <kernel/cpu.h>
 #include <kernel/init.h>
 #include <kernel/printk.h>
+#include <kernel/proc.h>
+
+// 定期唤醒 log writer，空闲时把日志写回原位置
+static struct timer checkpoint_timer;
+
+static void checkpoint_tick(struct timer *t) {
+    set_cpu_timer(t);
+    log_writer_tick();
+}
 
 void init_filesystem() {
     init_block_device();
     const SuperBlock *sblock = get_super_block();
     init_bcache(sblock, &block_device);
+    set_bcache_capacity(BCACHE_KERNEL_CAPACITY);
     init_inodes(sblock, &bcache);
+    start_proc(create_proc(), log_writer, 0);
+    start_proc(create_proc(), block_reader, 0);
+    checkpoint_timer.elapse = LOG_CHECKPOINT_IDLE_MS;
+    checkpoint_timer.handler = checkpoint_tick;
+    set_cpu_timer(&checkpoint_timer);
     init_ftable();
 }
 
@@ -28,71 +28,226 @@ static const SuperBlock *sblock;
 static const BlockCache *cache;
 
 /**
-    @brief global lock for inode layer.
+    @brief the in-memory inodes, hashed by `inode_no`.
 
-    Use it to protect anything you need.
+    An inode stays here after its last reference is put, so getting it again
+    does not read the inode block. Unreferenced inodes are kept on `lru`, and
+    the least recently used ones are freed when there are more than
+    `INODE_CACHE_MAX_UNUSED` of them.
 
-    e.g. the list of allocated blocks, ref counts, etc.
+    @note lock order: the lock of a bucket, then `lru_lock`.
+
+    @see Inode, inode_get, inode_put
  */
-static SpinLock lock;
+static struct {
+    SpinLock lock;
+    ListNode head;
+} icache[INODE_CACHE_NR_BUCKETS];
 
-/**
-    @brief the list of all allocated in-memory inodes.
+static SpinLock lru_lock;
+static ListNode lru;      // 没有引用的 inode，最近用过的在表头
+static usize num_unused;
 
-    We use a linked list to manage all allocated inodes.
+static INLINE usize bucket_of(usize inode_no) {
+    return inode_no % INODE_CACHE_NR_BUCKETS;
+}
 
-    You can implement your own data structure if you want better performance.
+/**
+    @brief the inode allocator.
 
-    @see Inode
- */
-static struct rb_root_ head;
+    Free inodes are recorded in the inode bitmap on disk. Inodes whose numbers
+    share `INODE_GROUP_SIZE` consecutive bits form a group. `free` counts the
+    free inodes of each group, so `alloc` skips full groups without reading
+    their bitmap.
 
-static bool compare(rb_node lnode, rb_node rnode) {
-    Inode *l = container_of(lnode, Inode, node);
-    Inode *r = container_of(rnode, Inode, node);
-    return l->inode_no < r->inode_no;
-}
+    The super block keeps a copy of `free` on disk, logged together with the
+    bitmap, so that it is read back instead of scanning every bitmap block.
 
-static free_inode_node free_inode_list;
-static SpinLock free_inode_list_lock;
-void push_free_inode(free_inode_node *node, free_inode_node *head) {
-    _acquire_spinlock(&free_inode_list_lock);
-    node->next = head->next;
-    head->next = node;
-    _release_spinlock(&free_inode_list_lock);
-}
-free_inode_node *pop_free_inode(free_inode_node *head) {
-    _acquire_spinlock(&free_inode_list_lock);
-    free_inode_node *node = head->next;
-    if (node != NULL) {
-        head->next = node->next;
-    }
-    _release_spinlock(&free_inode_list_lock);
-    return node;
-}
+    @note `free` is loaded on the first use. Images without the counts in the
+    super block are scanned once and get them on the first alloc or free.
+
+    @see inode_alloc_near, inode_free
+ */
+static struct {
+    SleepLock lock;
+    usize num_groups;
+    u32 *free; // 每组空闲的 inode 数
+} ialloc;
 
 // return which block `inode_no` lives on.
 static INLINE usize to_block_no(usize inode_no) {
     return sblock->inode_start + (inode_no / (INODE_PER_BLOCK));
 }
 
+// return which block of the inode bitmap records `inode_no`.
+static INLINE usize to_bitmap_block_no(usize inode_no) {
+    return sblock->inode_bitmap_start + inode_no / BIT_PER_BLOCK;
+}
+
 // return the pointer to on-disk inode.
 static INLINE InodeEntry *get_entry(Block *block, usize inode_no) {
     return ((InodeEntry *)block->data) + (inode_no % INODE_PER_BLOCK);
 }
 
-// return address array in indirect block.
-static INLINE u32 *get_addrs(Block *block) {
-    return ((IndirectBlock *)block->data)->addrs;
+// return the node in a block of the extent tree.
+static INLINE ExtentBlock *get_extent_block(Block *block) {
+    return (ExtentBlock *)block->data;
+}
+
+// is the data of `inode` stored inline in its entry?
+static INLINE bool is_inline(Inode *inode) {
+    return inode->entry.extent_header.depth == EXTENT_DEPTH_INLINE;
+}
+
+// return the inline data of `inode`.
+static INLINE u8 *inline_data(Inode *inode) {
+    return (u8 *)inode->entry.extents;
+}
+
+/**
+    @brief the dentry cache: the result of looking up a name in a directory.
+
+    An entry maps (directory inode, name) to the inode number of the name, or
+    to 0 if the directory has no such name (a negative entry). `namex` looks
+    names up here before reading directory blocks.
+
+    Entries are added by `namex` while it holds the lock of the directory, and
+    dropped by `inode_insert` and `inode_remove` under the same lock, so an
+    entry never disagrees with the directory.
+
+    @see dcache_lookup, dcache_add, dcache_drop
+ */
+typedef struct {
+    usize parent;
+    char name[FILE_NAME_MAX_LENGTH];
+    usize inode_no; // 0 表示目录中没有这个名字
+    ListNode hnode; // 哈希桶
+    ListNode lnode; // LRU 链表，最近使用的在表头
+} Dentry;
+
+static struct {
+    SpinLock lock;
+    ListNode buckets[DCACHE_NR_BUCKETS];
+    ListNode lru;
+    usize num_entries;
+} dcache;
+
+static void init_dcache() {
+    init_spinlock(&dcache.lock);
+    for (usize i = 0; i < DCACHE_NR_BUCKETS; i++) {
+        init_list_node(&dcache.buckets[i]);
+    }
+    init_list_node(&dcache.lru);
+    dcache.num_entries = 0;
+}
+
+static ListNode *dcache_bucket(usize parent, const char *name) {
+    usize h = parent;
+    for (usize i = 0; i < FILE_NAME_MAX_LENGTH && name[i]; i++) {
+        h = h * 31 + (u8)name[i];
+    }
+    return &dcache.buckets[h % DCACHE_NR_BUCKETS];
+}
+
+// caller must hold dcache.lock
+static Dentry *dcache_find(usize parent, const char *name) {
+    ListNode *b = dcache_bucket(parent, name);
+    for (ListNode *p = b->next; p != b; p = p->next) {
+        Dentry *d = container_of(p, Dentry, hnode);
+        if (d->parent == parent &&
+            strncmp(d->name, name, FILE_NAME_MAX_LENGTH) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+// caller must hold dcache.lock
+static void dcache_free(Dentry *d) {
+    _detach_from_list(&d->hnode);
+    _detach_from_list(&d->lnode);
+    dcache.num_entries--;
+    kfree(d);
+}
+
+// 查找目录 parent 中的 name。命中时把结果（可能是 0）放进 inode_no
+static bool dcache_lookup(usize parent, const char *name, usize *inode_no) {
+    _acquire_spinlock(&dcache.lock);
+    Dentry *d = dcache_find(parent, name);
+    if (d != NULL) {
+        *inode_no = d->inode_no;
+        _detach_from_list(&d->lnode);
+        _insert_into_list(&dcache.lru, &d->lnode);
+    }
+    _release_spinlock(&dcache.lock);
+    return d != NULL;
+}
+
+// 记录查找的结果，满了时淘汰最久没用的项。caller must hold the lock of parent
+static void dcache_add(usize parent, const char *name, usize inode_no) {
+    Dentry *new_d = kalloc(sizeof(Dentry));
+    _acquire_spinlock(&dcache.lock);
+    Dentry *d = dcache_find(parent, name);
+    if (d != NULL) {
+        _release_spinlock(&dcache.lock);
+        kfree(new_d);
+        return;
+    }
+    new_d->parent = parent;
+    strncpy(new_d->name, name, FILE_NAME_MAX_LENGTH);
+    new_d->inode_no = inode_no;
+    _insert_into_list(dcache_bucket(parent, name), &new_d->hnode);
+    _insert_into_list(&dcache.lru, &new_d->lnode);
+    dcache.num_entries++;
+    while (dcache.num_entries > DCACHE_MAX_ENTRIES) {
+        dcache_free(container_of(dcache.lru.prev, Dentry, lnode));
+    }
+    _release_spinlock(&dcache.lock);
+}
+
+// 目录 parent 中的 name 变了。caller must hold the lock of parent
+static void dcache_drop(usize parent, const char *name) {
+    _acquire_spinlock(&dcache.lock);
+    Dentry *d = dcache_find(parent, name);
+    if (d != NULL) {
+        dcache_free(d);
+    }
+    _release_spinlock(&dcache.lock);
+}
+
+// 目录 parent 被释放，它的 inode 号可能被复用，丢掉它下面的所有项
+static void dcache_drop_dir(usize parent) {
+    _acquire_spinlock(&dcache.lock);
+    ListNode *p = dcache.lru.next;
+    while (p != &dcache.lru) {
+        Dentry *d = container_of(p, Dentry, lnode);
+        p = p->next;
+        if (d->parent == parent) {
+            dcache_free(d);
+        }
+    }
+    _release_spinlock(&dcache.lock);
 }
 
 // initialize inode tree.
 void init_inodes(const SuperBlock *_sblock, const BlockCache *_cache) {
-    init_spinlock(&lock);
-    init_spinlock(&free_inode_list_lock);
-    // init_list_node(&head);
+    for (usize i = 0; i < INODE_CACHE_NR_BUCKETS; i++) {
+        init_spinlock(&icache[i].lock);
+        init_list_node(&icache[i].head);
+    }
+    init_spinlock(&lru_lock);
+    init_list_node(&lru);
+    num_unused = 0;
+    init_sleeplock(&ialloc.lock);
+    ialloc.num_groups =
+        (_sblock->num_inodes + INODE_GROUP_SIZE - 1) / INODE_GROUP_SIZE;
+    if (ialloc.free != NULL) {
+        kfree(ialloc.free);
+    }
+    ialloc.free = NULL;
     sblock = _sblock;
     cache = _cache;
+    init_dcache();
 
     if (ROOT_INODE_NO < sblock->num_inodes) {
         inodes.root = inodes.get(ROOT_INODE_NO);
@@ -104,49 +259,155 @@ void init_inodes(const SuperBlock *_sblock, const BlockCache *_cache) {
 static void init_inode(Inode *inode) {
     init_sleeplock(&inode->lock);
     init_rc(&inode->rc);
-    // init_list_node(&inode->node);
+    init_list_node(&inode->hnode);
+    init_list_node(&inode->lnode);
     inode->inode_no = 0;
     inode->valid = false;
+    inode->extent_hint.len = 0;
+    inode->delayed = NULL;
+    inode->delayed_start = 0;
+    inode->num_delayed = 0;
 }
 
-// see `inode.h`.
-static usize inode_alloc(OpContext *ctx, InodeType type) {
-    ASSERT(type != INODE_INVALID);
-
-    // TODO
-    // 第一步，找到空闲的inode。首先从空闲的inode链表中找，如果存在，直接修改并返回，如果不存在，向下
-    // 第二步，初始化该inode
-    free_inode_node *free_node = pop_free_inode(&free_inode_list);
-    if (free_node != NULL) {
-        Block *block = cache->acquire(to_block_no(free_node->inode_no));
-        InodeEntry *entry = get_entry(block, free_node->inode_no);
-        entry->type = type;
-        cache->sync(ctx, block);
-        cache->release(block);
-        return free_node->inode_no;
+// 数出每组空闲的 inode。超级块记了各组的空闲数时直接读出，否则扫描 inode
+// bitmap。caller must hold ialloc.lock
+static void count_free_inodes() {
+    if (ialloc.free != NULL) {
+        return;
     }
-    for (u32 i = 0; i <= sblock->num_inodes / INODE_PER_BLOCK; i++) {
-        Block *block = cache->acquire(sblock->inode_start + i);
-        for (u32 j = 0; j < INODE_PER_BLOCK; j++) {
-            if (i == 0 && j == 0) // 保留0编号
-                continue;
-            InodeEntry *entry = get_entry(block, j);
-            if (entry->type == INODE_INVALID) {
-                // 初始化block的内容
-                memset(entry, 0, sizeof(InodeEntry));
-                entry->type = type;
-                cache->sync(ctx, block);
-                cache->release(block);
-                return i * INODE_PER_BLOCK + j;
+    ialloc.free = kalloc(ialloc.num_groups * sizeof(u32));
+    Block *block = cache->acquire(SUPER_BLOCK_NO);
+    SuperBlock *sb = (SuperBlock *)block->data;
+    bool recorded = sb->num_inode_groups == ialloc.num_groups;
+    for (usize g = 0; recorded && g < ialloc.num_groups; g++) {
+        ialloc.free[g] = sb->free_inodes[g];
+    }
+    cache->release(block);
+    if (recorded) {
+        return;
+    }
+    for (usize g = 0; g < ialloc.num_groups; g++) {
+        usize first = g * INODE_GROUP_SIZE;
+        usize end = MIN(first + INODE_GROUP_SIZE, (usize)sblock->num_inodes);
+        Block *block = cache->acquire(to_bitmap_block_no(first));
+        ialloc.free[g] = 0;
+        for (usize i = first; i < end; i++) {
+            usize bit = i % BIT_PER_BLOCK;
+            if (!(block->data[bit / 8] & (1 << (bit % 8)))) {
+                ialloc.free[g]++;
             }
         }
         cache->release(block);
     }
-    // 如果没有找到，则PANIC
-    PANIC();
+}
+
+// 从 start 开始在第 g 组中找一个空闲的 inode，在 bitmap 中标记为已用。
+// 没有时返回 0。caller must hold ialloc.lock
+static usize alloc_in_group(OpContext *ctx, usize g, usize start) {
+    usize first = g * INODE_GROUP_SIZE;
+    usize n = MIN(first + INODE_GROUP_SIZE, (usize)sblock->num_inodes) - first;
+    Block *block = cache->acquire(to_bitmap_block_no(first));
+    for (usize i = 0; i < n; i++) {
+        usize inode_no = first + (start - first + i) % n;
+        usize bit = inode_no % BIT_PER_BLOCK;
+        if (!(block->data[bit / 8] & (1 << (bit % 8)))) {
+            block->data[bit / 8] |= (u8)(1 << (bit % 8));
+            cache->sync(ctx, block);
+            cache->release(block);
+            return inode_no;
+        }
+    }
+    cache->release(block);
     return 0;
 }
 
+// 把第 g 组的空闲数写进超级块。超级块里还没有记录时写入所有组。
+// caller must hold ialloc.lock
+static void update_free_inodes(OpContext *ctx, usize g) {
+    if (ialloc.num_groups > SUPER_MAX_INODE_GROUPS) {
+        return;
+    }
+    Block *block = cache->acquire(SUPER_BLOCK_NO);
+    SuperBlock *sb = (SuperBlock *)block->data;
+    if (sb->num_inode_groups != ialloc.num_groups) {
+        for (usize i = 0; i < ialloc.num_groups; i++) {
+            sb->free_inodes[i] = (u16)ialloc.free[i];
+        }
+        sb->num_inode_groups = (u32)ialloc.num_groups;
+    } else {
+        sb->free_inodes[g] = (u16)ialloc.free[g];
+    }
+    cache->sync(ctx, block);
+    cache->release(block);
+}
+
+// see `inode.h`.
+static usize inode_alloc_near(OpContext *ctx, InodeType type, usize parent) {
+    ASSERT(type != INODE_INVALID);
+    ASSERT(parent < sblock->num_inodes);
+
+    // 第一步，在 bitmap 中找到空闲的inode。
+    // 普通文件从父目录所在的组开始找，让同一个目录的 inode 挨在一起；
+    // 目录放到空闲 inode 最多的组，把目录分散开
+    unalertable_acquire_sleeplock(&ialloc.lock);
+    count_free_inodes();
+    usize g = parent / INODE_GROUP_SIZE;
+    usize start = parent;
+    if (type == INODE_DIRECTORY) {
+        for (usize i = 0; i < ialloc.num_groups; i++) {
+            if (ialloc.free[i] > ialloc.free[g]) {
+                g = i;
+            }
+        }
+        start = g * INODE_GROUP_SIZE;
+    }
+    usize inode_no = 0;
+    for (usize i = 0; i < ialloc.num_groups && inode_no == 0; i++) {
+        usize h = (g + i) % ialloc.num_groups;
+        if (ialloc.free[h] == 0) {
+            continue;
+        }
+        inode_no = alloc_in_group(ctx, h, i == 0 ? start : h * INODE_GROUP_SIZE);
+        ASSERT(inode_no != 0);
+        ialloc.free[h]--;
+        update_free_inodes(ctx, h);
+    }
+    release_sleeplock(&ialloc.lock);
+    // 如果没有找到，则PANIC
+    if (inode_no == 0) {
+        PANIC();
+    }
+
+    // 第二步，初始化该inode
+    Block *block = cache->acquire(to_block_no(inode_no));
+    InodeEntry *entry = get_entry(block, inode_no);
+    memset(entry, 0, sizeof(InodeEntry));
+    entry->type = type;
+    cache->sync(ctx, block);
+    cache->release(block);
+    return inode_no;
+}
+
+// see `inode.h`.
+static usize inode_alloc(OpContext *ctx, InodeType type) {
+    return inode_alloc_near(ctx, type, ROOT_INODE_NO);
+}
+
+// 在 bitmap 中释放 inode_no
+static void inode_free(OpContext *ctx, usize inode_no) {
+    unalertable_acquire_sleeplock(&ialloc.lock);
+    count_free_inodes();
+    Block *block = cache->acquire(to_bitmap_block_no(inode_no));
+    usize bit = inode_no % BIT_PER_BLOCK;
+    ASSERT(block->data[bit / 8] & (1 << (bit % 8)));
+    block->data[bit / 8] &= (u8)~(1 << (bit % 8));
+    cache->sync(ctx, block);
+    cache->release(block);
+    ialloc.free[inode_no / INODE_GROUP_SIZE]++;
+    update_free_inodes(ctx, inode_no / INODE_GROUP_SIZE);
+    release_sleeplock(&ialloc.lock);
+}
+
 // see `inode.h`.
 static void inode_lock(Inode *inode) {
     ASSERT(inode->rc.count > 0);
@@ -185,6 +446,11 @@ static void inode_sync(OpContext *ctx, Inode *inode, bool do_write) {
         Block *block = cache->acquire(to_block_no(inode->inode_no));
         InodeEntry *entry = get_entry(block, inode->inode_no);
         memcpy((void *)entry, &inode->entry, sizeof(InodeEntry));
+        // 延迟分配的块还没有落盘，磁盘上的大小只算到已分配的块
+        if (inode->num_delayed > 0) {
+            entry->num_bytes =
+                MIN(entry->num_bytes, inode->delayed_start * BLOCK_SIZE);
+        }
         cache->sync(ctx, block);
         cache->release(block);
         return;
@@ -206,78 +472,445 @@ static void inode_sync(OpContext *ctx, Inode *inode, bool do_write) {
     PANIC();
 }
 
+// 在桶中查找 inode_no。caller must hold the lock of the bucket
+static Inode *icache_find(usize b, usize inode_no) {
+    ListNode *head = &icache[b].head;
+    for (ListNode *p = head->next; p != head; p = p->next) {
+        Inode *inode = container_of(p, Inode, hnode);
+        if (inode->inode_no == inode_no) {
+            return inode;
+        }
+    }
+    return NULL;
+}
+
 // see `inode.h`.
 static Inode *inode_get(usize inode_no) {
     ASSERT(inode_no > 0);
     ASSERT(inode_no < sblock->num_inodes);
-    _acquire_spinlock(&lock);
-    Inode temp_inode = {.inode_no = inode_no};
-    // TODO
-    // 第一步，遍历所有的inode，找到inode_no对应的inode,将引用数加1
-    // 第二步，将inode返回，如果没有找到，那么就新建一个
-    // ListNode *temp = head.next;
-    // while (temp != &head) {
-    //     Inode *inode = container_of(temp, Inode, node);
-    //     if (inode->inode_no == inode_no) {
-    //         inode->rc.count++;
-    //         _release_spinlock(&lock);
-    //         return inode;
-    //     }
-    //     temp = temp->next;
-    // }
-    rb_node r = _rb_lookup(&temp_inode.node, &head, compare);
-    if (r != NULL) {
-        Inode *inode = container_of(r, Inode, node);
+    usize b = bucket_of(inode_no);
+    _acquire_spinlock(&icache[b].lock);
+    Inode *inode = icache_find(b, inode_no);
+    if (inode != NULL) {
+        // 没有引用的 inode 离开 LRU
+        if (inode->rc.count == 0) {
+            _acquire_spinlock(&lru_lock);
+            _detach_from_list(&inode->lnode);
+            num_unused--;
+            _release_spinlock(&lru_lock);
+        }
         _increment_rc(&inode->rc);
-        _release_spinlock(&lock);
+        _release_spinlock(&icache[b].lock);
         return inode;
     }
-    Inode *inode = kalloc(sizeof(Inode));
+    inode = kalloc(sizeof(Inode));
     init_inode(inode);
     inode->inode_no = inode_no;
     _increment_rc(&inode->rc);
-    if (_rb_insert(&inode->node, &head, compare)) {
-        PANIC();
-    }
-    _release_spinlock(&lock);
+    _insert_into_list(&icache[b].head, &inode->hnode);
+    _release_spinlock(&icache[b].lock);
     return inode;
 }
-// see `inode.h`.
-static void inode_clear(OpContext *ctx, Inode *inode) {
-    // TODO
 
-    // 第一步，释放inode对应的数据block
-    InodeEntry *entry = &inode->entry;
-    for (int i = 0; i < INODE_NUM_DIRECT; i++) {
-        if (entry->addrs[i] != 0) {
-            cache->free(ctx, entry->addrs[i]);
-            entry->addrs[i] = 0;
+// 没有引用的 inode 太多时，释放最久没用的
+static void icache_shrink() {
+    while (true) {
+        _acquire_spinlock(&lru_lock);
+        if (num_unused <= INODE_CACHE_MAX_UNUSED) {
+            _release_spinlock(&lru_lock);
+            return;
+        }
+        usize inode_no = container_of(lru.prev, Inode, lnode)->inode_no;
+        _release_spinlock(&lru_lock);
+
+        // 先拿桶的锁。期间它可能又被 get 了，所以按编号重新找
+        usize b = bucket_of(inode_no);
+        _acquire_spinlock(&icache[b].lock);
+        _acquire_spinlock(&lru_lock);
+        Inode *inode = icache_find(b, inode_no);
+        if (inode != NULL && inode->rc.count == 0) {
+            ASSERT(inode->num_delayed == 0);
+            _detach_from_list(&inode->lnode);
+            num_unused--;
+            _detach_from_list(&inode->hnode);
         } else {
+            inode = NULL;
+        }
+        _release_spinlock(&lru_lock);
+        _release_spinlock(&icache[b].lock);
+        if (inode != NULL) {
+            kfree(inode);
+        }
+    }
+}
+
+// 节点中最后一个 file_block <= fbn 的表项，没有时返回 0
+static usize extent_search(const ExtentHeader *h, const Extent *e, usize fbn) {
+    // 二分查找第一个 file_block > fbn 的表项
+    usize lo = 0, hi = h->num_entries;
+    while (lo < hi) {
+        usize mid = (lo + hi) / 2;
+        if (e[mid].file_block <= fbn) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo == 0 ? 0 : lo - 1;
+}
+
+// 查找覆盖文件块 fbn 的 extent。caller must hold the lock of `inode`
+static bool extent_lookup(Inode *inode, usize fbn, Extent *ext) {
+    Extent *hint = &inode->extent_hint;
+    if (hint->len > 0 && hint->file_block <= fbn &&
+        fbn < hint->file_block + hint->len) {
+        *ext = *hint;
+        return true;
+    }
+    ExtentHeader *h = &inode->entry.extent_header;
+    Extent *e = inode->entry.extents;
+    Block *block = NULL;
+    bool found = false;
+    while (h->num_entries > 0) {
+        Extent *x = &e[extent_search(h, e, fbn)];
+        if (fbn < x->file_block) {
             break;
         }
+        if (h->depth == 0) {
+            found = fbn < x->file_block + x->len;
+            if (found) {
+                *ext = *x;
+            }
+            break;
+        }
+        Block *child = cache->acquire(x->start);
+        if (block != NULL) {
+            cache->release(block);
+        }
+        block = child;
+        h = &get_extent_block(block)->header;
+        e = get_extent_block(block)->entries;
+    }
+    if (block != NULL) {
+        cache->release(block);
+    }
+    if (found) {
+        *hint = *ext;
+    }
+    return found;
+}
+
+// 最后一个 extent 之后的第一个文件块。goal 为磁盘上紧跟它的块，没有时为 0
+static usize extent_end(Inode *inode, usize *goal) {
+    ExtentHeader *h = &inode->entry.extent_header;
+    Extent *e = inode->entry.extents;
+    Block *block = NULL;
+    usize end = 0;
+    *goal = 0;
+    while (h->num_entries > 0) {
+        Extent *x = &e[h->num_entries - 1];
+        if (h->depth == 0) {
+            end = x->file_block + x->len;
+            *goal = x->start + x->len;
+            break;
+        }
+        Block *child = cache->acquire(x->start);
+        if (block != NULL) {
+            cache->release(block);
+        }
+        block = child;
+        h = &get_extent_block(block)->header;
+        e = get_extent_block(block)->entries;
     }
-    if (entry->indirect != 0) {
-        Block *indirect_block = cache->acquire(entry->indirect);
-        u32 *addrs = get_addrs(indirect_block);
-        for (u32 i = 0; i < INODE_NUM_INDIRECT; i++) {
-            if (addrs[i] != 0) {
-                cache->free(ctx, addrs[i]);
-            } else {
-                break;
+    if (block != NULL) {
+        cache->release(block);
+    }
+    return end;
+}
+
+// 节点下第一个覆盖 fbn 或在 fbn 之后的 extent 中，>= fbn 的第一个文件块。
+// 没有时返回 -1
+static usize subtree_next(const ExtentHeader *h, const Extent *e, usize fbn) {
+    for (usize i = extent_search(h, e, fbn); i < h->num_entries; i++) {
+        if (h->depth == 0) {
+            if (e[i].file_block + e[i].len > fbn) {
+                return MAX(fbn, (usize)e[i].file_block);
             }
+            continue;
+        }
+        Block *block = cache->acquire(e[i].start);
+        ExtentBlock *child = get_extent_block(block);
+        usize next = subtree_next(&child->header, child->entries, fbn);
+        cache->release(block);
+        if (next != (usize)-1) {
+            return next;
         }
-        cache->release(indirect_block);
-        cache->free(ctx, entry->indirect);
-        entry->indirect = 0;
     }
-    // 第二步，清理元数据
-    entry->num_bytes = 0;
-    for (u32 i = 0; i < INODE_NUM_DIRECT; i++) {
-        if (inode->entry.addrs[i])
-            PANIC();
+    return -1;
+}
+
+// 文件块 fbn 之后（含 fbn）第一个有磁盘块的文件块，没有时返回 -1
+static usize extent_next(Inode *inode, usize fbn) {
+    return subtree_next(&inode->entry.extent_header, inode->entry.extents,
+                        fbn);
+}
+
+// 按 file_block 的顺序插入一项，节点必须还有空位
+static void node_insert(ExtentHeader *h, Extent *e, const Extent *x) {
+    usize i = h->num_entries;
+    while (i > 0 && e[i - 1].file_block > x->file_block) {
+        e[i] = e[i - 1];
+        i--;
+    }
+    e[i] = *x;
+    h->num_entries++;
+}
+
+// 和前一个 extent 在文件里、磁盘上都连续时直接延长它
+static bool leaf_merge(ExtentHeader *h, Extent *e, const Extent *x) {
+    if (h->num_entries == 0) {
+        return false;
+    }
+    Extent *prev = &e[extent_search(h, e, x->file_block)];
+    if (prev->file_block + prev->len == x->file_block &&
+        prev->start + prev->len == x->start) {
+        prev->len += x->len;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Insert `x` into the subtree rooted at the node `h`/`e` holding at most
+ * `capacity` entries. If the node is full, it is split: the entry of the new
+ * sibling node is stored into `split` and true is returned.
+ */
+static bool subtree_insert(OpContext *ctx, ExtentHeader *h, Extent *e,
+                           usize capacity, const Extent *x, Extent *split) {
+    Extent item = *x;
+    if (h->depth > 0) {
+        Extent *parent = &e[extent_search(h, e, x->file_block)];
+        if (x->file_block < parent->file_block) {
+            parent->file_block = x->file_block;
+        }
+        Block *block = cache->acquire(parent->start);
+        ExtentBlock *child = get_extent_block(block);
+        bool child_split = subtree_insert(ctx, &child->header, child->entries,
+                                          EXTENT_PER_BLOCK, x, &item);
+        cache->sync(ctx, block);
+        cache->release(block);
+        if (!child_split) {
+            return false;
+        }
+    } else if (leaf_merge(h, e, x)) {
+        return false;
+    }
+    if (h->num_entries < capacity) {
+        node_insert(h, e, &item);
+        return false;
+    }
+
+    usize block_no = cache->alloc(ctx);
+    Block *block = cache->acquire(block_no);
+    ExtentBlock *sibling = get_extent_block(block);
+    sibling->header.depth = h->depth;
+    sibling->header.num_entries = 0;
+    if (item.file_block > e[h->num_entries - 1].file_block) {
+        // 追加在末尾时新节点只放新的一项，顺序写的文件节点都是满的
+        node_insert(&sibling->header, sibling->entries, &item);
+    } else {
+        usize half = h->num_entries / 2;
+        for (usize i = half; i < h->num_entries; i++) {
+            sibling->entries[i - half] = e[i];
+        }
+        sibling->header.num_entries = h->num_entries - half;
+        h->num_entries = half;
+        if (item.file_block >= sibling->entries[0].file_block) {
+            node_insert(&sibling->header, sibling->entries, &item);
+        } else {
+            node_insert(h, e, &item);
+        }
     }
-    if (inode->entry.indirect)
+    split->file_block = sibling->entries[0].file_block;
+    split->start = block_no;
+    split->len = 0;
+    cache->sync(ctx, block);
+    cache->release(block);
+    return true;
+}
+
+// 把 x 加入 inode 的 extent 树。caller must hold the lock of `inode`
+// and sync the inode afterwards.
+static void extent_insert(OpContext *ctx, Inode *inode, const Extent *x) {
+    ExtentHeader *h = &inode->entry.extent_header;
+    Extent *e = inode->entry.extents;
+    Extent split;
+    if (!subtree_insert(ctx, h, e, INODE_NUM_EXTENTS, x, &split)) {
+        return;
+    }
+    // 根节点分裂：把根的表项移到新块里，树长高一层
+    if (h->depth == EXTENT_MAX_DEPTH) {
         PANIC();
+    }
+    usize block_no = cache->alloc(ctx);
+    Block *block = cache->acquire(block_no);
+    ExtentBlock *child = get_extent_block(block);
+    child->header = *h;
+    for (usize i = 0; i < h->num_entries; i++) {
+        child->entries[i] = e[i];
+    }
+    cache->sync(ctx, block);
+    cache->release(block);
+    h->depth++;
+    h->num_entries = 2;
+    e[0].file_block = child->entries[0].file_block;
+    e[0].start = block_no;
+    e[0].len = 0;
+    e[1] = split;
+}
+
+// 从节点中删除第 i 项
+static void node_remove(ExtentHeader *h, Extent *e, usize i) {
+    for (; i + 1 < h->num_entries; i++) {
+        e[i] = e[i + 1];
+    }
+    h->num_entries--;
+}
+
+/*
+ * Remove file blocks [first, last] from the subtree rooted at `h`/`e`. They
+ * must lie in one extent. Children left empty are freed. If the blocks are in
+ * the middle of the extent, it keeps the head, the tail is stored into `tail`
+ * and true is returned; the caller inserts it back.
+ */
+static bool subtree_cut(OpContext *ctx, ExtentHeader *h, Extent *e,
+                        usize first, usize last, Extent *tail) {
+    usize i = extent_search(h, e, first);
+    if (h->depth > 0) {
+        Block *block = cache->acquire(e[i].start);
+        ExtentBlock *child = get_extent_block(block);
+        bool split = subtree_cut(ctx, &child->header, child->entries, first,
+                                 last, tail);
+        bool empty = child->header.num_entries == 0;
+        if (!empty) {
+            cache->sync(ctx, block);
+        }
+        cache->release(block);
+        if (empty) {
+            cache->free(ctx, e[i].start);
+            node_remove(h, e, i);
+        }
+        return split;
+    }
+    Extent *x = &e[i];
+    usize end = x->file_block + x->len;
+    usize n = last - first + 1;
+    ASSERT(x->file_block <= first && last < end);
+    if (x->file_block == first && end == last + 1) {
+        node_remove(h, e, i);
+    } else if (x->file_block == first) {
+        x->file_block += n;
+        x->start += n;
+        x->len -= n;
+    } else if (end == last + 1) {
+        x->len -= n;
+    } else {
+        tail->file_block = last + 1;
+        tail->start = x->start + (last + 1 - x->file_block);
+        tail->len = end - (last + 1);
+        x->len = first - x->file_block;
+        return true;
+    }
+    return false;
+}
+
+// 从 inode 的 extent 树中去掉文件块 [first, last] 并释放它们的磁盘块。
+// 这些块必须在同一个 extent 里。caller must hold the lock of `inode`
+// and sync the inode afterwards.
+static void extent_cut(OpContext *ctx, Inode *inode, usize first,
+                       usize last) {
+    ExtentHeader *h = &inode->entry.extent_header;
+    Extent ext;
+    bool found = extent_lookup(inode, first, &ext);
+    ASSERT(found);
+    inode->extent_hint.len = 0;
+    Extent tail;
+    if (subtree_cut(ctx, h, inode->entry.extents, first, last, &tail)) {
+        extent_insert(ctx, inode, &tail);
+    }
+    if (h->num_entries == 0) {
+        h->depth = 0;
+    }
+    usize start = ext.start + (first - ext.file_block);
+    for (usize i = 0; i <= last - first; i++) {
+        cache->free(ctx, start + i);
+    }
+}
+
+// 释放一段连续的块。预留不够时在新的操作里继续
+static void free_blocks(OpContext *ctx, usize start, usize len) {
+    // inode 所在的块，以及这段块在 bitmap 中跨过的块
+    usize need = 2 + (start + len - 1) / BIT_PER_BLOCK - start / BIT_PER_BLOCK;
+    if (!cache->extend_op(ctx, need)) {
+        cache->end_op(ctx);
+        cache->begin_op_reserve(ctx, need);
+    }
+    for (usize i = 0; i < len; i++) {
+        cache->free(ctx, start + i);
+    }
+}
+
+// 释放节点下所有的数据块和树的块
+static void extent_free(OpContext *ctx, ExtentHeader *h, Extent *e) {
+    for (usize i = 0; i < h->num_entries; i++) {
+        if (h->depth == 0) {
+            free_blocks(ctx, e[i].start, e[i].len);
+            continue;
+        }
+        Block *block = cache->acquire(e[i].start);
+        ExtentBlock *child = get_extent_block(block);
+        extent_free(ctx, &child->header, child->entries);
+        cache->release(block);
+        free_blocks(ctx, e[i].start, 1);
+    }
+    h->depth = 0;
+    h->num_entries = 0;
+}
+
+// n 个延迟分配的块预留的块数，包括 flush 时 extent 树可能用到的块
+static INLINE usize delayed_reservation(usize n) {
+    return n == 0 ? 0 : n + INODE_FLUSH_TREE_BLOCKS;
+}
+
+// 释放延迟分配的缓冲
+static void free_delayed(Inode *inode) {
+    for (usize i = 0; i < inode->num_delayed; i++) {
+        kfree_block(inode->delayed[i]);
+    }
+    if (inode->delayed != NULL) {
+        kfree(inode->delayed);
+    }
+    inode->delayed = NULL;
+    inode->num_delayed = 0;
+}
+
+// 丢掉延迟分配的缓冲，归还预留的块
+static void drop_delayed(Inode *inode) {
+    cache->unreserve(delayed_reservation(inode->num_delayed));
+    free_delayed(inode);
+}
+
+// see `inode.h`.
+static void inode_clear(OpContext *ctx, Inode *inode) {
+    // 第一步，释放inode对应的数据block和 extent 树，延迟分配的块直接丢掉
+    InodeEntry *entry = &inode->entry;
+    drop_delayed(inode);
+    // 内联的数据没有块，num_entries 为 0，extent_free 只重置树根
+    extent_free(ctx, &entry->extent_header, entry->extents);
+    memset(entry->extents, 0, sizeof(entry->extents));
+    inode->extent_hint.len = 0;
+    // 第二步，清理元数据
+    entry->num_bytes = 0;
     // 第三步，将inode写回磁盘
     inode_sync(ctx, inode, true);
 }
@@ -293,159 +926,148 @@ static Inode *inode_share(Inode *inode) {
 // see `inode.h`.
 static void inode_put(OpContext *ctx, Inode *inode) {
     // TODO
-    // 第一步，获得inode列表锁
-    _acquire_spinlock(&lock);
+    // 第一步，获得inode所在桶的锁
+    usize b = bucket_of(inode->inode_no);
+    _acquire_spinlock(&icache[b].lock);
     // 第二步，将计数器减一
     // 第三步，检测是否需要free掉inode
 
     if (inode->rc.count == 1) {
-        _release_spinlock(&lock);
+        _release_spinlock(&icache[b].lock);
         inode_lock(inode);
         if (inode->entry.num_links == 0) {
             ASSERT(inode->valid == true);
             ASSERT(inode->rc.count == 1);
+            if (inode->entry.type == INODE_DIRECTORY) {
+                dcache_drop_dir(inode->inode_no);
+            }
             inode_clear(ctx, inode);
             inode->entry.type = INODE_INVALID;
             inode_sync(ctx, inode, true);
-            _acquire_spinlock(&lock);
-            _rb_erase(&inode->node, &head);
-            _release_spinlock(&lock);
+            _acquire_spinlock(&icache[b].lock);
+            _detach_from_list(&inode->hnode);
+            _release_spinlock(&icache[b].lock);
             inode_unlock(inode);
+            inode_free(ctx, inode->inode_no);
             kfree(inode);
-
-            free_inode_node *free_node = kalloc(sizeof(free_inode_node));
-            free_node->inode_no = inode->inode_no;
-            push_free_inode(free_node, &free_inode_list);
             return;
         }
         inode_unlock(inode);
-        _decrement_rc(&inode->rc);
-
-        return;
+        _acquire_spinlock(&icache[b].lock);
+    }
+    // 最后一个引用：留在内存里，放进 LRU
+    bool unused = _decrement_rc(&inode->rc);
+    if (unused) {
+        _acquire_spinlock(&lru_lock);
+        _insert_into_list(&lru, &inode->lnode);
+        num_unused++;
+        _release_spinlock(&lru_lock);
     }
-    _decrement_rc(&inode->rc);
 
-    // 第四步，释放列表锁
-    _release_spinlock(&lock);
+    // 第四步，释放桶的锁
+    _release_spinlock(&icache[b].lock);
+    if (unused) {
+        icache_shrink();
+    }
 }
 
-/**
-    @brief get which block is the offset of the inode in.
-
-    e.g. `inode_map(ctx, my_inode, 1234, &modified)` will return the block_no
-    of the block that contains the 1234th byte of the file
-    represented by `my_inode`.
-
-    If a block has not been allocated for that byte, `inode_map` will
-    allocate a new block and update `my_inode`, at which time, `modified`
-    will be set to true.
-
-    HOWEVER, if `ctx == NULL`, `inode_map` will NOT try to allocate any new
-   block, and when it finds that the block has not been allocated, it will
-   return 0.
-
-    @param[out] modified true if some new block is allocated and `inode`
-    has been changed.
-
-    @return usize the block number of that block, or 0 if `ctx == NULL` and
-    the required block has not been allocated.
-
-    @note the caller must hold the lock of `inode`.
+/*
+ * Allocate blocks for file blocks [first, last], preferably beginning at
+ * disk block `goal`. Blocks of regular files are allocated in runs, so a
+ * large write gets few extents.
+ *
+ * The caller must hold the lock of `inode` and sync it afterwards.
  */
-static usize inode_map(OpContext *ctx, Inode *inode, usize offset,
-                       bool *modified) {
-    // TODO
-    // TODO 更改inode元数据
-    // 第一步，计算offset对应需要多少个block
-    usize need_block_count =
-        offset / BLOCK_SIZE + 1; // TODO:写需要支持大于512的写
-    if (need_block_count > INODE_NUM_DIRECT + INODE_NUM_INDIRECT) {
-        PANIC();
-    }
-    // 第二步，与已有的block数量进行比较，如果offset对应的block已经存在，那么就返回对应的block
-
-    usize inode_block_count =
-        inode->entry.num_bytes == 0
-            ? 0
-            : (inode->entry.num_bytes - 1) / BLOCK_SIZE + 1;
-    if (inode->entry.addrs[0] && inode_block_count == 0)
-        inode_block_count = 1;
-    if (need_block_count <= inode_block_count) {
-
-        *modified = false;
-        if (need_block_count <= INODE_NUM_DIRECT) {
-            return inode->entry.addrs[need_block_count - 1];
+static void extent_alloc(OpContext *ctx, Inode *inode, usize first,
+                         usize last, usize goal) {
+    for (usize fbn = first; fbn <= last;) {
+        usize start, len = 1;
+        if (inode->entry.type == INODE_REGULAR) {
+            // 普通文件的数据块按 ordered 模式写，不进日志
+            start = cache->alloc_range(ctx, last - fbn + 1, goal, &len);
         } else {
-            Block *indirect_block = cache->acquire(inode->entry.indirect);
-
-            u32 *addrs = get_addrs(indirect_block);
-            u32 result = addrs[need_block_count - INODE_NUM_DIRECT - 1];
-            cache->release(indirect_block);
-            return result;
+            start = cache->alloc(ctx);
         }
+        Extent x = {.file_block = (u32)fbn, .start = (u32)start, .len = (u32)len};
+        extent_insert(ctx, inode, &x);
+        fbn += len;
+        goal = start + len;
     }
-    //          如果没有，则分配block，直到足够容纳下offset对应的block
-    usize block_no = 0;
-    if (need_block_count > inode_block_count) {
+}
 
-        if (ctx == NULL) {
-            return 0;
-        }
-        *modified = true;
-        if (need_block_count <= INODE_NUM_DIRECT) {
-            for (u32 i = inode_block_count; i < need_block_count; i++) {
-                inode->entry.addrs[i] = cache->alloc(ctx);
-            }
-            block_no = inode->entry.addrs[need_block_count - 1];
+/*
+ * Allocate blocks for the file blocks in [first, last] that have none. The
+ * holes are filled in runs, each preferably right after the blocks before it.
+ *
+ * The caller must hold the lock of `inode` and sync it afterwards.
+ */
+static void extent_fill(OpContext *ctx, Inode *inode, usize first,
+                        usize last) {
+    Extent ext;
+    usize goal;
+    extent_end(inode, &goal);
+    if (first > 0 && extent_lookup(inode, first - 1, &ext)) {
+        goal = ext.start + ext.len;
+    }
+    for (usize fbn = first; fbn <= last;) {
+        usize next = extent_next(inode, fbn);
+        if (next > fbn) {
+            // fbn 在空洞里，一直分配到下一个 extent 之前
+            extent_alloc(ctx, inode, fbn, MIN(next - 1, last), goal);
+            fbn = next;
+            continue;
         }
-        if (need_block_count > INODE_NUM_DIRECT) {
-            if (inode_block_count <= INODE_NUM_DIRECT) {
+        extent_lookup(inode, fbn, &ext);
+        fbn = ext.file_block + ext.len;
+        goal = ext.start + ext.len;
+    }
+}
 
-                for (int i = inode_block_count; i < INODE_NUM_DIRECT; i++) {
-                    inode->entry.addrs[i] = cache->alloc(ctx);
-                }
-                if (inode->entry.indirect == NULL) {
-                    inode->entry.indirect = cache->alloc(ctx);
-                }
+/**
+    @brief get which block is the offset of the inode in.
 
-                Block *indirect_block = cache->acquire(inode->entry.indirect);
+    e.g. `inode_map(ctx, my_inode, 1234, &modified)` will return the block_no
+    of the block that contains the 1234th byte of the file
+    represented by `my_inode`.
 
-                IndirectBlock *indirect_block_data =
-                    (IndirectBlock *)indirect_block->data;
-                for (u32 i = 0; i < need_block_count - INODE_NUM_DIRECT; i++) {
-                    indirect_block_data->addrs[i] = cache->alloc(ctx);
-                }
+    If a block has not been allocated for that byte, `inode_map` will
+    allocate that one block only and update `my_inode`, at which time,
+    `modified` will be set to true. Holes before it stay holes, so files can
+    be sparse.
 
-                block_no = indirect_block_data
-                               ->addrs[need_block_count - INODE_NUM_DIRECT - 1];
+    HOWEVER, if `ctx == NULL`, `inode_map` will NOT try to allocate any new
+    block, and when it finds that the block has not been allocated (e.g. the
+    byte is in a hole), it will return 0.
 
-                cache->sync(ctx, indirect_block);
-                cache->release(indirect_block);
-            }
-            if (inode_block_count > INODE_NUM_DIRECT) {
-
-                // ASSERT(false);
-                Block *indirect_block = cache->acquire(inode->entry.indirect);
-                IndirectBlock *indirect_block_data =
-                    (IndirectBlock *)indirect_block->data;
-                for (u32 i = inode_block_count - INODE_NUM_DIRECT;
-                     i < need_block_count - INODE_NUM_DIRECT; i++) {
-                    indirect_block_data->addrs[i] = cache->alloc(ctx);
-                }
+    @param[out] modified true if some new block is allocated and `inode`
+    has been changed.
 
-                block_no = indirect_block_data
-                               ->addrs[need_block_count - INODE_NUM_DIRECT - 1];
+    @return usize the block number of that block, or 0 if `ctx == NULL` and
+    the required block has not been allocated.
 
-                cache->sync(ctx, indirect_block);
-                cache->release(indirect_block);
-            }
-        }
+    @note the caller must hold the lock of `inode`.
+ */
+static usize inode_map(OpContext *ctx, Inode *inode, usize offset,
+                       bool *modified) {
+    // 第一步，在 extent 树中查找 offset 所在的块
+    usize fbn = offset / BLOCK_SIZE;
+    *modified = false;
+    Extent ext;
+    if (extent_lookup(inode, fbn, &ext)) {
+        return ext.start + (fbn - ext.file_block);
+    }
+    if (ctx == NULL) {
+        return 0;
     }
+    // 第二步，没有找到，则只给 fbn 分配一块，前面的空洞保持不变
+    extent_fill(ctx, inode, fbn, fbn);
+    *modified = true;
 
     // 第三步，同步inode到磁盘
     inode_sync(ctx, inode, true);
 
-    return block_no;
+    extent_lookup(inode, fbn, &ext);
+    return ext.start + (fbn - ext.file_block);
 }
 
 // see `inode.h`.
@@ -464,28 +1086,245 @@ static usize inode_read(Inode *inode, u8 *dest, usize offset, usize count) {
     // TODO
     ASSERT(inode->valid == true);
 
+    // 内联的数据就在 inode 里，不用读数据块
+    if (is_inline(inode)) {
+        memcpy(dest, inline_data(inode) + offset, count);
+        return count;
+    }
+
     usize read_size = 0;
     bool modified;
 
     for (usize i = offset; i < end; i = BLOCK_BASE(i + BLOCK_SIZE)) {
-        Block *block = bcache.acquire(inode_map(NULL, inode, i, &modified));
+        usize fbn = i / BLOCK_SIZE;
+        Block *block = NULL;
+        u8 *data;
+        if (inode->num_delayed > 0 && fbn >= inode->delayed_start &&
+            fbn < inode->delayed_start + inode->num_delayed) {
+            // 延迟分配的块在内存缓冲里
+            data = inode->delayed[fbn - inode->delayed_start];
+        } else {
+            usize block_no = inode_map(NULL, inode, i, &modified);
+            if (block_no == 0) {
+                // 空洞读出来都是 0
+                usize n = MIN(end, BLOCK_BASE(i + BLOCK_SIZE)) - i;
+                memset(dest + read_size, 0, n);
+                read_size += n;
+                continue;
+            }
+            block = cache->acquire(block_no);
+            data = block->data;
+        }
         if (BLOCK_BASE(i) == BLOCK_BASE(end)) {
             // 最后一个BLOCK
-            memcpy((void *)(dest + read_size), block->data + i % BLOCK_SIZE,
+            memcpy((void *)(dest + read_size), data + i % BLOCK_SIZE,
                    end - i);
             read_size += end - i;
         } else {
-            memcpy((void *)(dest + read_size), block->data + i % BLOCK_SIZE,
+            memcpy((void *)(dest + read_size), data + i % BLOCK_SIZE,
                    BLOCK_SIZE - i % BLOCK_SIZE);
             read_size += BLOCK_SIZE - i % BLOCK_SIZE;
         }
-        bcache.release(block);
+        if (block != NULL) {
+            cache->release(block);
+        }
     }
     // 1.计算跨越的block数量
     // 3.返回读出的字节
     return count;
 }
 
+// 每次交给 block cache 的块数
+#define INODE_READAHEAD_BATCH 32
+
+// see `inode.h`.
+static void inode_readahead(Inode *inode, usize offset, usize count) {
+    InodeEntry *entry = &inode->entry;
+    if (entry->type == INODE_DEVICE || is_inline(inode) ||
+        offset >= entry->num_bytes) {
+        return;
+    }
+    usize end = MIN(offset + count, (usize)entry->num_bytes);
+    usize block_nos[INODE_READAHEAD_BATCH];
+    usize n = 0;
+    bool modified;
+    for (usize i = BLOCK_BASE(offset); i < end; i += BLOCK_SIZE) {
+        usize block_no = inode_map(NULL, inode, i, &modified);
+        if (block_no == 0) {
+            // 空洞，不用读
+            continue;
+        }
+        block_nos[n++] = block_no;
+        if (n == INODE_READAHEAD_BATCH) {
+            cache->readahead(block_nos, n);
+            n = 0;
+        }
+    }
+    cache->readahead(block_nos, n);
+}
+
+// see `inode.h`.
+usize inode_write_blocks(Inode *inode, usize count) {
+    if (inode->entry.type == INODE_DEVICE) {
+        return 0;
+    }
+    // 最多跨过的块数，以及分配这些块时用到的 bitmap 块。
+    // 写之前可能要先 flush 延迟分配的块
+    usize num_blocks = count / BLOCK_SIZE + 2 + inode->num_delayed;
+    usize num_bitmap_blocks = num_blocks / (BLOCK_SIZE * 8) + 2;
+    // inode 所在的块，extent 树的一条路径和分裂出的新节点
+    usize n = 1 + num_bitmap_blocks + 2 * (EXTENT_MAX_DEPTH + 1) +
+              num_blocks / (EXTENT_PER_BLOCK / 2);
+    // 普通文件的数据块不写日志
+    if (inode->entry.type != INODE_REGULAR) {
+        n += num_blocks;
+    }
+    return n;
+}
+
+// see `inode.h`.
+usize inode_allocate_blocks(Inode *inode, usize offset, usize count) {
+    usize end = offset + count;
+    if (count == 0 || (is_inline(inode) && end <= INODE_INLINE_BYTES)) {
+        return 0;
+    }
+    usize first = offset / BLOCK_SIZE, last = (end - 1) / BLOCK_SIZE;
+    usize holes = 0;
+    if (is_inline(inode)) {
+        // 内联数据先搬到第 0 块，范围里全是空洞
+        holes = last - first + 1 + (first > 0 ? 1 : 0);
+    } else {
+        for (usize fbn = first; fbn <= last;) {
+            usize next = extent_next(inode, fbn);
+            if (next > fbn) {
+                usize hole_end = MIN(next - 1, last);
+                holes += hole_end - fbn + 1;
+                fbn = hole_end + 1;
+                continue;
+            }
+            Extent ext;
+            extent_lookup(inode, fbn, &ext);
+            fbn = ext.file_block + ext.len;
+        }
+    }
+    if (holes == 0) {
+        return 0;
+    }
+    // 数据块，加上 extent 树的一条路径和分裂出的新节点
+    return holes + 2 * (EXTENT_MAX_DEPTH + 1) + holes / (EXTENT_PER_BLOCK / 2);
+}
+
+// see `inode.h`.
+static void inode_flush(OpContext *ctx, Inode *inode) {
+    if (inode->num_delayed == 0) {
+        return;
+    }
+    // 一次分配所有延迟的块，尽量连续地接在文件最后一个 extent 后面。
+    // 用 write_delayed 的预留分配，没用完的在 end_op 时归还
+    cache->claim(ctx, delayed_reservation(inode->num_delayed));
+    usize first = inode->delayed_start;
+    extent_fill(ctx, inode, first, first + inode->num_delayed - 1);
+    bool modified;
+    for (usize i = 0; i < inode->num_delayed; i++) {
+        usize offset = (first + i) * BLOCK_SIZE;
+        Block *block = cache->acquire(inode_map(NULL, inode, offset, &modified));
+        memcpy(block->data, inode->delayed[i], BLOCK_SIZE);
+        cache->sync_data(ctx, block);
+        cache->release(block);
+    }
+    free_delayed(inode);
+    inode_sync(ctx, inode, true);
+}
+
+// see `inode.h`.
+static usize inode_write_delayed(Inode *inode, u8 *src, usize offset,
+                                 usize count) {
+    InodeEntry *entry = &inode->entry;
+    // 写在文件末尾之后的由 write 写，中间留下空洞
+    if (entry->type != INODE_REGULAR || count == 0 ||
+        offset > entry->num_bytes) {
+        return 0;
+    }
+    // 内联的文件和放得进 inode 的小文件由 write 写
+    if (is_inline(inode) ||
+        (entry->num_bytes == 0 && entry->extent_header.num_entries == 0 &&
+         inode->num_delayed == 0 && offset + count <= INODE_INLINE_BYTES)) {
+        return 0;
+    }
+    if (inode->num_delayed == 0) {
+        usize goal;
+        inode->delayed_start = extent_end(inode, &goal);
+        // 文件末尾被打了洞时，最后一个 extent 之后还在文件里面，
+        // 延迟的块不能从那里开始，否则 sync 会把大小截短
+        if (inode->delayed_start * BLOCK_SIZE < entry->num_bytes) {
+            return 0;
+        }
+    }
+    // 已经分配了块的地方由 write 写
+    usize start = inode->delayed_start;
+    if (offset / BLOCK_SIZE < start) {
+        return 0;
+    }
+    usize end = MIN(offset + count,
+                    (start + INODE_DELAYED_MAX_BLOCKS) * BLOCK_SIZE);
+    if (end <= offset) {
+        return 0;
+    }
+    // 新的块只预留磁盘空间，不分配
+    usize num_blocks = (end - 1) / BLOCK_SIZE + 1 - start;
+    if (num_blocks > inode->num_delayed &&
+        !cache->reserve(delayed_reservation(num_blocks) -
+                        delayed_reservation(inode->num_delayed))) {
+        return 0;
+    }
+    if (inode->delayed == NULL) {
+        inode->delayed = kalloc(INODE_DELAYED_MAX_BLOCKS * sizeof(u8 *));
+    }
+    while (inode->num_delayed < num_blocks) {
+        u8 *data = kalloc_block();
+        memset(data, 0, BLOCK_SIZE);
+        inode->delayed[inode->num_delayed++] = data;
+    }
+    for (usize i = offset; i < end; i = BLOCK_BASE(i + BLOCK_SIZE)) {
+        usize n = MIN(end, BLOCK_BASE(i + BLOCK_SIZE)) - i;
+        memcpy(inode->delayed[i / BLOCK_SIZE - start] + i % BLOCK_SIZE,
+               src + (i - offset), n);
+    }
+    if (end > entry->num_bytes) {
+        entry->num_bytes = end;
+    }
+    return end - offset;
+}
+
+/**
+ * Move the inline data of `inode` to its first block, so that the inode can
+ * grow past `INODE_INLINE_BYTES`.
+ *
+ * The caller must hold the lock of `inode` and sync it afterwards.
+ */
+static void inline_to_blocks(OpContext *ctx, Inode *inode) {
+    InodeEntry *entry = &inode->entry;
+    u8 data[INODE_INLINE_BYTES];
+    memcpy(data, inline_data(inode), INODE_INLINE_BYTES);
+    entry->extent_header.depth = 0;
+    entry->extent_header.num_entries = 0;
+    memset(entry->extents, 0, sizeof(entry->extents));
+    if (entry->num_bytes == 0) {
+        return;
+    }
+    extent_alloc(ctx, inode, 0, 0, 0);
+    bool modified;
+    Block *block = cache->acquire(inode_map(NULL, inode, 0, &modified));
+    memset(block->data, 0, BLOCK_SIZE);
+    memcpy(block->data, data, entry->num_bytes);
+    if (entry->type == INODE_REGULAR) {
+        cache->sync_data(ctx, block);
+    } else {
+        cache->sync(ctx, block);
+    }
+    cache->release(block);
+}
+
 // see `inode.h`.
 static usize inode_write(OpContext *ctx, Inode *inode, u8 *src, usize offset,
                          usize count) {
@@ -496,7 +1335,6 @@ static usize inode_write(OpContext *ctx, Inode *inode, u8 *src, usize offset,
 
     InodeEntry *entry = &inode->entry;
     usize end = offset + count;
-    ASSERT(offset <= entry->num_bytes);
     ASSERT(end <= INODE_MAX_BYTES);
     ASSERT(offset <= end);
 
@@ -504,8 +1342,36 @@ static usize inode_write(OpContext *ctx, Inode *inode, u8 *src, usize offset,
     usize write_size = 0;
     bool modified;
 
+    // 空的小文件和目录直接存在 inode 里，变大时再搬到数据块
+    if (!is_inline(inode) && entry->num_bytes == 0 &&
+        entry->extent_header.num_entries == 0 && inode->num_delayed == 0 &&
+        end > 0 && end <= INODE_INLINE_BYTES) {
+        entry->extent_header.depth = EXTENT_DEPTH_INLINE;
+        memset(entry->extents, 0, sizeof(entry->extents));
+    }
+    if (is_inline(inode)) {
+        if (end <= INODE_INLINE_BYTES) {
+            memcpy(inline_data(inode) + offset, src, count);
+            if (end > entry->num_bytes) {
+                entry->num_bytes = end;
+            }
+            inode_sync(ctx, inode, true);
+            return count;
+        }
+        inline_to_blocks(ctx, inode);
+    }
+
+    // 先让延迟分配的块落盘，再一次分配整个写入需要的新块，让它们在磁盘上尽量连续
+    if (inode->num_delayed > 0 && end > inode->delayed_start * BLOCK_SIZE) {
+        inode_flush(ctx, inode);
+    }
+    if (count > 0) {
+        // 只给写到的块分配，offset 之前没写过的地方留作空洞
+        extent_fill(ctx, inode, offset / BLOCK_SIZE, (end - 1) / BLOCK_SIZE);
+    }
+
     for (usize i = offset; i < end; i = BLOCK_BASE(i + BLOCK_SIZE)) {
-        Block *block = bcache.acquire(inode_map(ctx, inode, i, &modified));
+        Block *block = cache->acquire(inode_map(ctx, inode, i, &modified));
         if (BLOCK_BASE(i) == BLOCK_BASE(end)) {
             // 最后一个BLOCK
             memcpy((void *)(block->data + i % BLOCK_SIZE), src + write_size,
@@ -517,8 +1383,12 @@ static usize inode_write(OpContext *ctx, Inode *inode, u8 *src, usize offset,
                    BLOCK_SIZE - i % BLOCK_SIZE);
             write_size += BLOCK_SIZE - i % BLOCK_SIZE;
         }
-        bcache.sync(ctx, block);
-        bcache.release(block);
+        if (entry->type == INODE_REGULAR) {
+            cache->sync_data(ctx, block);
+        } else {
+            cache->sync(ctx, block);
+        }
+        cache->release(block);
     }
     ASSERT(write_size == count);
 
@@ -567,6 +1437,102 @@ static usize inode_write(OpContext *ctx, Inode *inode, u8 *src, usize offset,
     // return count;
 }
 
+// see `inode.h`.
+static void inode_allocate(OpContext *ctx, Inode *inode, usize offset,
+                           usize count, bool keep_size) {
+    InodeEntry *entry = &inode->entry;
+    usize end = offset + count;
+    ASSERT(entry->type != INODE_DEVICE);
+    ASSERT(end <= INODE_MAX_BYTES);
+    if (count == 0) {
+        return;
+    }
+    if (is_inline(inode) && end > INODE_INLINE_BYTES) {
+        inline_to_blocks(ctx, inode);
+    }
+    if (!is_inline(inode)) {
+        // 延迟分配的块先落盘，再把范围里的空洞一次分配掉
+        if (inode->num_delayed > 0 && end > inode->delayed_start * BLOCK_SIZE) {
+            inode_flush(ctx, inode);
+        }
+        extent_fill(ctx, inode, offset / BLOCK_SIZE, (end - 1) / BLOCK_SIZE);
+    }
+    if (!keep_size && end > entry->num_bytes) {
+        entry->num_bytes = end;
+    }
+    inode_sync(ctx, inode, true);
+}
+
+// 把一个块里的 [from, to) 清零：延迟分配的块清缓冲，有磁盘块的清磁盘块
+static void zero_in_block(OpContext *ctx, Inode *inode, usize from,
+                          usize to) {
+    usize fbn = from / BLOCK_SIZE;
+    if (from >= to) {
+        return;
+    }
+    if (inode->num_delayed > 0 && fbn >= inode->delayed_start &&
+        fbn < inode->delayed_start + inode->num_delayed) {
+        memset(inode->delayed[fbn - inode->delayed_start] + from % BLOCK_SIZE,
+               0, to - from);
+        return;
+    }
+    bool modified;
+    usize block_no = inode_map(NULL, inode, from, &modified);
+    if (block_no == 0) {
+        return;
+    }
+    Block *block = cache->acquire(block_no);
+    memset(block->data + from % BLOCK_SIZE, 0, to - from);
+    if (inode->entry.type == INODE_REGULAR) {
+        cache->sync_data(ctx, block);
+    } else {
+        cache->sync(ctx, block);
+    }
+    cache->release(block);
+}
+
+// see `inode.h`.
+static bool inode_punch(OpContext *ctx, Inode *inode, usize offset,
+                        usize count) {
+    ASSERT(inode->entry.type != INODE_DEVICE);
+    usize end = offset + count;
+    if (count == 0) {
+        return true;
+    }
+    if (is_inline(inode)) {
+        if (offset < INODE_INLINE_BYTES) {
+            memset(inline_data(inode) + offset, 0,
+                   MIN(end, INODE_INLINE_BYTES) - offset);
+            inode_sync(ctx, inode, true);
+        }
+        return true;
+    }
+    // 第一步，去掉范围里整块的磁盘块，每次最多 INODE_PUNCH_MAX_BLOCKS 块
+    usize first = (offset + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    usize last_end = end / BLOCK_SIZE;
+    usize next = extent_next(inode, first);
+    if (next < last_end) {
+        Extent ext;
+        extent_lookup(inode, next, &ext);
+        usize last = MIN(ext.file_block + ext.len, last_end) - 1;
+        last = MIN(last, next + INODE_PUNCH_MAX_BLOCKS - 1);
+        extent_cut(ctx, inode, next, last);
+        inode_sync(ctx, inode, true);
+        return false;
+    }
+    // 第二步，两头不满一块的部分清零
+    usize head_end = MIN(end, BLOCK_BASE(offset) + BLOCK_SIZE);
+    zero_in_block(ctx, inode, offset, head_end);
+    zero_in_block(ctx, inode, MAX(head_end, BLOCK_BASE(end)), end);
+    // 第三步，延迟分配的块还没有磁盘块，整块清零
+    usize delayed_end = inode->delayed_start + inode->num_delayed;
+    for (usize fbn = MAX(first, inode->delayed_start);
+         fbn < MIN(last_end, delayed_end); fbn++) {
+        memset(inode->delayed[fbn - inode->delayed_start], 0, BLOCK_SIZE);
+    }
+    return true;
+}
+
 static int strcmp(const char *s1, const char *s2) {
     while (*s1 && *s2 && *s1 == *s2) {
         s1++;
@@ -575,12 +1541,333 @@ static int strcmp(const char *s1, const char *s2) {
     return *s1 - *s2;
 }
 
+// 目录的第 fbn 块。caller must hold the lock of `inode`
+static Block *dir_acquire(Inode *inode, usize fbn) {
+    bool modified;
+    usize block_no = inode_map(NULL, inode, fbn * BLOCK_SIZE, &modified);
+    ASSERT(block_no != 0);
+    return cache->acquire(block_no);
+}
+
+// 在目录末尾追加一块，返回它的文件块号
+static usize dir_append(OpContext *ctx, Inode *inode, void *data) {
+    ASSERT(inode->entry.num_bytes % BLOCK_SIZE == 0);
+    usize fbn = inode->entry.num_bytes / BLOCK_SIZE;
+    inode_write(ctx, inode, (u8 *)data, fbn * BLOCK_SIZE, BLOCK_SIZE);
+    return fbn;
+}
+
+// 目录的第 0 块是不是 hash 索引的根。caller must hold the lock of `inode`
+static bool dx_indexed(Inode *inode) {
+    // 有索引的目录至少有根和一个叶子
+    if (inode->entry.num_bytes < 2 * BLOCK_SIZE) {
+        return false;
+    }
+    Block *block = dir_acquire(inode, 0);
+    DxHeader *h = &((DxBlock *)block->data)->header;
+    bool indexed = h->zero == 0 && h->magic == DX_MAGIC;
+    cache->release(block);
+    return indexed;
+}
+
+// 节点中覆盖 hash 的表项：最后一个 hash 不大于它的表项，没有时返回 0
+static usize dx_search(const DxBlock *node, u32 hash) {
+    usize lo = 0, hi = node->header.num_entries;
+    while (lo < hi) {
+        usize mid = (lo + hi) / 2;
+        if (node->entries[mid].hash <= hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo == 0 ? 0 : lo - 1;
+}
+
+// 把 (hash, child) 按顺序插入没满的节点
+static void dx_node_insert(DxBlock *node, u32 hash, usize child) {
+    usize i = node->header.num_entries;
+    ASSERT(i < DX_PER_BLOCK);
+    for (; i > 0 && node->entries[i - 1].hash > hash; i--) {
+        node->entries[i] = node->entries[i - 1];
+    }
+    memset(&node->entries[i], 0, sizeof(DxEntry));
+    node->entries[i].hash = hash;
+    node->entries[i].block = (u32)child;
+    node->header.num_entries++;
+}
+
+// 从根到叶子的一条路径
+typedef struct {
+    usize depth;                     // 根的 depth
+    usize node[DX_MAX_DEPTH + 1];    // 路径上的索引节点，node[0] 是根
+    bool full[DX_MAX_DEPTH + 1];     // 这个索引节点满了吗
+    usize leaf;                      // hash 所在的叶子
+} DxPath;
+
+// 找到 hash 所在的叶子。caller must hold the lock of `inode`
+static void dx_walk(Inode *inode, u32 hash, DxPath *path) {
+    usize fbn = 0;
+    for (usize level = 0;; level++) {
+        Block *block = dir_acquire(inode, fbn);
+        DxBlock *node = (DxBlock *)block->data;
+        if (level == 0) {
+            path->depth = node->header.depth;
+            ASSERT(path->depth <= DX_MAX_DEPTH);
+        }
+        ASSERT(node->header.depth == path->depth - level);
+        path->node[level] = fbn;
+        path->full[level] = node->header.num_entries == DX_PER_BLOCK;
+        fbn = node->entries[dx_search(node, hash)].block;
+        cache->release(block);
+        if (level == path->depth) {
+            break;
+        }
+    }
+    path->leaf = fbn;
+}
+
+// 按名字的 hash 给目录项排序，hash 放在 hashes 里
+static void dx_sort(DirEntry *entries, u32 *hashes, usize n) {
+    for (usize i = 0; i < n; i++) {
+        DirEntry de = entries[i];
+        u32 h = dx_hash(de.name);
+        usize j = i;
+        for (; j > 0 && hashes[j - 1] > h; j--) {
+            entries[j] = entries[j - 1];
+            hashes[j] = hashes[j - 1];
+        }
+        entries[j] = de;
+        hashes[j] = h;
+    }
+}
+
+// 分裂排好序的 n 个项的位置。hash 相同的项要留在同一个叶子里，分不开时返回 0
+static usize dx_split_point(const u32 *hashes, usize n) {
+    usize mid = n / 2;
+    while (mid < n && hashes[mid] == hashes[mid - 1]) {
+        mid++;
+    }
+    if (mid == n) {
+        mid = n / 2;
+        while (mid > 0 && hashes[mid] == hashes[mid - 1]) {
+            mid--;
+        }
+    }
+    return mid;
+}
+
+// 把线性目录变成有索引的目录：第 0 块变成根，原来的项按 hash 分到两个叶子里。
+// 目录最多只有一块
+static void dx_create(OpContext *ctx, Inode *inode) {
+    ASSERT(inode->entry.num_bytes <= BLOCK_SIZE);
+    DirEntry *entries = kalloc_block();
+    memset(entries, 0, BLOCK_SIZE);
+    inode_read(inode, (u8 *)entries, 0, inode->entry.num_bytes);
+    usize n = 0;
+    for (usize i = 0; i < DIR_PER_BLOCK; i++) {
+        if (entries[i].inode_no != 0) {
+            entries[n++] = entries[i];
+        }
+    }
+    // 块大时放在栈上太大
+    u32 *hashes = kalloc(DIR_PER_BLOCK * sizeof(u32));
+    dx_sort(entries, hashes, n);
+    usize mid = n < 2 ? 0 : dx_split_point(hashes, n);
+    if (mid == 0) {
+        mid = n;
+    }
+
+    DxBlock *root = kalloc_block();
+    memset(root, 0, BLOCK_SIZE);
+    root->header.magic = DX_MAGIC;
+    dx_node_insert(root, 0, 1);
+    if (mid < n) {
+        dx_node_insert(root, hashes[mid], 2);
+    }
+    inode_write(ctx, inode, (u8 *)root, 0, BLOCK_SIZE);
+
+    // 第一个叶子是前 mid 项，第二个叶子是其余的项
+    DirEntry *leaf = (DirEntry *)root;
+    memset(leaf, 0, BLOCK_SIZE);
+    memcpy(leaf, entries, mid * sizeof(DirEntry));
+    dir_append(ctx, inode, leaf);
+    if (mid < n) {
+        memset(leaf, 0, BLOCK_SIZE);
+        memcpy(leaf, entries + mid, (n - mid) * sizeof(DirEntry));
+        dir_append(ctx, inode, leaf);
+    }
+    kfree(hashes);
+    kfree_block(root);
+    kfree_block(entries);
+}
+
+// 根满了：把根的表项搬到新的索引节点，根只指向它，索引长高一层
+static void dx_grow(OpContext *ctx, Inode *inode) {
+    DxBlock *node = kalloc_block();
+    Block *block = dir_acquire(inode, 0);
+    memcpy(node, block->data, BLOCK_SIZE);
+    cache->release(block);
+    usize child = dir_append(ctx, inode, node);
+    kfree_block(node);
+
+    block = dir_acquire(inode, 0);
+    DxBlock *root = (DxBlock *)block->data;
+    root->header.depth++;
+    root->header.num_entries = 0;
+    dx_node_insert(root, 0, child);
+    cache->sync(ctx, block);
+    cache->release(block);
+}
+
+// 把满了的叶子 fbn 按 hash 分成两半，后一半搬到新的叶子。
+// 返回新叶子，key 是它的最小 hash。hash 全相同时分不开，返回 0
+static usize dx_split_leaf(OpContext *ctx, Inode *inode, usize fbn, u32 *key) {
+    DirEntry *entries = kalloc_block();
+    Block *block = dir_acquire(inode, fbn);
+    memcpy(entries, block->data, BLOCK_SIZE);
+    u32 *hashes = kalloc(DIR_PER_BLOCK * sizeof(u32));
+    dx_sort(entries, hashes, DIR_PER_BLOCK);
+    usize mid = dx_split_point(hashes, DIR_PER_BLOCK);
+    if (mid == 0) {
+        cache->release(block);
+        kfree(hashes);
+        kfree_block(entries);
+        return 0;
+    }
+    memset(block->data, 0, BLOCK_SIZE);
+    memcpy(block->data, entries, mid * sizeof(DirEntry));
+    cache->sync(ctx, block);
+    cache->release(block);
+
+    usize rest = DIR_PER_BLOCK - mid;
+    memmove(entries, entries + mid, rest * sizeof(DirEntry));
+    memset(entries + rest, 0, mid * sizeof(DirEntry));
+    usize child = dir_append(ctx, inode, entries);
+    kfree_block(entries);
+    *key = hashes[mid];
+    kfree(hashes);
+    return child;
+}
+
+// 把 (hash, child) 插入满了的索引节点 fbn：后一半表项搬到新节点。
+// 返回新节点，key 是它的最小 hash
+static usize dx_split_node(OpContext *ctx, Inode *inode, usize fbn, u32 hash,
+                           usize child, u32 *key) {
+    DxBlock *new_node = kalloc_block();
+    memset(new_node, 0, BLOCK_SIZE);
+    Block *block = dir_acquire(inode, fbn);
+    DxBlock *node = (DxBlock *)block->data;
+    usize mid = DX_PER_BLOCK / 2 + 1;
+    new_node->header.depth = node->header.depth;
+    new_node->header.magic = DX_MAGIC;
+    new_node->header.num_entries = (u32)(DX_PER_BLOCK - mid);
+    memcpy(new_node->entries, node->entries + mid,
+           (DX_PER_BLOCK - mid) * sizeof(DxEntry));
+    memset(node->entries + mid, 0, (DX_PER_BLOCK - mid) * sizeof(DxEntry));
+    node->header.num_entries = (u32)mid;
+    *key = new_node->entries[0].hash;
+    if (hash < *key) {
+        dx_node_insert(node, hash, child);
+    } else {
+        dx_node_insert(new_node, hash, child);
+    }
+    cache->sync(ctx, block);
+    cache->release(block);
+    usize new_fbn = dir_append(ctx, inode, new_node);
+    kfree_block(new_node);
+    return new_fbn;
+}
+
+// 在有索引的目录中查找 name，index 同 `lookup`
+static usize dx_lookup(Inode *inode, const char *name, usize *index) {
+    DxPath path;
+    dx_walk(inode, dx_hash(name), &path);
+    Block *block = dir_acquire(inode, path.leaf);
+    DirEntry *entries = (DirEntry *)block->data;
+    usize inode_no = 0;
+    for (usize i = 0; i < DIR_PER_BLOCK; i++) {
+        if (entries[i].inode_no != 0 &&
+            strncmp(name, entries[i].name, FILE_NAME_MAX_LENGTH) == 0) {
+            inode_no = entries[i].inode_no;
+            if (index) {
+                *index = path.leaf * BLOCK_SIZE + i * sizeof(DirEntry);
+            }
+            break;
+        }
+    }
+    cache->release(block);
+    return inode_no;
+}
+
+// 在有索引的目录中插入 name，返回值同 `insert`
+static usize dx_insert(OpContext *ctx, Inode *inode, const char *name,
+                       usize inode_no) {
+    u32 hash = dx_hash(name);
+    while (true) {
+        DxPath path;
+        dx_walk(inode, hash, &path);
+        Block *block = dir_acquire(inode, path.leaf);
+        DirEntry *entries = (DirEntry *)block->data;
+        usize slot = DIR_PER_BLOCK;
+        for (usize i = 0; i < DIR_PER_BLOCK; i++) {
+            if (entries[i].inode_no == 0) {
+                if (slot == DIR_PER_BLOCK) {
+                    slot = i;
+                }
+            } else if (strncmp(name, entries[i].name,
+                               FILE_NAME_MAX_LENGTH) == 0) {
+                cache->release(block);
+                return -1;
+            }
+        }
+        if (slot < DIR_PER_BLOCK) {
+            memset(&entries[slot], 0, sizeof(DirEntry));
+            strncpy(entries[slot].name, name, FILE_NAME_MAX_LENGTH);
+            entries[slot].inode_no = (u16)inode_no;
+            cache->sync(ctx, block);
+            cache->release(block);
+            return path.leaf * BLOCK_SIZE + slot * sizeof(DirEntry);
+        }
+        cache->release(block);
+
+        // 叶子满了，分裂一直传到路径上第一个没满的索引节点 node[level - 1]。
+        // 根也满了就先长高一层
+        usize level = path.depth + 1;
+        while (level > 0 && path.full[level - 1]) {
+            level--;
+        }
+        if (level == 0) {
+            if (path.depth == DX_MAX_DEPTH) {
+                return -1;
+            }
+            dx_grow(ctx, inode);
+            continue;
+        }
+        u32 key;
+        usize child = dx_split_leaf(ctx, inode, path.leaf, &key);
+        if (child == 0) {
+            return -1;
+        }
+        for (usize l = path.depth + 1; l-- > level;) {
+            child = dx_split_node(ctx, inode, path.node[l], key, child, &key);
+        }
+        block = dir_acquire(inode, path.node[level - 1]);
+        dx_node_insert((DxBlock *)block->data, key, child);
+        cache->sync(ctx, block);
+        cache->release(block);
+        // 叶子有空位了，重新查找
+    }
+}
+
 // see `inode.h`.
 static usize inode_lookup(Inode *inode, const char *name, usize *index) {
     InodeEntry *entry = &inode->entry;
     ASSERT(entry->type == INODE_DIRECTORY);
 
-    // TODO
+    if (dx_indexed(inode)) {
+        return dx_lookup(inode, name, index);
+    }
     for (u64 offset = 0; offset < entry->num_bytes;
          offset += sizeof(DirEntry)) {
         DirEntry dir;
@@ -609,19 +1896,33 @@ static usize inode_insert(OpContext *ctx, Inode *inode, const char *name,
     ASSERT(entry->type == INODE_DIRECTORY);
     // TODO
     ASSERT(inode->valid == true);
-    // 第一步，先检测是否已经存在同名文件，如果有，返回-1
     usize index;
-    if (inode_lookup(inode, name, &index)) {
-        return -1;
-    }
-    DirEntry dir_entry = {0};
-    memcpy(dir_entry.name, name, strlen(name) + 1);
-    dir_entry.inode_no = inode_no;
-    // 如果沒有，在文件末尾进行追加写
-    inode_write(ctx, inode, (u8 *)&dir_entry, inode->entry.num_bytes,
-                sizeof(DirEntry));
-    // 第二步，返回空闲位置的index
-    index = inode->entry.num_bytes / sizeof(DirEntry) + 1;
+    if (dx_indexed(inode)) {
+        index = dx_insert(ctx, inode, name, inode_no);
+    } else {
+        // 第一步，先检测是否已经存在同名文件，如果有，返回-1
+        if (inode_lookup(inode, name, &index)) {
+            return -1;
+        }
+        usize num_bytes = inode->entry.num_bytes;
+        if (num_bytes <= BLOCK_SIZE &&
+            num_bytes + sizeof(DirEntry) > BLOCK_SIZE) {
+            // 第一块写满了，建立 hash 索引
+            dx_create(ctx, inode);
+            index = dx_insert(ctx, inode, name, inode_no);
+        } else {
+            DirEntry dir_entry = {0};
+            memcpy(dir_entry.name, name, strlen(name) + 1);
+            dir_entry.inode_no = inode_no;
+            // 如果沒有，在文件末尾进行追加写
+            inode_write(ctx, inode, (u8 *)&dir_entry, num_bytes,
+                        sizeof(DirEntry));
+            index = num_bytes;
+        }
+    }
+    if (index != (usize)-1) {
+        dcache_drop(inode->inode_no, name);
+    }
     return index;
 }
 
@@ -629,24 +1930,28 @@ static usize inode_search_by_idx_and_set_empty(OpContext *ctx, Inode *inode,
                                                usize index) {
     ASSERT(inode->valid == true);
     ASSERT(inode->entry.type == INODE_DIRECTORY);
-    int block_pos = index / DIR_PER_BLOCK;
-    usize block_no;
-    if (block_pos < INODE_NUM_DIRECT) {
-        block_no = inode->entry.addrs[block_pos];
-    } else {
-        Block *indirect_block = cache->acquire(inode->entry.indirect);
-        u32 *addrs = get_addrs(indirect_block);
-        block_no = addrs[block_pos - INODE_NUM_DIRECT];
-        cache->release(indirect_block);
+    // index 是 lookup 返回的字节偏移量
+    if (is_inline(inode)) {
+        DirEntry *dir_entry = (DirEntry *)(inline_data(inode) + index);
+        usize inode_no = dir_entry->inode_no;
+        if (inode_no != 0) {
+            dir_entry->inode_no = 0;
+            dcache_drop(inode->inode_no, dir_entry->name);
+            inode_sync(ctx, inode, true);
+        }
+        return inode_no;
     }
+    bool modified;
+    usize block_no = inode_map(NULL, inode, index, &modified);
     Block *block = cache->acquire(block_no);
-    DirEntry *dir_entry = (DirEntry *)block->data;
-    usize inode_no = dir_entry[index % DIR_PER_BLOCK].inode_no;
+    DirEntry *dir_entry = (DirEntry *)(block->data + index % BLOCK_SIZE);
+    usize inode_no = dir_entry->inode_no;
     if (inode_no == 0) {
         cache->release(block);
         return 0;
     }
-    dir_entry[index % DIR_PER_BLOCK].inode_no = 0;
+    dir_entry->inode_no = 0;
+    dcache_drop(inode->inode_no, dir_entry->name);
     cache->sync(ctx, block);
     cache->release(block);
     return inode_no;
@@ -668,6 +1973,7 @@ static void inode_remove(OpContext *ctx, Inode *inode, usize index) {
 
 InodeTree inodes = {
     .alloc = inode_alloc,
+    .alloc_near = inode_alloc_near,
     .lock = inode_lock,
     .unlock = inode_unlock,
     .sync = inode_sync,
@@ -676,7 +1982,12 @@ InodeTree inodes = {
     .share = inode_share,
     .put = inode_put,
     .read = inode_read,
+    .readahead = inode_readahead,
     .write = inode_write,
+    .write_delayed = inode_write_delayed,
+    .flush = inode_flush,
+    .allocate = inode_allocate,
+    .punch = inode_punch,
     .lookup = inode_lookup,
     .insert = inode_insert,
     .remove = inode_remove,
@@ -751,7 +2062,6 @@ static Inode *namex(const char *path, bool nameiparent, char *name,
     Inode *result = NULL;
     if (is_absolute) {
         result = inodes.get(ROOT_INODE_NO);
-        printk("\n");
     } else {
         ASSERT(cur_proc->cwd != NULL);
         result = cur_proc->cwd;
@@ -777,10 +2087,14 @@ static Inode *namex(const char *path, bool nameiparent, char *name,
     for (int i = 0; i < slash_count; i++) {
         rest_path = skipelem(rest_path, cur_name);
         pre_result = result;
-        inodes.lock(pre_result);
-        usize result_no = inodes.lookup(pre_result, cur_name, NULL);
-        // printk("result_no = %lld\n", result_no);
-        inodes.unlock(pre_result);
+        // 先查 dentry cache，没有命中才读目录
+        usize result_no;
+        if (!dcache_lookup(pre_result->inode_no, cur_name, &result_no)) {
+            inodes.lock(pre_result);
+            result_no = inodes.lookup(pre_result, cur_name, NULL);
+            dcache_add(pre_result->inode_no, cur_name, result_no);
+            inodes.unlock(pre_result);
+        }
         inodes.put(ctx, pre_result);
         if (result_no == 0) {
             return NULL;
@@ -12,6 +12,62 @@
  */
 #define ROOT_INODE_NO 1
 
+/**
+    @brief the number of hash buckets of the inode cache.
+ */
+#define INODE_CACHE_NR_BUCKETS 64
+
+/**
+    @brief the number of unreferenced inodes the inode cache keeps at most.
+ */
+#define INODE_CACHE_MAX_UNUSED 256
+
+/**
+    @brief the number of hash buckets of the dentry cache.
+ */
+#define DCACHE_NR_BUCKETS 256
+
+/**
+    @brief the number of entries the dentry cache keeps at most.
+ */
+#define DCACHE_MAX_ENTRIES 1024
+
+/**
+    @brief the number of log blocks `insert` may use besides
+    `OP_MAX_NUM_BLOCKS`: splitting a leaf and every index node on its path in
+    a hashed directory, and allocating the new blocks.
+
+    Operations creating a name reserve them with `bcache.begin_op_reserve`.
+ */
+#define INODE_INSERT_BLOCKS \
+    (2 * (DX_MAX_DEPTH + 3) + 2 * (EXTENT_MAX_DEPTH + 1) + 2)
+
+/**
+    @brief the number of blocks `write_delayed` buffers for an inode at most.
+ */
+#define INODE_DELAYED_MAX_BLOCKS 128
+
+/**
+    @brief the number of extent tree blocks `flush` may allocate for the
+    blocks buffered by `write_delayed`. They are reserved together with the
+    first buffered block.
+ */
+#define INODE_FLUSH_TREE_BLOCKS \
+    (2 * (EXTENT_MAX_DEPTH + 1) + INODE_DELAYED_MAX_BLOCKS / (EXTENT_PER_BLOCK / 2))
+
+/**
+    @brief the number of file blocks `punch` frees at most in one call.
+ */
+#define INODE_PUNCH_MAX_BLOCKS BIT_PER_BLOCK
+
+/**
+    @brief the number of log blocks one call of `punch` may use: the inode,
+    a path of the extent tree, the nodes split to keep both ends of a cut
+    extent, the bitmap blocks of the freed and allocated blocks and the
+    partial blocks at both ends of the hole.
+ */
+#define INODE_PUNCH_BLOCKS (5 * EXTENT_MAX_DEPTH + 8)
+
 /**
     @brief an inode in memory.
 
@@ -38,9 +94,15 @@ typedef struct {
     RefCount rc;
 
     /**
-        @brief link this inode into a linked list.
+        @brief link this inode into its bucket of the inode cache.
+     */
+    ListNode hnode;
+
+    /**
+        @brief link this inode into the LRU list of the inode cache while
+        `rc` is 0.
      */
-    struct rb_node_ node;
+    ListNode lnode;
 
     /**
         @brief the corresponding inode number on disk.
@@ -62,6 +124,28 @@ typedef struct {
         @brief the real in-memory copy of the inode on disk.
      */
     InodeEntry entry;
+
+    /**
+        @brief the extent found by the last lookup, or `len == 0` if none.
+
+        Sequential accesses hit it without walking the extent tree.
+
+        @note protected by the lock of the inode.
+     */
+    Extent extent_hint;
+
+    /**
+        @brief the blocks written by `write_delayed` that have no disk block
+        yet. File block `delayed_start + i` is buffered in `delayed[i]`.
+
+        `entry.num_bytes` includes them, but the inode on disk only covers the
+        allocated blocks until `flush`.
+
+        @note protected by the lock of the inode.
+     */
+    u8 **delayed;
+    usize delayed_start;
+    usize num_delayed;
 } Inode;
 
 /**
@@ -86,6 +170,17 @@ typedef struct {
      */
     usize (*alloc)(OpContext *ctx, InodeType type);
 
+    /**
+        @brief like `alloc`, but place the new inode near directory `parent`.
+
+        A file is placed in the group of `parent`, so that the inodes of a
+        directory stay clustered. A directory is placed in the group with the
+        most free inodes, so that directories spread out.
+
+        @see INODE_GROUP_SIZE
+     */
+    usize (*alloc_near)(OpContext *ctx, InodeType type, usize parent);
+
     /**
         @brief acquire the sleep lock of `inode`.
 
@@ -133,6 +228,9 @@ typedef struct {
 
         This method should increment the reference count of the inode by one.
 
+        Inodes are cached after their last `put`, so a recently used inode is
+        returned valid without reading the disk.
+
         @note it does NOT have to load the inode from disk!
 
         @see `sync` will be responsible to load the content of inode.
@@ -152,6 +250,10 @@ typedef struct {
        `inode->entry.num_bytes`.
 
         @note caller must hold the lock of `inode`.
+
+        @note if the log space reserved by `ctx` runs out while freeing a large
+        file, it ends `ctx` and continues in a new atomic operation. So it is
+        only used on inodes without links.
      */
     void (*clear)(OpContext *ctx, Inode *inode);
 
@@ -199,16 +301,93 @@ typedef struct {
      */
     usize (*read)(Inode *inode, u8 *dest, usize offset, usize count);
 
+    /**
+        @brief start reading the blocks holding `count` bytes of `inode`
+        beginning at `offset` into the block cache, without waiting for them.
+
+        @note caller must hold the lock of `inode`.
+
+        @see BlockCache::readahead
+     */
+    void (*readahead)(Inode *inode, usize offset, usize count);
+
     /**
         @brief write `count` bytes from `src` to `inode`, beginning at `offset`.
 
         @return how many bytes you actually write.
 
+        @note `offset` can be past the end of the file. Blocks are allocated
+        only for the written range, so the file blocks before it without
+        blocks stay holes, which read back as zeros.
+
+        @note a file or directory of at most `INODE_INLINE_BYTES` bytes is
+        stored inline in `entry.extents`, so reading it only reads the inode.
+        It moves to a data block when it grows past that.
+
         @note caller must hold the lock of `inode`.
      */
     usize (*write)(OpContext *ctx, Inode *inode, u8 *src, usize offset,
                    usize count);
 
+    /**
+        @brief like `write`, but buffer the blocks after the last allocated
+        block of a regular file in memory instead of allocating them.
+
+        It does not need an atomic operation. It only reserves free blocks
+        with `BlockCache::reserve`, plus `INODE_FLUSH_TREE_BLOCKS` for the
+        extent tree. The blocks are allocated together by `flush`, or
+        dropped without touching the disk if the file is truncated first.
+
+        @return how many bytes are buffered. It is less than `count` (maybe 0)
+        if `offset` is in an allocated block, the buffer is full or the disk
+        is short of free blocks. Use `write` for the rest.
+
+        @note caller must hold the lock of `inode`.
+     */
+    usize (*write_delayed)(Inode *inode, u8 *src, usize offset, usize count);
+
+    /**
+        @brief allocate the blocks buffered by `write_delayed` and write them.
+
+        `inode_write_blocks(inode, 0)` log blocks are enough for it. It
+        allocates from the reservation of `write_delayed`, so it does not
+        run out of free blocks.
+
+        @note caller must hold the lock of `inode`.
+     */
+    void (*flush)(OpContext *ctx, Inode *inode);
+
+    /**
+        @brief allocate blocks for the holes of `inode` in range
+        [offset, offset + count), preferably contiguous on disk. They read as
+        zeros.
+
+        Unless `keep_size` is true, the file grows to cover the range.
+
+        `inode_write_blocks(inode, count)` log blocks are enough for it.
+
+        @note caller must hold the lock of `inode`.
+     */
+    void (*allocate)(OpContext *ctx, Inode *inode, usize offset, usize count,
+                     bool keep_size);
+
+    /**
+        @brief punch a hole in range [offset, offset + count) of `inode`.
+
+        The whole blocks in the range are freed and the rest of the range is
+        zeroed. The size of the file does not change. Blocks buffered by
+        `write_delayed` have no disk block yet, so they are only zeroed.
+
+        Each call frees at most `INODE_PUNCH_MAX_BLOCKS` blocks and uses at
+        most `INODE_PUNCH_BLOCKS` log blocks.
+
+        @return true if the hole is complete, or false if the caller should
+        call it again, preferably in a new atomic operation.
+
+        @note caller must hold the lock of `inode`.
+     */
+    bool (*punch)(OpContext *ctx, Inode *inode, usize offset, usize count);
+
     /**
         @brief look up an entry named `name` in directory `inode`.
 
@@ -229,11 +408,16 @@ typedef struct {
        inode with `inode_no`.
 
         @return the index of new directory entry, or -1 if `name` already
-       exists.
+       exists (or, rarely, the hashed index of the directory cannot take it).
 
         @note if the directory inode is full, you should grow the size of
        directory inode.
 
+        @note once the first block of a directory is full, the directory gets
+        a hashed index (see `DxBlock`), so that `lookup` and `insert` only
+        read one block per level of the index. It may split blocks of the
+        index, see `INODE_INSERT_BLOCKS`.
+
         @note you do NOT need to change `inode->entry.num_links`. Another
        function to be finished in our final lab will do this.
 
@@ -274,12 +458,26 @@ extern InodeTree inodes;
  */
 void init_inodes(const SuperBlock *sblock, const BlockCache *cache);
 
-typedef struct free_inode_node {
-    usize inode_no;
-    struct free_inode_node *next;
-} free_inode_node;
-void push_free_inode(free_inode_node *node, free_inode_node *head);
-free_inode_node *pop_free_inode(free_inode_node *head);
+/**
+    @brief the number of log blocks `inodes.write` may use to write `count`
+    bytes to `inode`.
+
+    Pass it to `bcache.begin_op_reserve` or `bcache.extend_op`.
+ */
+usize inode_write_blocks(Inode *inode, usize count);
+
+/**
+    @brief the number of free blocks `inodes.allocate` may take to fill the
+    holes of `inode` in range [offset, offset + count): the data blocks and
+    the extent tree blocks for them. Blocks buffered by `write_delayed` are
+    not included, `flush` has its own reservation.
+
+    Reserve them with `bcache.reserve` and `bcache.claim` them in the atomic
+    operation, so that the disk cannot run out in the middle of it.
+
+    @note caller must hold the lock of `inode`.
+ */
+usize inode_allocate_blocks(Inode *inode, usize offset, usize count);
 
 void init_inodes(const SuperBlock* sblock, const BlockCache* cache);
 
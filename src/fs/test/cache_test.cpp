@@ -8,8 +8,10 @@ extern "C" {
 
 #include "mock/block_device.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
+#include <list>
 #include <random>
 #include <thread>
 
@@ -17,6 +19,11 @@ namespace {
 
 constexpr int IN_CHILD = 0;
 
+// 崩溃测试每轮都要转储整个镜像，块越大越慢，按块大小缩减轮数
+constexpr usize crash_rounds(usize num_rounds) {
+    return num_rounds * 512 / BLOCK_SIZE;
+}
+
 static void wait_process(int pid) {
     int wstatus;
     waitpid(pid, &wstatus, 0);
@@ -146,6 +153,147 @@ void test_lru() {
     assert_true(mock.write_count < 5);
 }
 
+// file data synced with `sync_data` skips the log: a sequential write costs
+// about half the disk writes of journaling every block.
+void test_ordered_data() {
+    constexpr usize num_ops = 50;
+    constexpr usize blocks_per_op = 8;
+
+    initialize(OP_MAX_NUM_BLOCKS, 2 * num_ops * blocks_per_op);
+    usize first = sblock.num_blocks - 2 * num_ops * blocks_per_op;
+
+    auto write_file = [&](usize begin, bool ordered) {
+        usize num_writes = mock.write_count;
+        for (usize j = 0; j < num_ops; j++) {
+            OpContext ctx;
+            bcache.begin_op(&ctx);
+            for (usize k = 0; k < blocks_per_op; k++) {
+                usize t = begin + j * blocks_per_op + k;
+                auto* b = bcache.acquire(t);
+                std::fill(b->data, b->data + BLOCK_SIZE, (u8)t);
+                if (ordered)
+                    bcache.sync_data(&ctx, b);
+                else
+                    bcache.sync(&ctx, b);
+                bcache.release(b);
+            }
+            // the metadata of the write, e.g. the inode block.
+            auto* b = bcache.acquire(sblock.inode_start);
+            b->data[0] = (u8)j;
+            bcache.sync(&ctx, b);
+            bcache.release(b);
+            bcache.end_op(&ctx);
+        }
+        return mock.write_count - num_writes;
+    };
+
+    usize journaled = write_file(first, false);
+    usize ordered = write_file(first + num_ops * blocks_per_op, true);
+    printf("(trace) #write: journaled = %zu, ordered = %zu\n", journaled, ordered);
+    assert_true(ordered * 10 < journaled * 7);
+
+    for (usize i = 0; i < 2 * num_ops * blocks_per_op; i++) {
+        assert_eq(mock.inspect(first + i)[123], (u8)(first + i));
+    }
+}
+
+// sequential file I/O of 2 MiB with ordered data. a larger `BLOCK_SIZE`
+// moves the same bytes in fewer device requests: compare `cache_test` with
+// `cache_test_4k`.
+void test_throughput() {
+    constexpr usize num_bytes = 2 << 20;
+    constexpr usize num_blocks = num_bytes / BLOCK_SIZE;
+    constexpr usize blocks_per_op = 8;
+
+    initialize(OP_MAX_NUM_BLOCKS, num_blocks);
+    usize first = sblock.num_blocks - num_blocks;
+
+    auto mbps = [&](auto begin_ts, auto end_ts) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(end_ts - begin_ts);
+        return static_cast<double>(num_bytes) / std::max<i64>(us.count(), 1);
+    };
+
+    usize num_writes = mock.write_count;
+    auto begin_ts = std::chrono::steady_clock::now();
+    for (usize j = 0; j < num_blocks; j += blocks_per_op) {
+        OpContext ctx;
+        bcache.begin_op(&ctx);
+        for (usize k = 0; k < blocks_per_op; k++) {
+            usize t = first + j + k;
+            auto* b = bcache.acquire(t);
+            std::fill(b->data, b->data + BLOCK_SIZE, (u8)t);
+            bcache.sync_data(&ctx, b);
+            bcache.release(b);
+        }
+        bcache.end_op(&ctx);
+    }
+    auto mid_ts = std::chrono::steady_clock::now();
+    num_writes = mock.write_count - num_writes;
+
+    // the cache keeps only a few blocks, so most of them are read from disk.
+    usize num_reads = mock.read_count;
+    for (usize i = 0; i < num_blocks; i++) {
+        auto* b = bcache.acquire(first + i);
+        assert_eq(b->data[123], (u8)(first + i));
+        bcache.release(b);
+    }
+    auto end_ts = std::chrono::steady_clock::now();
+    num_reads = mock.read_count - num_reads;
+
+    printf("(trace) block size %d: write %.1f MB/s in %zu requests, "
+           "read %.1f MB/s in %zu requests\n",
+           BLOCK_SIZE, mbps(begin_ts, mid_ts), num_writes, mbps(mid_ts, end_ts), num_reads);
+    assert_true(num_writes >= num_blocks);
+    assert_true(num_reads + EVICTION_THRESHOLD >= num_blocks);
+}
+
+// hot metadata blocks mixed with a long sequential scan. compare the cache
+// with a plain LRU of the same capacity on the same trace.
+void test_scan_resistance() {
+    constexpr usize capacity = 64;
+    constexpr usize hot_size = 40;
+    constexpr usize stream_size = 2000;
+    constexpr usize num_accesses = 20000;
+
+    std::mt19937 gen(0xdeadbeef);
+    initialize(1, hot_size + stream_size);
+    set_bcache_capacity(capacity);
+
+    std::list<usize> lru;
+    usize lru_hits = 0, stream_pos = 0;
+    usize num_reads = mock.read_count;
+    BCacheStat before;
+    get_bcache_stat(&before);
+    for (usize i = 0; i < num_accesses; i++) {
+        usize bno = gen() % 2 ? gen() % hot_size : hot_size + stream_pos++ % stream_size;
+
+        auto* b = bcache.acquire(bno);
+        assert_eq(b->data[123], mock.inspect(bno)[123]);
+        bcache.release(b);
+
+        auto it = std::find(lru.begin(), lru.end(), bno);
+        if (it != lru.end()) {
+            lru_hits++;
+            lru.erase(it);
+        } else if (lru.size() == capacity) {
+            lru.pop_back();
+        }
+        lru.push_front(bno);
+    }
+    BCacheStat after;
+    get_bcache_stat(&after);
+
+    usize hits = after.hits - before.hits;
+    usize misses = after.misses - before.misses;
+    printf("(trace) hit ratio = %.2f%% (lru: %.2f%%), #miss = %zu, #evict = %zu\n",
+           100.0 * hits / num_accesses, 100.0 * lru_hits / num_accesses, misses,
+           after.evictions - before.evictions);
+    assert_eq(hits + misses, num_accesses);
+    assert_eq(misses, mock.read_count - num_reads);
+    assert_true(hits > lru_hits * 3 / 2);
+    assert_true(bcache.get_num_cached_blocks() <= capacity);
+}
+
 // targets: `begin_op`, `end_op`, `sync`.
 
 void test_atomic_op() {
@@ -227,6 +375,52 @@ void test_overflow() {
     assert_eq(panicked, true);
 }
 
+void test_reservation() {
+    initialize(100, 100);
+
+    usize limit = std::min((usize)sblock.num_log_blocks - 1, (usize)LOG_MAX_SIZE);
+    usize t = sblock.num_blocks - 1;
+    auto touch = [&](OpContext* ctx, usize i) {
+        auto* b = bcache.acquire(t - i);
+        b->data[0] = (u8)i;
+        bcache.sync(ctx, b);
+        bcache.release(b);
+    };
+
+    // 比 OP_MAX_NUM_BLOCKS 多的预留
+    OpContext ctx;
+    bcache.begin_op_reserve(&ctx, 2 * OP_MAX_NUM_BLOCKS);
+    for (usize i = 0; i < 2 * OP_MAX_NUM_BLOCKS; i++) {
+        touch(&ctx, i);
+    }
+
+    // 已经修改过的块不再占用预留
+    assert_eq(bcache.extend_op(&ctx, 0), true);
+    touch(&ctx, 0);
+    assert_eq(bcache.extend_op(&ctx, 5), true);
+    for (usize i = 0; i < 5; i++) {
+        touch(&ctx, 2 * OP_MAX_NUM_BLOCKS + i);
+    }
+
+    // 日志满了之后不能再追加
+    usize used = 2 * OP_MAX_NUM_BLOCKS + 5;
+    assert_eq(bcache.extend_op(&ctx, limit - used), true);
+    assert_eq(bcache.extend_op(&ctx, limit - used + 1), false);
+    bcache.end_op(&ctx);
+
+    for (usize i = 0; i < used; i++) {
+        assert_eq(mock.inspect(t - i)[0], (u8)i);
+    }
+
+    bool panicked = false;
+    try {
+        bcache.begin_op_reserve(&ctx, limit + 1);
+    } catch (const Panic&) {
+        panicked = true;
+    }
+    assert_eq(panicked, true);
+}
+
 void test_resident() {
     // NOTE: this test may be a little controversial.
     // the main ideas are:
@@ -465,6 +659,114 @@ void test_alloc_free() {
     }
 }
 
+void test_alloc_range() {
+    constexpr usize num_data_blocks = 1000;
+
+    initialize(100, num_data_blocks);
+    usize first = sblock.num_blocks - num_data_blocks;
+
+    OpContext ctx;
+    usize len;
+    bcache.begin_op(&ctx);
+    usize a = bcache.alloc_range(&ctx, 16, 0, &len);
+    assert_eq(a, first);
+    assert_eq(len, 16);
+    // the run right after the goal continues the previous one.
+    usize b = bcache.alloc_range(&ctx, 16, a + 16, &len);
+    assert_eq(b, a + 16);
+    assert_eq(len, 16);
+    bcache.end_op(&ctx);
+    for (usize i = a; i < a + 32; i++) {
+        auto* d = mock.inspect(i);
+        for (usize j = 0; j < BLOCK_SIZE; j++) {
+            assert_eq(d[j], 0);
+        }
+    }
+
+    // a freed block is only reused after the transaction freeing it commits.
+    bcache.begin_op(&ctx);
+    bcache.free(&ctx, a + 4);
+    bcache.end_op(&ctx);
+
+    bcache.begin_op(&ctx);
+    // a hole shorter than the request is skipped...
+    usize c = bcache.alloc_range(&ctx, 8, 0, &len);
+    assert_eq(c, a + 32);
+    assert_eq(len, 8);
+    // ...unless it is the goal.
+    usize d = bcache.alloc_range(&ctx, 8, a + 4, &len);
+    assert_eq(d, a + 4);
+    assert_eq(len, 1);
+    bcache.end_op(&ctx);
+
+    // without a long enough run, take the free blocks left.
+    bcache.begin_op(&ctx);
+    usize e = bcache.alloc_range(&ctx, 2 * num_data_blocks, 0, &len);
+    assert_eq(e, a + 40);
+    assert_eq(len, num_data_blocks - 40);
+
+    bool panicked = false;
+    try {
+        bcache.alloc_range(&ctx, 1, 0, &len);
+    } catch (const Panic&) {
+        panicked = true;
+    }
+    assert_eq(panicked, true);
+}
+
+void test_reserve() {
+    initialize(100, 100);
+
+    assert_true(bcache.reserve(60));
+    assert_true(bcache.reserve(40));
+    assert_eq(bcache.reserve(1), false);
+    bcache.unreserve(10);
+
+    // allocations and frees are seen by reservations.
+    OpContext ctx;
+    bcache.begin_op(&ctx);
+    usize b = bcache.alloc(&ctx);
+    bcache.end_op(&ctx);
+    assert_eq(bcache.reserve(10), false);
+    assert_true(bcache.reserve(9));
+    bcache.begin_op(&ctx);
+    bcache.free(&ctx, b);
+    bcache.end_op(&ctx);
+    assert_true(bcache.reserve(1));
+    assert_eq(bcache.reserve(1), false);
+
+    // with every free block reserved, only an operation that claimed a
+    // reservation can allocate, and only as many blocks as it claimed.
+    bcache.begin_op(&ctx);
+    bcache.claim(&ctx, 10);
+    usize len;
+    usize c = bcache.alloc_range(&ctx, 20, 0, &len);
+    assert_eq(len, 10);
+    bcache.end_op(&ctx);
+    assert_eq(bcache.reserve(1), false);
+
+    bcache.begin_op(&ctx);
+    bool panicked = false;
+    try {
+        bcache.alloc(&ctx);
+    } catch (const Panic&) {
+        panicked = true;
+    }
+    assert_eq(panicked, true);
+
+    // blocks claimed but not allocated are given back by `end_op`.
+    for (usize i = c; i < c + len; i++) {
+        bcache.free(&ctx, i);
+    }
+    bcache.end_op(&ctx);
+    bcache.begin_op(&ctx);
+    bcache.claim(&ctx, 10);
+    bcache.alloc(&ctx);
+    bcache.end_op(&ctx);
+    assert_true(bcache.reserve(19));
+    assert_eq(bcache.reserve(1), false);
+}
+
 }  // namespace basic
 
 namespace concurrent {
@@ -506,6 +808,151 @@ void test_acquire() {
     }
 }
 
+// small operations from several threads share group commits of the log writer.
+void test_readahead() {
+    constexpr usize num_blocks = 64;
+
+    initialize(1, 2 * num_blocks);
+    set_bcache_capacity(2 * num_blocks);
+    std::vector<usize> block_nos;
+    for (usize i = 0; i < num_blocks; i++) {
+        block_nos.push_back(sblock.num_blocks - 1 - i);
+    }
+
+    // readahead is only a hint without the block reader.
+    usize num_reads = mock.read_count;
+    bcache.readahead(block_nos.data(), num_blocks);
+    assert_eq(mock.read_count, num_reads);
+
+    std::thread([] { block_reader(0); }).detach();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    BCacheStat before, stat;
+    get_bcache_stat(&before);
+    bcache.readahead(block_nos.data(), num_blocks);
+    // the reader may catch up with the block reader.
+    for (usize i = 0; i < num_blocks / 2; i++) {
+        bcache.release(bcache.acquire(block_nos[i]));
+    }
+    for (int i = 0; i < 1000; i++) {
+        get_bcache_stat(&stat);
+        if (stat.misses - before.misses >= num_blocks) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert_true(stat.readaheads > 0);
+    // every block is read from disk exactly once.
+    assert_eq(mock.read_count - num_reads, num_blocks);
+
+    for (usize i = 0; i < num_blocks; i++) {
+        bcache.release(bcache.acquire(block_nos[i]));
+    }
+    assert_eq(mock.read_count - num_reads, num_blocks);
+
+    fflush(stdout);
+    _exit(0);
+}
+
+void test_group_commit() {
+    constexpr usize num_workers = 8;
+    constexpr usize num_ops = 200;
+    constexpr usize blocks_per_op = 2;
+
+    initialize(num_workers * OP_MAX_NUM_BLOCKS, num_workers * blocks_per_op);
+    std::thread([] { log_writer(0); }).detach();
+    // wait for the log writer to take over commits.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    BCacheStat before;
+    get_bcache_stat(&before);
+    std::vector<std::thread> workers;
+    for (usize i = 0; i < num_workers; i++) {
+        workers.emplace_back([&, i] {
+            usize t = sblock.num_blocks - 1 - i * blocks_per_op;
+            for (usize j = 1; j <= num_ops; j++) {
+                OpContext ctx;
+                bcache.begin_op(&ctx);
+                for (usize k = 0; k < blocks_per_op; k++) {
+                    auto* b = bcache.acquire(t - k);
+                    *reinterpret_cast<usize*>(b->data) = j;
+                    bcache.sync(&ctx, b);
+                    bcache.release(b);
+                }
+                bcache.end_op(&ctx);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    BCacheStat after;
+    get_bcache_stat(&after);
+
+    usize commits = after.commits - before.commits;
+    printf("(trace) %zu operations in %zu commits, %zu checkpoints, #write = %zu\n",
+           num_workers * num_ops, commits, after.checkpoints - before.checkpoints,
+           mock.write_count.load());
+    assert_true(commits < num_workers * num_ops);
+
+    // the log is written back after two ticks without commits.
+    usize num_checkpoints = after.checkpoints;
+    for (int i = 0; i < 100 && after.checkpoints == num_checkpoints; i++) {
+        log_writer_tick();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        get_bcache_stat(&after);
+    }
+    for (usize i = 0; i < num_workers * blocks_per_op; i++) {
+        assert_eq(*reinterpret_cast<usize*>(mock.inspect(sblock.num_blocks - 1 - i)), num_ops);
+    }
+
+    // the log writer never returns. skip static destructors it may still use.
+    fflush(stdout);
+    _exit(0);
+}
+
+// lookup throughput of a warm cache holding thousands of blocks.
+void test_lookup() {
+    constexpr usize num_blocks = 4096;
+    constexpr usize num_lookups = 1000000;
+    constexpr usize num_workers = 4;
+
+    initialize(1, num_blocks);
+    set_bcache_capacity(num_blocks + 64);
+    usize first = sblock.num_blocks - num_blocks;
+    for (usize i = 0; i < num_blocks; i++) {
+        bcache.release(bcache.acquire(first + i));
+    }
+    usize num_reads = mock.read_count;
+
+    for (usize n : {(usize)1, num_workers}) {
+        auto begin_ts = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (usize i = 0; i < n; i++) {
+            workers.emplace_back([&, i] {
+                std::mt19937 gen(0x1234 + i);
+                for (usize j = 0; j < num_lookups / n; j++) {
+                    usize t = first + gen() % num_blocks;
+                    auto* b = bcache.acquire(t);
+                    assert_eq(b->block_no, t);
+                    bcache.release(b);
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        auto end_ts = std::chrono::steady_clock::now();
+        auto duration =
+            std::chrono::duration_cast<std::chrono::milliseconds>(end_ts - begin_ts).count();
+        printf("(trace) %zu thread(s): %.2f lookups/ms\n", n,
+               static_cast<double>(num_lookups) / std::max<i64>(duration, 1));
+    }
+
+    assert_eq(mock.read_count, num_reads);
+    assert_true(bcache.get_num_cached_blocks() <= num_blocks + 64);
+}
+
 void test_sync() {
     constexpr int num_rounds = 100;
 
@@ -657,6 +1104,121 @@ void test_simple_crash() {
     }
 }
 
+// a block freed by a transaction is not given to another file before the
+// transaction commits. otherwise the new data is written home first and a
+// crash leaves the old file pointing at it.
+void test_free_reuse() {
+    int child;
+    if ((child = fork()) == IN_CHILD) {
+        initialize(100, 100);
+
+        OpContext ctx;
+        usize len;
+        bcache.begin_op(&ctx);
+        usize data = bcache.alloc_range(&ctx, 1, 0, &len);
+        assert_eq(data, sblock.num_blocks - 100);
+        auto* b = bcache.acquire(data);
+        std::fill(b->data, b->data + BLOCK_SIZE, 0x11);
+        bcache.sync_data(&ctx, b);
+        bcache.release(b);
+        usize meta = bcache.alloc(&ctx);
+        assert_eq(meta, data + 1);
+        b = bcache.acquire(meta);
+        *reinterpret_cast<usize*>(b->data) = data;
+        bcache.sync(&ctx, b);
+        bcache.release(b);
+        bcache.end_op(&ctx);
+
+        // the old file frees the block, and another one allocates right there.
+        bcache.begin_op(&ctx);
+        b = bcache.acquire(meta);
+        *reinterpret_cast<usize*>(b->data) = 0;
+        bcache.sync(&ctx, b);
+        bcache.release(b);
+        bcache.free(&ctx, data);
+        usize other = bcache.alloc_range(&ctx, 1, data, &len);
+        assert_ne(other, data);
+        b = bcache.acquire(other);
+        std::fill(b->data, b->data + BLOCK_SIZE, 0x22);
+        bcache.sync_data(&ctx, b);
+        bcache.release(b);
+
+        // crash right before the log header is written.
+        mock.on_write = [&](usize block_no, u8*) {
+            if (block_no == sblock.log_start)
+                mock.offline = true;
+        };
+        try {
+            bcache.end_op(&ctx);
+        } catch (const Offline&) {
+        }
+
+        mock.dump("sd.img");
+        _exit(0);
+    } else {
+        wait_process(child);
+        initialize_mock(100, 100, "sd.img");
+        usize data = sblock.num_blocks - 100, meta = data + 1;
+        init_bcache(&sblock, &device);
+
+        assert_eq(*reinterpret_cast<usize*>(mock.inspect(meta)), data);
+        auto* d = mock.inspect(data);
+        for (usize i = 0; i < BLOCK_SIZE; i++) {
+            assert_eq(d[i], 0x11);
+        }
+    }
+}
+
+// with a log writer, commits only append to the log. repeated updates of the
+// same blocks are written home once per checkpoint and survive a crash.
+void test_lazy_checkpoint() {
+    constexpr usize num_ops = 100;
+    constexpr usize num_cold = 4;
+
+    int child;
+    if ((child = fork()) == IN_CHILD) {
+        initialize(60, num_cold + 1);
+        std::thread([] { log_writer(0); }).detach();
+        // wait for the log writer to take over commits.
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        usize hot = sblock.num_blocks - 1;
+        for (usize j = 1; j <= num_ops; j++) {
+            OpContext ctx;
+            bcache.begin_op(&ctx);
+            for (usize t : {hot, hot - 1 - j % num_cold}) {
+                auto* b = bcache.acquire(t);
+                *reinterpret_cast<usize*>(b->data) = j;
+                bcache.sync(&ctx, b);
+                bcache.release(b);
+            }
+            bcache.end_op(&ctx);
+        }
+
+        BCacheStat stat;
+        get_bcache_stat(&stat);
+        printf("(trace) %zu commits, %zu checkpoints\n", stat.commits, stat.checkpoints);
+        assert_true(stat.checkpoints * 10 < stat.commits);
+        assert_true(*reinterpret_cast<usize*>(mock.inspect(hot)) < num_ops);
+
+        mock.offline = true;
+        mock.dump("sd.img");
+        fflush(stdout);
+        _exit(0);
+    } else {
+        wait_process(child);
+        initialize_mock(60, num_cold + 1, "sd.img");
+        init_bcache(&sblock, &device);
+
+        usize hot = sblock.num_blocks - 1;
+        assert_eq(*reinterpret_cast<usize*>(mock.inspect(hot)), num_ops);
+        for (usize i = 0; i < num_cold; i++) {
+            usize last = num_ops - (num_ops - i) % num_cold;
+            assert_eq(*reinterpret_cast<usize*>(mock.inspect(hot - 1 - i)), last);
+        }
+    }
+}
+
 void test_parallel(usize num_rounds, usize num_workers, usize delay_ms, usize log_cut) {
     usize log_size = num_workers * OP_MAX_NUM_BLOCKS - log_cut;
     usize num_data_blocks = 200 + num_workers * OP_MAX_NUM_BLOCKS;
@@ -887,25 +1449,37 @@ int main() {
         {"loop_read", basic::test_loop_read},
         {"reuse", basic::test_reuse},
         {"lru", basic::test_lru},
+        {"scan_resistance", basic::test_scan_resistance},
+        {"ordered_data", basic::test_ordered_data},
+        {"throughput", basic::test_throughput},
         {"atomic_op", basic::test_atomic_op},
         {"overflow", basic::test_overflow},
+        {"reservation", basic::test_reservation},
         {"resident", basic::test_resident},
         {"local_absorption", basic::test_local_absorption},
         {"global_absorption", basic::test_global_absorption},
         {"replay", basic::test_replay},
         {"alloc", basic::test_alloc},
         {"alloc_free", basic::test_alloc_free},
+        {"alloc_range", basic::test_alloc_range},
+        {"reserve", basic::test_reserve},
 
         {"concurrent_acquire", concurrent::test_acquire},
         {"concurrent_sync", concurrent::test_sync},
         {"concurrent_alloc", concurrent::test_alloc},
+        {"concurrent_group_commit", concurrent::test_group_commit},
+        {"concurrent_readahead", concurrent::test_readahead},
+        {"concurrent_lookup", concurrent::test_lookup},
 
         {"simple_crash", crash::test_simple_crash},
-        {"single", [] { crash::test_parallel(1000, 1, 5, 0); }},
-        {"parallel_1", [] { crash::test_parallel(1000, 2, 5, 0); }},
-        {"parallel_2", [] { crash::test_parallel(1000, 4, 5, 0); }},
-        {"parallel_3", [] { crash::test_parallel(500, 4, 10, 1); }},
-        {"parallel_4", [] { crash::test_parallel(500, 4, 10, 2 * OP_MAX_NUM_BLOCKS); }},
+        {"lazy_checkpoint", crash::test_lazy_checkpoint},
+        {"free_reuse", crash::test_free_reuse},
+        {"single", [] { crash::test_parallel(crash_rounds(1000), 1, 5, 0); }},
+        {"parallel_1", [] { crash::test_parallel(crash_rounds(1000), 2, 5, 0); }},
+        {"parallel_2", [] { crash::test_parallel(crash_rounds(1000), 4, 5, 0); }},
+        {"parallel_3", [] { crash::test_parallel(crash_rounds(500), 4, 10, 1); }},
+        {"parallel_4",
+         [] { crash::test_parallel(crash_rounds(500), 4, 10, 2 * OP_MAX_NUM_BLOCKS); }},
         {"banker", crash::test_banker},
     };
     Runner(tests).run();
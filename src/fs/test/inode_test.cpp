@@ -2,6 +2,9 @@ extern "C" {
 #include <fs/inode.h>
 }
 
+#include <algorithm>
+#include <chrono>
+
 #include "assert.hpp"
 #include "pause.hpp"
 #include "runner.hpp"
@@ -40,6 +43,38 @@ void test_alloc() {
     assert_eq(mock.count_inodes(), 1);
 }
 
+void test_ialloc() {
+    usize num_free = mock.count_free_inodes();
+    assert_eq(num_free, mock.num_inodes - mock.count_inode_bits());
+    std::vector<usize> ino;
+
+    // 文件放在父目录所在的组，目录放到空闲 inode 最多的组
+    mock.begin_op(ctx);
+    ino.push_back(inodes.alloc(ctx, INODE_REGULAR));
+    ino.push_back(inodes.alloc(ctx, INODE_DIRECTORY));
+    ino.push_back(inodes.alloc_near(ctx, INODE_REGULAR, ino[1]));
+    ino.push_back(inodes.alloc_near(ctx, INODE_REGULAR, ino[1]));
+    mock.end_op(ctx);
+    assert_eq(ino[0] / INODE_GROUP_SIZE, ROOT_INODE_NO / INODE_GROUP_SIZE);
+    assert_ne(ino[1] / INODE_GROUP_SIZE, ROOT_INODE_NO / INODE_GROUP_SIZE);
+    assert_eq(ino[2] / INODE_GROUP_SIZE, ino[1] / INODE_GROUP_SIZE);
+    assert_eq(ino[3], ino[2] + 1);
+
+    assert_eq(mock.count_inodes(), 5);
+    assert_eq(mock.count_inode_bits(), 6);
+    assert_eq(mock.count_free_inodes(), num_free - 4);
+
+    for (usize i : ino) {
+        auto* p = inodes.get(i);
+        mock.begin_op(ctx);
+        inodes.put(ctx, p);
+        mock.end_op(ctx);
+    }
+    assert_eq(mock.count_inodes(), 1);
+    assert_eq(mock.count_inode_bits(), 2);
+    assert_eq(mock.count_free_inodes(), num_free);
+}
+
 void test_sync() {
     auto* p = inodes.get(1);
 
@@ -47,7 +82,7 @@ void test_sync() {
     assert_eq(p->entry.type, INODE_DIRECTORY);
     p->entry.major = 0x19;
     p->entry.minor = 0x26;
-    p->entry.indirect = 0xa817;
+    p->entry.extents[0].start = 0xa817;
     inodes.unlock(p);
 
     mock.begin_op(ctx);
@@ -61,7 +96,7 @@ void test_sync() {
     assert_eq(q->type, INODE_DIRECTORY);
     assert_eq(q->major, 0x19);
     assert_eq(q->minor, 0x26);
-    assert_eq(q->indirect, 0xa817);
+    assert_eq(q->extents[0].start, 0xa817);
 }
 
 void test_touch() {
@@ -80,10 +115,8 @@ void test_touch() {
         assert_eq(q->entry.minor, 0);
         assert_eq(q->entry.num_links, 0);
         assert_eq(q->entry.num_bytes, 0);
-        assert_eq(q->entry.indirect, 0);
-        for (usize j = 0; j < INODE_NUM_DIRECT; j++) {
-            assert_eq(q->entry.addrs[j], 0);
-        }
+        assert_eq(q->entry.extent_header.depth, 0);
+        assert_eq(q->entry.extent_header.num_entries, 0);
 
         q->entry.num_links++;
 
@@ -176,12 +209,66 @@ void test_share() {
     assert_eq(mock.count_inodes(), 1);
 }
 
+void test_icache() {
+    mock.begin_op(ctx);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+
+    auto* p = inodes.get(ino);
+    mock.begin_op(ctx);
+    inodes.lock(p);
+    p->entry.num_links = 1;
+    inodes.sync(ctx, p, true);
+    inodes.unlock(p);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+
+    // 最后一个引用放掉以后 inode 仍然在内存里
+    auto* q = inodes.get(ino);
+    assert_eq(q, p);
+    assert_eq(q->valid, true);
+    assert_eq(q->entry.num_links, 1);
+    mock.begin_op(ctx);
+    inodes.put(ctx, q);
+    mock.end_op(ctx);
+
+    // 用过更多的 inode 以后，它被挤出 LRU，要重新从磁盘读
+    std::vector<usize> others;
+    for (usize i = 0; i < INODE_CACHE_MAX_UNUSED + 10; i++) {
+        mock.begin_op(ctx);
+        others.push_back(inodes.alloc(ctx, INODE_REGULAR));
+        auto* r = inodes.get(others.back());
+        inodes.lock(r);
+        r->entry.num_links = 1;
+        inodes.sync(ctx, r, true);
+        inodes.unlock(r);
+        inodes.put(ctx, r);
+        mock.end_op(ctx);
+    }
+    q = inodes.get(ino);
+    assert_eq(q->valid, false);
+    others.push_back(ino);
+
+    for (usize i : others) {
+        auto* r = i == ino ? q : inodes.get(i);
+        mock.begin_op(ctx);
+        inodes.lock(r);
+        assert_eq(r->entry.num_links, 1);
+        r->entry.num_links = 0;
+        inodes.unlock(r);
+        inodes.put(ctx, r);
+        mock.end_op(ctx);
+    }
+    assert_eq(mock.count_inodes(), 1);
+}
+
 void test_small_file() {
     mock.begin_op(ctx);
     usize ino = inodes.alloc(ctx, INODE_REGULAR);
     mock.end_op(ctx);
 
-    u8 buf[1];
+    // 比内联的上限多一个字节，要占一个块
+    u8 buf[INODE_INLINE_BYTES + 1];
     auto* p = inodes.get(ino);
     inodes.lock(p);
 
@@ -190,20 +277,21 @@ void test_small_file() {
     assert_eq(buf[0], 0xcc);
 
     mock.begin_op(ctx);
-    inodes.write(ctx, p, buf, 0, 1);
+    inodes.write(ctx, p, buf, 0, sizeof(buf));
     assert_eq(mock.count_blocks(), 0);
     mock.end_op(ctx);
 
     auto* q = mock.inspect(ino);
-    assert_eq(q->indirect, 0);
-    assert_ne(q->addrs[0], 0);
-    assert_eq(q->addrs[1], 0);
-    assert_eq(q->num_bytes, 1);
+    assert_eq(q->extent_header.depth, 0);
+    assert_eq(q->extent_header.num_entries, 1);
+    assert_ne(q->extents[0].start, 0);
+    assert_eq(q->extents[0].len, 1);
+    assert_eq(q->num_bytes, sizeof(buf));
     assert_eq(mock.count_blocks(), 1);
 
     mock.fill_junk();
     buf[0] = 0;
-    inodes.read(p, buf, 0, 1);
+    inodes.read(p, buf, 0, sizeof(buf));
     assert_eq(buf[0], 0xcc);
 
     inodes.unlock(p);
@@ -215,8 +303,8 @@ void test_small_file() {
     mock.end_op(ctx);
 
     q = mock.inspect(ino);
-    assert_eq(q->indirect, 0);
-    assert_eq(q->addrs[0], 0);
+    assert_eq(q->extent_header.depth, 0);
+    assert_eq(q->extent_header.num_entries, 0);
     assert_eq(q->num_bytes, 0);
     assert_eq(mock.count_blocks(), 0);
 
@@ -228,6 +316,97 @@ void test_small_file() {
     assert_eq(mock.count_inodes(), 1);
 }
 
+void test_inline() {
+    mock.begin_op(ctx);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    usize dir = inodes.alloc(ctx, INODE_DIRECTORY);
+    mock.end_op(ctx);
+
+    auto* p = inodes.get(ino);
+    inodes.lock(p);
+
+    // a tiny file lives in the inode and takes no block.
+    u8 buf[BLOCK_SIZE], copy[BLOCK_SIZE];
+    for (usize i = 0; i < sizeof(buf); i++) {
+        buf[i] = (i * 7) & 0xff;
+    }
+    assert_eq(inodes.write_delayed(p, buf, 0, 10), 0);
+    mock.begin_op(ctx);
+    inodes.write(ctx, p, buf, 0, 10);
+    inodes.write(ctx, p, buf + 10, 10, INODE_INLINE_BYTES - 10);
+    mock.end_op(ctx);
+    auto* q = mock.inspect(ino);
+    assert_eq(q->extent_header.depth, EXTENT_DEPTH_INLINE);
+    assert_eq(q->num_bytes, INODE_INLINE_BYTES);
+    assert_eq(mock.count_blocks(), 0);
+
+    mock.fill_junk();
+    inodes.read(p, copy, 0, INODE_INLINE_BYTES);
+    for (usize i = 0; i < INODE_INLINE_BYTES; i++) {
+        assert_eq(copy[i], buf[i]);
+    }
+
+    // growing past the inode moves the data to a block.
+    mock.begin_op(ctx);
+    inodes.write(ctx, p, buf + INODE_INLINE_BYTES, INODE_INLINE_BYTES,
+                 sizeof(buf) - INODE_INLINE_BYTES);
+    mock.end_op(ctx);
+    assert_eq(q->extent_header.depth, 0);
+    assert_eq(q->extent_header.num_entries, 1);
+    assert_eq(q->num_bytes, sizeof(buf));
+    assert_eq(mock.count_blocks(), 1);
+    inodes.read(p, copy, 0, sizeof(copy));
+    for (usize i = 0; i < sizeof(buf); i++) {
+        assert_eq(copy[i], buf[i]);
+    }
+
+    mock.begin_op(ctx);
+    inodes.clear(ctx, p);
+    mock.end_op(ctx);
+    assert_eq(mock.count_blocks(), 0);
+
+    // a new directory with "." and ".." is inline too.
+    auto* d = inodes.get(dir);
+    inodes.lock(d);
+    mock.begin_op(ctx);
+    inodes.insert(ctx, d, ".", dir);
+    inodes.insert(ctx, d, "..", ROOT_INODE_NO);
+    usize index = inodes.insert(ctx, d, "a", ino);
+    mock.end_op(ctx);
+    q = mock.inspect(dir);
+    assert_eq(q->extent_header.depth, EXTENT_DEPTH_INLINE);
+    assert_eq(q->num_bytes, 3 * sizeof(DirEntry));
+    assert_eq(mock.count_blocks(), 0);
+    assert_eq(inodes.lookup(d, "..", NULL), ROOT_INODE_NO);
+
+    mock.begin_op(ctx);
+    inodes.remove(ctx, d, index);
+    mock.end_op(ctx);
+    assert_eq(inodes.lookup(d, "a", NULL), 0);
+
+    // the fourth entry does not fit.
+    mock.begin_op(ctx);
+    inodes.insert(ctx, d, "b", ino);
+    inodes.insert(ctx, d, "c", ino);
+    mock.end_op(ctx);
+    assert_eq(q->extent_header.depth, 0);
+    assert_eq(mock.count_blocks(), 1);
+    assert_eq(inodes.lookup(d, ".", NULL), dir);
+    assert_eq(inodes.lookup(d, "..", NULL), ROOT_INODE_NO);
+    assert_eq(inodes.lookup(d, "b", NULL), ino);
+    assert_eq(inodes.lookup(d, "c", NULL), ino);
+
+    mock.begin_op(ctx);
+    inodes.clear(ctx, d);
+    inodes.unlock(d);
+    inodes.put(ctx, d);
+    inodes.unlock(p);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+    assert_eq(mock.count_blocks(), 0);
+    assert_eq(mock.count_inodes(), 1);
+}
+
 void test_large_file() {
     mock.begin_op(ctx);
     usize ino = inodes.alloc(ctx, INODE_REGULAR);
@@ -287,6 +466,9 @@ void test_large_file() {
 
     auto* q = mock.inspect(ino);
     assert_eq(q->num_bytes, max_size);
+    // one write allocates its blocks as a single run.
+    assert_eq(q->extent_header.depth, 0);
+    assert_eq(q->extent_header.num_entries, 1);
 
     for (usize i = 0; i < max_size; i++) {
         buf[i] = 0;
@@ -310,6 +492,430 @@ void test_large_file() {
     assert_eq(mock.count_blocks(), 0);
 }
 
+void test_extent_tree() {
+    // interleaved appends leave every block of both files in its own extent.
+    constexpr usize num_blocks = 400;
+    usize ino[2];
+    Inode* p[2];
+    mock.begin_op(ctx);
+    for (usize k = 0; k < 2; k++) {
+        ino[k] = inodes.alloc(ctx, INODE_REGULAR);
+    }
+    mock.end_op(ctx);
+    for (usize k = 0; k < 2; k++) {
+        p[k] = inodes.get(ino[k]);
+        inodes.lock(p[k]);
+    }
+
+    u8 buf[BLOCK_SIZE];
+    for (usize i = 0; i < num_blocks; i++) {
+        for (usize k = 0; k < 2; k++) {
+            std::fill(buf, buf + BLOCK_SIZE, (i * 2 + k) & 0xff);
+            mock.begin_op(ctx);
+            inodes.write(ctx, p[k], buf, i * BLOCK_SIZE, BLOCK_SIZE);
+            mock.end_op(ctx);
+        }
+    }
+
+    // larger blocks hold more extents per node, so the tree may be lower.
+    usize min_depth = num_blocks > INODE_NUM_EXTENTS * EXTENT_PER_BLOCK ? 2 : 1;
+    for (usize k = 0; k < 2; k++) {
+        auto* q = mock.inspect(ino[k]);
+        assert_eq(q->num_bytes, num_blocks * BLOCK_SIZE);
+        assert_true(q->extent_header.depth >= min_depth);
+        for (usize i = 0; i < num_blocks; i++) {
+            inodes.read(p[k], buf, i * BLOCK_SIZE, BLOCK_SIZE);
+            assert_eq(buf[0], (i * 2 + k) & 0xff);
+            assert_eq(buf[BLOCK_SIZE - 1], (i * 2 + k) & 0xff);
+        }
+    }
+
+    // punching a hole frees its blocks. in a two level tree it also empties
+    // and frees whole nodes.
+    usize before = mock.count_blocks();
+    for (bool done = false; !done;) {
+        mock.begin_op(ctx);
+        done = inodes.punch(ctx, p[0], 100 * BLOCK_SIZE, 200 * BLOCK_SIZE);
+        mock.end_op(ctx);
+    }
+    if (min_depth >= 2)
+        assert_true(mock.count_blocks() < before - 200);
+    else
+        assert_eq(mock.count_blocks(), before - 200);
+    for (usize i = 0; i < num_blocks; i++) {
+        inodes.read(p[0], buf, i * BLOCK_SIZE, BLOCK_SIZE);
+        u8 expected = (i >= 100 && i < 300) ? 0 : (i * 2) & 0xff;
+        assert_eq(buf[0], expected);
+        assert_eq(buf[BLOCK_SIZE - 1], expected);
+    }
+
+    for (usize k = 0; k < 2; k++) {
+        mock.begin_op(ctx);
+        inodes.clear(ctx, p[k]);
+        inodes.unlock(p[k]);
+        inodes.put(ctx, p[k]);
+        mock.end_op(ctx);
+    }
+    assert_eq(mock.count_blocks(), 0);
+}
+
+void test_delayed() {
+    mock.begin_op(ctx);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+
+    auto* p = inodes.get(ino);
+    inodes.lock(p);
+
+    // buffered blocks are readable but not allocated.
+    u8 buf[3 * BLOCK_SIZE], copy[3 * BLOCK_SIZE];
+    for (usize i = 0; i < sizeof(buf); i++) {
+        buf[i] = i & 0xff;
+    }
+    constexpr usize split = 2 * BLOCK_SIZE - 24;
+    constexpr usize rest = 3 * BLOCK_SIZE - split;
+    assert_eq(inodes.write_delayed(p, buf, 0, split), split);
+    assert_eq(inodes.write_delayed(p, buf + split, split, rest), rest);
+    assert_eq(p->entry.num_bytes, 3 * BLOCK_SIZE);
+    assert_eq(p->num_delayed, 3);
+    assert_eq(mock.count_blocks(), 0);
+    assert_eq(reserved_blocks, 3 + INODE_FLUSH_TREE_BLOCKS);
+    inodes.read(p, copy, 0, sizeof(copy));
+    for (usize i = 0; i < sizeof(buf); i++) {
+        assert_eq(copy[i], buf[i]);
+    }
+
+    // flush allocates them as one run.
+    mock.begin_op(ctx);
+    inodes.flush(ctx, p);
+    mock.end_op(ctx);
+    assert_eq(mock.count_blocks(), 3);
+    assert_eq(reserved_blocks, 0);
+    auto* q = mock.inspect(ino);
+    assert_eq(q->num_bytes, 3 * BLOCK_SIZE);
+    assert_eq(q->extent_header.num_entries, 1);
+    assert_eq(q->extents[0].len, 3);
+
+    // allocated blocks are written by `write`.
+    assert_eq(inodes.write_delayed(p, buf, 0, 10), 0);
+
+    // the disk size only covers allocated blocks until the next flush.
+    assert_eq(inodes.write_delayed(p, buf, 3 * BLOCK_SIZE, BLOCK_SIZE), BLOCK_SIZE);
+    mock.begin_op(ctx);
+    inodes.sync(ctx, p, true);
+    mock.end_op(ctx);
+    assert_eq(q->num_bytes, 3 * BLOCK_SIZE);
+
+    // a write past the buffered blocks flushes them first.
+    mock.begin_op(ctx);
+    inodes.write(ctx, p, buf, 4 * BLOCK_SIZE, BLOCK_SIZE);
+    mock.end_op(ctx);
+    assert_eq(p->num_delayed, 0);
+    assert_eq(q->num_bytes, 5 * BLOCK_SIZE);
+    assert_eq(mock.count_blocks(), 5);
+
+    // dropped buffers never reach the disk.
+    assert_eq(inodes.write_delayed(p, buf, 5 * BLOCK_SIZE, 2 * BLOCK_SIZE),
+              2 * BLOCK_SIZE);
+    assert_eq(mock.count_blocks(), 5);
+    mock.begin_op(ctx);
+    inodes.clear(ctx, p);
+    inodes.unlock(p);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+    assert_eq(reserved_blocks, 0);
+    assert_eq(mock.count_blocks(), 0);
+}
+
+void test_sparse() {
+    mock.begin_op(ctx);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+
+    auto* p = inodes.get(ino);
+    inodes.lock(p);
+
+    // a write past the end leaves a hole that reads as zeros.
+    u8 buf[4 * BLOCK_SIZE], copy[16 * BLOCK_SIZE];
+    for (usize i = 0; i < sizeof(buf); i++) {
+        buf[i] = (i % 251) + 1;
+    }
+    assert_eq(inodes.write_delayed(p, buf, 10 * BLOCK_SIZE + 100, 10), 0);
+    mock.begin_op(ctx);
+    inodes.write(ctx, p, buf, 10 * BLOCK_SIZE + 100, 10);
+    mock.end_op(ctx);
+    assert_eq(p->entry.num_bytes, 10 * BLOCK_SIZE + 110);
+    assert_eq(mock.count_blocks(), 1);
+    mock.fill_junk();
+    inodes.read(p, copy, 0, 10 * BLOCK_SIZE + 110);
+    for (usize i = 0; i < 10 * BLOCK_SIZE + 100; i++) {
+        assert_eq(copy[i], 0);
+    }
+    for (usize i = 0; i < 10; i++) {
+        assert_eq(copy[10 * BLOCK_SIZE + 100 + i], buf[i]);
+    }
+
+    // allocate fills the holes with few extents and can keep the size.
+    assert_eq(inode_allocate_blocks(p, 0, 16 * BLOCK_SIZE),
+              15 + 2 * (EXTENT_MAX_DEPTH + 1));
+    mock.begin_op(ctx);
+    inodes.allocate(ctx, p, 0, 16 * BLOCK_SIZE, true);
+    mock.end_op(ctx);
+    assert_eq(inode_allocate_blocks(p, 0, 16 * BLOCK_SIZE), 0);
+    assert_eq(mock.count_blocks(), 16);
+    assert_eq(p->entry.num_bytes, 10 * BLOCK_SIZE + 110);
+    inodes.read(p, copy, 0, 10 * BLOCK_SIZE);
+    for (usize i = 0; i < 10 * BLOCK_SIZE; i++) {
+        assert_eq(copy[i], 0);
+    }
+    mock.begin_op(ctx);
+    inodes.allocate(ctx, p, 16 * BLOCK_SIZE, 4 * BLOCK_SIZE, false);
+    mock.end_op(ctx);
+    assert_eq(mock.count_blocks(), 20);
+    assert_eq(p->entry.num_bytes, 20 * BLOCK_SIZE);
+    assert_eq(mock.inspect(ino)->extent_header.depth, 0);
+
+    // punching frees the whole blocks and zeroes the partial ones.
+    mock.begin_op(ctx);
+    inodes.write(ctx, p, buf, 4 * BLOCK_SIZE, sizeof(buf));
+    mock.end_op(ctx);
+    usize offset = 5 * BLOCK_SIZE + 10, count = 2 * BLOCK_SIZE;
+    while (true) {
+        mock.begin_op(ctx);
+        bool done = inodes.punch(ctx, p, offset, count);
+        mock.end_op(ctx);
+        if (done) {
+            break;
+        }
+    }
+    assert_eq(mock.count_blocks(), 19);
+    assert_eq(p->entry.num_bytes, 20 * BLOCK_SIZE);
+    inodes.read(p, copy, 4 * BLOCK_SIZE, sizeof(buf));
+    for (usize i = 0; i < sizeof(buf); i++) {
+        usize pos = 4 * BLOCK_SIZE + i;
+        if (pos >= offset && pos < offset + count) {
+            assert_eq(copy[i], 0);
+        } else {
+            assert_eq(copy[i], buf[i]);
+        }
+    }
+
+    // writing into the hole only allocates the written block.
+    mock.begin_op(ctx);
+    inodes.write(ctx, p, buf, 6 * BLOCK_SIZE, BLOCK_SIZE);
+    mock.end_op(ctx);
+    assert_eq(mock.count_blocks(), 20);
+    inodes.read(p, copy, 6 * BLOCK_SIZE, BLOCK_SIZE);
+    for (usize i = 0; i < BLOCK_SIZE; i++) {
+        assert_eq(copy[i], buf[i]);
+    }
+
+    // punching everything leaves no block.
+    while (true) {
+        mock.begin_op(ctx);
+        bool done = inodes.punch(ctx, p, 0, 20 * BLOCK_SIZE);
+        mock.end_op(ctx);
+        if (done) {
+            break;
+        }
+    }
+    assert_eq(mock.count_blocks(), 0);
+    assert_eq(mock.inspect(ino)->extent_header.num_entries, 0);
+    inodes.read(p, copy, 0, sizeof(copy));
+    for (usize i = 0; i < sizeof(copy); i++) {
+        assert_eq(copy[i], 0);
+    }
+
+    // a hole punched at the end stays inside the file, so delayed writes
+    // must not start there.
+    mock.begin_op(ctx);
+    inodes.write(ctx, p, buf, 0, sizeof(buf));
+    mock.end_op(ctx);
+    while (true) {
+        mock.begin_op(ctx);
+        bool done = inodes.punch(ctx, p, 2 * BLOCK_SIZE, 18 * BLOCK_SIZE);
+        mock.end_op(ctx);
+        if (done) {
+            break;
+        }
+    }
+    assert_eq(inodes.write_delayed(p, buf, 2 * BLOCK_SIZE, 10), 0);
+    mock.begin_op(ctx);
+    inodes.write(ctx, p, buf, 2 * BLOCK_SIZE, 10);
+    mock.end_op(ctx);
+    assert_eq(p->entry.num_bytes, 20 * BLOCK_SIZE);
+    assert_eq(mock.inspect(ino)->num_bytes, 20 * BLOCK_SIZE);
+    inodes.read(p, copy, 2 * BLOCK_SIZE, 2 * BLOCK_SIZE);
+    for (usize i = 0; i < 2 * BLOCK_SIZE; i++) {
+        assert_eq(copy[i], i < 10 ? buf[i] : 0);
+    }
+
+    mock.begin_op(ctx);
+    inodes.clear(ctx, p);
+    inodes.unlock(p);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+    assert_eq(mock.count_blocks(), 0);
+}
+
+void test_dcache() {
+    auto* root = inodes.get(ROOT_INODE_NO);
+
+    // a missing name is cached as a negative entry...
+    mock.begin_op(ctx);
+    assert_eq(namei("/fudan", ctx), nullptr);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    auto* q = inodes.get(ino);
+    inodes.lock(q);
+    q->entry.num_links = 1;
+    inodes.sync(ctx, q, true);
+    inodes.unlock(q);
+    inodes.lock(root);
+    inodes.insert(ctx, root, "fudan", ino);
+    inodes.unlock(root);
+    mock.end_op(ctx);
+
+    // ...that `insert` drops.
+    mock.begin_op(ctx);
+    auto* p = namei("/fudan", ctx);
+    assert_ne(p, nullptr);
+    assert_eq(p->inode_no, ino);
+    inodes.put(ctx, p);
+    p = namei("/fudan", ctx);
+    assert_eq(p->inode_no, ino);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+
+    // `remove` drops the positive entry.
+    mock.begin_op(ctx);
+    usize index;
+    inodes.lock(root);
+    assert_eq(inodes.lookup(root, "fudan", &index), ino);
+    inodes.remove(ctx, root, index);
+    inodes.unlock(root);
+    mock.end_op(ctx);
+
+    mock.begin_op(ctx);
+    assert_eq(namei("/fudan", ctx), nullptr);
+    inodes.lock(q);
+    q->entry.num_links = 0;
+    inodes.unlock(q);
+    inodes.put(ctx, q);
+    inodes.put(ctx, root);
+    mock.end_op(ctx);
+}
+
+// 目录中所有没被删除的项，像 `ls` 一样线性地读
+static usize count_entries(Inode* p) {
+    usize n = 0;
+    for (usize offset = 0; offset < p->entry.num_bytes; offset += sizeof(DirEntry)) {
+        DirEntry de;
+        inodes.read(p, (u8*)&de, offset, sizeof(de));
+        if (de.inode_no != 0)
+            n++;
+    }
+    return n;
+}
+
+void test_dir_index() {
+    mock.begin_op(ctx);
+    usize ino = inodes.alloc(ctx, INODE_DIRECTORY);
+    mock.end_op(ctx);
+    auto* p = inodes.get(ino);
+    inodes.lock(p);
+
+    constexpr usize n = 2000;
+    for (usize i = 0; i < n; i++) {
+        mock.begin_op(ctx);
+        assert_ne(inodes.insert(ctx, p, std::to_string(i).data(), i + 2), (usize)-1);
+        mock.end_op(ctx);
+    }
+    assert_eq(inodes.insert(ctx, p, "1234", 2), (usize)-1);
+
+    // 第 0 块是索引的根。块小时根放不下这么多叶子，已经长高了一层
+    DxBlock root;
+    inodes.read(p, (u8*)&root, 0, BLOCK_SIZE);
+    assert_eq(root.header.zero, 0);
+    assert_eq(root.header.magic, DX_MAGIC);
+    assert_eq(root.header.depth, n > DX_PER_BLOCK * (BLOCK_SIZE / sizeof(DirEntry)) / 2 ? 1 : 0);
+    assert_eq(count_entries(p), n);
+
+    for (usize i = 0; i < n; i++) {
+        usize index = 10086;
+        assert_eq(inodes.lookup(p, std::to_string(i).data(), &index), i + 2);
+        assert_ne(index, 10086);
+        if (i % 2 == 0) {
+            mock.begin_op(ctx);
+            inodes.remove(ctx, p, index);
+            mock.end_op(ctx);
+        }
+    }
+    assert_eq(count_entries(p), n / 2);
+    for (usize i = 0; i < n; i++) {
+        usize expected = i % 2 == 0 ? 0 : i + 2;
+        assert_eq(inodes.lookup(p, std::to_string(i).data(), NULL), expected);
+    }
+
+    // 删掉的名字可以重新插入，目录不再变大
+    usize num_bytes = p->entry.num_bytes;
+    for (usize i = 0; i < n; i += 2) {
+        mock.begin_op(ctx);
+        assert_ne(inodes.insert(ctx, p, std::to_string(i).data(), i + 3), (usize)-1);
+        mock.end_op(ctx);
+    }
+    assert_eq(p->entry.num_bytes, num_bytes);
+    for (usize i = 0; i < n; i += 2) {
+        assert_eq(inodes.lookup(p, std::to_string(i).data(), NULL), i + 3);
+    }
+
+    mock.begin_op(ctx);
+    inodes.unlock(p);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+}
+
+// 在线性目录和有索引的目录中各创建 num_files 个文件
+void test_create_10k() {
+    constexpr usize num_files = 10000;
+    Inode* p[2];
+    for (usize k = 0; k < 2; k++) {
+        mock.begin_op(ctx);
+        p[k] = inodes.get(inodes.alloc(ctx, INODE_DIRECTORY));
+        mock.end_op(ctx);
+        inodes.lock(p[k]);
+    }
+
+    // 已经超过一块的目录不会建立索引，一直是线性的
+    std::vector<u8> zeros(2 * BLOCK_SIZE, 0);
+    mock.begin_op(ctx);
+    inodes.write(ctx, p[0], zeros.data(), 0, zeros.size());
+    mock.end_op(ctx);
+
+    // mock 的 end_op 要复制整个磁盘，所以只计时一个操作中的插入
+    double ms[2];
+    for (usize k = 0; k < 2; k++) {
+        mock.begin_op(ctx);
+        auto begin_ts = std::chrono::steady_clock::now();
+        for (usize i = 0; i < num_files; i++) {
+            inodes.insert(ctx, p[k], std::to_string(i).data(), i + 2);
+        }
+        auto end_ts = std::chrono::steady_clock::now();
+        mock.end_op(ctx);
+        ms[k] = std::chrono::duration<double, std::milli>(end_ts - begin_ts).count();
+        assert_eq(inodes.lookup(p[k], std::to_string(num_files - 1).data(), NULL),
+                  num_files + 1);
+    }
+    printf("(trace) create %zu files: linear %.0f ms, hashed index %.0f ms\n", num_files,
+           ms[0], ms[1]);
+
+    for (usize k = 0; k < 2; k++) {
+        mock.begin_op(ctx);
+        inodes.unlock(p[k]);
+        inodes.put(ctx, p[k]);
+        mock.end_op(ctx);
+    }
+}
+
 void test_dir() {
     usize ino[5] = {1};
 
@@ -334,7 +940,7 @@ void test_dir() {
     inodes.sync(ctx, p[1], true);
 
     auto* q = mock.inspect(ino[0]);
-    assert_eq(q->addrs[0], 0);
+    assert_eq(q->extent_header.num_entries, 0);
     assert_eq(inodes.lookup(p[0], "fudan", NULL), ino[1]);
     mock.end_op(ctx);
 
@@ -381,14 +987,15 @@ void test_dir() {
     inodes.sync(ctx, p[2], true);
 
     q = mock.inspect(ino[1]);
-    assert_ne(q->addrs[0], 0);
+    assert_ne(q->num_bytes, 0);
     assert_eq(inodes.lookup(p[1], "alice", NULL), 0);
     assert_eq(inodes.lookup(p[1], "bob", NULL), 0);
     mock.end_op(ctx);
 
-    assert_eq(q->addrs[0], 0);
+    assert_eq(q->num_bytes, 0);
     assert_eq(mock.count_inodes(), 5);
-    assert_ne(mock.count_blocks(), 0);
+    // both directories are small enough to be inline.
+    assert_eq(mock.count_blocks(), 0);
 
     for (usize i = 0; i < 5; i++) {
         mock.begin_op(ctx);
@@ -409,11 +1016,20 @@ int main() {
 
     std::vector<Testcase> tests = {
         {"alloc", adhoc::test_alloc},
+        {"ialloc", adhoc::test_ialloc},
         {"sync", adhoc::test_sync},
         {"touch", adhoc::test_touch},
         {"share", adhoc::test_share},
+        {"icache", adhoc::test_icache},
         {"small_file", adhoc::test_small_file},
+        {"inline", adhoc::test_inline},
         {"large_file", adhoc::test_large_file},
+        {"extent_tree", adhoc::test_extent_tree},
+        {"delayed", adhoc::test_delayed},
+        {"sparse", adhoc::test_sparse},
+        {"dcache", adhoc::test_dcache},
+        {"dir_index", adhoc::test_dir_index},
+        {"create_10k", adhoc::test_create_10k},
         {"dir", adhoc::test_dir},
     };
     Runner(tests).run();
@@ -4,6 +4,7 @@ extern "C" {
 #include <fs/inode.h>
 }
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
@@ -15,8 +16,10 @@ extern "C" {
 struct MockBlockCache {
     static constexpr usize num_blocks = 2000;
     static constexpr usize inode_start = 200;
+    static constexpr usize inode_bitmap_start = 800;
     static constexpr usize block_start = 1000;
-    static constexpr usize num_inodes = 1000;
+    // keep the number of inode groups the same for every block size.
+    static constexpr usize num_inodes = 1000 * (BLOCK_SIZE / 512);
 
     static auto get_sblock() -> SuperBlock {
         SuperBlock sblock;
@@ -27,6 +30,15 @@ struct MockBlockCache {
         sblock.log_start = 2;
         sblock.inode_start = inode_start;
         sblock.bitmap_start = 900;
+        sblock.inode_bitmap_start = inode_bitmap_start;
+        sblock.block_size = BLOCK_SIZE;
+        // inode 0 and the root are allocated, both in group 0.
+        sblock.num_inode_groups = (num_inodes + INODE_GROUP_SIZE - 1) / INODE_GROUP_SIZE;
+        for (usize g = 0; g < sblock.num_inode_groups; g++) {
+            usize first = g * INODE_GROUP_SIZE;
+            sblock.free_inodes[g] = (u16)(std::min(first + INODE_GROUP_SIZE, num_inodes) - first);
+        }
+        sblock.free_inodes[0] -= 2;
         return sblock;
     }
 
@@ -46,9 +58,14 @@ struct MockBlockCache {
         usize index;
         std::mutex mutex;
         Block block;
+        u8 data[BLOCK_SIZE];
+
+        Cell() {
+            block.data = data;
+        }
 
         auto operator=(const Cell &rhs) -> Cell & {
-            block = rhs.block;
+            std::copy(std::begin(rhs.data), std::end(rhs.data), data);
             return *this;
         }
 
@@ -102,9 +119,15 @@ struct MockBlockCache {
         auto sblock = get_sblock();
         u8 *buf = reinterpret_cast<u8 *>(&sblock);
         for (usize i = 0; i < sizeof(sblock); i++) {
-            sblk[1].block.data[i] = buf[i];
+            sblk[SUPER_BLOCK_NO].block.data[i] = buf[i];
         }
 
+        // mock inode bitmap: inode 0 is reserved and inode 1 is the root.
+        for (usize i = 0; i < num_inodes; i += BIT_PER_BLOCK) {
+            sblk[inode_bitmap_start + i / BIT_PER_BLOCK].zero();
+        }
+        sblk[inode_bitmap_start].block.data[0] = 0x3;
+
         // mock inodes.
         InodeEntry node[num_inodes];
         for (usize i = 0; i < num_inodes; i++) {
@@ -113,10 +136,13 @@ struct MockBlockCache {
             node[i].minor = gen() & 0xffff;
             node[i].num_links = gen() & 0xffff;
             node[i].num_bytes = gen() & 0xffff;
-            for (usize j = 0; j < INODE_NUM_DIRECT; j++) {
-                node[i].addrs[j] = gen();
+            node[i].extent_header.depth = gen() & 0xffff;
+            node[i].extent_header.num_entries = gen() & 0xffff;
+            for (usize j = 0; j < INODE_NUM_EXTENTS; j++) {
+                node[i].extents[j].file_block = gen();
+                node[i].extents[j].start = gen();
+                node[i].extents[j].len = gen();
             }
-            node[i].indirect = gen();
         }
 
         // mock root inode.
@@ -125,10 +151,8 @@ struct MockBlockCache {
         node[1].minor = 0;
         node[1].num_links = 1;
         node[1].num_bytes = 0;
-        for (usize i = 0; i < INODE_NUM_DIRECT; i++) {
-            node[1].addrs[i] = 0;
-        }
-        node[1].indirect = 0;
+        node[1].extent_header.depth = 0;
+        node[1].extent_header.num_entries = 0;
 
         usize step = 0;
         for (usize i = 0, j = inode_start; i < num_inodes; i += step, j++) {
@@ -175,6 +199,31 @@ struct MockBlockCache {
         return count;
     }
 
+    // count how many inodes are allocated in the inode bitmap on disk.
+    auto count_inode_bits() -> usize {
+        std::unique_lock lock(mutex);
+
+        usize count = 0;
+        for (usize i = 0; i < num_inodes; i++) {
+            auto &cell = sblk[inode_bitmap_start + i / BIT_PER_BLOCK];
+            usize bit = i % BIT_PER_BLOCK;
+            if (cell.block.data[bit / 8] & (1 << (bit % 8)))
+                count++;
+        }
+
+        return count;
+    }
+
+    // the number of free inodes recorded in the super block on disk.
+    auto count_free_inodes() -> usize {
+        std::unique_lock lock(mutex);
+        auto *sb = reinterpret_cast<SuperBlock *>(sblk[SUPER_BLOCK_NO].block.data);
+        usize count = 0;
+        for (usize g = 0; g < sb->num_inode_groups; g++)
+            count += sb->free_inodes[g];
+        return count;
+    }
+
     // count how many blocks on disk are allocated.
     auto count_blocks() -> usize {
         std::unique_lock lock(mutex);
@@ -10,6 +10,18 @@ static void stub_begin_op(OpContext *ctx) {
     mock.begin_op(ctx);
 }
 
+static void stub_begin_op_reserve(OpContext *ctx, usize num_blocks) {
+    (void)num_blocks;
+    mock.begin_op(ctx);
+}
+
+// the mock does not limit the blocks of an atomic operation.
+static bool stub_extend_op(OpContext *ctx, usize num_blocks) {
+    (void)ctx;
+    (void)num_blocks;
+    return true;
+}
+
 static void stub_end_op(OpContext *ctx) {
     mock.end_op(ctx);
 }
@@ -18,6 +30,48 @@ static usize stub_alloc(OpContext *ctx) {
     return mock.alloc(ctx);
 }
 
+// the mock journals file data like any other block.
+static usize stub_alloc_data(OpContext *ctx) {
+    return mock.alloc(ctx);
+}
+
+// the mock ignores `goal` and extends the run while `alloc` stays contiguous.
+static usize stub_alloc_range(OpContext *ctx, usize n, usize, usize *len) {
+    usize start = mock.alloc(ctx);
+    for (*len = 1; *len < n; (*len)++) {
+        usize next;
+        try {
+            next = mock.alloc(ctx);
+        } catch (const AssertionFailure &) {
+            break;
+        }
+        if (next != start + *len) {
+            mock.free(ctx, next);
+            break;
+        }
+    }
+    return start;
+}
+
+// the mock only counts reserved blocks, so tests can check they are given back.
+static usize reserved_blocks;
+
+static bool stub_reserve(usize num_blocks) {
+    reserved_blocks += num_blocks;
+    return true;
+}
+
+static void stub_unreserve(usize num_blocks) {
+    if (reserved_blocks < num_blocks)
+        throw AssertionFailure("unreserve more than reserved");
+    reserved_blocks -= num_blocks;
+}
+
+// the mock takes a claimed reservation as used up at once.
+static void stub_claim(OpContext *, usize num_blocks) {
+    stub_unreserve(num_blocks);
+}
+
 static void stub_free(OpContext *ctx, usize block_no) {
     mock.free(ctx, block_no);
 }
@@ -34,16 +88,35 @@ static void stub_sync(OpContext *ctx, Block *block) {
     mock.sync(ctx, block);
 }
 
+static void stub_sync_data(OpContext *ctx, Block *block) {
+    mock.sync(ctx, block);
+}
+
+// the mock reads blocks on demand only.
+static void stub_readahead(const usize *block_nos, usize n) {
+    (void)block_nos;
+    (void)n;
+}
+
 static struct _Loader {
     _Loader() {
         sblock = mock.get_sblock();
 
         cache.begin_op = stub_begin_op;
+        cache.begin_op_reserve = stub_begin_op_reserve;
+        cache.extend_op = stub_extend_op;
         cache.end_op = stub_end_op;
         cache.alloc = stub_alloc;
+        cache.alloc_data = stub_alloc_data;
+        cache.alloc_range = stub_alloc_range;
+        cache.reserve = stub_reserve;
+        cache.unreserve = stub_unreserve;
+        cache.claim = stub_claim;
         cache.free = stub_free;
         cache.acquire = stub_acquire;
         cache.release = stub_release;
+        cache.readahead = stub_readahead;
         cache.sync = stub_sync;
+        cache.sync_data = stub_sync_data;
     }
 } _loader;
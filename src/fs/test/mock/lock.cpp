@@ -19,6 +19,13 @@ struct Mutex {
         locked = true;
     }
 
+    bool try_lock() {
+        if (!mutex.try_lock())
+            return false;
+        locked = true;
+        return true;
+    }
+
     void unlock() {
         locked = false;
         mutex.unlock();
@@ -70,6 +77,16 @@ void _acquire_spinlock(struct SpinLock* lock) {
     mtx_map[lock].lock();
 }
 
+bool _try_acquire_spinlock(struct SpinLock* lock) {
+    if (holding++ == 0)
+        blocker.p();
+    if (mtx_map[lock].try_lock())
+        return true;
+    if (--holding == 0)
+        blocker.v();
+    return false;
+}
+
 void _release_spinlock(struct SpinLock* lock) {
     mtx_map[lock].unlock();
     if (--holding == 0)
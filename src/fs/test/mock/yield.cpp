@@ -4,4 +4,11 @@ extern "C" {
 void yield() {
     std::this_thread::yield();
 }
+
+// `yield()` in kernel/sched.h expands to these two calls.
+void _acquire_sched_lock() {}
+
+void _sched(int new_state [[maybe_unused]]) {
+    std::this_thread::yield();
+}
 }
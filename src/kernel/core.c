@@ -37,6 +37,7 @@ NO_RETURN void kernel_entry() {
     for (u64 q = (u64)icode; q < (u64)eicode; q += PAGE_SIZE) {
         *get_pte(&p->pgdir, PAGE_SIZE + q - (u64)icode, true) =
             K2P(q) | PTE_VALID | PTE_RX | PTE_USER_DATA;
+        p->pgdir.rss++;
         // vmmap(&p->pgdir, +q - (u64)icode, (void *)q, PTE_VALID | PTE_RX);
     }
     p->ucontext->x[0] = 0;
@@ -169,11 +169,9 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
     //     PANIC();
     // }
     free_pgdir(&thisproc()->pgdir);
-    memcpy(&thisproc()->pgdir, &new_pgdir, sizeof(struct pgdir));
     auto p = &thisproc()->pgdir;
-    // 由于new_pgdir里的section_head的地址与thisproc()->pgdir里的section_head的地址不同，所以需要修改section_head
-    p->section_head.prev = p->section_head.next->next->next->next->next;
-    p->section_head.next->next->next->next->next->next = &p->section_head;
+    // 原地替换，不能整个复制：别的 CPU 的换出扫描可能正拿着 p->lock
+    move_pgdir(p, &new_pgdir);
     attach_pgdir(p);
     arch_tlbi_vmalle1is();
     return 0;
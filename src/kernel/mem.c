@@ -32,17 +32,49 @@ void *shared_zero_page;
 define_early_init(alloc_page_cnt) { init_rc(&alloc_page_cnt); }
 
 static QueueNode *pages;
+// 空闲队列中的页数
+static RefCount queue_page_cnt;
 struct page pages_ref_array[MY_PAGE_COUNT];
 extern char end[];
+
+// 2MiB 大页池：启动时从内核末尾之后切出一段按 2MiB 对齐的连续物理内存。
+// huge_live[i] 记录第 i 块中仍被引用的 4KiB 页数，为 0 表示空闲。
+// 大页被拆分后每个 4KiB 页独立计数，全部释放后整块才回到池中。
+// 4KiB 空闲队列用完时 kalloc_page 把空闲块借来按页分配：huge_split[i] 标记
+// 借出的块，其空闲页挂在 huge_free[i] 上，块内的页全部释放后整块回到池中。
+// huge_idle 是池中 kalloc_page 还能拿到的页数。
+static SpinLock huge_lock;
+static u64 huge_pool;
+static int huge_live[HUGE_POOL_BLOCKS];
+static bool huge_split[HUGE_POOL_BLOCKS];
+static QueueNode *huge_free[HUGE_POOL_BLOCKS];
+static u64 huge_idle;
+
+static bool is_huge_frame(void *p) {
+    return (u64)p >= huge_pool &&
+           (u64)p < huge_pool + HUGE_POOL_BLOCKS * HUGE_PAGE_SIZE;
+}
+
 define_early_init(pages) {
     memset(pages_ref_array, 0, sizeof(pages_ref_array));
     // printk("pages_ref_array:addr = %llx\n", (u64)pages_ref_array);
     // printk("pages_ref_array count end = %llx\n",
     //        (u64)(&pages_ref_array[MY_PAGE_COUNT - 1].ref));
     // PANIC();
+    init_spinlock(&huge_lock);
+    memset(huge_live, 0, sizeof(huge_live));
+    memset(huge_split, 0, sizeof(huge_split));
+    memset(huge_free, 0, sizeof(huge_free));
+    huge_idle = HUGE_POOL_BLOCKS * HUGE_PAGE_PAGES;
+    init_rc(&queue_page_cnt);
+    huge_pool = HUGE_BASE(PAGE_BASE((u64)&end) + PAGE_SIZE + HUGE_PAGE_SIZE - 1);
     for (u64 p = PAGE_BASE((u64)&end) + PAGE_SIZE; p < P2K(PHYSTOP);
-         p += PAGE_SIZE)
+         p += PAGE_SIZE) {
+        if (is_huge_frame((void *)p))
+            continue;
         add_to_queue(&pages, (QueueNode *)p);
+        _increment_rc(&queue_page_cnt);
+    }
 
     // memset(shared_zero_page, 0, PAGE_SIZE);
 }
@@ -55,6 +87,38 @@ define_early_init(initTable) { init_spinlock(&lock); }
 
 short getCeilDivEight(int size) { return (size - 1) / 8 + 1; }
 
+// 从大页池中拿一个 4KiB 页：先用借出块中的空闲页，没有时再借出一个空闲块
+static void *kalloc_pool_page() {
+    QueueNode *page = NULL;
+    int idx = -1;
+    _acquire_spinlock(&huge_lock);
+    for (int i = 0; i < HUGE_POOL_BLOCKS; i++) {
+        if (huge_split[i] && huge_free[i] != NULL) {
+            idx = i;
+            break;
+        }
+        if (idx < 0 && huge_live[i] == 0)
+            idx = i;
+    }
+    if (idx >= 0 && !huge_split[idx]) {
+        u64 base = huge_pool + (u64)idx * HUGE_PAGE_SIZE;
+        huge_split[idx] = true;
+        for (int i = HUGE_PAGE_PAGES - 1; i >= 0; i--) {
+            QueueNode *node = (QueueNode *)(base + (u64)i * PAGE_SIZE);
+            node->next = huge_free[idx];
+            huge_free[idx] = node;
+        }
+    }
+    if (idx >= 0) {
+        page = huge_free[idx];
+        huge_free[idx] = page->next;
+        huge_live[idx]++;
+        huge_idle--;
+    }
+    _release_spinlock(&huge_lock);
+    return page;
+}
+
 void *kalloc_page() {
     _increment_rc(&alloc_page_cnt);
     if (alloc_page_cnt.count > MY_PAGE_COUNT) {
@@ -64,9 +128,16 @@ void *kalloc_page() {
     // PANIC();
     // TODO
     u64 *addr = (u64 *)fetch_from_queue(&pages);
-    // if (addr == NULL) {
-    //     PANIC();
-    // }
+    if (addr != NULL) {
+        _decrement_rc(&queue_page_cnt);
+    } else {
+        addr = kalloc_pool_page();
+    }
+    if (addr == NULL) {
+        // 正常情况下 oom_check 会在此之前杀掉进程，这里只剩内核自身耗尽内存
+        printk("kalloc_page: out of memory\n");
+        PANIC();
+    }
     memset((void *)addr, 0, PAGE_SIZE);
     u64 idx = (u64)K2P(addr) / PAGE_SIZE;
     _increment_rc(&(pages_ref_array[idx].ref));
@@ -80,12 +151,68 @@ void kfree_page(void *p) {
     _decrement_rc(&(pages_ref_array[(u64)K2P(p) / PAGE_SIZE].ref));
 
     if (pages_ref_array[(u64)K2P(p) / PAGE_SIZE].ref.count == 0) {
-        add_to_queue(&pages, (QueueNode *)p);
+        if (is_huge_frame(p)) {
+            u64 i = ((u64)p - huge_pool) / HUGE_PAGE_SIZE;
+            _acquire_spinlock(&huge_lock);
+            huge_live[i]--;
+            if (huge_split[i]) {
+                ((QueueNode *)p)->next = huge_free[i];
+                huge_free[i] = (QueueNode *)p;
+                huge_idle++;
+            } else if (huge_live[i] == 0) {
+                huge_idle += HUGE_PAGE_PAGES;
+            }
+            if (huge_live[i] == 0) {
+                huge_split[i] = false;
+                huge_free[i] = NULL;
+            }
+            _release_spinlock(&huge_lock);
+        } else {
+            add_to_queue(&pages, (QueueNode *)p);
+            _increment_rc(&queue_page_cnt);
+        }
         _decrement_rc(&alloc_page_cnt);
     }
     // printk("free_page: %llx\n", (u64)p);
 }
 
+int page_ref_cnt(void *p) {
+    return pages_ref_array[(u64)K2P(p) / PAGE_SIZE].ref.count;
+}
+
+void *kshare_page(void *p) {
+    _increment_rc(&(pages_ref_array[(u64)K2P(p) / PAGE_SIZE].ref));
+    return p;
+}
+
+void *kalloc_huge_page() {
+    int idx = -1;
+    _acquire_spinlock(&huge_lock);
+    for (int i = 0; i < HUGE_POOL_BLOCKS; i++) {
+        if (huge_live[i] == 0) {
+            huge_live[i] = HUGE_PAGE_PAGES;
+            huge_idle -= HUGE_PAGE_PAGES;
+            idx = i;
+            break;
+        }
+    }
+    _release_spinlock(&huge_lock);
+    if (idx < 0)
+        return NULL;
+    void *addr = (void *)(huge_pool + (u64)idx * HUGE_PAGE_SIZE);
+    memset(addr, 0, HUGE_PAGE_SIZE);
+    for (int i = 0; i < HUGE_PAGE_PAGES; i++) {
+        _increment_rc(&alloc_page_cnt);
+        kshare_page(addr + i * PAGE_SIZE);
+    }
+    return addr;
+}
+
+void kfree_huge_page(void *p) {
+    for (int i = 0; i < HUGE_PAGE_PAGES; i++)
+        kfree_page(p + i * PAGE_SIZE);
+}
+
 define_early_init(tableInit) { memset(hashTable, 0, sizeof(hashTable)); }
 
 u64 *doAllocPage(isize size) {
@@ -235,6 +362,15 @@ void kfree(void *p) {
 
 u64 left_page_cnt() { return PAGE_COUNT - alloc_page_cnt.count; }
 
+u64 free_queue_cnt() {
+    _acquire_spinlock(&huge_lock);
+    u64 idle = huge_idle;
+    _release_spinlock(&huge_lock);
+    return (u64)queue_page_cnt.count + idle;
+}
+
+bool is_zero_page(void *p) { return p == shared_zero_page; }
+
 WARN_RESULT void *get_zero_page() {
     // TODO
     // Return the shared zero page
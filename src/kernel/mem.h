@@ -12,11 +12,32 @@ struct page {
 };
 
 u64 left_page_cnt();
+// pages kalloc_page can still hand out, including the idle huge page pool
+u64 free_queue_cnt();
 
 WARN_RESULT void *get_zero_page();
+bool is_zero_page(void *);
 
 WARN_RESULT void *kalloc_page();
 void kfree_page(void *);
+// take one more reference of a page returned by kalloc_page
+void *kshare_page(void *);
+// the current reference count of a page
+int page_ref_cnt(void *);
+
+// 大页池中的 2MiB 块数
+#define HUGE_POOL_BLOCKS 32
+
+/**
+    @brief allocate a zeroed, 2MiB aligned block of HUGE_PAGE_PAGES pages.
+    Every 4KiB page of the block holds one reference for the caller.
+    @note kalloc_page lends free blocks of the pool out page by page once the
+    4KiB pages run out; a lent block comes back when all its pages are free.
+    @return NULL if the huge page pool is exhausted.
+ */
+WARN_RESULT void *kalloc_huge_page();
+// drop the caller's reference of every page in a block from kalloc_huge_page
+void kfree_huge_page(void *);
 
 WARN_RESULT void *kalloc(isize);
 void kfree(void *);
\ No newline at end of file
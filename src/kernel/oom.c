@@ -0,0 +1,109 @@
+#include <common/spinlock.h>
+#include <common/string.h>
+#include <kernel/init.h>
+#include <kernel/mem.h>
+#include <kernel/oom.h>
+#include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+
+extern struct proc root_proc;
+
+static SpinLock oom_lock;
+static u64 oom_kills;
+
+define_early_init(oom) {
+    init_spinlock(&oom_lock);
+    oom_kills = 0;
+}
+
+u64 oom_badness(struct proc *p) {
+    return p->pgdir.rss + p->pgdir.swap_ents + p->pgdir.pt_pages +
+           p->kernel_bytes / PAGE_SIZE;
+}
+
+struct oom_scan {
+    struct proc *victim;
+    int pid;
+    u64 badness;
+    // 已经有被杀的进程还没退出
+    bool pending;
+};
+
+static bool scan_proc(struct proc *p, void *arg) {
+    struct oom_scan *sc = arg;
+    if (p == &root_proc || p->idle || is_unused(p) || is_zombie(p))
+        return false;
+    // 内核线程没有用户内存，杀掉也释放不了多少
+    if (p->pgdir.rss + p->pgdir.swap_ents == 0)
+        return false;
+    if (p->killed) {
+        sc->pending = true;
+        return false;
+    }
+    u64 badness = oom_badness(p);
+    // 一样大时选当前进程，它不用等待调度就能退出
+    if (badness > sc->badness ||
+        (badness == sc->badness && p == thisproc())) {
+        sc->victim = p;
+        sc->pid = p->pid;
+        sc->badness = badness;
+    }
+    return false;
+}
+
+bool oom_check() {
+    struct proc *this = thisproc();
+    if (free_queue_cnt() >= OOM_MIN_PAGES)
+        return false;
+    struct oom_scan sc = {.victim = NULL, .pid = -1, .badness = 0};
+    for_each_proc(scan_proc, &sc);
+    if (!sc.pending && sc.victim != NULL && kill(sc.pid) == 0) {
+        _acquire_spinlock(&oom_lock);
+        oom_kills++;
+        _release_spinlock(&oom_lock);
+        printk("oom: killed process %d (%lld pages), %lld pages free\n",
+               sc.pid, sc.badness, free_queue_cnt());
+    }
+    if (this->killed)
+        return true;
+    // 等被杀的进程退出把内存还回来
+    for (int i = 0; i < OOM_WAIT_YIELDS && free_queue_cnt() < OOM_MIN_PAGES;
+         i++) {
+        yield();
+    }
+    return this->killed;
+}
+
+struct stat_scan {
+    int pid;
+    struct mem_stat *st;
+    bool found;
+};
+
+static bool stat_proc(struct proc *p, void *arg) {
+    struct stat_scan *sc = arg;
+    if (p->pid != sc->pid || is_unused(p))
+        return false;
+    sc->st->rss = p->pgdir.rss;
+    sc->st->swap_ents = p->pgdir.swap_ents;
+    sc->st->pt_pages = p->pgdir.pt_pages;
+    sc->st->kernel_bytes = p->kernel_bytes;
+    sc->found = true;
+    return true;
+}
+
+int get_mem_stat(int pid, struct mem_stat *st) {
+    struct stat_scan sc = {.pid = pid, .st = st, .found = false};
+    if (pid == 0)
+        sc.pid = thisproc()->pid;
+    memset(st, 0, sizeof(*st));
+    for_each_proc(stat_proc, &sc);
+    if (!sc.found)
+        return -1;
+    st->free_pages = free_queue_cnt();
+    _acquire_spinlock(&oom_lock);
+    st->oom_kills = oom_kills;
+    _release_spinlock(&oom_lock);
+    return 0;
+}
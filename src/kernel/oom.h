@@ -0,0 +1,40 @@
+#pragma once
+
+#include <common/defines.h>
+#include <kernel/proc.h>
+
+// 换出之后空闲页仍低于 OOM_MIN_PAGES 时杀掉占用内存最多的进程。
+// 留下的页保证内核路径（缺页、系统调用、退出）不会把内存用完
+#define OOM_MIN_PAGES 128
+// 杀掉别的进程后最多让出 CPU 的次数，等待它退出释放内存
+#define OOM_WAIT_YIELDS 64
+
+/**
+    @brief memory usage of a process.
+ */
+struct mem_stat {
+    u64 rss;          // resident user pages, the shared zero page excluded
+    u64 swap_ents;    // user pages in the swap area
+    u64 pt_pages;     // page-table pages
+    u64 kernel_bytes; // kernel objects owned by the process
+    u64 free_pages;   // system wide: pages kalloc_page can still hand out
+    u64 oom_kills;    // system wide: processes killed by the OOM killer
+};
+
+// the number of pages killing `p` would release
+u64 oom_badness(struct proc *p);
+
+/**
+    @brief if free memory is below OOM_MIN_PAGES, kill the process with the
+    largest oom_badness.
+    @return true if the current process has been killed.
+    @note must be called without any lock held, e.g. on entry from user mode.
+ */
+bool oom_check();
+
+/**
+    @brief fill `st` with the memory usage of process `pid`, or of the current
+    process if `pid` is 0.
+    @return 0, or -1 if there is no such process.
+ */
+int get_mem_stat(int pid, struct mem_stat *st);
@@ -0,0 +1,288 @@
+#include <common/sem.h>
+#include <common/spinlock.h>
+#include <common/string.h>
+#include <fs/cache.h>
+#include <fs/file.h>
+#include <kernel/init.h>
+#include <kernel/mem.h>
+#include <kernel/pagecache.h>
+#include <kernel/printk.h>
+#include <kernel/pt.h>
+#include <kernel/sched.h>
+
+// 剩余物理页少于该值时不再预读
+#define READAHEAD_LOW_PAGES 256
+
+static SpinLock pc_lock;
+static ListNode buckets[PAGECACHE_NR_BUCKETS];
+static ListNode lru;
+static struct pagecache_stat pc_stat;
+
+// 异步预读请求，由 readahead_worker 处理
+struct ra_request {
+    Inode *ip;
+    u64 index;
+    u64 n;
+    ListNode node;
+};
+
+static SpinLock ra_lock;
+static ListNode ra_queue;
+static Semaphore ra_sem;
+static bool ra_started;
+
+define_early_init(pagecache) {
+    init_spinlock(&pc_lock);
+    for (int i = 0; i < PAGECACHE_NR_BUCKETS; i++) {
+        init_list_node(&buckets[i]);
+    }
+    init_list_node(&lru);
+    memset(&pc_stat, 0, sizeof(pc_stat));
+
+    init_spinlock(&ra_lock);
+    init_list_node(&ra_queue);
+    init_sem(&ra_sem, 0);
+    ra_started = false;
+}
+
+static ListNode *bucket_of(usize inode_no, u64 index) {
+    return &buckets[(inode_no * 31 + index) % PAGECACHE_NR_BUCKETS];
+}
+
+// caller must hold pc_lock
+static struct cached_page *find_page(usize inode_no, u64 index) {
+    ListNode *b = bucket_of(inode_no, index);
+    _for_in_list(node, b) {
+        if (node == b) {
+            continue;
+        }
+        struct cached_page *cp = container_of(node, struct cached_page, hnode);
+        if (cp->inode_no == inode_no && cp->index == index) {
+            return cp;
+        }
+    }
+    return NULL;
+}
+
+// caller must hold pc_lock
+static void drop_page(struct cached_page *cp) {
+    _detach_from_list(&cp->hnode);
+    _detach_from_list(&cp->lnode);
+    pc_stat.nr_pages--;
+    kfree_page(cp->page);
+    kfree(cp);
+}
+
+static void *lookup_page(usize inode_no, u64 index, bool fault) {
+    void *page = NULL;
+    _acquire_spinlock(&pc_lock);
+    struct cached_page *cp = find_page(inode_no, index);
+    if (cp != NULL) {
+        // 移到 LRU 表头
+        _detach_from_list(&cp->lnode);
+        _insert_into_list(&lru, &cp->lnode);
+        if (fault) {
+            pc_stat.hits++;
+            if (cp->readahead) {
+                pc_stat.ra_hits++;
+            }
+        }
+        cp->readahead = false;
+        page = kshare_page(cp->page);
+    }
+    _release_spinlock(&pc_lock);
+    return page;
+}
+
+/*
+ * Insert `page` as file page `index`. The caller's reference of `page` is
+ * handed back through the return value: if the page was cached meanwhile, the
+ * cached copy is returned instead and `page` is released.
+ */
+static void *insert_page(usize inode_no, u64 index, void *page,
+                         bool readahead) {
+    struct cached_page *new_cp = kalloc(sizeof(struct cached_page));
+    _acquire_spinlock(&pc_lock);
+    struct cached_page *cp = find_page(inode_no, index);
+    if (cp != NULL) {
+        void *cached = kshare_page(cp->page);
+        _release_spinlock(&pc_lock);
+        kfree(new_cp);
+        kfree_page(page);
+        return cached;
+    }
+    new_cp->inode_no = inode_no;
+    new_cp->index = index;
+    new_cp->page = kshare_page(page);
+    new_cp->readahead = readahead;
+    _insert_into_list(bucket_of(inode_no, index), &new_cp->hnode);
+    _insert_into_list(&lru, &new_cp->lnode);
+    pc_stat.nr_pages++;
+    if (readahead) {
+        pc_stat.readahead++;
+    }
+    // 超出容量时淘汰最久未使用的页（仍被映射的页由映射者持有）
+    while (pc_stat.nr_pages > PAGECACHE_MAX_PAGES) {
+        drop_page(container_of(lru.prev, struct cached_page, lnode));
+    }
+    _release_spinlock(&pc_lock);
+    return page;
+}
+
+// 从磁盘读入一页并放进缓存。持有 inode 锁完成插入，保证不会和写者交错
+static void *load_page(Inode *ip, u64 index, bool readahead) {
+    void *page = kalloc_page();
+    usize offset = index * PAGE_SIZE;
+    inodes.lock(ip);
+    if (offset < ip->entry.num_bytes) {
+        inodes.read(ip, page, offset, PAGE_SIZE);
+    }
+    page = insert_page(ip->inode_no, index, page, readahead);
+    inodes.unlock(ip);
+    return page;
+}
+
+void *pagecache_lookup(usize inode_no, u64 index) {
+    return lookup_page(inode_no, index, false);
+}
+
+void *pagecache_get(Inode *ip, u64 index) {
+    void *page = lookup_page(ip->inode_no, index, true);
+    if (page != NULL) {
+        return page;
+    }
+    _acquire_spinlock(&pc_lock);
+    pc_stat.misses++;
+    _release_spinlock(&pc_lock);
+    return load_page(ip, index, false);
+}
+
+void pagecache_invalidate(usize inode_no, usize offset, usize n) {
+    if (n == 0) {
+        return;
+    }
+    u64 first = offset / PAGE_SIZE;
+    u64 last = (offset + n - 1) / PAGE_SIZE;
+    if (offset + n < offset) {
+        last = (u64)-1 / PAGE_SIZE;
+    }
+    _acquire_spinlock(&pc_lock);
+    // 范围较小时按页查哈希表，否则扫描整个 LRU 链表
+    if (last - first < PAGECACHE_MAX_PAGES) {
+        for (u64 i = first; i <= last; i++) {
+            struct cached_page *cp = find_page(inode_no, i);
+            if (cp != NULL) {
+                drop_page(cp);
+            }
+        }
+    } else {
+        ListNode *node = lru.next;
+        while (node != &lru) {
+            struct cached_page *cp =
+                container_of(node, struct cached_page, lnode);
+            node = node->next;
+            if (cp->inode_no == inode_no && cp->index >= first &&
+                cp->index <= last) {
+                drop_page(cp);
+            }
+        }
+    }
+    _release_spinlock(&pc_lock);
+}
+
+static void readahead_worker(u64 arg) {
+    (void)arg;
+    while (1) {
+        unalertable_wait_sem(&ra_sem);
+        _acquire_spinlock(&ra_lock);
+        ListNode *node = ra_queue.next;
+        _detach_from_list(node);
+        _release_spinlock(&ra_lock);
+        struct ra_request *req = container_of(node, struct ra_request, node);
+
+        for (u64 i = req->index; i < req->index + req->n; i++) {
+            if (left_page_cnt() < READAHEAD_LOW_PAGES) {
+                break;
+            }
+            _acquire_spinlock(&pc_lock);
+            bool cached = find_page(req->ip->inode_no, i) != NULL;
+            _release_spinlock(&pc_lock);
+            if (cached) {
+                continue;
+            }
+            if (i * PAGE_SIZE >= req->ip->entry.num_bytes) {
+                break;
+            }
+            kfree_page(load_page(req->ip, i, true));
+        }
+
+        OpContext ctx;
+        bcache.begin_op(&ctx);
+        inodes.put(&ctx, req->ip);
+        bcache.end_op(&ctx);
+        kfree(req);
+    }
+}
+
+void pagecache_readahead(Inode *ip, u64 index, u64 n) {
+    if (n == 0 || left_page_cnt() < READAHEAD_LOW_PAGES) {
+        return;
+    }
+    struct ra_request *req = kalloc(sizeof(struct ra_request));
+    req->ip = inodes.share(ip);
+    req->index = index;
+    req->n = n;
+
+    _acquire_spinlock(&ra_lock);
+    bool start = !ra_started;
+    ra_started = true;
+    _insert_into_list(ra_queue.prev, &req->node);
+    _release_spinlock(&ra_lock);
+
+    // 第一次预读时才创建工作线程（create_proc 需要文件系统已初始化）
+    if (start) {
+        struct proc *p = create_proc();
+        start_proc(p, readahead_worker, 0);
+    }
+    post_sem(&ra_sem);
+}
+
+int pagecache_fault_around(struct pgdir *pd, vma *v, u64 va, u64 flags) {
+    usize inode_no = v->file->ip->inode_no;
+    u64 begin = va & ~(FAULT_AROUND_PAGES * PAGE_SIZE - 1);
+    u64 end = begin + FAULT_AROUND_PAGES * PAGE_SIZE;
+    if (begin < v->start) {
+        begin = v->start;
+    }
+    if (end > PAGE_BASE(v->end + PAGE_SIZE - 1)) {
+        end = PAGE_BASE(v->end + PAGE_SIZE - 1);
+    }
+    int n = 0;
+    for (u64 addr = begin; addr < end; addr += PAGE_SIZE) {
+        if (addr == PAGE_BASE(va)) {
+            continue;
+        }
+        PTEntriesPtr pte = get_pte(pd, addr, false);
+        if (pte != NULL && *pte != 0) {
+            continue;
+        }
+        void *page =
+            pagecache_lookup(inode_no, (v->off + addr - v->start) / PAGE_SIZE);
+        if (page == NULL) {
+            continue;
+        }
+        vmmap(pd, addr, page, flags);
+        kfree_page(page);
+        n++;
+    }
+    _acquire_spinlock(&pc_lock);
+    pc_stat.fault_around += n;
+    _release_spinlock(&pc_lock);
+    return n;
+}
+
+void pagecache_get_stat(struct pagecache_stat *st) {
+    _acquire_spinlock(&pc_lock);
+    memcpy(st, &pc_stat, sizeof(pc_stat));
+    _release_spinlock(&pc_lock);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <common/defines.h>
+#include <common/list.h>
+#include <fs/inode.h>
+#include <kernel/proc.h>
+
+// 页缓存：按 (inode_no, 页号) 缓存文件页，供 mmap 缺页共享使用
+#define PAGECACHE_NR_BUCKETS 64
+#define PAGECACHE_MAX_PAGES 256
+
+// 缺页时顺带映射周围已缓存的页（对齐窗口，单位：页）
+#define FAULT_AROUND_PAGES 16
+
+// 顺序预读窗口的初始值和上限（单位：页）
+#define READAHEAD_MIN_PAGES 4
+#define READAHEAD_MAX_PAGES 32
+
+/**
+    @brief a file page held by the page cache.
+    The cache owns one reference of `page` (see `pages_ref_array`).
+ */
+struct cached_page {
+    usize inode_no;
+    u64 index;
+    void *page;
+    // inserted by readahead and not yet touched by a fault
+    bool readahead;
+    ListNode hnode; // hash bucket
+    ListNode lnode; // global LRU list, most recently used first
+};
+
+/**
+    @brief page cache statistics, returned to user space by `SYS_pcstat`.
+ */
+struct pagecache_stat {
+    u64 hits;         // faults served from the page cache
+    u64 misses;       // faults that had to read the file synchronously
+    u64 fault_around; // extra PTEs installed by fault-around (faults avoided)
+    u64 readahead;    // pages loaded by the async readahead worker
+    u64 ra_hits;      // faults served by a page loaded by readahead
+    u64 nr_pages;     // pages currently cached
+};
+
+/**
+    @brief get file page `index` of `ip`, reading it from disk on a miss.
+    @return the kernel address of the page. The caller owns one reference and
+    must `kfree_page` it when done (after `vmmap` took its own).
+    @note caller must NOT hold the lock of `ip`.
+ */
+WARN_RESULT void *pagecache_get(Inode *ip, u64 index);
+
+/**
+    @brief look up file page `index` without reading it.
+    @return the page with one reference for the caller, or NULL on a miss.
+ */
+WARN_RESULT void *pagecache_lookup(usize inode_no, u64 index);
+
+/**
+    @brief drop cached pages of `inode_no` overlapping [offset, offset + n).
+    Pages still mapped by some process stay alive until they are unmapped.
+ */
+void pagecache_invalidate(usize inode_no, usize offset, usize n);
+
+/**
+    @brief queue an asynchronous read of pages [index, index + n) of `ip`.
+    Pages already cached are skipped by the worker.
+ */
+void pagecache_readahead(Inode *ip, u64 index, u64 n);
+
+/**
+    @brief map the already-cached pages around `va` into `pd` for vma `v`.
+    Only empty PTEs inside the vma are filled.
+    @return the number of PTEs installed.
+ */
+int pagecache_fault_around(struct pgdir *pd, vma *v, u64 va, u64 flags);
+
+void pagecache_get_stat(struct pagecache_stat *st);
@@ -1,24 +1,29 @@
 #include <aarch64/mmu.h>
+#include <aarch64/trap.h>
 #include <common/defines.h>
 #include <common/list.h>
 #include <common/sem.h>
 #include <common/string.h>
+#include <errno.h>
 #include <fs/block_device.h>
 #include <fs/cache.h>
 #include <kernel/init.h>
 #include <kernel/mem.h>
+#include <kernel/pagecache.h>
 #include <kernel/paging.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
 #include <kernel/pt.h>
 #include <kernel/sched.h>
+#include <kernel/swap.h>
+#include <sys/mman.h>
 
 #define STACK_TOP 0x800000
 define_rest_init(paging) {
     // TODO
 }
 static bool is_valid_pte(PTEntriesPtr pte) {
-    return (pte != NULL) || (!((*pte) & (u64)PTE_VALID));
+    return pte != NULL && ((*pte) & (u64)PTE_VALID);
 }
 static void init_section(struct section *sec) { init_list_node(&sec->stnode); }
 
@@ -140,42 +145,20 @@ void free_sections(struct pgdir *pd) {
     _acquire_spinlock(&pd->lock);
     ListNode *head = &pd->section_head;
     while (!_empty_list(head)) {
-        auto node = _detach_from_list(head);
+        auto node = head->next;
+        _detach_from_list(node);
         sec = container_of(node, struct section, stnode);
-        for (u64 va = sec->begin; va < sec->end;
-             va = PAGE_BASE(va + PAGE_SIZE)) {
-            PTEntriesPtr pte = get_pte(pd, va, false);
-            if ((pte != NULL) && (*pte & PTE_VALID)) {
-                kfree_page((void *)P2K(PTE_ADDRESS(*pte)));
-                *pte = 0;
-            }
-        }
+        unmap_range(pd, sec->begin, sec->end, true);
         kfree(sec);
     }
-    PTEntriesPtr pte = get_pte(pd, STACK_TOP, false);
-    if (pte != NULL && (*pte & PTE_VALID)) {
-        kfree_page((void *)P2K(PTE_ADDRESS(*pte)));
-        *pte = 0;
-    }
+    unmap_range(pd, STACK_TOP, STACK_TOP + PAGE_SIZE, true);
     _release_spinlock(&pd->lock);
 }
 
 static void recycle_sec_page(struct section *sec, u64 pre_end) {
     struct proc *p = thisproc();
-    u64 cur_end = sec->end;
-    u64 begin_pd_addr = PAGE_BASE((cur_end + PAGE_SIZE - 1));
-    u64 end_pd_addr = PAGE_BASE((pre_end - 1));
-    for (u64 i = begin_pd_addr; i <= end_pd_addr; i += PAGE_SIZE) {
-        PTEntriesPtr pte = get_pte(&p->pgdir, i, FALSE);
-        if (pte == NULL) {
-            continue;
-        }
-        if (*pte & PTE_VALID) {
-            kfree_page((void *)P2K(PTE_ADDRESS((*pte))));
-            (*pte) = 0;
-        }
-        // 释放掉页表项
-    }
+    // 释放 [新的堆顶所在页之后, 原堆顶] 的页以及空出来的页表
+    unmap_range(&p->pgdir, PAGE_BASE(sec->end + PAGE_SIZE - 1), pre_end, true);
 }
 
 u64 sbrk(i64 size) {
@@ -201,12 +184,149 @@ u64 sbrk(i64 size) {
         }
         // printk("pre_end = %lld,head->end = %lld\n", pre_end, heap->end);
         recycle_sec_page(heap, heap_end);
-        arch_tlbi_vmalle1is();
     }
     _release_spinlock(&pd->lock);
     return heap_end;
 }
 
+/*
+ * Apply `advice` to the pages of [begin, end) that belong to a mmap area or
+ * the heap. An access pattern hint is recorded in every vma overlapping the
+ * range, since vmas are not split here.
+ */
+static void advise_range(struct pgdir *pd, vma *v, u64 begin, u64 end,
+                         int advice) {
+    switch (advice) {
+    case MADV_NORMAL:
+    case MADV_SEQUENTIAL:
+    case MADV_RANDOM:
+        if (v != NULL) {
+            v->advice = advice;
+            v->ra_size = 0;
+        }
+        break;
+    case MADV_WILLNEED:
+        if (v != NULL && v->file != NULL) {
+            // 文件页异步读进页缓存，缺页时由 fault-around 批量映射
+            if (v->off % PAGE_SIZE == 0) {
+                pagecache_readahead(v->file->ip,
+                                    (v->off + begin - v->start) / PAGE_SIZE,
+                                    (end - begin) / PAGE_SIZE);
+            }
+        } else {
+            // 匿名页：把已经换出的页读回来
+            swap_in_range(pd, begin, end);
+        }
+        break;
+    case MADV_DONTNEED:
+        // 共享文件映射先写回，之后的缺页从文件重新读；私有页直接丢弃，
+        // 再访问时得到零页或文件内容
+        if (v != NULL && v->file != NULL && (v->flags & MAP_SHARED)) {
+            writeback(v, begin, end - begin);
+        }
+        // 共享匿名映射没有后备文件，丢掉就找不回来了，跳过
+        if (v != NULL && v->file == NULL && (v->flags & MAP_SHARED)) {
+            break;
+        }
+        _acquire_spinlock(&pd->lock);
+        unmap_range(pd, begin, end, true);
+        _release_spinlock(&pd->lock);
+        break;
+    }
+}
+
+int vm_madvise(u64 addr, u64 len, int advice) {
+    if (PAGE_BASE(addr) != addr || addr + len < addr ||
+        advice < MADV_NORMAL || advice > MADV_DONTNEED) {
+        return -EINVAL;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    struct proc *p = thisproc();
+    struct pgdir *pd = &p->pgdir;
+    u64 end = PAGE_BASE(addr + len + PAGE_SIZE - 1);
+    bool found = false;
+    for (int i = 0; i < NCVMA; i++) {
+        vma *v = p->vma[i];
+        if (v == NULL || v->end <= addr || v->start >= end) {
+            continue;
+        }
+        found = true;
+        advise_range(pd, v, MAX(addr, v->start),
+                     MIN(end, PAGE_BASE(v->end + PAGE_SIZE - 1)), advice);
+    }
+    _acquire_spinlock(&pd->lock);
+    struct section *heap = container_of(pd->section_head.next->next->next->next,
+                                        struct section, stnode);
+    u64 heap_begin = heap->begin, heap_end = heap->end;
+    _release_spinlock(&pd->lock);
+    if (heap_begin < end && heap_end > addr) {
+        found = true;
+        advise_range(pd, NULL, MAX(addr, heap_begin),
+                     MIN(end, PAGE_BASE(heap_end + PAGE_SIZE - 1)), advice);
+    }
+    return found ? 0 : -ENOMEM;
+}
+
+// 写时复制：原页是共享零页时直接换成新分配的零页，不必复制
+static void cow_page(struct pgdir *pd, u64 va, PTEntriesPtr pte, u64 flags) {
+    void *old_page = (void *)P2K(PTE_ADDRESS(*pte));
+    void *new_page = kalloc_page();
+    if (old_page != get_zero_page())
+        memcpy(new_page, old_page, PAGE_SIZE);
+    vmmap(pd, PAGE_BASE(va), new_page, flags);
+    kfree_page(new_page);
+}
+
+bool try_map_huge(struct pgdir *pd, u64 va, u64 begin, u64 end, u64 flags) {
+    u64 base = HUGE_BASE(va);
+    if (base < begin || base + HUGE_PAGE_SIZE > end)
+        return false;
+    PTEntriesPtr pmd = get_pmd(pd, base, true);
+    if (*pmd != 0)
+        return false;
+    void *huge = kalloc_huge_page();
+    if (huge == NULL)
+        return false;
+    vmmap_huge(pd, base, huge, flags);
+    kfree_huge_page(huge);
+    return true;
+}
+
+// 顺序预读：缺页落在上一次缺页之后不远处视为顺序访问，预读窗口逐次翻倍
+// MADV_SEQUENTIAL 时每次缺页都按顺序访问处理，窗口直接从最大值开始；
+// MADV_RANDOM 时不预读
+static void vma_readahead(vma *v, u64 index) {
+    if (v->advice == MADV_RANDOM) {
+        return;
+    }
+    bool sequential = v->advice == MADV_SEQUENTIAL ||
+                      (index > v->ra_prev &&
+                       index <= v->ra_prev + 2 * FAULT_AROUND_PAGES);
+    v->ra_prev = index;
+    if (!sequential) {
+        v->ra_size = 0;
+        v->ra_next = index + 1;
+        return;
+    }
+    if (v->ra_size == 0) {
+        v->ra_size = v->advice == MADV_SEQUENTIAL ? READAHEAD_MAX_PAGES
+                                                  : READAHEAD_MIN_PAGES;
+    }
+    if (v->ra_next <= index) {
+        v->ra_next = index + 1;
+    }
+    u64 last = (v->off + PAGE_BASE(v->end + PAGE_SIZE - 1) - v->start) /
+               PAGE_SIZE;
+    u64 target = MIN(index + 1 + v->ra_size, last);
+    if (v->ra_next < target) {
+        pagecache_readahead(v->file->ip, v->ra_next, target - v->ra_next);
+        v->ra_next = target;
+        v->ra_size = MIN(v->ra_size * 2, (u64)READAHEAD_MAX_PAGES);
+    }
+}
+
 int mmap_handler(u64 va, u64 iss) {
     // printk("mmap_handler:va = %llx\n", va);
     auto p = thisproc();
@@ -223,21 +343,63 @@ int mmap_handler(u64 va, u64 iss) {
     if (v == NULL) {
         return -1;
     }
-    if (iss == 13)
-        return -2;
-    if ((iss == 15) && (v->permission & PTE_RO))
+    bool write = (iss & ISS_WNR) != 0;
+    if (write && (v->permission & PTE_RO))
         return -3;
 
     va = PAGE_BASE(va);
-    void *mem = kalloc_page();
-    if (mem == NULL)
-        return -4;
-    memset(mem, 0, PAGE_SIZE);
-    vmmap(&p->pgdir, va, mem, v->permission);
+    // 私有可写映射：先只读映射缓存页，写的时候再复制
+    bool cow = !(v->permission & PTE_RO) && (v->flags & MAP_PRIVATE);
+    PTEntriesPtr pte = get_pte(&p->pgdir, va, false);
+    if (pte != NULL && (*pte & PTE_VALID)) {
+        if (!(write && cow && (*pte & PTE_RO)))
+            return -2;
+        cow_page(&p->pgdir, va, pte, v->permission);
+        return 0;
+    }
+
     File *f = v->file;
-    inodes.lock(f->ip);
-    inodes.read(f->ip, mem, v->off + va - v->start, PAGE_SIZE);
-    inodes.unlock(f->ip);
+    if (f == NULL) {
+        // 私有匿名映射的读缺页只映射零页，第一次写时再分配
+        // 整块落在 vma 内时优先用 2MiB 块映射
+        if (cow && !write) {
+            vmmap(&p->pgdir, va, get_zero_page(), v->permission | PTE_RO);
+        } else if (!try_map_huge(&p->pgdir, va, v->start, v->end,
+                                 v->permission)) {
+            void *mem = kalloc_page();
+            vmmap(&p->pgdir, va, mem, v->permission);
+            kfree_page(mem);
+        }
+        return 0;
+    }
+    if (v->off % PAGE_SIZE != 0) {
+        // 文件偏移没有按页对齐，无法共享缓存页，单独读一份
+        void *mem = kalloc_page();
+        inodes.lock(f->ip);
+        if (v->off + va - v->start < f->ip->entry.num_bytes)
+            inodes.read(f->ip, mem, v->off + va - v->start, PAGE_SIZE);
+        inodes.unlock(f->ip);
+        vmmap(&p->pgdir, va, mem, v->permission);
+        kfree_page(mem);
+        return 0;
+    }
+
+    u64 index = (v->off + va - v->start) / PAGE_SIZE;
+    vma_readahead(v, index);
+    void *page = pagecache_get(f->ip, index);
+    u64 flags = cow ? (v->permission | PTE_RO) : v->permission;
+    if (cow && write) {
+        void *mem = kalloc_page();
+        memcpy(mem, page, PAGE_SIZE);
+        vmmap(&p->pgdir, va, mem, v->permission);
+        kfree_page(mem);
+    } else {
+        vmmap(&p->pgdir, va, page, flags);
+    }
+    kfree_page(page);
+    if (v->advice != MADV_RANDOM) {
+        pagecache_fault_around(&p->pgdir, v, va, flags);
+    }
     return 0;
 }
 
@@ -246,6 +408,10 @@ int pgfault_handler(u64 iss) {
     struct pgdir *pd = &p->pgdir;
     u64 addr = arch_get_far(); // Attempting to access this address caused the
                                // page fault
+    // 换出的页和被老化的页
+    if (swap_fault(pd, addr, iss) == 0) {
+        return 0;
+    }
     // vma:
     if (mmap_handler(addr, iss) == 0) {
         return 0;
@@ -268,101 +434,66 @@ int pgfault_handler(u64 iss) {
     }
     // 2. Check section flags to determine page fault type
     // 3. Handle the page fault accordingly
+    // 不属于任何段：由调用者决定杀死进程（EL0）或走异常修复表（EL1）
     if (sec == NULL) {
-        // MYTODO 改成kill
-        if (kill(p->pid)) {
-        }
-        // PANIC();
         _release_spinlock(&pd->lock);
-        return 0;
+        return -1;
     }
+    int ret = 0;
     if (sec->flags == (u64)ST_HEAP) {
         // printk("Heap\n");
-        void *new_page = kalloc_page();
+        u64 flags = PTE_RW | PTE_VALID | PTE_USER_DATA;
         PTEntriesPtr pte = get_pte(pd, addr, false);
-        if (pte != NULL) {
-            printk("pte = %llx\n", (u64)*pte);
-        }
         if (pte == NULL || !(*pte & PTE_VALID)) {
-            // Lazy Allocation
-            printk("Heap:Lazy Allocation\n");
-            pte = get_pte(pd, addr, true);
-            vmmap(pd, addr, new_page, PTE_RW | PTE_VALID | PTE_USER_DATA);
+            // Lazy Allocation：读只映射零页，写时再真正分配
+            if (!(iss & ISS_WNR)) {
+                vmmap(pd, addr, get_zero_page(), flags | PTE_RO);
+            } else if (!try_map_huge(pd, addr, sec->begin, sec->end, flags)) {
+                // 整个 2MiB 对齐块都在堆内且尚未映射时用块映射
+                void *new_page = kalloc_page();
+                vmmap(pd, addr, new_page, flags);
+                kfree_page(new_page);
+            }
         } else if ((u64)*pte & (u64)PTE_RO) {
-            // COW
-            printk("Heap:COW\n");
-            void *old_page = (void *)P2K(PTE_ADDRESS(*pte));
-            memcpy(new_page, old_page, PAGE_SIZE);
-            vmmap(pd, addr, new_page, PTE_RW | PTE_VALID | PTE_USER_DATA);
+            cow_page(pd, addr, pte, flags);
         } else {
-            // MYTODO 改成PANIC
-            if (kill(p->pid)) {
-            }
-            // PANIC();
+            ret = -1;
         }
-        arch_tlbi_vmalle1is();
     } else if (sec->flags == (u64)ST_BSS) {
         // printk("Bss\n");
         PTEntriesPtr pte = get_pte(pd, addr, false);
         if (pte == NULL || !(*pte & PTE_VALID)) {
-            // MYTODO:PANIC改成kill
-
-            if (kill(p->pid)) {
-            }
-            // PANIC();
-        }
-        if (*pte & PTE_RO) {
+            ret = -1;
+        } else if (*pte & PTE_RO) {
             // bss段的COW
             // printk("Bss:COW\n");
-            void *new_page = kalloc_page();
-            void *old_page = (void *)P2K(PTE_ADDRESS(*pte));
-            memcpy(new_page, old_page, PAGE_SIZE);
-            vmmap(pd, addr, new_page,
-                  PTE_RW | PTE_VALID | PTE_USER_DATA | PTE_BSS);
+            cow_page(pd, addr, pte,
+                     PTE_RW | PTE_VALID | PTE_USER_DATA | PTE_BSS);
         }
-        arch_tlbi_vmalle1is();
     } else if (sec->flags == (u64)ST_DATA) {
         // printk("Data\n");
         PTEntriesPtr pte = get_pte(pd, addr, false);
         if (pte == NULL || !(*pte & PTE_VALID)) {
-            PANIC();
-        }
-        if ((*pte & PTE_RO)) {
+            ret = -1;
+        } else if ((*pte & PTE_RO)) {
             // COW
-            void *new_page = kalloc_page();
-            void *old_page = (void *)P2K(PTE_ADDRESS(*pte));
-            memcpy(new_page, old_page, PAGE_SIZE);
-            vmmap(pd, addr, new_page, PTE_RW | PTE_VALID | PTE_USER_DATA);
+            cow_page(pd, addr, pte, PTE_RW | PTE_VALID | PTE_USER_DATA);
         }
-        arch_tlbi_vmalle1is();
-
-        // MYTODO:改成kill
     } else if (sec->flags == (u64)ST_TEXT) {
         // printk("text\n");
-        // PANIC();
-        if (kill(p->pid)) {
-        }
-        // MYTODO:改成kill
+        ret = -1;
     } else if (sec->flags == (u64)ST_STACK) {
         // printk("stack\n");
         PTEntriesPtr pte = get_pte(pd, addr, false);
+        // 栈段覆盖堆顶到 STACK_TOP，大多数错误的用户指针落在这里：
+        // 没有映射或已经可写都返回 -1，由调用者杀进程或走 __ex_table
         if (!is_valid_pte(pte)) {
-            // MYTODO 改成kill
-            if (kill(p->pid)) {
-            }
-            // PANIC();
-        }
-        if (*pte & PTE_RO) {
+            ret = -1;
+        } else if (*pte & PTE_RO) {
             // COW
-            void *new_page = kalloc_page();
-            void *old_page = (void *)P2K(PTE_ADDRESS(*pte));
-            memcpy(new_page, old_page, PAGE_SIZE);
-            vmmap(pd, addr, new_page, PTE_RW | PTE_VALID | PTE_USER_DATA);
+            cow_page(pd, addr, pte, PTE_RW | PTE_VALID | PTE_USER_DATA);
         } else {
-            // Lazy Allocation
-            PANIC();
-            // if (kill(p->pid)) {
-            // }
+            ret = -1;
         }
         // stack
     }
@@ -371,5 +502,5 @@ int pgfault_handler(u64 iss) {
     // 4. Return to user code or kill the process
     // p->ucontext->elr = p->ucontext->elr - 4;
 
-    return 0;
+    return ret;
 }
\ No newline at end of file
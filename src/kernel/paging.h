@@ -13,6 +13,8 @@
 #define ST_BSS ST_FILE
 
 #define STACK_TOP 0x800000
+// init_sections 为每个进程分配的段数
+#define NR_SECTIONS 5
 
 struct section {
     u64 flags;
@@ -38,6 +40,7 @@ struct sections_info {
     u64 stack_end;
 };
 
+// 返回 0 表示已处理；-1 表示非法访问，由 trap 处理（杀进程或异常修复）
 int pgfault_handler(u64 iss);
 void init_sections(ListNode *section_head);
 void copy_sections(struct pgdir *dst, struct pgdir *src);
@@ -45,4 +48,20 @@ void set_sections(struct pgdir *dst, struct sections_info secs);
 void get_sections(struct pgdir *src, struct sections_info *secs);
 void free_sections(struct pgdir *pd);
 struct section *get_section_by_va(u64 va);
-u64 sbrk(i64 size);
\ No newline at end of file
+u64 sbrk(i64 size);
+/**
+    @brief madvise for the mmap areas and the heap of the current process.
+    MADV_WILLNEED starts readahead of file pages and swaps in anonymous
+    pages, MADV_DONTNEED drops the pages (shared anonymous mappings are left
+    alone), MADV_NORMAL/SEQUENTIAL/RANDOM set the readahead policy of the mmap
+    areas.
+    @return 0 (also for an empty range), -EINVAL on a bad argument, or -ENOMEM
+    if nothing in the range is mapped.
+ */
+int vm_madvise(u64 addr, u64 len, int advice);
+/**
+    @brief map the 2MiB aligned block containing `va` with one block descriptor
+    if the whole block lies in [begin, end) and nothing is mapped there yet.
+    @return false if the block is not eligible or the huge page pool is empty.
+ */
+bool try_map_huge(struct pgdir *pd, u64 va, u64 begin, u64 end, u64 flags);
\ No newline at end of file
@@ -174,6 +174,28 @@ int kill(int pid) {
     return 0;
 }
 
+void for_each_proc(bool (*fn)(struct proc *, void *), void *arg) {
+    struct MyQueue q;
+    initQueue(&q);
+    _acquire_spinlock(&pLock);
+    enqueue(&q, &root_proc);
+    bool stop = false;
+    while (!isEmpty(&q)) {
+        auto proc = dequeue(&q);
+        if (stop || fn(proc, arg)) {
+            stop = true;
+            continue;
+        }
+        _for_in_list(p, &proc->children) {
+            if (p == &proc->children) {
+                break;
+            }
+            enqueue(&q, container_of(p, struct proc, ptnode));
+        }
+    }
+    _release_spinlock(&pLock);
+}
+
 int start_proc(struct proc *p, void (*entry)(u64), u64 arg) {
     // TODO
     // 1. set the parent to root_proc if NULL
@@ -221,6 +243,8 @@ void init_proc(struct proc *p) {
     init_schinfo(&p->schinfo);
     p->kstack = kalloc_page();
     memset(p->kstack, 0, PAGE_SIZE);
+    p->kernel_bytes =
+        sizeof(struct proc) + PAGE_SIZE + NR_SECTIONS * sizeof(struct section);
     p->kcontext =
         (KernelContext *)((u64)p->kstack + PAGE_SIZE - 16 -
                           sizeof(KernelContext) - sizeof(UserContext));
@@ -252,25 +276,13 @@ void copy_pgdir(struct pgdir *dst, struct pgdir *src) {
     ListNode *temp = src->section_head.next;
     while (temp != (&src->section_head) /* .next->prev */) {
         auto section = container_of(temp, struct section, stnode);
-        for (u64 addr = section->begin; addr < section->end;
-             addr = PAGE_BASE(addr + PAGE_SIZE)) {
-            PTEntriesPtr pte = get_pte(src, addr, false);
-            if ((pte == NULL || !(*pte & PTE_VALID)) &&
-                (section->flags != ST_HEAP)) {
-                printk("section->begin = %llx\n", section->begin);
-                printk("section->end = %llx\n", section->end);
-                printk("addr = %llx\n", addr);
-                printk("flags = %llx\n", section->flags);
-                printk("pte = %llx\n", (u64)pte);
-                PANIC();
-            }
-            vmmap(dst, addr, (void *)(P2K(PTE_ADDRESS(*pte))),
-                  PTE_FLAGS(*pte) | PTE_RO);
-            *pte = *pte | PTE_RO;
-        }
+        // 父子进程共享页面，两边都改为只读以实现 COW。
+        // 别的进程缺页时可能在换出 src 的页
+        _acquire_spinlock(&src->lock);
+        copy_range(dst, src, section->begin, section->end, true);
+        _release_spinlock(&src->lock);
         temp = temp->next;
     }
-    arch_tlbi_vmalle1is();
 }
 
 // void copy_pgdir(struct pgdir *dst, struct pgdir *src) {
@@ -421,6 +433,7 @@ int fork() { /* TODO: Your code here. */
         if (this->oftable.files[i] != NULL) {
             newProc->oftable.files[i] = this->oftable.files[i];
             file_dup(newProc->oftable.files[i]);
+            newProc->kernel_bytes += file_kernel_bytes(this->oftable.files[i]);
         }
     }
     newProc->cwd = this->cwd;
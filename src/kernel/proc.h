@@ -36,6 +36,12 @@ typedef struct vma {
     File *file;
     struct vma *next;
     int ref;
+    // 顺序预读状态（文件页号）：上次缺页、下一个未预读的页、当前窗口大小
+    u64 ra_prev;
+    u64 ra_next;
+    u64 ra_size;
+    // madvise 设置的访问模式：MADV_NORMAL、MADV_SEQUENTIAL 或 MADV_RANDOM
+    int advice;
 } vma;
 
 struct proc {
@@ -56,6 +62,9 @@ struct proc {
     struct oftable oftable;
     Inode *cwd; // current working dictionary
     vma *vma[NCVMA];
+    // 进程持有的内核对象占用的字节数：proc 结构、内核栈、段描述，
+    // 以及随分配和释放更新的 vma、打开的文件和管道
+    u64 kernel_bytes;
 };
 
 // void init_proc(struct proc*);
@@ -64,6 +73,12 @@ int start_proc(struct proc *, void (*entry)(u64), u64 arg);
 NO_RETURN void exit(int code);
 WARN_RESULT int wait(int *exitcode);
 WARN_RESULT int kill(int pid);
+/**
+    @brief call `fn` on every process in the process tree until it returns
+    true.
+    @note `fn` runs with the process tree locked and must not sleep.
+ */
+void for_each_proc(bool (*fn)(struct proc *, void *), void *arg);
 WARN_RESULT int fork();
 vma *vma_alloc();
 void writeback(vma *v, u64 addr, u64 n);
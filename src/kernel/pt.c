@@ -4,11 +4,9 @@
 #include <kernel/paging.h>
 #include <kernel/printk.h>
 #include <kernel/pt.h>
+#include <kernel/swap.h>
 #define PHYSTOP 0x3f000000 /* Top physical memory */
 
-#define MY_PAGE_COUNT (PHYSTOP / PAGE_SIZE)
-
-extern struct page pages_ref_array[MY_PAGE_COUNT];
 PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) {
     // TODO
     // Return a pointer to the PTE (Page Table Entry) for virtual address 'va'
@@ -22,6 +20,7 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) {
         if (alloc) {
             pgdir->pt = kalloc_page();
             memset((void *)pgdir->pt, 0, PAGE_SIZE);
+            pgdir->pt_pages++;
         } else {
             return NULL;
         }
@@ -32,6 +31,10 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) {
         index[i] = (va >> (39 - i * 9)) & 0x1ff;
     }
     for (int i = 0; i < 3; i++) {
+        // 需要访问 4KiB 表项时，先把 2MiB 块映射拆开
+        if (is_huge_pte(pgdir_pt[index[i]])) {
+            split_huge(pgdir, &pgdir_pt[index[i]]);
+        }
         if (!((pgdir_pt[index[i]] & PTE_TABLE) == PTE_TABLE)) {
             if (alloc) {
                 for (int j = i; j < 3; j++) {
@@ -39,6 +42,7 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) {
                     memset((void *)pt, 0, PAGE_SIZE);
                     pgdir_pt[index[j]] = K2P(pt) | PTE_TABLE;
                     ASSERT(pgdir_pt[index[j]] < PHYSTOP);
+                    pgdir->pt_pages++;
                     pgdir_pt = pt;
                 }
 
@@ -54,10 +58,298 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc) {
     return pgdir_pt + index[3];
 }
 
+PTEntriesPtr get_pmd(struct pgdir *pgdir, u64 va, bool alloc) {
+    if (pgdir->pt == NULL) {
+        if (!alloc)
+            return NULL;
+        pgdir->pt = kalloc_page();
+        pgdir->pt_pages++;
+    }
+    PTEntriesPtr pt = pgdir->pt;
+    u64 index[2] = {VA_PART0(va), VA_PART1(va)};
+    for (int i = 0; i < 2; i++) {
+        if ((pt[index[i]] & PTE_TABLE) != PTE_TABLE) {
+            if (!alloc)
+                return NULL;
+            u64 *next = kalloc_page();
+            pt[index[i]] = K2P(next) | PTE_TABLE;
+            pgdir->pt_pages++;
+        }
+        pt = (PTEntriesPtr)P2K(PTE_ADDRESS(pt[index[i]]));
+    }
+    return pt + VA_PART2(va);
+}
+
+void split_huge(struct pgdir *pd, PTEntriesPtr pmd) {
+    ASSERT(is_huge_pte(*pmd));
+    PTEntriesPtr pt = kalloc_page();
+    u64 pa = PTE_ADDRESS(*pmd);
+    u64 flags = (PTE_FLAGS(*pmd) & ~(u64)PTE_TABLE) | PTE_PAGE;
+    for (int i = 0; i < N_PTE_PER_TABLE; i++) {
+        pt[i] = (pa + (u64)i * PAGE_SIZE) | flags;
+    }
+    // 改变映射粒度前先 break-before-make
+    *pmd = 0;
+    arch_tlbi_vmalle1is();
+    *pmd = K2P(pt) | PTE_TABLE;
+    pd->pt_pages++;
+}
+
+void vmmap_huge(struct pgdir *pd, u64 va, void *ka, u64 flags) {
+    ASSERT(HUGE_BASE(va) == va && HUGE_BASE(K2P(ka)) == K2P(ka));
+    PTEntriesPtr pmd = get_pmd(pd, va, true);
+    // 只在该 2MiB 范围还没有页表时使用块映射
+    ASSERT(*pmd == 0);
+    *pmd = K2P(ka) | (flags & ~(u64)(PTE_TABLE | PTE_BSS)) | PTE_BLOCK;
+    arch_tlbi_vmalle1is();
+    for (int i = 0; i < HUGE_PAGE_PAGES; i++) {
+        kshare_page(ka + i * PAGE_SIZE);
+    }
+    pd->rss += HUGE_PAGE_PAGES;
+}
+
+void unmap_huge(struct pgdir *pd, PTEntriesPtr pmd) {
+    ASSERT(is_huge_pte(*pmd));
+    kfree_huge_page((void *)P2K(PTE_ADDRESS(*pmd)));
+    *pmd = 0;
+    pd->rss -= HUGE_PAGE_PAGES;
+}
+
+/*
+ * Range operations. Each of them walks the tree once for [begin, end):
+ * subtrees without a valid entry are skipped, intermediate tables emptied by
+ * unmap_range are freed, and the TLB is flushed once at the end.
+ */
+#define PT_LEVEL_SHIFT(level) (39 - 9 * (level))
+#define PT_LEVEL_SIZE(level) (1ull << PT_LEVEL_SHIFT(level))
+#define PT_INDEX(va, level) (((va) >> PT_LEVEL_SHIFT(level)) & 0x1ff)
+
+// va 所在的 level 级表项覆盖范围的结束地址（不超过 end）
+static u64 level_next(u64 va, int level, u64 end) {
+    u64 next = (va & ~(PT_LEVEL_SIZE(level) - 1)) + PT_LEVEL_SIZE(level);
+    return next > end ? end : next;
+}
+
+// 范围不大时只失效这些页的 TLB 表项，否则整个刷掉
+#define TLBI_RANGE_MAX_PAGES 64
+
+static void flush_tlb_range(u64 begin, u64 end) {
+    if ((end - begin) / PAGE_SIZE > TLBI_RANGE_MAX_PAGES)
+        arch_tlbi_vmalle1is();
+    else
+        arch_tlbi_range(begin, end);
+}
+
+static bool is_empty_table(PTEntriesPtr pt) {
+    for (int i = 0; i < N_PTE_PER_TABLE; i++) {
+        if (pt[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+static PTEntriesPtr next_table(u64 pte) {
+    return (PTEntriesPtr)P2K(PTE_ADDRESS(pte));
+}
+
+static PTEntriesPtr alloc_table(struct pgdir *pd) {
+    pd->pt_pages++;
+    return kalloc_page();
+}
+
+static void free_table(struct pgdir *pd, PTEntriesPtr pt) {
+    pd->pt_pages--;
+    kfree_page(pt);
+}
+
+// 共享零页不计入常驻页数
+static bool is_rss_pte(u64 pte) {
+    return (pte & PTE_VALID) && !is_zero_page((void *)P2K(PTE_ADDRESS(pte)));
+}
+
+static void map_level(struct pgdir *pd, PTEntriesPtr pt, int level, u64 begin,
+                      u64 end, u64 pa, u64 flags) {
+    for (u64 va = begin, next; va < end; va = next) {
+        next = level_next(va, level, end);
+        PTEntry *e = &pt[PT_INDEX(va, level)];
+        if (level == 3) {
+            u64 old = *e;
+            *e = (pa + va - begin) | flags;
+            kshare_page((void *)P2K(pa + va - begin));
+            pd->rss += is_rss_pte(*e);
+            if (old & PTE_VALID) {
+                pd->rss -= is_rss_pte(old);
+                kfree_page((void *)P2K(PTE_ADDRESS(old)));
+            } else if (is_swap_pte(old)) {
+                pd->swap_ents--;
+                swap_free(swap_pte_slot(old));
+            }
+            continue;
+        }
+        if (level == 2 && is_huge_pte(*e))
+            split_huge(pd, e);
+        if ((*e & PTE_TABLE) != PTE_TABLE)
+            *e = K2P(alloc_table(pd)) | PTE_TABLE;
+        map_level(pd, next_table(*e), level + 1, va, next, pa + va - begin,
+                  flags);
+    }
+}
+
+void vmmap_range(struct pgdir *pd, u64 begin, u64 end, void *ka, u64 flags) {
+    ASSERT(PAGE_BASE(begin) == begin);
+    if (pd->pt == NULL)
+        pd->pt = alloc_table(pd);
+    map_level(pd, pd->pt, 0, begin, end, K2P(ka), flags);
+    flush_tlb_range(begin, end);
+}
+
+// 返回该表是否已经为空
+static bool unmap_level(struct pgdir *pd, PTEntriesPtr pt, int level,
+                        u64 begin, u64 end, bool do_free) {
+    for (u64 va = begin, next; va < end; va = next) {
+        next = level_next(va, level, end);
+        PTEntry *e = &pt[PT_INDEX(va, level)];
+        if (level == 3 && is_swap_pte(*e)) {
+            // 换出的页没有物理页，只需释放交换槽
+            if (do_free)
+                swap_free(swap_pte_slot(*e));
+            *e = 0;
+            pd->swap_ents--;
+            continue;
+        }
+        if (!(*e & PTE_VALID))
+            continue;
+        if (level == 3) {
+            pd->rss -= is_rss_pte(*e);
+            if (do_free)
+                kfree_page((void *)P2K(PTE_ADDRESS(*e)));
+            *e = 0;
+            continue;
+        }
+        if (level == 2 && is_huge_pte(*e)) {
+            if (next - va == HUGE_PAGE_SIZE) {
+                if (do_free) {
+                    unmap_huge(pd, e);
+                } else {
+                    *e = 0;
+                    pd->rss -= HUGE_PAGE_PAGES;
+                }
+                continue;
+            }
+            split_huge(pd, e);
+        }
+        PTEntriesPtr child = next_table(*e);
+        if (unmap_level(pd, child, level + 1, va, next, do_free)) {
+            *e = 0;
+            free_table(pd, child);
+        }
+    }
+    return is_empty_table(pt);
+}
+
+void unmap_range(struct pgdir *pd, u64 begin, u64 end, bool do_free) {
+    if (pd->pt == NULL || begin >= end)
+        return;
+    unmap_level(pd, pd->pt, 0, PAGE_BASE(begin), end, do_free);
+    flush_tlb_range(begin, end);
+}
+
+static void protect_level(struct pgdir *pd, PTEntriesPtr pt, int level,
+                          u64 begin, u64 end, u64 set, u64 clear) {
+    for (u64 va = begin, next; va < end; va = next) {
+        next = level_next(va, level, end);
+        PTEntry *e = &pt[PT_INDEX(va, level)];
+        // 换出的页同样修改保存下来的属性位，换入后生效
+        if (level == 3 && is_swap_pte(*e)) {
+            *e = (*e | set) & ~(clear | PTE_VALID);
+            continue;
+        }
+        if (!(*e & PTE_VALID))
+            continue;
+        if (level == 2 && is_huge_pte(*e)) {
+            if (next - va == HUGE_PAGE_SIZE) {
+                *e = (*e | set) & ~clear;
+                continue;
+            }
+            split_huge(pd, e);
+        }
+        if (level == 3) {
+            *e = (*e | set) & ~clear;
+            continue;
+        }
+        protect_level(pd, next_table(*e), level + 1, va, next, set, clear);
+    }
+}
+
+void protect_range(struct pgdir *pd, u64 begin, u64 end, u64 set, u64 clear) {
+    if (pd->pt == NULL || begin >= end)
+        return;
+    protect_level(pd, pd->pt, 0, PAGE_BASE(begin), end, set, clear);
+    flush_tlb_range(begin, end);
+}
+
+static void copy_level(struct pgdir *pd, PTEntriesPtr dst, PTEntriesPtr src,
+                       int level, u64 begin, u64 end, bool cow) {
+    for (u64 va = begin, next; va < end; va = next) {
+        next = level_next(va, level, end);
+        PTEntry *s = &src[PT_INDEX(va, level)];
+        PTEntry *d = &dst[PT_INDEX(va, level)];
+        if (level == 3 && is_swap_pte(*s)) {
+            // 子进程共享交换槽，换入时各自读一份
+            if (*d != 0)
+                continue;
+            if (cow)
+                *s |= PTE_RO;
+            *d = *s;
+            swap_dup(swap_pte_slot(*s));
+            pd->swap_ents++;
+            continue;
+        }
+        if (!(*s & PTE_VALID))
+            continue;
+        bool huge = level == 2 && is_huge_pte(*s);
+        if (level == 3 || huge) {
+            // 区间重叠时可能已经复制过
+            if (*d & PTE_VALID)
+                continue;
+            if (cow)
+                *s |= PTE_RO;
+            *d = *s;
+            void *ka = (void *)P2K(PTE_ADDRESS(*s));
+            for (int i = 0; i < (huge ? HUGE_PAGE_PAGES : 1); i++) {
+                kshare_page(ka + i * PAGE_SIZE);
+            }
+            pd->rss += huge ? HUGE_PAGE_PAGES : is_rss_pte(*d);
+            continue;
+        }
+        if (!(*d & PTE_VALID))
+            *d = K2P(alloc_table(pd)) | PTE_TABLE;
+        if ((*d & PTE_TABLE) != PTE_TABLE)
+            continue;
+        copy_level(pd, next_table(*d), next_table(*s), level + 1, va, next,
+                   cow);
+    }
+}
+
+void copy_range(struct pgdir *dst, struct pgdir *src, u64 begin, u64 end,
+                bool cow) {
+    if (src->pt == NULL || begin >= end)
+        return;
+    if (dst->pt == NULL)
+        dst->pt = alloc_table(dst);
+    copy_level(dst, dst->pt, src->pt, 0, PAGE_BASE(begin), end, cow);
+    if (cow)
+        arch_tlbi_vmalle1is();
+}
+
 void init_pgdir(struct pgdir *pgdir) {
     pgdir->pt = kalloc_page();
     memset((void *)pgdir->pt, 0, PAGE_SIZE);
     init_spinlock(&pgdir->lock);
+    pgdir->swap_hand = 0;
+    pgdir->rss = 0;
+    pgdir->swap_ents = 0;
+    pgdir->pt_pages = 1;
     init_list_node(&pgdir->section_head);
     init_sections(&(pgdir->section_head));
 }
@@ -71,9 +363,14 @@ void free_pgdir(struct pgdir *pgdir) {
     // Free pages used by the page table. If pgdir->pt=NULL, do nothing.
     // DONT FREE PAGES DESCRIBED BY THE PAGE TABLE
     free_sections(pgdir);
+    // 换出扫描可能在别的 CPU 上遍历这个页表，先置空再释放
+    _acquire_spinlock(&pgdir->lock);
     PTEntriesPtr pt0 = pgdir->pt;
-    if (pt0 == NULL)
+    if (pt0 == NULL) {
+        _release_spinlock(&pgdir->lock);
         return;
+    }
+    pgdir->pt = NULL;
     for (int i = 0; i < 512; i++) {
         if (is_invalid_pte(pt0[i]))
             continue;
@@ -87,14 +384,29 @@ void free_pgdir(struct pgdir *pgdir) {
                 if (is_invalid_pte(pt2[k]))
                     continue;
                 PTEntriesPtr pt3 = (PTEntriesPtr)P2K(PTE_ADDRESS(pt2[k]));
-                kfree_page(pt3);
+                free_table(pgdir, pt3);
             }
-            kfree_page(pt2);
+            free_table(pgdir, pt2);
         }
-        kfree_page(pt1);
+        free_table(pgdir, pt1);
     }
-    kfree_page(pt0);
-    pgdir->pt = NULL;
+    free_table(pgdir, pt0);
+    _release_spinlock(&pgdir->lock);
+}
+
+void move_pgdir(struct pgdir *dst, struct pgdir *src) {
+    _acquire_spinlock(&dst->lock);
+    ASSERT(dst->pt == NULL && _empty_list(&dst->section_head));
+    dst->pt = src->pt;
+    dst->swap_hand = 0;
+    dst->rss = src->rss;
+    dst->swap_ents = src->swap_ents;
+    dst->pt_pages = src->pt_pages;
+    // 把段链表整个接到 dst 的表头上，顺序不变
+    _merge_list(&dst->section_head, &src->section_head);
+    _detach_from_list(&src->section_head);
+    src->pt = NULL;
+    _release_spinlock(&dst->lock);
 }
 
 void attach_pgdir(struct pgdir *pgdir) {
@@ -110,19 +422,7 @@ void vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags) {
     // Map virtual address 'va' to the physical address represented by kernel
     // address 'ka' in page directory 'pd', 'flags' is the flags for the page
     // table entry
-    PTEntriesPtr pte = get_pte(pd, va, true);
-    if (pte == NULL) {
-        PANIC();
-    }
-    if (*pte & PTE_VALID) {
-        kfree_page((void *)P2K(PTE_ADDRESS(*pte)));
-    }
-    *pte = K2P((u64)ka) | flags;
-    arch_tlbi_vmalle1is();
-    // printk("vmmap:ka = %llx, *pte = %llx\n", (u64)ka, *pte);
-    // printk("vmmap:pages_ref_array index is %llx\n", K2P((u64)ka) /
-    // PAGE_SIZE);
-    _increment_rc(&pages_ref_array[K2P(ka) / PAGE_SIZE].ref);
+    vmmap_range(pd, PAGE_BASE(va), PAGE_BASE(va) + PAGE_SIZE, ka, flags);
 }
 
 /*
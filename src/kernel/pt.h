@@ -7,11 +7,60 @@ struct pgdir {
     PTEntriesPtr pt;
     SpinLock lock;
     ListNode section_head;
+    // 换出扫描的时钟指针（用户虚拟地址）
+    u64 swap_hand;
+    // 内存用量，由下面的页表操作维护
+    u64 rss;       // 映射的物理页数，不含共享零页
+    u64 swap_ents; // 换出到交换区的页数
+    u64 pt_pages;  // 页表本身占用的页数
 };
 
 void init_pgdir(struct pgdir *pgdir);
 WARN_RESULT PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc);
+
+// is `pte` a level-2 descriptor mapping a whole 2MiB block?
+static inline bool is_huge_pte(u64 pte) {
+    return (pte & PTE_TABLE) == PTE_BLOCK;
+}
+/**
+    @brief get the level-2 entry covering `va`, which is either empty, a
+    table or a 2MiB block descriptor. Missing upper tables are allocated only
+    if `alloc` is true.
+    @note unlike get_pte, it never splits a block mapping.
+ */
+WARN_RESULT PTEntriesPtr get_pmd(struct pgdir *pgdir, u64 va, bool alloc);
+// replace the block descriptor `*pmd` by a table of 4KiB entries
+void split_huge(struct pgdir *pd, PTEntriesPtr pmd);
+// map the 2MiB block at kernel address `ka` to `va`, both 2MiB aligned
+void vmmap_huge(struct pgdir *pd, u64 va, void *ka, u64 flags);
+// clear the block descriptor `*pmd` and release its pages
+void unmap_huge(struct pgdir *pd, PTEntriesPtr pmd);
 void vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags);
+/**
+    @brief map the physically contiguous pages starting at `ka` to
+    [begin, end). Old pages mapped there are released.
+ */
+void vmmap_range(struct pgdir *pd, u64 begin, u64 end, void *ka, u64 flags);
+/**
+    @brief unmap every page in [begin, end), releasing the pages if
+    `do_free`. Page-table pages left empty are freed.
+ */
+void unmap_range(struct pgdir *pd, u64 begin, u64 end, bool do_free);
+// set bits `set` and clear bits `clear` of every valid leaf in [begin, end)
+void protect_range(struct pgdir *pd, u64 begin, u64 end, u64 set, u64 clear);
+/**
+    @brief share the pages mapped in [begin, end) of `src` with `dst`.
+    If `cow` is true, both copies become read-only. 2MiB blocks are shared
+    as a whole.
+ */
+void copy_range(struct pgdir *dst, struct pgdir *src, u64 begin, u64 end,
+                bool cow);
 void free_pgdir(struct pgdir *pgdir);
+/**
+    @brief move the page table and the sections of `src` into `dst`, which
+    must have been emptied by `free_pgdir`. `dst` keeps its lock, so the
+    reclaim scan of other CPUs sees either the old or the new table.
+ */
+void move_pgdir(struct pgdir *dst, struct pgdir *src);
 void attach_pgdir(struct pgdir *pgdir);
 int copyout(struct pgdir *pd, void *va, void *p, usize len);
\ No newline at end of file
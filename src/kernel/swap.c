@@ -0,0 +1,372 @@
+#include <aarch64/intrinsic.h>
+#include <aarch64/trap.h>
+#include <common/spinlock.h>
+#include <common/string.h>
+#include <driver/sd.h>
+#include <kernel/init.h>
+#include <kernel/mem.h>
+#include <kernel/paging.h>
+#include <kernel/printk.h>
+#include <kernel/pt.h>
+#include <kernel/sched.h>
+#include <kernel/swap.h>
+#include <sys/mman.h>
+
+static SpinLock swap_lock;
+// 每个交换槽被多少个 PTE 引用，0 表示空闲
+static u16 swap_map[SWAP_MAX_SLOTS];
+static u64 swap_lba;
+static u64 next_slot;
+static struct swap_stat sw_stat;
+// 第一次需要换出时才读取分区表
+static bool swap_probed;
+// 进程的时钟指针：上次换出的进程的 pid
+static int proc_hand;
+
+define_early_init(swap) {
+    init_spinlock(&swap_lock);
+    memset(&sw_stat, 0, sizeof(sw_stat));
+    swap_probed = false;
+    next_slot = 0;
+    proc_hand = 0;
+}
+
+static void swap_probe() {
+    u32 lba, sectors;
+    bool found = sd_get_partition(SWAP_PARTITION, &lba, &sectors);
+    _acquire_spinlock(&swap_lock);
+    if (!swap_probed) {
+        swap_probed = true;
+        if (found) {
+            swap_lba = lba;
+            sw_stat.nr_slots =
+                MIN((u64)sectors / SWAP_SECTORS_PER_PAGE, (u64)SWAP_MAX_SLOTS);
+            printk("swap: %lld pages at sector %lld\n", sw_stat.nr_slots,
+                   swap_lba);
+        }
+    }
+    _release_spinlock(&swap_lock);
+}
+
+// 下次适配分配一个交换槽，交换区满时返回 -1
+static u64 swap_alloc() {
+    u64 slot = (u64)-1;
+    _acquire_spinlock(&swap_lock);
+    // 交换区满时不必扫描整个 swap_map
+    u64 n = sw_stat.used_slots < sw_stat.nr_slots ? sw_stat.nr_slots : 0;
+    for (u64 i = 0; i < n; i++) {
+        u64 s = (next_slot + i) % sw_stat.nr_slots;
+        if (swap_map[s] == 0) {
+            swap_map[s] = 1;
+            sw_stat.used_slots++;
+            next_slot = s + 1;
+            slot = s;
+            break;
+        }
+    }
+    _release_spinlock(&swap_lock);
+    return slot;
+}
+
+void swap_dup(u64 slot) {
+    _acquire_spinlock(&swap_lock);
+    ASSERT(swap_map[slot] != 0 && swap_map[slot] != (u16)-1);
+    swap_map[slot]++;
+    _release_spinlock(&swap_lock);
+}
+
+void swap_free(u64 slot) {
+    _acquire_spinlock(&swap_lock);
+    ASSERT(swap_map[slot] != 0);
+    if (--swap_map[slot] == 0)
+        sw_stat.used_slots--;
+    _release_spinlock(&swap_lock);
+}
+
+static void swap_rw(u64 slot, void *page, bool write) {
+    // 一页是连续的 SWAP_SECTORS_PER_PAGE 个扇区，一条多块命令直接读写整页
+    struct buf b;
+    b.blockno = (u32)(swap_lba + slot * SWAP_SECTORS_PER_PAGE);
+    b.flags = write ? B_MULTI | B_DIRTY | B_VALID : B_MULTI;
+    b.count = SWAP_SECTORS_PER_PAGE;
+    b.addr = page;
+    sdrw(&b);
+}
+
+int swap_fault(struct pgdir *pd, u64 va, u64 iss) {
+    PTEntriesPtr pte = get_pte(pd, va, false);
+    if (pte == NULL)
+        return -1;
+    // 被老化过的页再次被访问：重新置上访问标志
+    if ((iss & FSC_TYPE_MASK) == FSC_ACCESS_FLAG && (*pte & PTE_VALID)) {
+        _acquire_spinlock(&pd->lock);
+        *pte |= AF_USED;
+        _release_spinlock(&pd->lock);
+        return 0;
+    }
+    u64 old = *pte;
+    if (!is_swap_pte(old))
+        return -1;
+
+    // 读盘会睡眠，不能持有 pd->lock；进程是单线程的，期间表项不会变
+    void *page = kalloc_page();
+    swap_rw(swap_pte_slot(old), page, false);
+    _acquire_spinlock(&pd->lock);
+    ASSERT(*pte == old);
+    // vmmap 替换掉换出表项时释放交换槽
+    vmmap(pd, va, page, PTE_FLAGS(old) | PTE_VALID | AF_USED);
+    _release_spinlock(&pd->lock);
+    kfree_page(page);
+
+    _acquire_spinlock(&swap_lock);
+    sw_stat.swap_ins++;
+    _release_spinlock(&swap_lock);
+    return 0;
+}
+
+void swap_in_range(struct pgdir *pd, u64 begin, u64 end) {
+    for (u64 va = PAGE_BASE(begin); va < end; va += PAGE_SIZE) {
+        if (free_queue_cnt() < SWAP_HIGH_PAGES)
+            break;
+        // 没有页表或是 2MiB 块的范围里不会有换出的页
+        PTEntriesPtr pmd = get_pmd(pd, va, false);
+        if (pmd == NULL || (*pmd & PTE_TABLE) != PTE_TABLE) {
+            va = HUGE_BASE(va) + HUGE_PAGE_SIZE - PAGE_SIZE;
+            continue;
+        }
+        PTEntriesPtr pt = (PTEntriesPtr)P2K(PTE_ADDRESS(*pmd));
+        if (is_swap_pte(pt[VA_PART3(va)]))
+            swap_fault(pd, va, FSC_TRANSLATION);
+    }
+}
+
+struct swap_batch {
+    int n;
+    void *page[SWAP_BATCH];
+    u64 slot[SWAP_BATCH];
+};
+
+/*
+ * Clock scan of the leaf PTEs in [begin, end): a recently used page only
+ * loses its access flag, a page still unused since the last pass is moved to
+ * a swap slot. Only pages owned by a single PTE are taken; 2MiB blocks,
+ * shared pages and the zero page stay resident.
+ * Return the address where the scan stopped.
+ */
+static u64 scan_range(struct pgdir *pd, u64 begin, u64 end,
+                      struct swap_batch *b, isize *budget) {
+    u64 va = begin;
+    while (va < end && b->n < SWAP_BATCH && *budget > 0) {
+        u64 next = MIN(HUGE_BASE(va) + HUGE_PAGE_SIZE, end);
+        PTEntriesPtr pmd = get_pmd(pd, va, false);
+        if (pmd == NULL || (*pmd & PTE_TABLE) != PTE_TABLE) {
+            (*budget)--;
+            va = next;
+            continue;
+        }
+        PTEntriesPtr pt = (PTEntriesPtr)P2K(PTE_ADDRESS(*pmd));
+        for (; va < next && b->n < SWAP_BATCH && *budget > 0;
+             va += PAGE_SIZE) {
+            (*budget)--;
+            PTEntry *e = &pt[VA_PART3(va)];
+            if (!(*e & PTE_VALID))
+                continue;
+            void *page = (void *)P2K(PTE_ADDRESS(*e));
+            if (page_ref_cnt(page) != 1)
+                continue;
+            if (*e & AF_USED) {
+                *e &= ~(u64)AF_USED;
+                continue;
+            }
+            u64 slot = swap_alloc();
+            if (slot == (u64)-1) {
+                // 交换区已满
+                *budget = -1;
+                break;
+            }
+            // 页的引用从 PTE 转给 batch，写盘后释放
+            b->page[b->n] = page;
+            b->slot[b->n] = slot;
+            b->n++;
+            *e = make_swap_pte(*e, slot);
+            pd->rss--;
+            pd->swap_ents++;
+        }
+    }
+    return va;
+}
+
+// 匿名内存区域：除代码段外的各段，以及私有的匿名 mmap。
+// 共享的匿名页换出后 fork 会复制槽位，父子各换入一份私有的拷贝，所以不换出
+static int anon_regions(struct proc *p, u64 *rb, u64 *re) {
+    int n = 0;
+    _for_in_list(node, &p->pgdir.section_head) {
+        if (node == &p->pgdir.section_head)
+            continue;
+        struct section *sec = container_of(node, struct section, stnode);
+        if (sec->flags == (u64)ST_TEXT || sec->begin >= sec->end)
+            continue;
+        rb[n] = sec->begin;
+        re[n] = sec->end;
+        n++;
+    }
+    for (int i = 0; i < NCVMA; i++) {
+        vma *v = p->vma[i];
+        if (v == NULL || v->file != NULL || (v->flags & MAP_SHARED))
+            continue;
+        rb[n] = v->start;
+        re[n] = v->end;
+        n++;
+    }
+    // 按起始地址排序，时钟指针单调前进
+    for (int i = 1; i < n; i++) {
+        for (int j = i; j > 0 && rb[j] < rb[j - 1]; j--) {
+            u64 t = rb[j];
+            rb[j] = rb[j - 1];
+            rb[j - 1] = t;
+            t = re[j];
+            re[j] = re[j - 1];
+            re[j - 1] = t;
+        }
+    }
+    return n;
+}
+
+/*
+ * Pick a batch of cold pages of process `p` and unmap them, without any I/O.
+ * Return the remaining scan budget: 0 if it ran out before the batch was
+ * full, or -1 if the swap area is full or `p` has no page table any more.
+ */
+static isize swap_collect(struct proc *p, struct swap_batch *b) {
+    struct pgdir *pd = &p->pgdir;
+    u64 rb[8 + NCVMA], re[8 + NCVMA];
+    isize budget = SWAP_SCAN_MAX;
+
+    _acquire_spinlock(&pd->lock);
+    // 进程正在退出或 exec，页表已经释放
+    if (pd->pt == NULL) {
+        _release_spinlock(&pd->lock);
+        return -1;
+    }
+    int nr = anon_regions(p, rb, re);
+    u64 hand = pd->swap_hand;
+    // 从指针处转两整圈：第一圈老化，第二圈换出
+    for (int round = 0; round < 3 && b->n < SWAP_BATCH && budget > 0;
+         round++) {
+        for (int i = 0; i < nr && b->n < SWAP_BATCH && budget > 0; i++) {
+            if (hand >= re[i])
+                continue;
+            hand = scan_range(pd, MAX(hand, rb[i]), re[i], b, &budget);
+        }
+        if (b->n < SWAP_BATCH && budget > 0)
+            hand = 0;
+    }
+    pd->swap_hand = hand;
+    _release_spinlock(&pd->lock);
+    return budget;
+}
+
+// 有没有可以换出的用户内存。只是提示，swap_collect 持锁时再检查页表
+static bool reclaimable(struct proc *p) {
+    return !p->idle && !is_unused(p) && !is_zombie(p) &&
+           p->pgdir.pt != NULL && p->pgdir.rss > 0;
+}
+
+struct proc_pick {
+    int hand;  // 从这个 pid 之后开始找
+    int next;  // pid 大于 hand 的第一个候选，没有时为 -1
+    int first; // pid 最小的候选，用于绕回
+    int count; // 候选进程数
+};
+
+static bool pick_proc(struct proc *p, void *arg) {
+    struct proc_pick *pk = arg;
+    if (!reclaimable(p))
+        return false;
+    pk->count++;
+    if (p->pid > pk->hand && (pk->next < 0 || p->pid < pk->next))
+        pk->next = p->pid;
+    if (pk->first < 0 || p->pid < pk->first)
+        pk->first = p->pid;
+    return false;
+}
+
+struct proc_collect {
+    int pid;
+    struct swap_batch *b;
+    isize budget;
+};
+
+// 持有进程树的锁，进程不会在扫描期间被回收
+static bool collect_proc(struct proc *p, void *arg) {
+    struct proc_collect *pc = arg;
+    if (p->pid != pc->pid || !reclaimable(p))
+        return false;
+    pc->budget = swap_collect(p, pc->b);
+    return true;
+}
+
+/*
+ * Swap out a batch of cold pages of process `pid`. Return the number of
+ * pages swapped out, which is 0 if the scan budget ran out before a victim
+ * was found, or -1 if nothing can be swapped out at all.
+ */
+static int swap_out(int pid) {
+    struct swap_batch *b = kalloc(sizeof(struct swap_batch));
+    b->n = 0;
+    struct proc_collect pc = {.pid = pid, .b = b, .budget = -1};
+    for_each_proc(collect_proc, &pc);
+    // 清掉的访问标志和换出的表项都要从 TLB 中刷掉
+    arch_tlbi_vmalle1is();
+
+    for (int i = 0; i < b->n; i++) {
+        swap_rw(b->slot[i], b->page[i], true);
+        kfree_page(b->page[i]);
+    }
+    int n = b->n;
+    kfree(b);
+
+    _acquire_spinlock(&swap_lock);
+    sw_stat.swap_outs += n;
+    _release_spinlock(&swap_lock);
+    // 转完两圈仍没有可换出的页，或者交换区已满
+    if (n == 0 && pc.budget != 0)
+        return -1;
+    return n;
+}
+
+void swap_balance() {
+    if (free_queue_cnt() >= SWAP_LOW_PAGES)
+        return;
+    if (!swap_probed)
+        swap_probe();
+    if (sw_stat.nr_slots == 0)
+        return;
+    // 时钟指针按 pid 依次走过所有进程，每个进程内再用自己的指针扫描，
+    // 空闲进程的冷页也会被老化和换出。所有进程都换不出时停下
+    int misses = 0;
+    while (free_queue_cnt() < SWAP_HIGH_PAGES) {
+        _acquire_spinlock(&swap_lock);
+        struct proc_pick pk = {.hand = proc_hand, .next = -1, .first = -1};
+        _release_spinlock(&swap_lock);
+        for_each_proc(pick_proc, &pk);
+        if (pk.count == 0)
+            break;
+        int pid = pk.next >= 0 ? pk.next : pk.first;
+        _acquire_spinlock(&swap_lock);
+        proc_hand = pid;
+        _release_spinlock(&swap_lock);
+        int n = swap_out(pid);
+        if (n > 0) {
+            misses = 0;
+        } else if (n < 0 && ++misses >= pk.count) {
+            break;
+        }
+    }
+}
+
+void swap_get_stat(struct swap_stat *st) {
+    _acquire_spinlock(&swap_lock);
+    memcpy(st, &sw_stat, sizeof(sw_stat));
+    _release_spinlock(&swap_lock);
+}
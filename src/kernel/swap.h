@@ -0,0 +1,73 @@
+#pragma once
+
+#include <aarch64/mmu.h>
+#include <common/buf.h>
+#include <common/defines.h>
+#include <kernel/proc.h>
+
+// 交换区：SD 卡的第三个分区（见 boot/generate-image.py）
+#define SWAP_PARTITION 2
+#define SWAP_MAX_SLOTS (1 << 19)
+#define SWAP_SECTORS_PER_PAGE (PAGE_SIZE / BSIZE)
+
+// 空闲页低于 SWAP_LOW_PAGES 时开始换出，直到回到 SWAP_HIGH_PAGES
+#define SWAP_LOW_PAGES 512
+#define SWAP_HIGH_PAGES 1024
+// 每次最多换出的页数和扫描的表项数
+#define SWAP_BATCH 32
+#define SWAP_SCAN_MAX 8192
+
+/*
+ * A swapped-out page keeps its leaf PTE with PTE_VALID cleared: the attribute
+ * bits are preserved (bit 1 of a page descriptor stays set) and the output
+ * address holds the swap slot.
+ */
+static inline bool is_swap_pte(u64 pte) {
+    return (pte & PTE_TABLE) == (PTE_TABLE & ~PTE_VALID);
+}
+
+static inline u64 swap_pte_slot(u64 pte) { return P2N(PTE_ADDRESS(pte)); }
+
+static inline u64 make_swap_pte(u64 pte, u64 slot) {
+    return (PTE_FLAGS(pte) & ~(u64)PTE_VALID) | (slot << 12);
+}
+
+/**
+    @brief swap statistics.
+ */
+struct swap_stat {
+    u64 nr_slots;   // size of the swap area in pages, 0 if there is none
+    u64 used_slots; // slots referenced by some PTE
+    u64 swap_outs;  // pages written to the swap area
+    u64 swap_ins;   // pages read back on a fault
+};
+
+// take one more reference of a swap slot (a PTE holding it was copied)
+void swap_dup(u64 slot);
+// drop a reference of a swap slot, freeing it on the last one
+void swap_free(u64 slot);
+
+/**
+    @brief handle a fault on a swapped-out or aged page of `pd`.
+    @return 0 if handled, -1 if the fault is not swap related.
+    @note caller must NOT hold `pd->lock`.
+ */
+int swap_fault(struct pgdir *pd, u64 va, u64 iss);
+
+/**
+    @brief read the swapped-out pages of [begin, end) back in, stopping early
+    when free memory gets low.
+    @note caller must NOT hold `pd->lock`.
+ */
+void swap_in_range(struct pgdir *pd, u64 begin, u64 end);
+
+/**
+    @brief swap out cold anonymous pages while free pages are below
+    SWAP_LOW_PAGES. A clock hand moves over all processes, so the cold pages
+    of idle processes are aged and evicted too, not only those of the
+    faulting one.
+    @note must be called without any lock held, e.g. on a user page fault.
+ */
+void swap_balance();
+
+void swap_get_stat(struct swap_stat *st);
@@ -1,3 +1,6 @@
+#include <errno.h>
+
+#include <aarch64/mmu.h>
 #include <common/sem.h>
 #include <kernel/paging.h>
 #include <kernel/printk.h>
@@ -30,55 +33,38 @@ void syscall_entry(UserContext *context) {
         context->x[0] = ret;
     }
 }
-// check if the virtual address [start,start+size) is READABLE by the current
-// user process
-bool user_readable(const void *start, usize size) {
-    // TODO
 
-    const void *start_addr = start;
-    while ((isize)size > 0) {
-        struct section *sec = get_section_by_va((u64)start_addr);
-        if (sec == NULL) {
-            PANIC();
-            return false;
-        }
-        start_addr += PAGE_SIZE;
-        size -= PAGE_SIZE;
-    }
-    return true;
+// implemented in aarch64/usercopy.S
+usize __copy_user(void *dst, const void *src, usize n);
+isize __strncpy_user(char *dst, const char *src, usize n);
+
+// [addr, addr + n) 必须完全落在用户地址空间（低半部分）内
+static bool user_range(u64 addr, usize n) {
+    return addr + n >= addr && ((addr | (addr + n)) & KSPACE_MASK) == 0;
 }
 
-// check if the virtual address [start,start+size) is READABLE & WRITEABLE by
-// the current user process
-bool user_writeable(const void *start, usize size) {
-    // TODO
-    isize count = (isize)size;
-    const void *start_addr = start;
-    while ((isize)count > 0) {
-        struct section *sec = get_section_by_va((u64)start_addr);
-        if (sec == NULL) {
-            PANIC();
-            return false;
-        }
-        if (sec->flags == ST_TEXT) {
-            return false;
-        }
-        start_addr += PAGE_SIZE;
-        count -= PAGE_SIZE;
-    }
-    return true;
+int copy_from_user(void *dst, const void *src, usize n) {
+    if (!user_range((u64)src, n) || __copy_user(dst, src, n) != 0)
+        return -EFAULT;
+    return 0;
 }
 
-// get the length of a string including tailing '\0' in the memory space of
-// current user process return 0 if the length exceeds maxlen or the string is
-// not readable by the current user process
-usize user_strlen(const char *str, usize maxlen) {
-    for (usize i = 0; i < maxlen; i++) {
-        if (user_readable(&str[i], 1)) {
-            if (str[i] == 0)
-                return i + 1;
-        } else
-            return 0;
-    }
+int copy_to_user(void *dst, const void *src, usize n) {
+    if (!user_range((u64)dst, n) || __copy_user(dst, src, n) != 0)
+        return -EFAULT;
     return 0;
-}
\ No newline at end of file
+}
+
+isize strncpy_from_user(char *dst, const char *src, usize n) {
+    if (n == 0)
+        return 0;
+    // 只检查起始地址，字符串可能很短；越界部分由异常表兜底
+    if (!user_range((u64)src, 1))
+        return -EFAULT;
+    usize limit = (~KSPACE_MASK + 1) - (u64)src;
+    isize len = __strncpy_user(dst, src, MIN(n, limit));
+    // 读到用户空间末尾仍没有 '\0'
+    if (len < 0 || (usize)len == limit)
+        return -EFAULT;
+    return len;
+}
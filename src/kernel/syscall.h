@@ -15,6 +15,23 @@ void syscall_entry(UserContext *context);
     }                                                                          \
     static u64 sys_##name(__VA_ARGS__)
 
-bool user_readable(const void *start, usize size);
-bool user_writeable(const void *start, usize size);
-usize user_strlen(const char *str, usize maxlen);
\ No newline at end of file
+/**
+    @brief copy `n` bytes from user address `src` to kernel buffer `dst`.
+    Faults on `src` are caught by the exception table.
+    @return 0 on success, -EFAULT if `src` is not mapped or not a user address.
+ */
+int copy_from_user(void *dst, const void *src, usize n);
+
+/**
+    @brief copy `n` bytes from kernel buffer `src` to user address `dst`.
+    @return 0 on success, -EFAULT if `dst` is not writable user memory.
+ */
+int copy_to_user(void *dst, const void *src, usize n);
+
+/**
+    @brief copy a NUL-terminated string from user address `src`, at most `n`
+    bytes including the '\0'.
+    @return the length of the string, `n` if it does not fit (`dst` is then not
+    terminated), or -EFAULT.
+ */
+isize strncpy_from_user(char *dst, const char *src, usize n);
\ No newline at end of file
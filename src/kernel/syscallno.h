@@ -4,6 +4,9 @@
 #define SYS_yield 124
 #define SYS_myreport 499
 #define SYS_pstat 500
+#define SYS_pcstat 501
+#define SYS_swapstat 502
+#define SYS_memstat 503
 #define SYS_sbrk 12
 #define SYS_brk 214
 #define SYS_mprotect 226
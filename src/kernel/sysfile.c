@@ -4,6 +4,7 @@
 // user code, and calls into file.c and fs.c.
 //
 
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
@@ -19,6 +20,7 @@
 #include <fs/inode.h>
 #include <fs/pipe.h>
 #include <kernel/mem.h>
+#include <kernel/pagecache.h>
 #include <kernel/paging.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
@@ -30,6 +32,9 @@ struct iovec {
     usize iov_len;  /* Number of bytes to transfer. */
 };
 
+// 路径参数的最大长度（含 '\0'）
+#define MAXPATH 256
+
 // MY Code
 static SpinLock sysfile_lock;
 
@@ -60,12 +65,22 @@ int fdalloc(struct file *f) {
     for (i = 0; i < NFILE; i++) {
         if (table->files[i] == NULL) {
             table->files[i] = f;
+            proc->kernel_bytes += file_kernel_bytes(f);
             return i;
         }
     }
     return -1;
 }
 
+// 清空文件描述符 fd，返回它指向的文件，由调用者关闭
+static struct file *fdclear(int fd) {
+    struct proc *proc = thisproc();
+    struct file *f = proc->oftable.files[fd];
+    proc->oftable.files[fd] = NULL;
+    proc->kernel_bytes -= file_kernel_bytes(f);
+    return f;
+}
+
 // ioctl - control device
 define_syscall(ioctl, int fd, u64 request) {
     // 0x5413 is TIOCGWINSZ (I/O Control to Get the WINdow SIZe, a magic request
@@ -81,31 +96,39 @@ define_syscall(mmap, void *addr, int length, int prot, int flags, int fd,
                int offset) {
     // TODO
     // 创新点：支持中间截断
-    if ((isize)addr < 0 || length < 0 || prot < 0 || flags < 0 || fd < 0) {
+    bool anon = (flags & MAP_ANONYMOUS) != 0;
+    if ((isize)addr < 0 || length < 0 || prot < 0 || flags < 0 ||
+        (!anon && fd < 0)) {
         return -1;
     }
     auto p = thisproc();
-    File *f = fd2file(fd);
+    File *f = NULL;
     u64 pte_flag = PTE_USER_DATA;
-    ASSERT(f->ip->valid);
-    if (!(f->ip->entry.type == INODE_REGULAR)) {
-        printk("mmap: not a regular file\n");
-        return -1;
-    }
+    if (!anon) {
+        f = fd2file(fd);
+        if (f == NULL) {
+            return -1;
+        }
+        ASSERT(f->ip->valid);
+        if (!(f->ip->entry.type == INODE_REGULAR)) {
+            printk("mmap: not a regular file\n");
+            return -1;
+        }
 
-    if (!f->readable) {
-        printk("mmap: Unreadable\n");
-        return -1;
-    }
+        if (!f->readable) {
+            printk("mmap: Unreadable\n");
+            return -1;
+        }
 
-    if ((flags & MAP_SHARED) &&
-        ((prot & PROT_WRITE) && (!f->readable || !f->writable))) {
-        printk("mmap: MAP_SHARED failed\n");
-        return -1;
-    }
-    if (f->ref == 0) {
-        printk("mmap: file ref = 0\n");
-        return -1;
+        if ((flags & MAP_SHARED) &&
+            ((prot & PROT_WRITE) && (!f->readable || !f->writable))) {
+            printk("mmap: MAP_SHARED failed\n");
+            return -1;
+        }
+        if (f->ref == 0) {
+            printk("mmap: file ref = 0\n");
+            return -1;
+        }
     }
     if (!(prot & PROT_WRITE)) {
         pte_flag |= PTE_RO;
@@ -116,6 +139,10 @@ define_syscall(mmap, void *addr, int length, int prot, int flags, int fd,
     v->off = offset;
     v->file = f;
     v->flags = flags;
+    v->ra_prev = (u64)-1;
+    v->ra_next = 0;
+    v->ra_size = 0;
+    v->advice = MADV_NORMAL;
     u64 vma_end = 0;
     int i = -1;
     bool found = false;
@@ -132,6 +159,10 @@ define_syscall(mmap, void *addr, int length, int prot, int flags, int fd,
         vma_end = VMA_START;
     }
     v->start = page_ceil(vma_end);
+    if (anon && (u64)length >= HUGE_PAGE_SIZE) {
+        // 大的匿名映射按 2MiB 对齐，以便缺页时使用块映射
+        v->start = HUGE_BASE(vma_end + HUGE_PAGE_SIZE - 1);
+    }
     v->end = v->start + length;
     cvma_alloc(v);
 
@@ -170,6 +201,7 @@ define_syscall(munmap, void *addr, long int length) {
     uvmunmap(&p->pgdir, (u64)addr, length / PAGE_SIZE, 1);
     vma_close(v);
     p->vma[idx] = NULL;
+    p->kernel_bytes -= sizeof(vma);
     if ((u64)addr > v->start) {
         vma *v2 = vma_alloc();
         memcpy(v2, v, sizeof(vma));
@@ -192,6 +224,11 @@ define_syscall(munmap, void *addr, long int length) {
     return 0;
 }
 
+// madvise - give advice about the use of memory
+define_syscall(madvise, void *addr, usize length, int advice) {
+    return vm_madvise((u64)addr, length, advice);
+}
+
 // dup - duplicate a file descriptor
 define_syscall(dup, int fd) {
     struct file *f = fd2file(fd);
@@ -206,33 +243,96 @@ define_syscall(dup, int fd) {
     return fd;
 }
 
+/*
+ * Copy the user path `upath` into the kernel buffer `path` (MAXPATH bytes).
+ * Return 0 on success, -EFAULT on a bad pointer, -1 if it is too long.
+ */
+static int fetch_path(char *path, const char *upath) {
+    isize len = strncpy_from_user(path, upath, MAXPATH);
+    if (len < 0)
+        return -EFAULT;
+    if (len == 0 || len >= MAXPATH)
+        return -1;
+    return 0;
+}
+
 // read - read from a file descriptor
 define_syscall(read, int fd, char *buffer, int size) {
     struct file *f = fd2file(fd);
-    if (!f || size <= 0 || !user_writeable(buffer, size))
-        return -1;
-    return file_read(f, buffer, size);
+    if (!f || size <= 0)
+        return -1;
+    // 先读进内核页再复制给用户，用户缓冲区出错时返回 -EFAULT
+    char *kbuf = kalloc_page();
+    isize tot = 0;
+    while (tot < size) {
+        isize n = MIN((isize)PAGE_SIZE, size - tot);
+        isize r = file_read(f, kbuf, n);
+        if (r < 0 && tot == 0)
+            tot = r;
+        if (r <= 0)
+            break;
+        if (copy_to_user(buffer + tot, kbuf, r) < 0) {
+            tot = -EFAULT;
+            break;
+        }
+        tot += r;
+        // 管道、设备和文件末尾：读到多少返回多少
+        if (r < n || f->type != FD_INODE || f->ip->entry.type == INODE_DEVICE)
+            break;
+    }
+    kfree_page(kbuf);
+    return tot;
+}
+
+// copy `size` bytes from user `buffer` to `f` one page at a time
+static isize write_from_user(struct file *f, const char *buffer, isize size) {
+    char *kbuf = kalloc_page();
+    isize tot = 0;
+    while (tot < size) {
+        isize n = MIN((isize)PAGE_SIZE, size - tot);
+        if (copy_from_user(kbuf, buffer + tot, n) < 0) {
+            tot = -EFAULT;
+            break;
+        }
+        isize r = file_write(f, kbuf, n);
+        if (r < 0 && tot == 0)
+            tot = r;
+        if (r <= 0)
+            break;
+        tot += r;
+        if (r < n)
+            break;
+    }
+    kfree_page(kbuf);
+    return tot;
 }
 
 // write - write to a file descriptor
 define_syscall(write, int fd, char *buffer, int size) {
     struct file *f = fd2file(fd);
-    if (!f || size <= 0 || !user_readable(buffer, size))
+    if (!f || size <= 0)
         return -1;
-    return file_write(f, buffer, size);
+    return write_from_user(f, buffer, size);
 }
 
 // writev - write data into multiple buffers
 define_syscall(writev, int fd, struct iovec *iov, int iovcnt) {
     struct file *f = fd2file(fd);
-    struct iovec *p;
-    if (!f || iovcnt <= 0 || !user_readable(iov, sizeof(struct iovec) * iovcnt))
-        return -1;
-    usize tot = 0;
-    for (p = iov; p < iov + iovcnt; p++) {
-        if (!user_readable(p->iov_base, p->iov_len))
-            return -1;
-        tot += file_write(f, p->iov_base, p->iov_len);
+    if (!f || iovcnt <= 0)
+        return -1;
+    isize tot = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        struct iovec v;
+        if (copy_from_user(&v, &iov[i], sizeof(v)) < 0)
+            return -EFAULT;
+        if (v.iov_len == 0)
+            continue;
+        isize r = write_from_user(f, v.iov_base, v.iov_len);
+        if (r < 0)
+            return tot > 0 ? tot : r;
+        tot += r;
+        if ((usize)r < v.iov_len)
+            break;
     }
     return tot;
 }
@@ -246,25 +346,88 @@ define_syscall(close, int fd) {
     if (f == NULL) {
         return -1;
     }
-    table->files[fd] = NULL;
-    file_close(f);
+    file_close(fdclear(fd));
     return 0;
 }
 
+// fsync - write the delayed blocks of a file to disk
+define_syscall(fsync, int fd) {
+    struct file *f = fd2file(fd);
+    if (!f)
+        return -1;
+    return file_sync(f);
+}
+
+// lseek - reposition the offset of a file descriptor. The offset can be past
+// the end of the file: a write there leaves a hole.
+define_syscall(lseek, int fd, isize offset, int whence) {
+    struct file *f = fd2file(fd);
+    if (!f || f->type != FD_INODE)
+        return -1;
+    isize base;
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = f->off;
+        break;
+    case SEEK_END:
+        inodes.lock(f->ip);
+        base = f->ip->entry.num_bytes;
+        inodes.unlock(f->ip);
+        break;
+    default:
+        return -EINVAL;
+    }
+    if (base + offset < 0 || base + offset > (isize)INODE_MAX_BYTES)
+        return -EINVAL;
+    f->off = base + offset;
+    return f->off;
+}
+
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 1
+#define FALLOC_FL_PUNCH_HOLE 2
+#endif
+
+// fallocate - preallocate blocks of a file, or punch a hole in it
+define_syscall(fallocate, int fd, int mode, isize offset, isize len) {
+    struct file *f = fd2file(fd);
+    if (!f)
+        return -1;
+    if (offset < 0 || len <= 0)
+        return -EINVAL;
+    switch (mode) {
+    case 0:
+        return file_allocate(f, offset, len, false);
+    case FALLOC_FL_KEEP_SIZE:
+        return file_allocate(f, offset, len, true);
+    case FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE:
+        return file_punch(f, offset, len);
+    default:
+        return -EOPNOTSUPP;
+    }
+}
+
 // fstat - get file status
 define_syscall(fstat, int fd, struct stat *st) {
     struct file *f = fd2file(fd);
-    if (!f || !user_writeable(st, sizeof(*st)))
+    struct stat kst;
+    if (!f || file_stat(f, &kst) < 0)
         return -1;
-    return file_stat(f, st);
+    return copy_to_user(st, &kst, sizeof(kst));
 }
 
 // newfstatat - get file status (on some platform also called fstatat64, i.e. a
 // 64-bit version of fstatat)
-define_syscall(newfstatat, int dirfd, const char *path, struct stat *st,
+define_syscall(newfstatat, int dirfd, const char *upath, struct stat *st,
                int flags) {
-    if (!user_strlen(path, 256) || !user_writeable(st, sizeof(*st)))
-        return -1;
+    char path[MAXPATH];
+    struct stat kst;
+    int err = fetch_path(path, upath);
+    if (err < 0)
+        return err;
     if (dirfd != AT_FDCWD) {
         printk("sys_fstatat: dirfd unimplemented\n");
         return -1;
@@ -282,12 +445,12 @@ define_syscall(newfstatat, int dirfd, const char *path, struct stat *st,
         return -1;
     }
     inodes.lock(ip);
-    stati(ip, st);
+    stati(ip, &kst);
     inodes.unlock(ip);
     inodes.put(&ctx, ip);
     bcache.end_op(&ctx);
 
-    return 0;
+    return copy_to_user(st, &kst, sizeof(kst));
 }
 
 // is the directory `dp` empty except for "." and ".." ?
@@ -295,24 +458,28 @@ static int isdirempty(Inode *dp) {
     usize off;
     DirEntry de;
 
-    for (off = 2 * sizeof(de); off < dp->entry.num_bytes; off += sizeof(de)) {
+    // 有 hash 索引的目录中 "." 和 ".." 不一定在最前面
+    for (off = 0; off < dp->entry.num_bytes; off += sizeof(de)) {
         if (inodes.read(dp, (u8 *)&de, off, sizeof(de)) != sizeof(de))
             PANIC();
-        if (de.inode_no != 0)
+        if (de.inode_no != 0 &&
+            strncmp(de.name, ".", FILE_NAME_MAX_LENGTH) != 0 &&
+            strncmp(de.name, "..", FILE_NAME_MAX_LENGTH) != 0)
             return 0;
     }
     return 1;
 }
 
 // unlinkat - delete a name and possibly the file it refers to
-define_syscall(unlinkat, int fd, const char *path, int flag) {
+define_syscall(unlinkat, int fd, const char *upath, int flag) {
     ASSERT(fd == AT_FDCWD && flag == 0);
     Inode *ip, *dp;
-    DirEntry de;
     char name[FILE_NAME_MAX_LENGTH];
     usize off;
-    if (!user_strlen(path, 256))
-        return -1;
+    char path[MAXPATH];
+    int err = fetch_path(path, upath);
+    if (err < 0)
+        return err;
     OpContext ctx;
     bcache.begin_op(&ctx);
     if ((dp = nameiparent(path, name, &ctx)) == 0) {
@@ -341,9 +508,8 @@ define_syscall(unlinkat, int fd, const char *path, int flag) {
         goto bad;
     }
 
-    memset(&de, 0, sizeof(de));
-    if (inodes.write(&ctx, dp, (u8 *)&de, off, sizeof(de)) != sizeof(de))
-        PANIC();
+    // 通过 remove 删除目录项，dentry cache 随之失效
+    inodes.remove(&ctx, dp, off);
     if (ip->entry.type == INODE_DIRECTORY) {
         dp->entry.num_links--;
         inodes.sync(&ctx, dp, true);
@@ -352,6 +518,8 @@ define_syscall(unlinkat, int fd, const char *path, int flag) {
     inodes.put(&ctx, dp);
     ip->entry.num_links--;
     inodes.sync(&ctx, ip, true);
+    if (ip->entry.num_links == 0)
+        pagecache_invalidate(ip->inode_no, 0, (usize)-1);
     inodes.unlock(ip);
     inodes.put(&ctx, ip);
     bcache.end_op(&ctx);
@@ -396,7 +564,7 @@ Inode *create(const char *path, short type, short major, short minor,
         _release_spinlock(&sysfile_lock);
         return NULL;
     }
-    usize inode_no = inodes.alloc(ctx, type);
+    usize inode_no = inodes.alloc_near(ctx, type, parent->inode_no);
     child = inodes.get(inode_no);
     inodes.lock(child);
     inodes.lock(parent);
@@ -439,13 +607,15 @@ Inode *create(const char *path, short type, short major, short minor,
 }
 
 // openat - open a file
-define_syscall(openat, int dirfd, const char *path, int omode) {
+define_syscall(openat, int dirfd, const char *upath, int omode) {
     int fd;
     struct file *f;
     Inode *ip;
     // printk("openat once\n");
-    if (!user_strlen(path, 256))
-        return -1;
+    char path[MAXPATH];
+    int err = fetch_path(path, upath);
+    if (err < 0)
+        return err;
 
     if (dirfd != AT_FDCWD) {
         printk("sys_openat: dirfd unimplemented\n");
@@ -453,7 +623,9 @@ define_syscall(openat, int dirfd, const char *path, int omode) {
     }
 
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op_reserve(&ctx, (omode & O_CREAT)
+                                      ? OP_MAX_NUM_BLOCKS + INODE_INSERT_BLOCKS
+                                      : OP_MAX_NUM_BLOCKS);
     if (omode & O_CREAT) {
         // FIXME: Support acl mode.
         ip = create(path, INODE_REGULAR, 0, 0, &ctx);
@@ -492,10 +664,12 @@ define_syscall(openat, int dirfd, const char *path, int omode) {
 }
 
 // mkdirat - create a directory
-define_syscall(mkdirat, int dirfd, const char *path, int mode) {
+define_syscall(mkdirat, int dirfd, const char *upath, int mode) {
     Inode *ip;
-    if (!user_strlen(path, 256))
-        return -1;
+    char path[MAXPATH];
+    int err = fetch_path(path, upath);
+    if (err < 0)
+        return err;
     if (dirfd != AT_FDCWD) {
         printk("sys_mkdirat: dirfd unimplemented\n");
         return -1;
@@ -505,7 +679,7 @@ define_syscall(mkdirat, int dirfd, const char *path, int mode) {
         return -1;
     }
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op_reserve(&ctx, OP_MAX_NUM_BLOCKS + INODE_INSERT_BLOCKS);
     if ((ip = create(path, INODE_DIRECTORY, 0, 0, &ctx)) == 0) {
         bcache.end_op(&ctx);
         return -1;
@@ -517,11 +691,13 @@ define_syscall(mkdirat, int dirfd, const char *path, int mode) {
 }
 
 // mknodat - create a special or ordinary file
-define_syscall(mknodat, int dirfd, const char *path, mode_t mode, dev_t dev) {
+define_syscall(mknodat, int dirfd, const char *upath, mode_t mode, dev_t dev) {
     printk("mknodat:mode = %d\n", mode);
     Inode *ip;
-    if (!user_strlen(path, 256))
-        return -1;
+    char path[MAXPATH];
+    int err = fetch_path(path, upath);
+    if (err < 0)
+        return err;
     if (dirfd != AT_FDCWD) {
         printk("sys_mknodat: dirfd unimplemented\n");
         return -1;
@@ -531,7 +707,7 @@ define_syscall(mknodat, int dirfd, const char *path, mode_t mode, dev_t dev) {
     unsigned int mi = minor(dev);
     printk("mknodat: path '%s', major:minor %u:%u\n", path, ma, mi);
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op_reserve(&ctx, OP_MAX_NUM_BLOCKS + INODE_INSERT_BLOCKS);
     if ((ip = create(path, INODE_DEVICE, (short)ma, (short)mi, &ctx)) == 0) {
         bcache.end_op(&ctx);
         return -1;
@@ -544,11 +720,15 @@ define_syscall(mknodat, int dirfd, const char *path, mode_t mode, dev_t dev) {
 }
 
 // chdir - change current working directory
-define_syscall(chdir, const char *path) {
+define_syscall(chdir, const char *upath) {
     // TODO
     // change the cwd (current working dictionary) of current process to 'path'
     // you may need to do some validations
     // TODO 当前假设为绝对路径
+    char path[MAXPATH];
+    int err = fetch_path(path, upath);
+    if (err < 0)
+        return err;
     if (strlen(path) > FILE_NAME_MAX_LENGTH) {
         return -1;
     }
@@ -587,16 +767,18 @@ define_syscall(pipe2, int pipefd[2], int flags) {
     int fd_write = -1;
     if ((fd_read = fdalloc(f_read)) < 0 || (fd_write = fdalloc(f_write)) < 0) {
         if (fd_read >= 0) {
-            thisproc()->oftable.files[fd_read] = NULL;
-            file_close(f_read);
+            file_close(fdclear(fd_read));
         }
         if (fd_write >= 0) {
-            thisproc()->oftable.files[fd_write] = NULL;
-            file_close(f_write);
+            file_close(fdclear(fd_write));
         }
         return -1;
     }
-    pipefd[0] = fd_read;
-    pipefd[1] = fd_write;
+    int fds[2] = {fd_read, fd_write};
+    if (copy_to_user(pipefd, fds, sizeof(fds)) < 0) {
+        file_close(fdclear(fd_read));
+        file_close(fdclear(fd_write));
+        return -EFAULT;
+    }
     return 0;
 }
\ No newline at end of file
@@ -1,8 +1,13 @@
+#include <common/string.h>
+#include <errno.h>
 #include <kernel/mem.h>
+#include <kernel/oom.h>
+#include <kernel/pagecache.h>
 #include <kernel/paging.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
 #include <kernel/sched.h>
+#include <kernel/swap.h>
 #include <kernel/syscall.h>
 
 define_syscall(gettid) { return thisproc()->pid; }
@@ -28,6 +33,30 @@ define_syscall(yield) {
 
 define_syscall(pstat) { return (u64)left_page_cnt(); }
 
+// pcstat - copy page cache statistics to user space
+define_syscall(pcstat, struct pagecache_stat *st) {
+    struct pagecache_stat stat;
+    pagecache_get_stat(&stat);
+    return copy_to_user(st, &stat, sizeof(stat));
+}
+
+// swapstat - copy swap statistics to user space
+define_syscall(swapstat, struct swap_stat *st) {
+    struct swap_stat stat;
+    swap_get_stat(&stat);
+    return copy_to_user(st, &stat, sizeof(stat));
+}
+
+// memstat - copy the memory usage of process `pid` (0: the caller) to user
+// space
+define_syscall(memstat, int pid, struct mem_stat *st) {
+    struct mem_stat stat;
+    if (get_mem_stat(pid, &stat) < 0) {
+        return -ESRCH;
+    }
+    return copy_to_user(st, &stat, sizeof(stat));
+}
+
 define_syscall(sbrk, i64 size) { return sbrk(size); }
 
 define_syscall(clone, int flag, void *childstk) {
@@ -48,10 +77,15 @@ define_syscall(exit_group, int n) { exit(n); }
 int execve(const char *path, char *const argv[], char *const envp[]);
 define_syscall(execve, const char *p, void *argv, void *envp) {
     // printk("in execve syscall\n");
-    if (!user_strlen(p, 256)) {
+    char path[256];
+    isize len = strncpy_from_user(path, p, sizeof(path));
+    if (len < 0) {
+        return len;
+    }
+    if (len == 0 || len >= (isize)sizeof(path)) {
         return -1;
     }
-    return execve(p, argv, envp);
+    return execve(path, argv, envp);
 }
 
 define_syscall(wait4, int pid, int options, int *wstatus, void *rusage) {
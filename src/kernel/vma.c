@@ -6,6 +6,7 @@
 #include <kernel/printk.h>
 #include <kernel/proc.h>
 #include <kernel/sched.h>
+#include <kernel/syscall.h>
 // #include <kernel/vma.h>
 #include <sys/mman.h>
 #define NVMA 15
@@ -23,17 +24,16 @@ void copy_vma(struct proc *dst, struct proc *src) {
         if (src->vma[i] == NULL) {
             continue;
         }
-        dst->vma[i] = src->vma[i];
-        vma_dup(src->vma[i]);
-        for (u64 va = src->vma[i]->start; va < src->vma[i]->end;
-             va += PAGE_SIZE) {
-            PTEntriesPtr pte = get_pte(&src->pgdir, va, false);
-            if (pte == NULL || ((*pte & PTE_VALID) == 0)) {
-                continue;
-            }
-            vmmap(&dst->pgdir, va, (void *)(P2K(PTE_ADDRESS(*pte))),
-                  PTE_FLAGS(*pte));
-        }
+        vma *v = src->vma[i];
+        dst->vma[i] = v;
+        dst->kernel_bytes += sizeof(vma);
+        vma_dup(v);
+        // 私有可写映射在父子进程之间写时复制
+        bool cow = (v->flags & MAP_PRIVATE) && !(v->permission & PTE_RO);
+        // 别的进程缺页时可能在换出 src 的页
+        _acquire_spinlock(&src->pgdir.lock);
+        copy_range(&dst->pgdir, &src->pgdir, v->start, v->end, cow);
+        _release_spinlock(&src->pgdir.lock);
     }
 }
 
@@ -52,13 +52,15 @@ void vma_close(vma *v) {
     _acquire_spinlock(&vma_lock);
     v->ref--;
     _release_spinlock(&vma_lock);
-    file_close(v->file);
+    if (v->file != NULL)
+        file_close(v->file);
 }
 
 void vma_dup(vma *vma) {
     _acquire_spinlock(&vma_lock);
     vma->ref++;
-    file_dup(vma->file);
+    if (vma->file != NULL)
+        file_dup(vma->file);
     _release_spinlock(&vma_lock);
 }
 
@@ -68,8 +70,10 @@ void cvma_alloc(vma *vma) {
         auto this_proc = thisproc();
         if (this_proc->vma[i] == NULL) {
             this_proc->vma[i] = vma;
+            this_proc->kernel_bytes += sizeof(*vma);
             vma_dup(vma);
-            file_dup(vma->file);
+            if (vma->file != NULL)
+                file_dup(vma->file);
             return;
         }
     }
@@ -77,46 +81,43 @@ void cvma_alloc(vma *vma) {
 }
 
 void writeback(vma *v, u64 addr, u64 n) {
-    if ((v->permission & PTE_RO) || (v->flags & MAP_PRIVATE)) {
+    if ((v->permission & PTE_RO) || (v->flags & MAP_PRIVATE) ||
+        v->file == NULL) {
         return;
     }
     if ((addr % PAGE_SIZE) != 0) {
         PANIC();
     }
     File *f = v->file;
+    // 按页写回，预留不够时在同一个操作里追加，日志满了才开始新的操作
+    // 先拷到内核缓冲区再加锁：持有 inode 锁时访问用户地址可能缺页，
+    // 而文件映射的缺页处理要再锁同一个 inode
+    u8 *kbuf = kalloc_page();
+    OpContext ctx;
+    bcache.begin_op_reserve(&ctx, 0);
     u64 i = 0;
-    u64 max = 3 * BLOCK_SIZE;
     while (i < n) {
-        u64 n1 = n - i;
-        if (n1 > max) {
-            n1 = max;
+        u64 n1 = MIN(n - i, (u64)PAGE_SIZE);
+        if (copy_from_user(kbuf, (void *)(addr + i), n1) < 0)
+            break;
+        usize blocks = inode_write_blocks(f->ip, n1);
+        if (!bcache.extend_op(&ctx, blocks)) {
+            bcache.end_op(&ctx);
+            bcache.begin_op_reserve(&ctx, blocks);
         }
-        OpContext ctx;
-        bcache.begin_op(&ctx);
         inodes.lock(f->ip);
-        u64 r = inodes.write(&ctx, f->ip, (u8 *)addr + i,
-                             v->off + v->start - addr + i, n1);
+        u64 r = inodes.write(&ctx, f->ip, kbuf,
+                             v->off + addr - v->start + i, n1);
         inodes.unlock(f->ip);
-        bcache.end_op(&ctx);
         i += r;
     }
+    bcache.end_op(&ctx);
+    kfree_page(kbuf);
 }
 void uvmunmap(struct pgdir *pd, u64 va, u64 npages, int do_free) {
-    u64 a;
-    PTEntriesPtr pte;
-
     if ((va % PAGE_SIZE) != 0)
         PANIC();
-
-    for (a = va; a < va + npages * PAGE_SIZE; a += PAGE_SIZE) {
-        if ((pte = get_pte(pd, a, false)) == NULL)
-            continue;
-        if ((*pte & PTE_VALID) == 0)
-            continue;
-        if (do_free) {
-            u64 ka = P2K(PTE_ADDRESS(*pte));
-            kfree_page((void *)ka);
-        }
-        *pte = 0;
-    }
-}
\ No newline at end of file
+    _acquire_spinlock(&pd->lock);
+    unmap_range(pd, va, va + npages * PAGE_SIZE, do_free);
+    _release_spinlock(&pd->lock);
+}
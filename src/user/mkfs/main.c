@@ -33,16 +33,18 @@ typedef uint32_t uint;
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 #define BSIZE         BLOCK_SIZE
 #define LOGSIZE       LOG_MAX_SIZE
-#define NDIRECT       INODE_NUM_DIRECT
-#define NINDIRECT     INODE_NUM_INDIRECT
 #define DIRSIZ        FILE_NAME_MAX_LENGTH
 #define IPB           (BSIZE / sizeof(InodeEntry))
 #define IBLOCK(i, sb) ((i) / IPB + sb.inode_start)
+#define DPB           (BSIZE / sizeof(struct dirent))
+// the root directory has at most one level of index.
+#define MAXROOT       (DX_PER_BLOCK * DPB)
 
 int nbitmap = FSSIZE / (BSIZE * 8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
+int ninodebitmap = NINODES / (BSIZE * 8) + 1;
 int num_log_blocks = LOGSIZE;
-int nmeta;            // Number of meta blocks (boot, sb, num_log_blocks, inode, bitmap)
+int nmeta;            // Number of meta blocks (boot, sb, num_log_blocks, inode, inode bitmap, bitmap)
 int num_data_blocks;  // Number of data blocks
 
 int fsfd;
@@ -50,14 +52,20 @@ SuperBlock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+struct dirent rootents[MAXROOT];
+int nrootents;
 
 void balloc(int);
+void ibitmap(int);
 void wsect(uint, void *);
 void winode(uint, struct dinode *);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint bmap(InodeEntry *din, uint fbn);
+void rootappend(struct dirent *de);
+void rootindex(uint rootino);
 
 // convert to little-endian byte order
 ushort xshort(ushort x) {
@@ -101,8 +109,8 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    // 1 fs block = 1 disk sector
-    nmeta = 2 + num_log_blocks + ninodeblocks + nbitmap;
+    // 1 fs block = BSIZE / 512 disk sectors
+    nmeta = 2 + num_log_blocks + ninodeblocks + ninodebitmap + nbitmap;
     num_data_blocks = FSSIZE - nmeta;
 
     sb.num_blocks = xint(FSSIZE);
@@ -111,13 +119,16 @@ int main(int argc, char *argv[]) {
     sb.num_log_blocks = xint(num_log_blocks);
     sb.log_start = xint(2);
     sb.inode_start = xint(2 + num_log_blocks);
-    sb.bitmap_start = xint(2 + num_log_blocks + ninodeblocks);
+    sb.inode_bitmap_start = xint(2 + num_log_blocks + ninodeblocks);
+    sb.bitmap_start = xint(2 + num_log_blocks + ninodeblocks + ninodebitmap);
+    sb.block_size = xint(BSIZE);
 
-    printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d "
-           "total %d\n",
+    printf("nmeta %d (boot, super, log blocks %u inode blocks %u, inode bitmap blocks %u, "
+           "bitmap blocks %u) blocks %d total %d\n",
            nmeta,
            num_log_blocks,
            ninodeblocks,
+           ninodebitmap,
            nbitmap,
            num_data_blocks,
            FSSIZE);
@@ -129,7 +140,7 @@ int main(int argc, char *argv[]) {
 
     memset(buf, 0, sizeof(buf));
     memmove(buf, &sb, sizeof(sb));
-    wsect(0, buf);
+    wsect(SUPER_BLOCK_NO, buf);
 
     rootino = ialloc(INODE_DIRECTORY);
     assert(rootino == ROOT_INODE_NO);
@@ -137,12 +148,12 @@ int main(int argc, char *argv[]) {
     bzero(&de, sizeof(de));
     de.inode_no = xshort(rootino);
     strcpy(de.name, ".");
-    iappend(rootino, &de, sizeof(de));
+    rootappend(&de);
 
     bzero(&de, sizeof(de));
     de.inode_no = xshort(rootino);
     strcpy(de.name, "..");
-    iappend(rootino, &de, sizeof(de));
+    rootappend(&de);
 
     for (i = 2; i < argc; i++) {
         char *path = argv[i];
@@ -174,7 +185,7 @@ int main(int argc, char *argv[]) {
         bzero(&de, sizeof(de));
         de.inode_no = xshort(inum);
         strncpy(de.name, argv[i], DIRSIZ);
-        iappend(rootino, &de, sizeof(de));
+        rootappend(&de);
 
         while ((cc = read(fd, buf, sizeof(buf))) > 0)
             iappend(inum, buf, cc);
@@ -182,14 +193,25 @@ int main(int argc, char *argv[]) {
         close(fd);
     }
 
-    // fix size of root inode dir
-    rinode(rootino, &din);
-    off = xint(din.num_bytes);
-    off = ((off / BSIZE) + 1) * BSIZE;
-    din.num_bytes = xint(off);
-    winode(rootino, &din);
+    if (nrootents <= (int)DPB) {
+        for (i = 0; i < nrootents; i++)
+            iappend(rootino, &rootents[i], sizeof(rootents[i]));
+
+        // fix size of root inode dir
+        // 内联存储的根目录没有数据块，大小保持实际字节数
+        rinode(rootino, &din);
+        if (xshort(din.extent_header.depth) != EXTENT_DEPTH_INLINE) {
+            off = xint(din.num_bytes);
+            off = (off + BSIZE - 1) / BSIZE * BSIZE;
+            din.num_bytes = xint(off);
+            winode(rootino, &din);
+        }
+    } else {
+        rootindex(rootino);
+    }
 
     balloc(freeblock);
+    ibitmap(freeinode);
 
     exit(0);
 }
@@ -253,50 +275,142 @@ uint ialloc(ushort type) {
 
 void balloc(int used) {
     uchar buf[BSIZE];
-    int i;
+    int i, b;
 
     printf("balloc: first %d blocks have been allocated\n", used);
-    assert(used < BSIZE * 8);
-    bzero(buf, BSIZE);
-    for (i = 0; i < used; i++) {
-        buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+    assert(used <= nbitmap * BSIZE * 8);
+    for (b = 0; b < nbitmap; b++) {
+        bzero(buf, BSIZE);
+        for (i = 0; i < BSIZE * 8 && b * BSIZE * 8 + i < used; i++) {
+            buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+        }
+        printf("balloc: write bitmap block at sector %d\n", sb.bitmap_start + b);
+        wsect(sb.bitmap_start + b, buf);
+    }
+}
+
+// 前 used 个 inode（包括保留的 0 号）已经分配，写 inode bitmap 和超级块中各组的空闲数
+void ibitmap(int used) {
+    uchar buf[BSIZE];
+    int i, b;
+
+    printf("ibitmap: first %d inodes have been allocated\n", used);
+    assert(used <= NINODES);
+    for (b = 0; b < ninodebitmap; b++) {
+        bzero(buf, BSIZE);
+        for (i = 0; i < BSIZE * 8 && b * BSIZE * 8 + i < used; i++) {
+            buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+        }
+        wsect(xint(sb.inode_bitmap_start) + b, buf);
     }
-    printf("balloc: write bitmap block at sector %d\n", sb.bitmap_start);
-    wsect(sb.bitmap_start, buf);
+
+    int ngroups = (NINODES + INODE_GROUP_SIZE - 1) / INODE_GROUP_SIZE;
+    if (ngroups <= SUPER_MAX_INODE_GROUPS) {
+        sb.num_inode_groups = xint(ngroups);
+        for (b = 0; b < ngroups; b++) {
+            int n = 0;
+            for (i = b * INODE_GROUP_SIZE; i < (b + 1) * (int)INODE_GROUP_SIZE && i < NINODES; i++) {
+                n += i >= used;
+            }
+            sb.free_inodes[b] = xshort(n);
+        }
+    }
+    bzero(buf, BSIZE);
+    memmove(buf, &sb, sizeof(sb));
+    wsect(SUPER_BLOCK_NO, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// mkfs 只在文件末尾追加：fbn 要么在最后一个 extent 里，要么紧跟在它后面。
+// 根节点放满后搬到一个叶子块，树最多一层叶子。
+uint bmap(InodeEntry *din, uint fbn) {
+    ExtentHeader *h = &din->extent_header;
+    Extent *e = din->extents;
+    uint capacity = INODE_NUM_EXTENTS;
+    uint lbuf[BSIZE / sizeof(uint)];
+    ExtentBlock *leaf = (ExtentBlock *)lbuf;
+    uint leaf_no = 0;
+    Extent *x;
+
+    if (h->depth > 0) {
+        assert(h->depth == 1);
+        leaf_no = e[h->num_entries - 1].start;
+        rsect(leaf_no, lbuf);
+        h = &leaf->header;
+        e = leaf->entries;
+        capacity = EXTENT_PER_BLOCK;
+    }
+    if (h->num_entries > 0) {
+        x = &e[h->num_entries - 1];
+        if (fbn < x->file_block + x->len)
+            return x->start + (fbn - x->file_block);
+        assert(fbn == x->file_block + x->len);
+        if (x->start + x->len == freeblock) {
+            x->len++;
+            if (leaf_no)
+                wsect(leaf_no, lbuf);
+            return freeblock++;
+        }
+    }
+    if (h->num_entries == capacity && din->extent_header.depth == 0) {
+        bzero(lbuf, BSIZE);
+        leaf->header.num_entries = h->num_entries;
+        memmove(leaf->entries, e, sizeof(din->extents));
+        leaf_no = freeblock++;
+        din->extent_header.depth = 1;
+        din->extent_header.num_entries = 1;
+        din->extents[0] = (Extent){0, leaf_no, 0};
+        h = &leaf->header;
+        e = leaf->entries;
+        capacity = EXTENT_PER_BLOCK;
+    }
+    if (h->num_entries == capacity) {
+        assert(din->extent_header.num_entries < INODE_NUM_EXTENTS);
+        bzero(lbuf, BSIZE);
+        leaf_no = freeblock++;
+        din->extents[din->extent_header.num_entries++] = (Extent){fbn, leaf_no, 0};
+    }
+    e[h->num_entries++] = (Extent){fbn, freeblock, 1};
+    if (leaf_no)
+        wsect(leaf_no, lbuf);
+    return freeblock++;
+}
+
 void iappend(uint inum, void *xp, int n) {
     char *p = (char *)xp;
     uint fbn, off, n1;
     struct dinode din;
     char buf[BSIZE];
-    uint indirect[NINDIRECT];
     uint x;
 
     rinode(inum, &din);
     off = xint(din.num_bytes);
     // printf("append inum %d at off %d sz %d\n", inum, off, n);
+    // 小文件内联在 inode 里，超过 INODE_INLINE_BYTES 时搬到数据块
+    if (xshort(din.extent_header.depth) == EXTENT_DEPTH_INLINE ||
+        (off == 0 && din.extent_header.num_entries == 0)) {
+        if (off + n <= INODE_INLINE_BYTES) {
+            din.extent_header.depth = xshort(EXTENT_DEPTH_INLINE);
+            bcopy(p, (char *)din.extents + off, n);
+            din.num_bytes = xint(off + n);
+            winode(inum, &din);
+            return;
+        }
+        if (off > 0) {
+            char old[INODE_INLINE_BYTES];
+            bcopy(din.extents, old, off);
+            din.extent_header.depth = 0;
+            bzero(din.extents, sizeof(din.extents));
+            din.num_bytes = 0;
+            winode(inum, &din);
+            iappend(inum, old, off);
+            rinode(inum, &din);
+        }
+    }
     while (n > 0) {
         fbn = off / BSIZE;
-        assert(fbn < INODE_MAX_BLOCKS);
-        if (fbn < NDIRECT) {
-            if (xint(din.addrs[fbn]) == 0) {
-                din.addrs[fbn] = xint(freeblock++);
-            }
-            x = xint(din.addrs[fbn]);
-        } else {
-            if (xint(din.indirect) == 0) {
-                din.indirect = xint(freeblock++);
-            }
-            rsect(xint(din.indirect), (char *)indirect);
-            if (indirect[fbn - NDIRECT] == 0) {
-                indirect[fbn - NDIRECT] = xint(freeblock++);
-                wsect(xint(din.indirect), (char *)indirect);
-            }
-            x = xint(indirect[fbn - NDIRECT]);
-        }
+        x = bmap(&din, fbn);
         n1 = min(n, (fbn + 1) * BSIZE - off);
         rsect(x, buf);
         bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -308,3 +422,48 @@ void iappend(uint inum, void *xp, int n) {
     din.num_bytes = xint(off);
     winode(inum, &din);
 }
+
+void rootappend(struct dirent *de) {
+    assert(nrootents < (int)MAXROOT);
+    rootents[nrootents++] = *de;
+}
+
+int hashcmp(const void *a, const void *b) {
+    uint x = dx_hash(((const struct dirent *)a)->name);
+    uint y = dx_hash(((const struct dirent *)b)->name);
+    return x < y ? -1 : x > y;
+}
+
+// 根目录放不下一块时建立 hash 索引：第 0 块是根，后面是按 hash 排好序的叶子。
+// 同一个 hash 的项不能跨两个叶子。
+void rootindex(uint rootino) {
+    DxBlock root;
+    struct dirent leaf[DPB];
+    uint n, i, j, start[DX_PER_BLOCK];
+
+    qsort(rootents, nrootents, sizeof(rootents[0]), hashcmp);
+    n = 0;
+    for (i = 0; i < (uint)nrootents; i++) {
+        if (i == 0 || i - start[n - 1] == DPB) {
+            assert(i == 0 || dx_hash(rootents[i].name) != dx_hash(rootents[i - 1].name));
+            assert(n < DX_PER_BLOCK);
+            start[n++] = i;
+        }
+    }
+
+    bzero(&root, sizeof(root));
+    root.header.magic = xint(DX_MAGIC);
+    root.header.num_entries = xint(n);
+    for (j = 0; j < n; j++) {
+        root.entries[j].hash = xint(j == 0 ? 0 : dx_hash(rootents[start[j]].name));
+        root.entries[j].block = xint(j + 1);
+    }
+    iappend(rootino, &root, sizeof(root));
+
+    for (j = 0; j < n; j++) {
+        bzero(leaf, sizeof(leaf));
+        i = (j + 1 < n ? start[j + 1] : (uint)nrootents) - start[j];
+        memmove(leaf, &rootents[start[j]], i * sizeof(leaf[0]));
+        iappend(rootino, leaf, sizeof(leaf));
+    }
+}
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,13 +13,51 @@
 
 #define MAP_SHARED 0x01
 #define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+
+#define MADV_NORMAL 0
+#define MADV_RANDOM 1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED 3
+#define MADV_DONTNEED 4
 
 #define PGSIZE 4096
 #define BSIZE 512
 #define O_CREATE O_CREAT
 
+#define SYS_sbrk 12
+#define SYS_madvise 233
+#define SYS_pstat 500
+#define SYS_pcstat 501
+#define SYS_memstat 503
+
+// keep in sync with kernel/pagecache.h
+struct pagecache_stat {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long fault_around;
+    unsigned long readahead;
+    unsigned long ra_hits;
+    unsigned long nr_pages;
+};
+
+// keep in sync with kernel/oom.h
+struct mem_stat {
+    unsigned long rss;
+    unsigned long swap_ents;
+    unsigned long pt_pages;
+    unsigned long kernel_bytes;
+    unsigned long free_pages;
+    unsigned long oom_kills;
+};
+
 void mmap_test();
 void fork_test();
+void readahead_test();
+void anon_test();
+void zero_page_test();
+void memstat_test();
+void madvise_test();
 char buf[BSIZE];
 
 #define MAP_FAILED ((char *)-1)
@@ -26,6 +65,11 @@ char buf[BSIZE];
 int main(int argc, char *argv[]) {
     mmap_test();
     fork_test();
+    readahead_test();
+    anon_test();
+    zero_page_test();
+    memstat_test();
+    madvise_test();
     printf("mmaptest: all tests succeeded\n");
     exit(0);
 }
@@ -289,4 +333,307 @@ void fork_test(void) {
     _v1(p2);
 
     printf("fork_test parent OK\n");
-}
\ No newline at end of file
+}
+//
+// scan a mapped file sequentially twice. the first scan checks the content
+// read through readahead; the second one should be served by fault-around
+// from the page cache with only a couple of faults.
+//
+void readahead_test(void) {
+    int fd, i;
+    const int npages = 16;
+    const char *const f = "mmap.ra";
+    struct pagecache_stat before, after;
+
+    printf("readahead_test starting\n");
+    testname = "readahead_test";
+
+    unlink(f);
+    if ((fd = open(f, O_RDWR | O_CREATE)) == -1)
+        err("open");
+    for (i = 0; i < npages * (PGSIZE / BSIZE); i++) {
+        memset(buf, 'a' + i % 26, BSIZE);
+        if (write(fd, buf, BSIZE) != BSIZE)
+            err("write");
+    }
+
+    char *p = mmap(0, PGSIZE * npages, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        err("mmap (6)");
+    for (i = 0; i < PGSIZE * npages; i++) {
+        if (p[i] != 'a' + (i / BSIZE) % 26)
+            err("readahead mismatch (1)");
+    }
+    if (munmap(p, PGSIZE * npages) == -1)
+        err("munmap (5)");
+
+    if (syscall(SYS_pcstat, &before) != 0)
+        err("pcstat");
+    p = mmap(0, PGSIZE * npages, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        err("mmap (7)");
+    for (i = 0; i < PGSIZE * npages; i++) {
+        if (p[i] != 'a' + (i / BSIZE) % 26)
+            err("readahead mismatch (2)");
+    }
+    if (syscall(SYS_pcstat, &after) != 0)
+        err("pcstat");
+    if (after.hits + after.misses - before.hits - before.misses >= npages / 2)
+        err("fault-around did not map cached pages");
+    printf("readahead_test: faults %lu, fault-around %lu, readahead %lu\n",
+           after.hits + after.misses - before.hits - before.misses,
+           after.fault_around - before.fault_around,
+           after.readahead - before.readahead);
+
+    munmap(p, PGSIZE * npages);
+    close(fd);
+    unlink(f);
+    printf("readahead_test OK\n");
+}
+
+//
+// a large anonymous mapping is backed by 2MiB blocks. check that it is
+// zero-filled, copied on write after fork, and still correct after a partial
+// munmap splits a block.
+//
+void anon_test(void) {
+    int i, pid;
+    const int len = 4 * 1024 * 1024;
+
+    printf("anon_test starting\n");
+    testname = "anon_test";
+
+    char *p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+    if (p == MAP_FAILED)
+        err("mmap (8)");
+    for (i = 0; i < len; i += PGSIZE) {
+        if (p[i] != 0)
+            err("anon not zero");
+        p[i] = (char)(i / PGSIZE);
+    }
+
+    if ((pid = fork()) < 0)
+        err("fork");
+    if (pid == 0) {
+        for (i = 0; i < len; i += PGSIZE) {
+            if (p[i] != (char)(i / PGSIZE))
+                err("anon child mismatch");
+            p[i] = 'C';
+        }
+        exit(0);
+    }
+    wait(NULL);
+    for (i = 0; i < len; i += PGSIZE) {
+        if (p[i] != (char)(i / PGSIZE))
+            err("anon parent sees child writes");
+    }
+
+    // unmap the first page, the rest of the first block must survive.
+    if (munmap(p, PGSIZE) == -1)
+        err("munmap (6)");
+    for (i = PGSIZE; i < len; i += PGSIZE) {
+        if (p[i] != (char)(i / PGSIZE))
+            err("anon mismatch after split");
+    }
+    if (munmap(p + PGSIZE, len - PGSIZE) == -1)
+        err("munmap (7)");
+    printf("anon_test OK\n");
+}
+
+// 读一遍再隔 16 页写一次，空闲页只应减少写过的页（外加少量页表页）
+void _sparse_touch(char *p, int len) {
+    const int written = len / PGSIZE / 16;
+    long before = syscall(SYS_pstat);
+    for (int i = 0; i < len; i += PGSIZE) {
+        if (p[i] != 0)
+            err("not zero");
+    }
+    long used = before - syscall(SYS_pstat);
+    if (used > 4) {
+        printf("read faults used %ld pages\n", used);
+        err("read faults allocated pages");
+    }
+    for (int i = 0; i < len; i += 16 * PGSIZE)
+        p[i] = 'z';
+    used = before - syscall(SYS_pstat);
+    if (used < written || used > written + 4) {
+        printf("%d pages written, %ld pages used\n", written, used);
+        err("write faults");
+    }
+    for (int i = 0; i < len; i += PGSIZE) {
+        if (p[i] != (i % (16 * PGSIZE) == 0 ? 'z' : 0))
+            err("content");
+    }
+}
+
+void zero_page_test(void) {
+    const int len = 1024 * 1024;
+
+    printf("zero_page_test starting\n");
+    testname = "zero_page_test";
+
+    char *p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+    if (p == MAP_FAILED)
+        err("mmap (9)");
+    _sparse_touch(p, len);
+    if (munmap(p, len) == -1)
+        err("munmap (8)");
+
+    char *heap = (char *)syscall(SYS_sbrk, len);
+    if (heap == (char *)-1)
+        err("sbrk");
+    _sparse_touch(heap, len);
+    syscall(SYS_sbrk, -len);
+    printf("zero_page_test OK\n");
+}
+
+void _memstat(int pid, struct mem_stat *st) {
+    if (syscall(SYS_memstat, pid, st) != 0)
+        err("memstat");
+}
+
+// 常驻页数只随写缺页增长，fork 出的子进程也计入共享的页
+void memstat_test(void) {
+    const int npages = 64;
+    struct mem_stat before, st;
+
+    printf("memstat_test starting\n");
+    testname = "memstat_test";
+
+    _memstat(0, &before);
+    if (before.pt_pages == 0 || before.kernel_bytes == 0)
+        err("no page tables or kernel objects");
+    if (syscall(SYS_memstat, -1, &st) != -1 || errno != ESRCH)
+        err("memstat of a bad pid");
+
+    char *p = mmap(0, npages * PGSIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        err("mmap (10)");
+    for (int i = 0; i < npages; i++) {
+        if (p[i * PGSIZE] != 0)
+            err("not zero");
+    }
+    _memstat(getpid(), &st);
+    if (st.rss != before.rss)
+        err("read faults counted in rss");
+    if (st.kernel_bytes <= before.kernel_bytes)
+        err("vma not counted in kernel_bytes");
+    for (int i = 0; i < npages; i++)
+        p[i * PGSIZE] = 'm';
+    _memstat(0, &st);
+    if (st.rss < before.rss + npages || st.rss > before.rss + npages + 2) {
+        printf("rss %lu -> %lu\n", before.rss, st.rss);
+        err("write faults not counted in rss");
+    }
+
+    int pid = fork();
+    if (pid < 0)
+        err("fork");
+    if (pid == 0) {
+        struct mem_stat cst;
+        _memstat(0, &cst);
+        if (cst.rss < npages)
+            err("child rss");
+        exit(0);
+    }
+    wait(NULL);
+
+    if (munmap(p, npages * PGSIZE) == -1)
+        err("munmap (9)");
+    _memstat(0, &st);
+    if (st.rss > before.rss + 2) {
+        printf("rss %lu -> %lu\n", before.rss, st.rss);
+        err("munmap not counted in rss");
+    }
+    if (st.kernel_bytes != before.kernel_bytes)
+        err("munmap not counted in kernel_bytes");
+    printf("memstat_test OK\n");
+}
+
+// DONTNEED 丢掉匿名页和堆页（再读是零），WILLNEED/SEQUENTIAL 只是提示
+void madvise_test(void) {
+    const int npages = 32;
+    const char *const f = "mmap.madv";
+    struct mem_stat before, st;
+    int i, fd;
+
+    printf("madvise_test starting\n");
+    testname = "madvise_test";
+
+    if (syscall(SYS_madvise, PGSIZE + 1, PGSIZE, MADV_DONTNEED) != -1 ||
+        errno != EINVAL)
+        err("unaligned address");
+
+    char *p = mmap(0, npages * PGSIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        err("mmap (11)");
+    if (syscall(SYS_madvise, p, PGSIZE, 42) != -1 || errno != EINVAL)
+        err("bad advice");
+    for (i = 0; i < npages; i++)
+        p[i * PGSIZE] = i + 1;
+    _memstat(0, &before);
+    if (syscall(SYS_madvise, p, npages / 2 * PGSIZE, MADV_DONTNEED) != 0)
+        err("anon dontneed");
+    _memstat(0, &st);
+    if (st.rss + npages / 2 > before.rss) {
+        printf("rss %lu -> %lu\n", before.rss, st.rss);
+        err("dontneed did not free pages");
+    }
+    for (i = 0; i < npages; i++) {
+        if (p[i * PGSIZE] != (i < npages / 2 ? 0 : i + 1))
+            err("anon content after dontneed");
+    }
+    if (syscall(SYS_madvise, p, npages * PGSIZE, MADV_WILLNEED) != 0)
+        err("anon willneed");
+    if (munmap(p, npages * PGSIZE) == -1)
+        err("munmap (10)");
+    if (syscall(SYS_madvise, p, PGSIZE, MADV_WILLNEED) != -1 || errno != ENOMEM)
+        err("unmapped range");
+
+    char *heap = (char *)syscall(SYS_sbrk, npages * PGSIZE);
+    if (heap == (char *)-1)
+        err("sbrk");
+    for (i = 0; i < npages; i++)
+        heap[i * PGSIZE] = 'h';
+    if (syscall(SYS_madvise, heap, npages * PGSIZE, MADV_DONTNEED) != 0)
+        err("heap dontneed");
+    for (i = 0; i < npages; i++) {
+        if (heap[i * PGSIZE] != 0)
+            err("heap content after dontneed");
+    }
+    syscall(SYS_sbrk, -npages * PGSIZE);
+
+    unlink(f);
+    if ((fd = open(f, O_RDWR | O_CREATE)) == -1)
+        err("open");
+    for (i = 0; i < npages * (PGSIZE / BSIZE); i++) {
+        memset(buf, 'a' + i % 26, BSIZE);
+        if (write(fd, buf, BSIZE) != BSIZE)
+            err("write");
+    }
+    p = mmap(0, PGSIZE * npages, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        err("mmap (12)");
+    if (syscall(SYS_madvise, p, npages * PGSIZE, MADV_SEQUENTIAL) != 0 ||
+        syscall(SYS_madvise, p, npages * PGSIZE, MADV_WILLNEED) != 0)
+        err("file advice");
+    for (i = 0; i < PGSIZE * npages; i++) {
+        if (p[i] != 'a' + (i / BSIZE) % 26)
+            err("file content after willneed");
+    }
+    if (syscall(SYS_madvise, p, npages * PGSIZE, MADV_RANDOM) != 0 ||
+        syscall(SYS_madvise, p, npages * PGSIZE, MADV_DONTNEED) != 0)
+        err("file dontneed");
+    for (i = 0; i < PGSIZE * npages; i += BSIZE) {
+        if (p[i] != 'a' + (i / BSIZE) % 26)
+            err("file content after dontneed");
+    }
+    munmap(p, PGSIZE * npages);
+    close(fd);
+    unlink(f);
+    printf("madvise_test OK\n");
+}
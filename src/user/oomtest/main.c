@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PGSIZE 4096
+
+#define SYS_memstat 503
+
+// keep in sync with kernel/oom.h
+struct mem_stat {
+    unsigned long rss;
+    unsigned long swap_ents;
+    unsigned long pt_pages;
+    unsigned long kernel_bytes;
+    unsigned long free_pages;
+    unsigned long oom_kills;
+};
+
+// 比物理内存加交换区还大的匿名映射
+#define HOG_BYTES (4UL << 30)
+
+static void memstat(struct mem_stat *st) {
+    if (syscall(SYS_memstat, 0, st) != 0) {
+        printf("oomtest: memstat failed\n");
+        exit(1);
+    }
+}
+
+// 子进程不停地写新页，直到被 OOM killer 杀掉；父进程不受影响
+int main(int argc, char *argv[]) {
+    struct mem_stat before, after;
+    memstat(&before);
+
+    int pid = fork();
+    if (pid < 0) {
+        printf("oomtest: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        char *p = mmap(0, HOG_BYTES, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            printf("oomtest: mmap failed\n");
+            exit(1);
+        }
+        for (unsigned long i = 0; i < HOG_BYTES; i += PGSIZE)
+            p[i] = 1;
+        printf("oomtest: hog was not killed\n");
+        exit(1);
+    }
+    wait(NULL);
+
+    memstat(&after);
+    if (after.oom_kills != before.oom_kills + 1) {
+        printf("oomtest: %lu processes killed\n",
+               after.oom_kills - before.oom_kills);
+        exit(1);
+    }
+    if (after.free_pages < before.free_pages / 2) {
+        printf("oomtest: only %lu of %lu pages free after the kill\n",
+               after.free_pages, before.free_pages);
+        exit(1);
+    }
+    printf("oomtest OK\n");
+    exit(0);
+}
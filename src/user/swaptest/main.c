@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PGSIZE 4096
+
+#define SYS_pstat 500
+#define SYS_swapstat 502
+
+// keep in sync with kernel/swap.h
+struct swap_stat {
+    unsigned long nr_slots;
+    unsigned long used_slots;
+    unsigned long swap_outs;
+    unsigned long swap_ins;
+};
+
+// 比当前空闲物理内存多出的页数
+#define EXTRA_PAGES (16 * 1024)
+// fork 测试保留的页：跳过开头用 2MiB 块映射（不会换出）的部分
+#define KEEP_FIRST (16 * 1024)
+#define KEEP_PAGES 4096
+
+static unsigned long tag(long i) { return (unsigned long)i * 2654435761UL; }
+
+static void check(char *p, long first, long last, const char *who) {
+    for (long i = first; i < last; i++) {
+        unsigned long *w = (unsigned long *)(p + i * PGSIZE);
+        if (w[0] != tag(i) || w[PGSIZE / sizeof(long) - 1] != ~tag(i)) {
+            printf("swaptest: %s: page %ld corrupted\n", who, i);
+            exit(1);
+        }
+    }
+}
+
+static void print_stat(const char *when) {
+    struct swap_stat st;
+    if (syscall(SYS_swapstat, &st) != 0) {
+        printf("swaptest: swapstat failed\n");
+        exit(1);
+    }
+    printf("swaptest: %s: %lu/%lu slots used, %lu out, %lu in\n", when,
+           st.used_slots, st.nr_slots, st.swap_outs, st.swap_ins);
+}
+
+// 分配比物理内存更多的匿名内存，逐页写入后读回校验
+int main(int argc, char *argv[]) {
+    struct swap_stat st;
+    if (syscall(SYS_swapstat, &st) != 0) {
+        printf("swaptest: swapstat failed\n");
+        exit(1);
+    }
+    long npages = syscall(SYS_pstat) + EXTRA_PAGES;
+    printf("swaptest: touching %ld pages\n", npages);
+
+    char *p = mmap(0, npages * PGSIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        printf("swaptest: mmap failed\n");
+        exit(1);
+    }
+    for (long i = 0; i < npages; i++) {
+        unsigned long *w = (unsigned long *)(p + i * PGSIZE);
+        w[0] = tag(i);
+        w[PGSIZE / sizeof(long) - 1] = ~tag(i);
+    }
+    print_stat("after write");
+    check(p, 0, npages, "parent");
+    print_stat("after read");
+
+    // 只留下中间一段（多数已被换出），子进程共享这些交换槽
+    long last = KEEP_FIRST + KEEP_PAGES;
+    if (munmap(p, KEEP_FIRST * PGSIZE) != 0 ||
+        munmap(p + last * PGSIZE, (npages - last) * PGSIZE) != 0) {
+        printf("swaptest: munmap failed\n");
+        exit(1);
+    }
+    print_stat("after partial munmap");
+    int pid = fork();
+    if (pid < 0) {
+        printf("swaptest: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        check(p, KEEP_FIRST, last, "child");
+        exit(0);
+    }
+    wait(NULL);
+    check(p, KEEP_FIRST, last, "parent after fork");
+
+    munmap(p + KEEP_FIRST * PGSIZE, KEEP_PAGES * PGSIZE);
+    print_stat("after munmap");
+    printf("swaptest OK\n");
+    exit(0);
+}
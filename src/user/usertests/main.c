@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -77,6 +78,9 @@ void writetest(void) {
     printf("small file test ok\n");
 }
 
+// 1 MiB, far beyond what the old direct and indirect blocks could map.
+#define BIG_BLOCKS 2048
+
 void writetestbig(void) {
     int i, fd, n;
 
@@ -88,7 +92,7 @@ void writetestbig(void) {
         exit(1);
     }
 
-    for (i = 0; i < INODE_MAX_BLOCKS; i++) {
+    for (i = 0; i < BIG_BLOCKS; i++) {
         ((int *)buf)[0] = i;
         if (write(fd, buf, 512) != 512) {
             printf("error: write big file failed\n");
@@ -108,7 +112,7 @@ void writetestbig(void) {
     for (;;) {
         i = read(fd, buf, 512);
         if (i == 0) {
-            if (n == INODE_MAX_BLOCKS - 1) {
+            if (n == BIG_BLOCKS - 1) {
                 printf("read only %d blocks from big", n);
                 exit(1);
             }
@@ -152,6 +156,52 @@ void createtest(void) {
     printf("many creates, followed by unlink; ok\n");
 }
 
+// 非法用户指针应返回 EFAULT，而不是让内核崩溃
+void copyusertest(void) {
+    char *bad[] = {(char *)0x1000000000, (char *)0xffff000000080000};
+    int fd;
+
+    printf("bad user pointer test\n");
+    fd = open("copyuser", O_CREAT | O_RDWR);
+    if (fd < 0) {
+        printf("error: creat copyuser failed!\n");
+        exit(1);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (write(fd, bad[i], 10) != -1 || errno != EFAULT) {
+            printf("write from %p did not fail with EFAULT\n", bad[i]);
+            exit(1);
+        }
+        if (open(bad[i], O_RDONLY) != -1 || errno != EFAULT) {
+            printf("open %p did not fail with EFAULT\n", bad[i]);
+            exit(1);
+        }
+    }
+    if (write(fd, "0123456789", 10) != 10) {
+        printf("error: write copyuser failed\n");
+        exit(1);
+    }
+    close(fd);
+    fd = open("copyuser", O_RDONLY);
+    if (read(fd, bad[0], 10) != -1 || errno != EFAULT) {
+        printf("read into %p did not fail with EFAULT\n", bad[0]);
+        exit(1);
+    }
+    close(fd);
+    // 起始地址不对齐的读也要走完整的复制
+    fd = open("copyuser", O_RDONLY);
+    if (read(fd, buf + 3, 7) != 7 || memcmp(buf + 3, "0123456", 7) != 0) {
+        printf("unaligned read failed\n");
+        exit(1);
+    }
+    close(fd);
+    if (unlink("copyuser") < 0) {
+        printf("unlink copyuser failed\n");
+        exit(1);
+    }
+    printf("bad user pointer test ok\n");
+}
+
 int main(int argc, char *argv[]) {
     printf("usertests starting\n");
 
@@ -159,6 +209,7 @@ int main(int argc, char *argv[]) {
     writetest();
     writetestbig();
     createtest();
+    copyusertest();
 
     exit(0);
 }
\ No newline at end of file